@@ -8,6 +8,11 @@
 #define KEYLENGTH   10
 #define IVLENGTH    10
 
+// full trivium warm up, reduced round variants are selected at run time
+#define INIT_ROUNDS (4 * 288)
+// longer warm ups than this are taken for a typo
+#define MAX_INIT_ROUNDS (16 * INIT_ROUNDS)
+
 #define BUFFER_MAX_LENGTH 150
 typedef uint8_t u8;
 typedef long u64;
@@ -20,6 +25,7 @@ u8* decrypt(u8* key, u8* iv, u8* input, u64 length);
 
 u8 trivum_state[STATELENGTH];
 u8 trivium_output[64];
+u64 init_rounds = INIT_ROUNDS;
 
 
 /***
@@ -349,7 +355,7 @@ void ip_cipher(u8* key, u8* iv, u8* input, u64 length) {
 
   u8* state;
   state = setup(key, iv);
-  for (iter = 0; iter < (4 * 288); iter++) update(state);
+  for (iter = 0; iter < init_rounds; iter++) update(state);
 
   u8 keystream;
  
@@ -491,7 +497,16 @@ int main(int argc, char ** argv)
    	FILE *fp_in_ivs;  // input ivs
 
    	//open regarded files
-   	if(argc == 3){
+   	if(argc == 3 || argc == 4){
+   		// optional third argument: number of initialization rounds
+   		if(argc == 4){
+   			char* end;
+   			init_rounds = strtol(argv[3], &end, 10);
+   			if(end == argv[3] || *end != 0 || init_rounds < 0 || init_rounds > MAX_INIT_ROUNDS){
+   				printf("[ERROR] initialization rounds must be a number within 0..%d\n", MAX_INIT_ROUNDS);
+   				return 1;
+   			}
+   		}
    		fp_in = fopen (argv[1], "r");
    		fp_out = fopen (argv[2], "w");
 		fp_in_keys = fopen("keys.txt","r");
@@ -0,0 +1,502 @@
+/*
+ * acquire.c
+ *
+ * capture power traces straight into an archive (traces.h): the scope
+ * in segmented acquisition (see scope.h), optionally driving the board
+ * over its serial port as collect.m does
+ *
+ *  build : gcc -O3 -march=native -pthread -o acquire acquire.c scope.c fold.c traces.c -lm
+ *  run   : ./acquire [-a address] [-C channel] [-T source] [-L level] [-F] [-p points]
+ *                    [-s segments] [-n traces] [-k keys] [-i ivs] [-d device] [-B baud]
+ *                    [-r repeats] [-x cipher] [-m] [-v variance] [-z sigmas] [-c codec]
+ *                    [-q bits] [-w seconds] [-S stop] archive
+ *
+ *   -a address   the scope, host[:port] (default 127.0.0.1:5025)
+ *   -C channel   analog channel of the power trace (default 1)
+ *   -T source    trigger source PIN_B0 is wired to (default EXTernal)
+ *   -L level     trigger level in volts (default 2.5)
+ *   -F           trigger on the falling edge
+ *   -p points    samples per trace (default 2000)
+ *   -s segments  segments per batch, all downloaded in one transfer
+ *                (default 500)
+ *   -n traces    stop after this many (default: the lines of the keys)
+ *   -k keys      keys.txt of the traces
+ *   -i ivs       ivs.txt of the traces
+ *   -d device    drive the board on this serial port: send every key
+ *                and iv, let it encrypt until the scope has the repeats
+ *                and end the run with 'z'
+ *   -B baud      of the serial port (default 9600)
+ *   -r repeats   triggers to wait for per key and iv with -d (default 1)
+ *   -x cipher    with -d, where the board's cipher text goes, one line
+ *                per key and iv (as generated_cipher_text.txt)
+ *   -m           fold the captures of every key and iv into their mean
+ *                (see fold.h), one trace per key and iv
+ *   -v variance  with -m, archive of their variances
+ *   -z sigmas    with -m, drop outlying captures (default 0, keep all)
+ *   -c codec     of the archive: float, quant or rice (default float,
+ *                the only one that keeps the scope's codes exactly;
+ *                the others round them onto a grid of their own)
+ *   -q bits      quantization bits of quant and rice (default 8)
+ *   -w seconds   give up waiting for triggers after this long (default 10)
+ *   -S stop      stop when this file appears (default stop.txt, as
+ *                written by attack_monitor)
+ *
+ * without -d something else makes the board encrypt, and every segment
+ * is taken to be the next line of the key and iv files (zeros without
+ * them). With -d the board repeats the encryption until told to stop,
+ * so every key and iv fills repeats segments or a few more; the count
+ * of filled segments before and after tells which are its. A batch
+ * ends when another key might not fit, and is downloaded while the
+ * board is idle.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "scope.h"
+#include "fold.h"
+#include "traces.h"
+#include "util.h"
+
+#define LINE_MAX_LENGTH 256
+#define CIPHER_DIGITS   128             // what collect.m reads back
+
+
+typedef struct {
+  const char*    address;
+  scope_config_t scope;
+  u64   traces;
+  FILE* keys;
+  FILE* ivs;
+  const char* device;
+  u32   baud;
+  u64   repeats;
+  FILE* cipher;
+  int   fold;
+  const char* variance;
+  double sigmas;
+  u32   codec;
+  u32   qbits;
+  double timeout;
+  const char* stop;
+} options_t;
+
+
+
+/**********
+ * Serial *
+ **********/
+
+
+
+static speed_t baud_rate(u32 baud) {
+
+  switch (baud) {
+  case 9600:   return B9600;
+  case 19200:  return B19200;
+  case 38400:  return B38400;
+  case 57600:  return B57600;
+  case 115200: return B115200;
+  default:     return B0;
+  }
+}
+
+
+/***
+ * serial_open
+ *
+ * raw 8N1, reads returning after a tenth of a second without input
+ *
+ */
+static int serial_open(const char* path, u32 baud) {
+
+  struct termios t;
+  int fd = open(path, O_RDWR | O_NOCTTY);
+
+  if (fd < 0 || tcgetattr(fd, &t) != 0 || baud_rate(baud) == B0) {
+    printf("[ERROR] could not open %s at %u baud\n", path, baud);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  cfmakeraw(&t);
+  cfsetispeed(&t, baud_rate(baud));
+  cfsetospeed(&t, baud_rate(baud));
+  t.c_cflag |= CLOCAL | CREAD;
+  t.c_cc[VMIN] = 0;
+  t.c_cc[VTIME] = 1;
+
+  if (tcsetattr(fd, TCSANOW, &t) != 0) {
+    printf("[ERROR] could not set up %s\n", path);
+    close(fd);
+    return -1;
+  }
+  tcflush(fd, TCIOFLUSH);
+
+  return fd;
+}
+
+
+static int serial_write(int fd, const char* text, u64 length) {
+
+  ssize_t n;
+
+  while (length > 0) {
+    if ((n = write(fd, text, length)) <= 0) return -1;
+    text += n;
+    length -= (u64)n;
+  }
+
+  return 0;
+}
+
+
+/***
+ * serial_read
+ *
+ * count characters, fewer if the board goes quiet for timeout seconds
+ *
+ */
+static u64 serial_read(int fd, char* out, u64 count, double timeout) {
+
+  double last = now();
+  u64 n = 0;
+  ssize_t r;
+
+  while (n < count && now() - last < timeout) {
+    r = read(fd, out + n, count - n);
+    if (r > 0) {
+      n += (u64)r;
+      last = now();
+    }
+  }
+
+  return n;
+}
+
+
+
+/***********
+ * Batches *
+ ***********/
+
+
+
+/***
+ * next_info
+ *
+ * key and iv of the next trace or encryption, 1 at the end of the files
+ *
+ */
+static int next_info(const options_t* o, trace_info_t* info) {
+
+  memset(info, 0, sizeof(trace_info_t));
+
+  if ((o->keys != NULL && next_hex(o->keys, info->key, KEYLENGTH) < 0) ||
+      (o->ivs != NULL && next_hex(o->ivs, info->iv, IVLENGTH) < 0)) return 1;
+
+  return 0;
+}
+
+
+/***
+ * free_batch
+ *
+ * wait for the segments of a batch while something else drives the
+ * board; the segments filled, 1 in *end when the triggers or the keys
+ * ran out
+ *
+ */
+static int free_batch(const options_t* o, scope_t* s, u64 wanted, trace_info_t* info, u64* filled, int* end) {
+
+  u64 i;
+
+  if (scope_arm(s) < 0 || scope_wait(s, wanted, o->timeout, filled) < 0) return -1;
+
+  // fewer within the time: the triggers have stopped
+  if (*filled < wanted) *end = 1;
+  else *filled = wanted;
+
+  for (i = 0; i < *filled; i++) {
+    if (next_info(o, &info[i]) != 0) {
+      *end = 1;
+      break;
+    }
+  }
+  *filled = i;
+
+  return 0;
+}
+
+
+/***
+ * driven_batch
+ *
+ * key after key to the board until the batch might not hold another;
+ * the segments filled, 1 in *end when the keys ran out
+ *
+ */
+static int driven_batch(const options_t* o, scope_t* s, int board, u64 wanted, trace_info_t* info, u64* filled,
+                        int* end) {
+
+  trace_info_t next;
+  char text[2 * (KEYLENGTH + IVLENGTH) + 1], cipher[CIPHER_DIGITS + 1];
+  u64 before = 0, after, i, n;
+
+  *filled = 0;
+  if (scope_arm(s) < 0) return -1;
+
+  // a key may overrun its repeats by a trigger or two before the 'z' lands
+  while ((before == 0 || before + 2 * o->repeats <= wanted) && access(o->stop, F_OK) != 0) {
+    if (next_info(o, &next) != 0) {
+      *end = 1;
+      break;
+    }
+
+    for (i = 0; i < KEYLENGTH; i++) sprintf(text + 2 * i, "%02X", next.key[i]);
+    for (i = 0; i < IVLENGTH; i++) sprintf(text + 2 * (KEYLENGTH + i), "%02X", next.iv[i]);
+
+    if (serial_write(board, text, strlen(text)) < 0 || scope_wait(s, before + o->repeats, o->timeout, &after) < 0 ||
+        serial_write(board, "z", 1) < 0) return -1;
+
+    n = serial_read(board, cipher, CIPHER_DIGITS, 1.0);
+    cipher[n] = 0;
+    if (n < CIPHER_DIGITS) {
+      // as collect.m: ask the board to start over
+      printf("[WARNING] %lu of %d cipher digits for key %s\n", n, CIPHER_DIGITS, text);
+      serial_write(board, "y", 1);
+    }
+    if (o->cipher != NULL) fprintf(o->cipher, "%s\n", cipher);
+
+    if (scope_filled(s, &after) < 0) return -1;
+    if (after > wanted) after = wanted;
+    if (after == before) printf("[WARNING] no trigger for key %s\n", text);
+
+    for (i = before; i < after; i++) info[i] = next;
+    before = after;
+  }
+
+  *filled = before;
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int acquire(const options_t* o, const char* path) {
+
+  scope_t s;
+  trace_writer_t w, v;
+  fold_t f;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  u64 i, batch, filled, total = 0;
+  double start, t0;
+  int board = -1, open = 0, variances = 0, end = 0, result = 1;
+
+  memset(&f, 0, sizeof(f));
+
+  if (scope_open(&s, o->address, o->timeout) < 0) return 1;
+  printf("%s\n", s.identity);
+
+  if (scope_setup(&s, &o->scope) < 0) goto done;
+
+  if (o->device != NULL && (board = serial_open(o->device, o->baud)) < 0) goto done;
+
+  traces = malloc(o->scope.segments * o->scope.points * sizeof(float));
+  info = malloc(o->scope.segments * sizeof(trace_info_t));
+  if (traces == NULL || info == NULL || (o->fold && fold_alloc(&f, o->scope.points, 0, o->sigmas) < 0)) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (trace_writer_open(&w, path, o->scope.points, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+  open = 1;
+  f.mean = &w;
+
+  if (o->variance != NULL) {
+    if (trace_writer_open(&v, o->variance, o->scope.points, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+    variances = 1;
+    f.variance = &v;
+  }
+
+  // a stop file left from an earlier run would end this one at once
+  remove(o->stop);
+  start = now();
+
+  while (!end && total < o->traces) {
+    if (access(o->stop, F_OK) == 0) {
+      printf("stopped by %s\n", o->stop);
+      break;
+    }
+
+    batch = (o->traces - total < o->scope.segments) ? o->traces - total : o->scope.segments;
+    t0 = now();
+
+    if (board >= 0) {
+      if (driven_batch(o, &s, board, batch, info, &filled, &end) < 0) goto done;
+    } else {
+      if (free_batch(o, &s, batch, info, &filled, &end) < 0) goto done;
+    }
+
+    if (filled == 0) {
+      if (!end) printf("[ERROR] no trigger within %.1f s\n", o->timeout);
+      break;
+    }
+
+    if (scope_download(&s, filled, traces) < 0) goto done;
+
+    for (i = 0; i < filled; i++) {
+      if ((o->fold ? fold_add(&f, traces + i * o->scope.points, &info[i]) :
+                     trace_writer_add(&w, traces + i * o->scope.points, &info[i])) < 0) goto done;
+    }
+    total += filled;
+
+    printf("%8lu traces  batch of %5lu in %6.3f s  %8.1f traces/s\n", total, filled, now() - t0,
+           total / (now() - start));
+    fflush(stdout);
+  }
+
+  printf("%lu traces in %.1f s\n", total, now() - start);
+
+  if (o->fold) {
+    if (fold_flush(&f) < 0) goto done;
+    fold_report(&f);
+  }
+  result = 0;
+
+done:
+  if (open && trace_writer_close(&w) < 0) result = 1;
+  if (variances && trace_writer_close(&v) < 0) result = 1;
+  fold_free(&f);
+  if (board >= 0) close(board);
+  scope_close(&s);
+  free(traces);
+  free(info);
+
+  return result;
+}
+
+
+static u64 count_lines(FILE* fp) {
+
+  char buffer[LINE_MAX_LENGTH];
+  u64 n = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (buffer[0] != '\n' && buffer[0] != '\r') n++;
+  }
+  rewind(fp);
+
+  return n;
+}
+
+
+static void usage(const char* name) {
+
+  int w = (int)strlen(name);
+
+  printf("usage: %s [-a address] [-C channel] [-T source] [-L level] [-F] [-p points]\n"
+         "       %*s [-s segments] [-n traces] [-k keys] [-i ivs] [-d device] [-B baud]\n"
+         "       %*s [-r repeats] [-x cipher] [-m] [-v variance] [-z sigmas] [-c codec]\n"
+         "       %*s [-q bits] [-w seconds] [-S stop] archive\n", name, w, "", w, "", w, "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  const char* cipher = NULL;
+  int option, result;
+
+  memset(&o, 0, sizeof(o));
+  o.address = "127.0.0.1:5025";
+  o.scope.channel = 1;
+  snprintf(o.scope.trigger, sizeof(o.scope.trigger), "EXTernal");
+  o.scope.level = 2.5;
+  o.scope.points = 2000;
+  o.scope.segments = 500;
+  o.baud = 9600;
+  o.repeats = 1;
+  o.codec = TRACE_FLOAT;
+  o.qbits = 8;
+  o.timeout = 10;
+  o.stop = "stop.txt";
+
+  while ((option = getopt(argc, argv, "a:C:T:L:Fp:s:n:k:i:d:B:r:x:mv:z:c:q:w:S:")) != -1) {
+    switch (option) {
+    case 'a': o.address        = optarg;                     break;
+    case 'C': o.scope.channel  = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'L': o.scope.level    = atof(optarg);               break;
+    case 'F': o.scope.falling  = 1;                          break;
+    case 'p': o.scope.points   = strtoul(optarg, NULL, 10);  break;
+    case 's': o.scope.segments = strtoul(optarg, NULL, 10);  break;
+    case 'n': o.traces         = strtoul(optarg, NULL, 10);  break;
+    case 'd': o.device         = optarg;                     break;
+    case 'B': o.baud           = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'r': o.repeats        = strtoul(optarg, NULL, 10);  break;
+    case 'x': cipher           = optarg;                     break;
+    case 'm': o.fold           = 1;                          break;
+    case 'v': o.variance       = optarg;                     break;
+    case 'z': o.sigmas         = atof(optarg);               break;
+    case 'q': o.qbits          = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'w': o.timeout        = atof(optarg);               break;
+    case 'S': o.stop           = optarg;                     break;
+    case 'T':
+      snprintf(o.scope.trigger, sizeof(o.scope.trigger), "%s", optarg);
+      break;
+    case 'k':
+    case 'i':
+      if ((*(option == 'k' ? &o.keys : &o.ivs) = fopen(optarg, "r")) == NULL) {
+        printf("[ERROR] could not open %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 'c':
+      if (trace_codec_parse(optarg, &o.codec) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (o.traces == 0 && o.keys != NULL) o.traces = count_lines(o.keys);
+
+  if (optind != argc - 1 || o.traces == 0 || o.scope.points == 0 || o.scope.segments == 0 || o.repeats == 0 ||
+      !(o.timeout > 0) || (o.device != NULL && (o.keys == NULL || o.ivs == NULL || 2 * o.repeats > o.scope.segments)) ||
+      ((o.variance != NULL || o.sigmas != 0) && !o.fold) || o.sigmas < 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (cipher != NULL && (o.cipher = fopen(cipher, "a")) == NULL) {
+    printf("[ERROR] could not open %s\n", cipher);
+    return 2;
+  }
+
+  result = acquire(&o, argv[optind]);
+
+  if (o.keys != NULL) fclose(o.keys);
+  if (o.ivs != NULL) fclose(o.ivs);
+  if (o.cipher != NULL) fclose(o.cipher);
+
+  return result;
+}
@@ -0,0 +1,356 @@
+/*
+ * anf.c
+ *
+ * algebraic normal form of the first clocks (see anf.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "anf.h"
+
+#define KEY_HIGH 0xFFFFULL                // key variables 64..79 in var[1]
+
+
+static int compare_terms(const void* x, const void* y) {
+
+  const anf_term_t* a = x;
+  const anf_term_t* b = y;
+  int i;
+
+  for (i = 2; i >= 0; i--) {
+    if (a->var[i] != b->var[i]) return (a->var[i] < b->var[i]) ? -1 : 1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * cancel
+ *
+ * sort terms and drop the pairs that cancel, x + x = 0; the count left
+ *
+ */
+static u64 cancel(anf_term_t* t, u64 n) {
+
+  u64 i, out = 0;
+
+  qsort(t, n, sizeof(anf_term_t), compare_terms);
+
+  for (i = 0; i < n; i++) {
+    if (i + 1 < n && compare_terms(&t[i], &t[i + 1]) == 0) {
+      i++;
+      continue;
+    }
+    t[out++] = t[i];
+  }
+
+  return out;
+}
+
+
+/***
+ * store
+ *
+ * terms into the pool as a new polynomial
+ *
+ */
+static int store(anf_t* a, const anf_term_t* t, u64 n, anf_poly_t* p) {
+
+  anf_term_t* grown;
+  u64 capacity;
+
+  if (a->used + n > a->limit) return -1;
+
+  if (a->used + n > a->capacity) {
+    capacity = a->capacity ? a->capacity : 1024;
+    while (capacity < a->used + n) capacity *= 2;
+    grown = realloc(a->term, capacity * sizeof(anf_term_t));
+    if (grown == NULL) return -1;
+    a->term = grown;
+    a->capacity = capacity;
+  }
+
+  memcpy(a->term + a->used, t, n * sizeof(anf_term_t));
+  p->first = a->used;
+  p->terms = n;
+  a->used += n;
+
+  return 0;
+}
+
+
+static int variable(anf_t* a, u32 v, anf_poly_t* p) {
+
+  anf_term_t t = { { 0, 0, 0 } };
+
+  t.var[v / 64] = (u64)1 << (v % 64);
+
+  return store(a, &t, 1, p);
+}
+
+
+/***
+ * feedback
+ *
+ * x ^ y ^ (u & v) ^ w of the state before a clock, as update() computes
+ * t1, t2 and t3
+ *
+ */
+static int feedback(anf_t* a, u64 clock, u32 x, u32 y, u32 u, u32 v, u32 w, anf_poly_t* out) {
+
+  anf_poly_t px = anf_state(a, clock, x), py = anf_state(a, clock, y), pw = anf_state(a, clock, w);
+  anf_poly_t pu = anf_state(a, clock, u), pv = anf_state(a, clock, v);
+  u64 n = px.terms + py.terms + pw.terms + pu.terms * pv.terms, i, j, k = 0;
+  anf_term_t* t;
+  int result;
+
+  if (a->used + n > a->limit) return -1;
+
+  t = malloc((n ? n : 1) * sizeof(anf_term_t));
+  if (t == NULL) return -1;
+
+  for (i = 0; i < px.terms; i++) t[k++] = a->term[px.first + i];
+  for (i = 0; i < py.terms; i++) t[k++] = a->term[py.first + i];
+  for (i = 0; i < pw.terms; i++) t[k++] = a->term[pw.first + i];
+
+  for (i = 0; i < pu.terms; i++) {
+    for (j = 0; j < pv.terms; j++) {
+      const anf_term_t* s = &a->term[pu.first + i];
+      const anf_term_t* r = &a->term[pv.first + j];
+      t[k].var[0] = s->var[0] | r->var[0];
+      t[k].var[1] = s->var[1] | r->var[1];
+      t[k].var[2] = s->var[2] | r->var[2];
+      k++;
+    }
+  }
+
+  result = store(a, t, cancel(t, k), out);
+  free(t);
+
+  return result;
+}
+
+
+/***
+ * anf_build
+ *
+ * the feedbacks of the first clocks, -1 if they take more terms than
+ * the limit (0 for ANF_LIMIT); what was built before stays usable and
+ * a->clocks says how far it got
+ *
+ */
+int anf_build(anf_t* a, u64 clocks, u64 limit) {
+
+  static const anf_term_t one = { { 0, 0, 0 } };
+  u64 c;
+  u32 j;
+
+  memset(a, 0, sizeof(anf_t));
+  a->limit = limit ? limit : ANF_LIMIT;
+
+  if (clocks > ANF_MAX_CLOCKS) return -1;
+
+  for (j = 0; j < 8 * KEYLENGTH; j++) {
+    if (variable(a, j, &a->loaded[j]) < 0) return -1;
+  }
+  for (j = 0; j < 8 * IVLENGTH; j++) {
+    if (variable(a, ANF_IV + j, &a->loaded[ALEN + j]) < 0) return -1;
+  }
+  for (j = STATEBITS - 3; j < STATEBITS; j++) {
+    if (store(a, &one, 1, &a->loaded[j]) < 0) return -1;
+  }
+
+  for (c = 0; c < clocks; c++) {
+    if (feedback(a, c, 65,  92,  90,  91,  170, &a->feedback[c][0]) < 0 ||
+        feedback(a, c, 161, 176, 174, 175, 263, &a->feedback[c][1]) < 0 ||
+        feedback(a, c, 242, 287, 285, 286, 68,  &a->feedback[c][2]) < 0) {
+      return -1;
+    }
+    a->clocks = c + 1;
+  }
+
+  return 0;
+}
+
+
+void anf_free(anf_t* a) {
+
+  free(a->term);
+  memset(a, 0, sizeof(anf_t));
+
+  return;
+}
+
+
+/***
+ * anf_state
+ *
+ * state bit i (zero based, as in update()) after a number of clocks, at
+ * most a->clocks
+ *
+ */
+anf_poly_t anf_state(const anf_t* a, u64 clock, u32 i) {
+
+  u64 k;
+
+  if (i < ALEN) {
+    k = i;
+    return (k >= clock) ? a->loaded[k - clock] : a->feedback[clock - 1 - k][2];
+  }
+
+  if (i < ALEN + BLEN) {
+    k = i - ALEN;
+    return (k >= clock) ? a->loaded[i - clock] : a->feedback[clock - 1 - k][0];
+  }
+
+  k = i - ALEN - BLEN;
+  return (k >= clock) ? a->loaded[i - clock] : a->feedback[clock - 1 - k][1];
+}
+
+
+/***
+ * anf_feedback
+ *
+ * t1, t2 or t3 (kind 0, 1, 2 as in targets.h) computed at a clock below
+ * a->clocks
+ *
+ */
+anf_poly_t anf_feedback(const anf_t* a, u64 clock, u32 kind) {
+  return a->feedback[clock][kind];
+}
+
+
+/***
+ * anf_pack
+ *
+ * the 80 bits of a key or iv in file order, bit j into bit j % 64 of
+ * word j / 64
+ *
+ */
+void anf_pack(const u8* bytes, u64* bits) {
+
+  u64 r;
+  u32 i;
+
+  bits[0] = bits[1] = 0;
+
+  // byte 9 - i holds bits 8i..8i+7, the first in its top bit
+  for (i = 0; i < 10; i++) {
+    r = ((bytes[9 - i] * 0x0202020202ULL) & 0x010884422010ULL) % 1023;
+    if (i < 8) bits[0] |= r << (8 * i);
+    else bits[1] |= r << (8 * (i - 8));
+  }
+
+  return;
+}
+
+
+/***
+ * anf_value
+ *
+ * a polynomial for a key and iv (both packed)
+ *
+ */
+u8 anf_value(const anf_t* a, anf_poly_t p, const u64* key, const u64* iv) {
+
+  u64 x[3], i;
+  u8 v = 0;
+
+  x[0] = key[0];
+  x[1] = (key[1] & KEY_HIGH) | (iv[0] << 16);
+  x[2] = (iv[0] >> 48) | (iv[1] << 16);
+
+  for (i = 0; i < p.terms; i++) {
+    const u64* m = a->term[p.first + i].var;
+    v ^= ((x[0] & m[0]) == m[0]) & ((x[1] & m[1]) == m[1]) & ((x[2] & m[2]) == m[2]);
+  }
+
+  return v;
+}
+
+
+u64 anf_degree(const anf_t* a, anf_poly_t p) {
+
+  u64 i, d, degree = 0;
+
+  for (i = 0; i < p.terms; i++) {
+    const u64* m = a->term[p.first + i].var;
+    d = (u64)(__builtin_popcountll(m[0]) + __builtin_popcountll(m[1]) + __builtin_popcountll(m[2]));
+    if (d > degree) degree = d;
+  }
+
+  return degree;
+}
+
+
+/***
+ * anf_restrict
+ *
+ * a polynomial with the key (packed) substituted: terms whose key bits
+ * are not all set vanish, the rest keep their iv bits
+ *
+ */
+int anf_restrict(const anf_t* a, anf_poly_t p, const u64* key, anf_fn_t* f) {
+
+  anf_term_t* t = malloc((p.terms ? p.terms : 1) * sizeof(anf_term_t));
+  u64 i, n = 0, iv[2];
+
+  memset(f, 0, sizeof(anf_fn_t));
+  if (t == NULL) return -1;
+
+  for (i = 0; i < p.terms; i++) {
+    const u64* m = a->term[p.first + i].var;
+
+    if ((key[0] & m[0]) != m[0] || (key[1] & m[1] & KEY_HIGH) != (m[1] & KEY_HIGH)) continue;
+
+    iv[0] = (m[1] >> 16) | (m[2] << 48);
+    iv[1] = (m[2] >> 16) & KEY_HIGH;
+
+    switch (__builtin_popcountll(iv[0]) + __builtin_popcountll(iv[1])) {
+    case 0:
+      f->constant ^= 1;
+      break;
+    case 1:
+      f->linear[0] ^= iv[0];
+      f->linear[1] ^= iv[1];
+      break;
+    default:
+      t[n].var[0] = iv[0];
+      t[n].var[1] = iv[1];
+      t[n].var[2] = 0;
+      n++;
+    }
+  }
+
+  // different key terms may leave the same product of iv bits
+  n = cancel(t, n);
+
+  f->term = malloc((n ? n : 1) * sizeof(*f->term));
+  if (f->term == NULL) {
+    free(t);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    f->term[i][0] = t[i].var[0];
+    f->term[i][1] = t[i].var[1];
+  }
+  f->terms = n;
+
+  free(t);
+
+  return 0;
+}
+
+
+void anf_fn_free(anf_fn_t* f) {
+
+  free(f->term);
+  memset(f, 0, sizeof(anf_fn_t));
+
+  return;
+}
@@ -0,0 +1,103 @@
+/*
+ * anf.h
+ *
+ * the first clocks of trivium in algebraic normal form over the loaded
+ * key and iv bits
+ *
+ * every state bit after c clocks, and every feedback of clock c, is a
+ * polynomial over GF(2) in the 80 key bits (variables 0..79, key bit j
+ * as in target_t) and the 80 iv bits (variables 80..159, iv bit j being
+ * state index 93 + j). A term is the product of the variables set in its
+ * 160 bit mask, the empty mask being the constant 1. The table stores
+ * the three feedbacks of every clock built; any state bit is a loaded
+ * bit or an earlier feedback shifted along its register.
+ *
+ * the feedbacks stay linear but for the pairs t1, t2 and t3 multiply,
+ * and the degree only grows once products are fed back, so the first
+ * clocks take few terms: anf_build() stops at a term limit.
+ *
+ * for hypotheses a polynomial is restricted to a key (or key guess),
+ * which leaves a function of the iv alone: a linear mask, a constant and
+ * a few products of iv bits. Its value for an iv is the parity of
+ * popcount(iv & mask) and a subset test per product, instead of loading
+ * and clocking the cipher for every iv.
+ *
+ */
+
+#ifndef ANF_H
+#define ANF_H
+
+#include "trivium.h"
+
+#define ANF_VARS       160
+#define ANF_IV         80              // first iv variable
+#define ANF_MAX_CLOCKS 288
+#define ANF_LIMIT      (1 << 22)       // default term limit
+
+
+typedef struct {
+  u64 var[3];
+} anf_term_t;
+
+
+typedef struct {
+  u64 first;                            // into the term pool
+  u64 terms;
+} anf_poly_t;
+
+
+typedef struct {
+  u64         clocks;
+  anf_term_t* term;
+  u64         used, capacity, limit;
+  anf_poly_t  loaded[STATEBITS];        // what setup() puts in every bit
+  anf_poly_t  feedback[ANF_MAX_CLOCKS][3];  // t1, t2, t3 of every clock
+} anf_t;
+
+
+/***
+ * anf_fn_t
+ *
+ * a polynomial restricted to a key: iv bit j is bit j % 64 of word j / 64
+ *
+ */
+typedef struct {
+  u64  linear[2];
+  u8   constant;
+  u64  terms;                           // products of two or more iv bits
+  u64  (*term)[2];
+} anf_fn_t;
+
+
+int  anf_build(anf_t* a, u64 clocks, u64 limit);
+void anf_free(anf_t* a);
+
+anf_poly_t anf_state(const anf_t* a, u64 clock, u32 i);
+anf_poly_t anf_feedback(const anf_t* a, u64 clock, u32 kind);
+
+void anf_pack(const u8* bytes, u64* bits);
+u8   anf_value(const anf_t* a, anf_poly_t p, const u64* key, const u64* iv);
+u64  anf_degree(const anf_t* a, anf_poly_t p);
+
+int  anf_restrict(const anf_t* a, anf_poly_t p, const u64* key, anf_fn_t* f);
+void anf_fn_free(anf_fn_t* f);
+
+
+/***
+ * anf_eval
+ *
+ * a restricted polynomial for one iv
+ *
+ */
+static inline u8 anf_eval(const anf_fn_t* f, const u64* iv) {
+
+  u64 v = (u64)__builtin_popcountll(iv[0] & f->linear[0]) + (u64)__builtin_popcountll(iv[1] & f->linear[1]);
+  u64 t;
+
+  v ^= f->constant;
+  for (t = 0; t < f->terms; t++) v ^= ((iv[0] & f->term[t][0]) == f->term[t][0]) & ((iv[1] & f->term[t][1]) == f->term[t][1]);
+
+  return (u8)(v & 0x01);
+}
+
+#endif
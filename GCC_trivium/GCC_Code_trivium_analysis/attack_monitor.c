@@ -0,0 +1,368 @@
+/*
+ * attack_monitor.c
+ *
+ * follow an acquisition and tell it to stop once the correlation attack
+ * on t1 has succeeded (see monitor.h)
+ *
+ *  build : gcc -O3 -march=native -pthread -o attack_monitor attack_monitor.c monitor.c fisher.c cpa.c \
+ *                                        rank.c targets.c -lm
+ *  run   : ./attack_monitor [-c first:last] [-w first:count] [-e traces] [-m sigmas] [-r bits]
+ *                           [-p probability] [-k key] [-f] [-i seconds] [-s stop] [-t threads]
+ *                           samples raw ivs
+ *
+ *   -c clocks    clocks to attack (default 0:65)
+ *   -w window    samples to look at (default all)
+ *   -e traces    check every this many traces (default 100)
+ *   -m sigmas    success once every target's margin reaches this
+ *                (default 5, 0 to only use the rank)
+ *   -r bits      with a key, success once log2 of its rank is at most
+ *                this (by the upper bound)
+ *   -p prob      success probability the trace prediction is for
+ *                (default 0.9)
+ *   -k key       the key of the acquisition, for the rank and the
+ *                prediction
+ *   -f           follow: wait for the files to grow
+ *   -i seconds   give up following after this long without a trace
+ *                (default 60)
+ *   -s stop      file to create on success (default stop.txt), the
+ *                acquisition loop stops when it appears
+ *   -t threads   worker threads (default: online cpus)
+ *
+ * raw holds the float32 traces of the given number of samples back to
+ * back as the scope dumps them, ivs their ivs one per line as in
+ * ivs.txt, in the same order. Every check prints a line with the traces
+ * predicted to be needed, the target needing them and the 95% bands of
+ * its right (or best) and strongest wrong guess; the exit status is 0
+ * once the attack has succeeded, 1 if the traces ran out first.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "monitor.h"
+#include "util.h"
+
+#define LINE_MAX_LENGTH 256
+#define POLL_SECONDS    0.2
+
+
+typedef struct {
+  u32   first_clock, last_clock;
+  u64   trace_samples;                  // of a trace in the raw file
+  u64   window, samples;                // the columns attacked
+  u64   every;
+  u64   threads;
+  double margin;
+  double rank;
+  double probability;
+  int   has_key;
+  u8    key[KEYLENGTH];
+  int   follow;
+  double idle;
+  const char* stop;
+} options_t;
+
+
+typedef struct {
+  FILE* raw;
+  FILE* ivs;
+  u64   samples;                        // per trace
+  u64   traces;                         // read so far
+} source_t;
+
+
+
+/**********
+ * Source *
+ **********/
+
+
+
+/***
+ * available
+ *
+ * whole traces in the raw file that have not been read
+ *
+ */
+static u64 available(const source_t* s) {
+
+  struct stat st;
+
+  if (fstat(fileno(s->raw), &st) != 0) return 0;
+
+  return (u64)st.st_size / (s->samples * sizeof(float)) - s->traces;
+}
+
+
+/***
+ * read_iv
+ *
+ * the next complete line of the ivs file; a line still being written is
+ * left for the next attempt
+ *
+ */
+static int read_iv(FILE* fp, u8* iv) {
+
+  char line[LINE_MAX_LENGTH], *text;
+  long position = ftell(fp);
+  u64 length;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    length = strlen(line);
+    if (length == 0 || line[length - 1] != '\n') break;
+
+    for (text = line; *text == ' ' || *text == '\t'; text++);
+    if (*text == '\r' || *text == '\n') {
+      position = ftell(fp);
+      continue;
+    }
+
+    return parse_bytes(text, iv, IVLENGTH);
+  }
+
+  clearerr(fp);
+  fseek(fp, position, SEEK_SET);
+
+  return 1;
+}
+
+
+/***
+ * source_read
+ *
+ * count traces and their ivs, 0 if not all of them are there yet
+ *
+ */
+static int source_read(source_t* s, u64 count, float* traces, u8* ivs) {
+
+  long position = ftell(s->ivs);
+  u64 t;
+  int status;
+
+  if (available(s) < count) return 0;
+
+  for (t = 0; t < count; t++) {
+    status = read_iv(s->ivs, ivs + t * IVLENGTH);
+    if (status < 0) {
+      printf("[ERROR] the iv of trace %lu is not %d bytes of hex\n", s->traces + t, IVLENGTH);
+      return -1;
+    }
+    if (status > 0) {
+      fseek(s->ivs, position, SEEK_SET);
+      return 0;
+    }
+  }
+
+  if (fseek(s->raw, (long)(s->traces * s->samples * sizeof(float)), SEEK_SET) != 0 ||
+      fread(traces, sizeof(float) * s->samples, count, s->raw) != count) {
+    clearerr(s->raw);
+    fseek(s->ivs, position, SEEK_SET);
+    return 0;
+  }
+
+  s->traces += count;
+
+  return 1;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static void print_report(const monitor_t* m, const monitor_report_t* r) {
+
+  printf("%8lu  %6.4f  %5u  %7.2f  %5u", r->traces, r->peak, r->peak_clock, r->margin, r->margin_clock);
+  if (isinf(r->needed)) printf("         -");
+  else printf("  %8.0f", r->needed);
+  printf("  %5u  [%7.4f, %7.4f]  [%7.4f, %7.4f]", r->needed_clock, r->right.lower, r->right.upper, r->wrong.lower, r->wrong.upper);
+  if (r->ranked) printf("  %3lu/%-3lu  %6.1f  [%5.1f, %5.1f]", r->first, m->targets, r->rank.estimate, r->rank.lower, r->rank.upper);
+  printf("\n");
+
+  return;
+}
+
+
+static int monitor(const options_t* o, const char* raw, const char* ivs) {
+
+  source_t source;
+  monitor_t m;
+  monitor_report_t report;
+  float* traces = NULL;
+  u8* iv = NULL;
+  double last = now(), start = last;
+  u64 n, stride = o->trace_samples;
+  int result = 1, status;
+  FILE* fp;
+
+  memset(&source, 0, sizeof(source));
+  memset(&m, 0, sizeof(m));
+
+  source.samples = stride;
+  source.raw = fopen(raw, "rb");
+  source.ivs = fopen(ivs, "r");
+
+  if (source.raw == NULL || source.ivs == NULL) {
+    printf("[ERROR] could not open %s and %s\n", raw, ivs);
+    goto done;
+  }
+
+  traces = malloc(o->every * stride * sizeof(float));
+  iv = malloc(o->every * IVLENGTH);
+
+  if (traces == NULL || iv == NULL || monitor_init(&m, o->first_clock, o->last_clock, o->samples, o->every, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  m.margin = o->margin;
+  m.rank = o->rank;
+  m.probability = o->probability;
+  m.has_key = o->has_key;
+  memcpy(m.key, o->key, KEYLENGTH);
+
+  printf("  traces    peak  clock   margin  clock    needed  clock  %-18s  %-18s%s\n", o->has_key ? "right" : "best", "wrong",
+         o->has_key ? "  first  log2 rank [bounds]" : "");
+
+  for (;;) {
+    status = source_read(&source, o->every, traces, iv);
+    if (status < 0) goto done;
+
+    if (status == 0) {
+      // without -f, or at the end, whatever is left makes the last check
+      n = available(&source);
+      if (n > o->every) n = o->every;
+      if (!o->follow || now() - last > o->idle) {
+        if (n == 0 || (status = source_read(&source, n, traces, iv)) <= 0) break;
+      } else {
+        usleep((useconds_t)(1e6 * POLL_SECONDS));
+        continue;
+      }
+    } else {
+      n = o->every;
+    }
+
+    last = now();
+
+    if (monitor_add(&m, traces + o->window, stride, n, iv) < 0 || monitor_check(&m, &report) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+
+    if (report.traces < 4) continue;
+    print_report(&m, &report);
+
+    if (report.success) {
+      if ((fp = fopen(o->stop, "w")) == NULL) {
+        printf("[ERROR] could not create %s\n", o->stop);
+        goto done;
+      }
+      fprintf(fp, "stop after %lu traces\n", report.traces);
+      fclose(fp);
+
+      printf("success after %lu traces, %s written (%.1f s)\n", report.traces, o->stop, now() - start);
+      result = 0;
+      goto done;
+    }
+  }
+
+  printf("no success after %lu traces (%.1f s)\n", source.traces, now() - start);
+
+done:
+  monitor_free(&m);
+  free(traces);
+  free(iv);
+  if (source.raw != NULL) fclose(source.raw);
+  if (source.ivs != NULL) fclose(source.ivs);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c first:last] [-w first:count] [-e traces] [-m sigmas] [-r bits]\n"
+         "       %*s [-p probability] [-k key] [-f] [-i seconds] [-s stop] [-t threads]\n"
+         "       %*s samples raw ivs\n", name, (int)strlen(name), "", (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u64 a, b;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.last_clock = TARGET_CLOCKS - 1;
+  o.every = 100;
+  o.margin = 5;
+  o.rank = -1;
+  o.probability = MONITOR_PROBABILITY;
+  o.idle = 60;
+  o.stop = "stop.txt";
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "c:w:e:m:r:p:k:fi:s:t:")) != -1) {
+    switch (option) {
+    case 'e': o.every   = strtoul(optarg, NULL, 10);  break;
+    case 'm': o.margin  = atof(optarg);               break;
+    case 'r': o.rank    = atof(optarg);               break;
+    case 'p': o.probability = atof(optarg);           break;
+    case 'f': o.follow  = 1;                          break;
+    case 'i': o.idle    = atof(optarg);               break;
+    case 's': o.stop    = optarg;                     break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);  break;
+    case 'c':
+      if (parse_range(optarg, &a, &b) < 0 || a > b || b >= TARGET_CLOCKS) {
+        printf("[ERROR] clocks must be within 0:%d\n", TARGET_CLOCKS - 1);
+        return 2;
+      }
+      o.first_clock = (u32)a;
+      o.last_clock = (u32)b;
+      break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0 || o.samples == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 3 || o.every < 4 || o.threads == 0 || !(o.probability > 0 && o.probability < 1) || (o.margin <= 0 && !(o.has_key && o.rank >= 0))) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  o.trace_samples = strtoul(argv[optind], NULL, 10);
+  if (o.samples == 0) o.samples = (o.trace_samples > o.window) ? o.trace_samples - o.window : 0;
+
+  if (o.trace_samples == 0 || o.window + o.samples > o.trace_samples) {
+    printf("[ERROR] the window must lie within the %lu samples of a trace\n", o.trace_samples);
+    return 2;
+  }
+
+  return monitor(&o, argv[optind + 1], argv[optind + 2]);
+}
@@ -0,0 +1,237 @@
+/*
+ * bench_trivium.c
+ *
+ * encryptions per second of the trivium implementations for a given
+ * number of initialization rounds
+ *
+ *  build : gcc -O3 -march=native -o bench_trivium bench_trivium.c trivium_ref.c trivium_word.c \
+ *                                   trivium_masked.c anf.c
+ *  run   : ./bench_trivium [rounds] [count]
+ *
+ * every encryption is a fresh key/iv setup, the warm up and a 64 byte
+ * keystream, the same work the batch encryptor does per line of keys.txt
+ *
+ * the masked core runs at every order, its overhead is the time per
+ * encryption relative to the word core
+ *
+ * hypothesis bits (t1 of an early clock for one key and many ivs) are
+ * timed both by loading and clocking the word core per iv and from the
+ * key restricted normal form of anf.h
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "trivium.h"
+#include "anf.h"
+#include "util.h"
+
+#define BLOCK_LENGTH 64
+
+
+/***
+ * next_iv
+ *
+ * step the iv like a counter so that no two encryptions are alike
+ *
+ */
+static void next_iv(u8* iv) {
+
+  int i;
+
+  for (i = IVLENGTH - 1; i >= 0 && ++iv[i] == 0; i--);
+
+  return;
+}
+
+
+/***
+ * report
+ *
+ * print the rate of one run; the checksum keeps the work observable
+ *
+ */
+static void report(const char* name, u64 rounds, u64 count, double seconds, u8 checksum) {
+
+  printf("%-14s rounds %-5lu %10lu enc %8.3f s %12.0f enc/s  (%02X)\n",
+         name, rounds, count, seconds, count / seconds, checksum);
+
+  return;
+}
+
+
+static void bench_ref(u64 rounds, u64 count) {
+
+  u8 key[KEYLENGTH] = { 0x80 }, iv[IVLENGTH] = { 0 }, out[BLOCK_LENGTH], checksum = 0;
+  double start = now();
+  u64 i;
+
+  init_rounds = rounds;
+
+  for (i = 0; i < count; i++) {
+    trivium_ref_keystream(key, iv, out, BLOCK_LENGTH);
+    checksum ^= out[0];
+    next_iv(iv);
+  }
+
+  init_rounds = INIT_ROUNDS;
+
+  report("ref", rounds, count, now() - start, checksum);
+
+  return;
+}
+
+
+static double bench_word(u64 rounds, u64 count) {
+
+  u8 key[KEYLENGTH] = { 0x80 }, iv[IVLENGTH] = { 0 }, out[BLOCK_LENGTH], checksum = 0;
+  trivium_word_t s;
+  double start = now(), seconds;
+  u64 i;
+
+  for (i = 0; i < count; i++) {
+    trivium_word_load(&s, key, iv);
+    trivium_word_rounds(&s, rounds);
+    trivium_word_stream(&s, out, BLOCK_LENGTH);
+    checksum ^= out[0];
+    next_iv(iv);
+  }
+
+  seconds = now() - start;
+  report("word", rounds, count, seconds, checksum);
+
+  return seconds / count;
+}
+
+
+/***
+ * bench_masked
+ *
+ * the masked core of one order, with the overhead over a word
+ * encryption that took unmasked seconds
+ *
+ */
+static void bench_masked(u64 order, u64 rounds, u64 count, double unmasked) {
+
+  u8 key[KEYLENGTH] = { 0x80 }, iv[IVLENGTH] = { 0 }, out[BLOCK_LENGTH], checksum = 0;
+  trivium_masked_t s;
+  char name[32];
+  double start = now(), seconds;
+  u64 i;
+
+  for (i = 0; i < count; i++) {
+    trivium_masked_load(&s, key, iv, order, i);
+    trivium_masked_rounds(&s, rounds);
+    trivium_masked_stream(&s, out, BLOCK_LENGTH);
+    checksum ^= out[0];
+    next_iv(iv);
+  }
+
+  seconds = now() - start;
+  snprintf(name, sizeof(name), "masked/%lu", order);
+  report(name, rounds, count, seconds, checksum);
+  printf("%-14s %.1fx the word core\n", "", seconds / count / unmasked);
+
+  return;
+}
+
+
+/***
+ * bench_anf
+ *
+ * t1 of a clock for count ivs under one key, clocked and from the normal
+ * form; the checksums must agree
+ *
+ */
+static void bench_anf(const anf_t* a, u64 clock, u64 count) {
+
+  u8 key[KEYLENGTH] = { 0x80 }, iv[IVLENGTH] = { 0 }, bits[STATEBITS], clocked = 0, formed = 0;
+  u64 packed[2], v[2];
+  trivium_word_t s;
+  anf_fn_t f;
+  double start, seconds[2];
+  u64 i;
+
+  start = now();
+  for (i = 0; i < count; i++) {
+    trivium_word_load(&s, key, iv);
+    trivium_word_rounds(&s, clock);
+    trivium_word_bits(&s, bits);
+    clocked = (u8)(31 * clocked + (bits[65] ^ bits[92] ^ (bits[90] & bits[91]) ^ bits[170]));
+    next_iv(iv);
+  }
+  seconds[0] = now() - start;
+
+  memset(iv, 0, sizeof(iv));
+  start = now();
+  anf_pack(key, packed);
+  if (anf_restrict(a, anf_feedback(a, clock, 0), packed, &f) < 0) return;
+  for (i = 0; i < count; i++) {
+    anf_pack(iv, v);
+    formed = (u8)(31 * formed + anf_eval(&f, v));
+    next_iv(iv);
+  }
+  seconds[1] = now() - start;
+
+  printf("%-14s clock  %-5lu %10lu ivs %8.3f s %12.0f bit/s  (%02X)\n", "t1/clocked", clock, count, seconds[0], count / seconds[0], clocked);
+  printf("%-14s clock  %-5lu %10lu ivs %8.3f s %12.0f bit/s  (%02X)\n", "t1/anf", clock, count, seconds[1], count / seconds[1], formed);
+  printf("%-14s %.1fx faster, %lu terms\n", "", seconds[0] / seconds[1], f.terms + (u64)__builtin_popcountll(f.linear[0]) +
+         (u64)__builtin_popcountll(f.linear[1]) + f.constant);
+
+  anf_fn_free(&f);
+
+  return;
+}
+
+
+/***
+ * parse_count
+ *
+ * a whole decimal number, nothing before or after it
+ *
+ */
+static int parse_count(const char* text, u64* value) {
+
+  char* end;
+
+  if (*text < '0' || *text > '9') return -1;
+  *value = strtoul(text, &end, 10);
+
+  return (*end != 0) ? -1 : 0;
+}
+
+
+int main(int argc, char** argv) {
+
+  u64 rounds = INIT_ROUNDS, count = 1000000;
+  static anf_t anf;
+  double unmasked;
+  u64 order;
+
+  if (argc > 3 || (argc > 1 && parse_count(argv[1], &rounds) < 0) || (argc > 2 && parse_count(argv[2], &count) < 0) ||
+      count == 0) {
+    printf("usage: %s [rounds] [count]\n", argv[0]);
+    return 2;
+  }
+
+  // the byte oriented reference is a few hundred times slower
+  bench_ref(rounds, count / 256 + 1);
+
+  unmasked = bench_word(rounds, count);
+
+  // the masked core is several times slower, a tenth of the count will do
+  for (order = 1; order <= MASKED_MAX_ORDER; order++) bench_masked(order, rounds, count / 10 + 1, unmasked);
+
+  if (anf_build(&anf, ANF_MAX_CLOCKS, 0) < 0) {
+    printf("[ERROR] the normal form of %d clocks takes more than %d terms\n", ANF_MAX_CLOCKS, ANF_LIMIT);
+    return 1;
+  }
+  bench_anf(&anf, 65, count);
+  bench_anf(&anf, ANF_MAX_CLOCKS - 1, count);
+  anf_free(&anf);
+
+  return 0;
+}
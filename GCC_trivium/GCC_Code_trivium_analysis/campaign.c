@@ -0,0 +1,536 @@
+/*
+ * campaign.c
+ *
+ * campaign designs and their files (see campaign.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "campaign.h"
+#include "util.h"
+
+#define GOLDEN    0x9E3779B97F4A7C15ULL  // splitmix64 step
+#define POSITIONS (8 * (KEYLENGTH + IVLENGTH))
+
+
+static const char* design_names[] = { "uniform", "tvla", "walking", "chosen" };
+
+
+static void put_u32(u8* p, u32 v) { memcpy(p, &v, sizeof(v)); }
+static void put_u64(u8* p, u64 v) { memcpy(p, &v, sizeof(v)); }
+static u32  get_u32(const u8* p) { u32 v; memcpy(&v, p, sizeof(v)); return v; }
+static u64  get_u64(const u8* p) { u64 v; memcpy(&v, p, sizeof(v)); return v; }
+
+
+const char* campaign_design_name(u32 design) {
+  return (design <= CAMPAIGN_CHOSEN) ? design_names[design] : "unknown";
+}
+
+
+int campaign_design_parse(const char* name, u32* design) {
+
+  u32 i;
+
+  for (i = 0; i <= CAMPAIGN_CHOSEN; i++) {
+    if (strcmp(name, design_names[i]) == 0) {
+      *design = i;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+/***
+ * draw
+ *
+ * length bytes from the next generator steps, little endian
+ *
+ */
+static void draw(u64* state, u8* out, u64 length) {
+
+  u64 w, n;
+
+  while (length > 0) {
+    w = splitmix64(state);
+    n = (length < 8) ? length : 8;
+    memcpy(out, &w, n);
+    out += n;
+    length -= n;
+  }
+
+  return;
+}
+
+
+/***
+ * campaign_init
+ *
+ * a design with its defaults: all zero plain text (as plain.txt), the
+ * walking bit on a zero key and iv with the legacy stride, and for the
+ * other designs a fixed key and iv drawn from the seed
+ *
+ */
+void campaign_init(campaign_t* c, u32 design, u64 records, u64 seed) {
+
+  u64 state = seed ^ 0x46495845444B4559ULL;   // apart from every record's steps
+
+  memset(c, 0, sizeof(campaign_t));
+  c->design = design;
+  c->records = records;
+  c->seed = seed;
+  c->stride = 9;
+
+  if (design != CAMPAIGN_WALKING) {
+    draw(&state, c->key, KEYLENGTH);
+    if (design != CAMPAIGN_CHOSEN) draw(&state, c->iv, IVLENGTH);
+  }
+
+  return;
+}
+
+
+int campaign_check(const campaign_t* c) {
+
+  u32 j, k;
+
+  if (c->design > CAMPAIGN_CHOSEN || c->records == 0) {
+    printf("[ERROR] no such design, or no records\n");
+    return -1;
+  }
+
+  if ((c->flags & CAMPAIGN_RANDOM_PLAIN) && c->design != CAMPAIGN_UNIFORM && c->design != CAMPAIGN_TVLA) {
+    printf("[ERROR] only uniform and tvla draw the plain text\n");
+    return -1;
+  }
+
+  if (c->design == CAMPAIGN_WALKING && c->stride % POSITIONS == 0) {
+    printf("[ERROR] a stride of %u walks nowhere\n", c->stride);
+    return -1;
+  }
+
+  if (c->design == CAMPAIGN_CHOSEN) {
+    if (c->cube_bits == 0 || c->cube_bits > CAMPAIGN_MAX_CUBE) {
+      printf("[ERROR] chosen needs 1 to %d cube bits\n", CAMPAIGN_MAX_CUBE);
+      return -1;
+    }
+    for (j = 0; j < c->cube_bits; j++) {
+      for (k = 0; k <= j; k++) {
+        if (c->cube[j] >= 8 * IVLENGTH || (k < j && c->cube[j] == c->cube[k])) {
+          printf("[ERROR] cube bits must be distinct iv bits 0..%d\n", 8 * IVLENGTH - 1);
+          return -1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+u64 campaign_record_size(const campaign_t* c) {
+  return KEYLENGTH + IVLENGTH + 1 + ((c->flags & CAMPAIGN_RANDOM_PLAIN) ? CAMPAIGN_PLAIN : 0);
+}
+
+
+/***
+ * campaign_record
+ *
+ * record i of a campaign; the steps are group, key (2), iv (2) and plain
+ * text (8), and what a design does not draw is skipped, not generated
+ *
+ */
+void campaign_record(const campaign_t* c, u64 i, campaign_record_t* r) {
+
+  u64 state = c->seed + i * CAMPAIGN_WORDS * GOLDEN, p, j, b;
+  u8 mask;
+
+  memcpy(r->key, c->key, KEYLENGTH);
+  memcpy(r->iv, c->iv, IVLENGTH);
+  r->group = 1;
+
+  switch (c->design) {
+  case CAMPAIGN_UNIFORM:
+    state += GOLDEN;
+    draw(&state, r->key, KEYLENGTH);
+    draw(&state, r->iv, IVLENGTH);
+    break;
+
+  case CAMPAIGN_TVLA:
+    r->group = (u8)(splitmix64(&state) & 0x01);
+    state += 2 * GOLDEN;
+    if (r->group) draw(&state, r->iv, IVLENGTH);
+    else state += 2 * GOLDEN;
+    break;
+
+  case CAMPAIGN_WALKING:
+    p = ((i % POSITIONS) * c->stride) % POSITIONS;
+    mask = (u8)(0x80 >> (p % 8));
+    if (p < 8 * KEYLENGTH) r->key[p / 8] ^= mask;
+    else r->iv[p / 8 - KEYLENGTH] ^= mask;
+    break;
+
+  case CAMPAIGN_CHOSEN:
+    for (j = 0; j < c->cube_bits; j++) {
+      b = c->cube[j];
+      mask = (u8)(0x80 >> (b % 8));
+      if ((i >> j) & 0x01) r->iv[IVLENGTH - 1 - b / 8] |= mask;
+      else r->iv[IVLENGTH - 1 - b / 8] &= (u8)~mask;
+    }
+    break;
+  }
+
+  if ((c->flags & CAMPAIGN_RANDOM_PLAIN) && r->group) draw(&state, r->plain, CAMPAIGN_PLAIN);
+  else memcpy(r->plain, c->plain, CAMPAIGN_PLAIN);
+
+  return;
+}
+
+
+
+/**********
+ * Writer *
+ **********/
+
+
+
+typedef struct {
+  const campaign_t* c;
+  int   text;
+  u64   first, count;                   // records of the round
+  u64   next;                           // next block, shared by the workers
+  u8*   out[3];                         // records, or keys, ivs and groups
+  u64   size[3];                        // bytes per record in each
+} write_job_t;
+
+
+static void put_hex(u8* out, const u8* bytes, u64 length) {
+
+  static const char digits[] = "0123456789ABCDEF";
+  u64 i;
+
+  for (i = 0; i < length; i++) {
+    out[2 * i]     = (u8)digits[bytes[i] >> 4];
+    out[2 * i + 1] = (u8)digits[bytes[i] & 0x0F];
+  }
+  out[2 * length] = '\n';
+
+  return;
+}
+
+
+static void* write_worker(void* arg) {
+
+  write_job_t* job = arg;
+  const campaign_t* c = job->c;
+  campaign_record_t r;
+  u64 b, i, last;
+  u8* p;
+
+  while ((b = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) * CAMPAIGN_BLOCK < job->count) {
+    last = (b + 1) * CAMPAIGN_BLOCK < job->count ? (b + 1) * CAMPAIGN_BLOCK : job->count;
+
+    for (i = b * CAMPAIGN_BLOCK; i < last; i++) {
+      campaign_record(c, job->first + i, &r);
+
+      if (job->text) {
+        put_hex(job->out[0] + i * job->size[0], r.key, KEYLENGTH);
+        put_hex(job->out[1] + i * job->size[1], r.iv, IVLENGTH);
+        if (job->out[2] != NULL) {
+          job->out[2][2 * i] = (u8)('0' + r.group);
+          job->out[2][2 * i + 1] = '\n';
+        }
+      } else {
+        p = job->out[0] + i * job->size[0];
+        memcpy(p, r.key, KEYLENGTH);
+        memcpy(p + KEYLENGTH, r.iv, IVLENGTH);
+        p[KEYLENGTH + IVLENGTH] = r.group;
+        if (c->flags & CAMPAIGN_RANDOM_PLAIN) memcpy(p + KEYLENGTH + IVLENGTH + 1, r.plain, CAMPAIGN_PLAIN);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+/***
+ * write_rounds
+ *
+ * every record, a round of threads * CAMPAIGN_BLOCK records at a time:
+ * the workers fill the round's buffers, which are then written in order
+ *
+ */
+static int write_rounds(write_job_t* job, FILE** fp, u64 threads) {
+
+  pthread_t thread[CAMPAIGN_MAX_THREADS];
+  u64 round, i, k, started;
+  int result = -1;
+
+  threads = (threads == 0) ? 1 : (threads > CAMPAIGN_MAX_THREADS) ? CAMPAIGN_MAX_THREADS : threads;
+  round = threads * CAMPAIGN_BLOCK;
+  if (round > job->c->records) round = job->c->records;
+
+  for (k = 0; k < 3; k++) {
+    if (fp[k] == NULL) continue;
+    job->out[k] = malloc(round * job->size[k]);
+    if (job->out[k] == NULL) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+  }
+
+  for (job->first = 0; job->first < job->c->records; job->first += job->count) {
+    job->count = (job->c->records - job->first < round) ? job->c->records - job->first : round;
+    job->next = 0;
+
+    started = 0;
+    if (threads > 1) {
+      for (started = 0; started < threads; started++) {
+        if (pthread_create(&thread[started], NULL, write_worker, job) != 0) break;
+      }
+    }
+    if (started == 0) write_worker(job);
+    for (i = 0; i < started; i++) pthread_join(thread[i], NULL);
+
+    for (k = 0; k < 3; k++) {
+      if (fp[k] != NULL && fwrite(job->out[k], job->size[k], job->count, fp[k]) != job->count) {
+        printf("[ERROR] could not write the campaign\n");
+        goto done;
+      }
+    }
+  }
+
+  result = 0;
+
+done:
+  for (k = 0; k < 3; k++) free(job->out[k]);
+
+  return result;
+}
+
+
+static void encode_header(const campaign_t* c, u8* header) {
+
+  memset(header, 0, CAMPAIGN_HEADER);
+  memcpy(header, CAMPAIGN_MAGIC, 8);
+  put_u32(header + 8,  CAMPAIGN_VERSION);
+  put_u32(header + 12, c->design);
+  put_u32(header + 16, c->flags);
+  put_u32(header + 20, c->stride);
+  put_u64(header + 24, c->records);
+  put_u64(header + 32, c->seed);
+  put_u32(header + 40, (u32)campaign_record_size(c));
+  put_u32(header + 44, c->cube_bits);
+  memcpy(header + 48, c->key, KEYLENGTH);
+  memcpy(header + 58, c->iv, IVLENGTH);
+  memcpy(header + 68, c->plain, CAMPAIGN_PLAIN);
+  memcpy(header + 132, c->cube, CAMPAIGN_MAX_CUBE);
+
+  return;
+}
+
+
+/***
+ * campaign_write
+ *
+ * the binary campaign file, records generated by threads in parallel
+ *
+ */
+int campaign_write(const campaign_t* c, const char* path, u64 threads) {
+
+  u8 header[CAMPAIGN_HEADER];
+  write_job_t job;
+  FILE* fp[3] = { NULL, NULL, NULL };
+  int result = -1;
+
+  if (campaign_check(c) < 0) return -1;
+
+  fp[0] = fopen(path, "wb");
+  if (fp[0] == NULL) {
+    printf("[ERROR] could not create %s\n", path);
+    return -1;
+  }
+
+  encode_header(c, header);
+  if (fwrite(header, CAMPAIGN_HEADER, 1, fp[0]) != 1) {
+    printf("[ERROR] could not write %s\n", path);
+    goto done;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.c = c;
+  job.size[0] = campaign_record_size(c);
+
+  result = write_rounds(&job, fp, threads);
+
+done:
+  if (fclose(fp[0]) != 0) result = -1;
+
+  return result;
+}
+
+
+/***
+ * campaign_write_text
+ *
+ * keys.txt, ivs.txt and plain.txt (and groups.txt for tvla) in a
+ * directory, in the format the encryption and acquisition scripts read
+ *
+ */
+int campaign_write_text(const campaign_t* c, const char* directory, u64 threads) {
+
+  static const char* names[4] = { "keys.txt", "ivs.txt", "groups.txt", "plain.txt" };
+  char path[4][4096];
+  u8 line[2 * CAMPAIGN_PLAIN + 1];
+  write_job_t job;
+  FILE* fp[4] = { NULL, NULL, NULL, NULL };
+  u64 k;
+  int result = -1;
+
+  if (campaign_check(c) < 0) return -1;
+
+  if (c->flags & CAMPAIGN_RANDOM_PLAIN) {
+    printf("[ERROR] plain.txt holds one plain text, random ones need the binary format\n");
+    return -1;
+  }
+
+  for (k = 0; k < 4; k++) {
+    if (k == 2 && c->design != CAMPAIGN_TVLA) continue;
+
+    snprintf(path[k], sizeof(path[k]), "%s/%s", directory, names[k]);
+    fp[k] = fopen(path[k], "wb");
+    if (fp[k] == NULL) {
+      printf("[ERROR] could not create %s\n", path[k]);
+      goto done;
+    }
+  }
+
+  put_hex(line, c->plain, CAMPAIGN_PLAIN);
+  if (fwrite(line, sizeof(line), 1, fp[3]) != 1) {
+    printf("[ERROR] could not write %s\n", path[3]);
+    goto done;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.c = c;
+  job.text = 1;
+  job.size[0] = 2 * KEYLENGTH + 1;
+  job.size[1] = 2 * IVLENGTH + 1;
+  job.size[2] = 2;
+
+  result = write_rounds(&job, fp, threads);
+
+done:
+  for (k = 0; k < 4; k++) {
+    if (fp[k] != NULL && fclose(fp[k]) != 0) result = -1;
+  }
+
+  return result;
+}
+
+
+
+/**********
+ * Reader *
+ **********/
+
+
+
+int campaign_open(campaign_file_t* f, const char* path) {
+
+  campaign_t* c = &f->campaign;
+  u8 header[CAMPAIGN_HEADER];
+
+  memset(f, 0, sizeof(campaign_file_t));
+
+  f->fp = fopen(path, "rb");
+  if (f->fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  if (fread(header, CAMPAIGN_HEADER, 1, f->fp) != 1 || memcmp(header, CAMPAIGN_MAGIC, 8) != 0 ||
+      get_u32(header + 8) != CAMPAIGN_VERSION) {
+    printf("[ERROR] %s is not a campaign\n", path);
+    goto fail;
+  }
+
+  c->design    = get_u32(header + 12);
+  c->flags     = get_u32(header + 16);
+  c->stride    = get_u32(header + 20);
+  c->records   = get_u64(header + 24);
+  c->seed      = get_u64(header + 32);
+  c->cube_bits = get_u32(header + 44);
+  memcpy(c->key, header + 48, KEYLENGTH);
+  memcpy(c->iv, header + 58, IVLENGTH);
+  memcpy(c->plain, header + 68, CAMPAIGN_PLAIN);
+  memcpy(c->cube, header + 132, CAMPAIGN_MAX_CUBE);
+
+  f->record_size = campaign_record_size(c);
+
+  if (get_u32(header + 40) != f->record_size || campaign_check(c) < 0) {
+    printf("[ERROR] %s: damaged campaign header\n", path);
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  fclose(f->fp);
+  f->fp = NULL;
+
+  return -1;
+}
+
+
+void campaign_close(campaign_file_t* f) {
+
+  if (f->fp != NULL) fclose(f->fp);
+  memset(f, 0, sizeof(campaign_file_t));
+
+  return;
+}
+
+
+/***
+ * campaign_read
+ *
+ * records first..first+count-1 as stored
+ *
+ */
+int campaign_read(campaign_file_t* f, u64 first, u64 count, campaign_record_t* r) {
+
+  const campaign_t* c = &f->campaign;
+  u8 record[KEYLENGTH + IVLENGTH + 1 + CAMPAIGN_PLAIN];
+  u64 i;
+
+  if (first + count > c->records || first + count < first) {
+    printf("[ERROR] records %lu..%lu are not in the campaign\n", first, first + count - 1);
+    return -1;
+  }
+
+  if (fseeko(f->fp, (off_t)(CAMPAIGN_HEADER + first * f->record_size), SEEK_SET) != 0) return -1;
+
+  for (i = 0; i < count; i++) {
+    if (fread(record, f->record_size, 1, f->fp) != 1) {
+      printf("[ERROR] the campaign ends before record %lu\n", first + i);
+      return -1;
+    }
+
+    memcpy(r[i].key, record, KEYLENGTH);
+    memcpy(r[i].iv, record + KEYLENGTH, IVLENGTH);
+    r[i].group = record[KEYLENGTH + IVLENGTH];
+    if (c->flags & CAMPAIGN_RANDOM_PLAIN) memcpy(r[i].plain, record + KEYLENGTH + IVLENGTH + 1, CAMPAIGN_PLAIN);
+    else memcpy(r[i].plain, c->plain, CAMPAIGN_PLAIN);
+  }
+
+  return 0;
+}
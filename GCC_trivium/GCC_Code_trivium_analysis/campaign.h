@@ -0,0 +1,118 @@
+/*
+ * campaign.h
+ *
+ * acquisition campaigns: the key, iv and plain text of every encryption
+ *
+ * a campaign is a design and its parameters; record i is a function of
+ * them and i alone, drawn from a counter based generator (splitmix64
+ * started at seed + 13 i steps), so any range of records is generated
+ * independently and the same seed gives the same campaign everywhere.
+ *
+ * designs:
+ *
+ *   uniform   random key and iv for every record
+ *   tvla      fixed key; every record is drawn into the fixed group
+ *             (fixed iv and plain text) or the random group (random iv)
+ *             with even odds, for fixed-vs-random t-tests
+ *   walking   the fixed key and iv with one bit flipped, bit i * stride
+ *             mod 160 counted from the first hex digit of the key on to
+ *             the iv: a stride of 9 gives the walking-one lines of the
+ *             legacy keys.txt
+ *   chosen    fixed key; the cube iv bits (state order, as cube_sum
+ *             takes them) run through all their values, record i
+ *             setting cube bit j to bit j of i, the other iv bits fixed
+ *
+ * the plain text is the campaign's fixed one unless the design draws it
+ * for every record (CAMPAIGN_RANDOM_PLAIN, uniform and the random group
+ * of tvla).
+ *
+ * binary format, little endian:
+ *
+ *   header  "TRVCAMP1" version design flags stride records seed
+ *           record_size cube_bits key iv plain cube        (192 bytes)
+ *   record  key iv group [plain]      (21 bytes, 85 with random plain)
+ *
+ * the legacy text files are keys.txt and ivs.txt with one record per
+ * line, plain.txt with the fixed plain text, and for tvla groups.txt
+ * with the group of every record.
+ *
+ */
+
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#include <stdio.h>
+
+#include "trivium.h"
+
+#define CAMPAIGN_MAGIC       "TRVCAMP1"
+#define CAMPAIGN_VERSION     1
+#define CAMPAIGN_HEADER      192
+#define CAMPAIGN_PLAIN       64         // bytes per encryption, as plain.txt
+#define CAMPAIGN_MAX_CUBE    32
+#define CAMPAIGN_WORDS       13         // generator steps per record
+#define CAMPAIGN_BLOCK       65536      // records per work item
+#define CAMPAIGN_MAX_THREADS 256
+
+#define CAMPAIGN_RANDOM_PLAIN 0x01
+
+enum {
+  CAMPAIGN_UNIFORM = 0,
+  CAMPAIGN_TVLA    = 1,
+  CAMPAIGN_WALKING = 2,
+  CAMPAIGN_CHOSEN  = 3
+};
+
+
+/***
+ * campaign_record_t
+ *
+ * one encryption, file order as in keys.txt / ivs.txt; group is 0 for
+ * the fixed group of tvla and 1 otherwise
+ *
+ */
+typedef struct {
+  u8 key[KEYLENGTH];
+  u8 iv[IVLENGTH];
+  u8 group;
+  u8 plain[CAMPAIGN_PLAIN];
+} campaign_record_t;
+
+
+typedef struct {
+  u32 design;
+  u32 flags;
+  u64 records;
+  u64 seed;
+  u8  key[KEYLENGTH];                   // fixed key, background of walking
+  u8  iv[IVLENGTH];                     // fixed iv, background of walking and chosen
+  u8  plain[CAMPAIGN_PLAIN];            // fixed plain text
+  u32 stride;                           // walking
+  u32 cube_bits;                        // chosen
+  u8  cube[CAMPAIGN_MAX_CUBE];          // iv bit indices
+} campaign_t;
+
+
+typedef struct {
+  campaign_t campaign;
+  FILE*      fp;
+  u64        record_size;
+} campaign_file_t;
+
+
+const char* campaign_design_name(u32 design);
+int  campaign_design_parse(const char* name, u32* design);
+
+void campaign_init(campaign_t* c, u32 design, u64 records, u64 seed);
+int  campaign_check(const campaign_t* c);
+u64  campaign_record_size(const campaign_t* c);
+void campaign_record(const campaign_t* c, u64 i, campaign_record_t* r);
+
+int  campaign_write(const campaign_t* c, const char* path, u64 threads);
+int  campaign_write_text(const campaign_t* c, const char* directory, u64 threads);
+
+int  campaign_open(campaign_file_t* f, const char* path);
+void campaign_close(campaign_file_t* f);
+int  campaign_read(campaign_file_t* f, u64 first, u64 count, campaign_record_t* r);
+
+#endif
@@ -0,0 +1,640 @@
+/*
+ * cpa.c
+ *
+ * streaming correlation engine (see cpa.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __AVX512VNNI__
+#include <immintrin.h>
+#endif
+
+#include "cpa.h"
+
+
+typedef struct {
+  cpa_t*         c;
+  const float*   traces;
+  u64            stride;
+  u64            count;
+  const float*   h;
+  cpa_columns_fn columns;
+  const void*    ctx;
+  const int8_t*  traces8;               // the int8 path instead
+  const u32*     h8;                    // [quads][hypotheses], four traces' bytes each
+  const u64*     sh8;                   // [hypotheses], sum of h over the batch
+  int            reference;             // the first batch: set ref_x from its first trace
+  u64            next;                  // next tile, shared by the workers
+} cpa_job_t;
+
+
+int cpa_alloc(cpa_t* c, u64 hypotheses, u64 columns, u64 threads) {
+
+  memset(c, 0, sizeof(cpa_t));
+
+  if (hypotheses == 0 || columns == 0) return -1;
+
+  c->hypotheses = hypotheses;
+  c->columns    = columns;
+  c->threads    = (threads == 0) ? 1 : (threads > CPA_MAX_THREADS ? CPA_MAX_THREADS : threads);
+  c->ref_x      = calloc(columns, sizeof(double));
+  c->sum_h      = calloc(hypotheses, sizeof(double));
+  c->sum_hh     = calloc(hypotheses, sizeof(double));
+  c->sum_x      = calloc(columns, sizeof(double));
+  c->sum_xx     = calloc(columns, sizeof(double));
+  c->sum_hx     = calloc(hypotheses * columns, sizeof(double));
+
+  if (c->ref_x == NULL || c->sum_h == NULL || c->sum_hh == NULL || c->sum_x == NULL || c->sum_xx == NULL || c->sum_hx == NULL) {
+    cpa_free(c);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void cpa_free(cpa_t* c) {
+
+  free(c->ref_x);
+  free(c->sum_h);
+  free(c->sum_hh);
+  free(c->sum_x);
+  free(c->sum_xx);
+  free(c->sum_hx);
+  memset(c, 0, sizeof(cpa_t));
+
+  return;
+}
+
+
+/***
+ * cpa_worker
+ *
+ * whole tiles of columns: the tile of the batch (made by the column
+ * function, or read in place) less the reference, in double, then its
+ * products with the hypotheses, CPA_HYPOTHESES at a time so that their
+ * sums stay in L1. A worker that cannot allocate its buffers leaves the
+ * tiles to the others.
+ *
+ */
+static void* cpa_worker(void* arg) {
+
+  cpa_job_t* job = arg;
+  cpa_t* c = job->c;
+  u64 H = c->hypotheses, tiles = (c->columns + CPA_TILE - 1) / CPA_TILE;
+  u64 tile, col0, width, t, k, k0, kn, j, stride;
+  float* buffer = job->columns ? aligned_alloc(64, job->count * CPA_TILE * sizeof(float)) : NULL;
+  double* d = aligned_alloc(64, job->count * CPA_TILE * sizeof(double));
+  double (*acc)[CPA_TILE] = aligned_alloc(64, CPA_HYPOTHESES * CPA_TILE * sizeof(double));
+  double sx[CPA_TILE], sxx[CPA_TILE];
+  const float* x;
+
+  if ((job->columns && buffer == NULL) || d == NULL || acc == NULL) goto done;
+
+  while ((tile = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < tiles) {
+    col0 = tile * CPA_TILE;
+    width = (c->columns - col0 < CPA_TILE) ? c->columns - col0 : CPA_TILE;
+
+    if (job->columns) {
+      memset(buffer, 0, job->count * CPA_TILE * sizeof(float));
+      job->columns(job->ctx, job->traces, job->stride, job->count, col0, width, buffer);
+      x = buffer;
+      stride = CPA_TILE;
+    } else {
+      x = job->traces + col0;
+      stride = job->stride;
+    }
+
+    if (job->reference) {
+      for (j = 0; j < width; j++) c->ref_x[col0 + j] = x[j];
+    }
+
+    // the columns past width stay zero, so the loops below run whole tiles
+    memset(d, 0, job->count * CPA_TILE * sizeof(double));
+    memset(sx, 0, sizeof(sx));
+    memset(sxx, 0, sizeof(sxx));
+
+    for (t = 0; t < job->count; t++) {
+      const float* row = x + t * stride;
+      double* dt = d + t * CPA_TILE;
+      for (j = 0; j < width; j++) {
+        dt[j] = row[j] - c->ref_x[col0 + j];
+        sx[j] += dt[j];
+        sxx[j] += dt[j] * dt[j];
+      }
+    }
+
+    for (j = 0; j < width; j++) {
+      c->sum_x[col0 + j] += sx[j];
+      c->sum_xx[col0 + j] += sxx[j];
+    }
+
+    for (k0 = 0; k0 < H; k0 += CPA_HYPOTHESES) {
+      kn = (H - k0 < CPA_HYPOTHESES) ? H - k0 : CPA_HYPOTHESES;
+      memset(acc, 0, CPA_HYPOTHESES * CPA_TILE * sizeof(double));
+
+      for (t = 0; t < job->count; t++) {
+        const double* dt = d + t * CPA_TILE;
+        const float* h = job->h + t * H + k0;
+
+        for (k = 0; k < kn; k++) {
+          double hk = h[k];
+          if (hk == 0) continue;
+          for (j = 0; j < CPA_TILE; j++) acc[k][j] += hk * dt[j];
+        }
+      }
+
+      for (k = 0; k < kn; k++) {
+        double* out = c->sum_hx + (k0 + k) * c->columns + col0;
+        for (j = 0; j < width; j++) out[j] += acc[k][j];
+      }
+    }
+  }
+
+done:
+  free(buffer);
+  free(d);
+  free(acc);
+
+  return NULL;
+}
+
+
+/***
+ * cpa_add
+ *
+ * count traces, stride floats apart, with their hypotheses
+ * h[t * hypotheses + k]. Without a column function the columns are the
+ * first c->columns samples of the traces.
+ *
+ */
+int cpa_add(cpa_t* c, const float* traces, u64 stride, u64 count, const float* h,
+            cpa_columns_fn columns, const void* ctx) {
+
+  pthread_t thread[CPA_MAX_THREADS];
+  cpa_job_t job;
+  u64 i, k, threads, tiles = (c->columns + CPA_TILE - 1) / CPA_TILE;
+
+  if (count == 0) return 0;
+
+  memset(&job, 0, sizeof(job));
+  job.c       = c;
+  job.traces  = traces;
+  job.stride  = stride;
+  job.count   = count;
+  job.h       = h;
+  job.columns = columns;
+  job.ctx     = ctx;
+  job.reference = (c->traces == 0);
+
+  threads = (tiles < c->threads) ? tiles : c->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, cpa_worker, &job) != 0) break;
+  }
+
+  if (i == 0) cpa_worker(&job);
+  threads = i;
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  // every tile was taken unless no worker could start, then nothing was added
+  if (job.next < tiles) return -1;
+
+  for (i = 0; i < count; i++) {
+    for (k = 0; k < c->hypotheses; k++) {
+      c->sum_h[k] += h[i * c->hypotheses + k];
+      c->sum_hh[k] += (double)h[i * c->hypotheses + k] * h[i * c->hypotheses + k];
+    }
+  }
+  c->traces += count;
+
+  return 0;
+}
+
+
+/***********
+ * Integer *
+ ***********/
+
+
+
+/***
+ * dot_int8
+ *
+ * acc[k][j] += the products of hypothesis k and column j over the quads
+ * of traces. x holds the four bytes of a column's traces in one 32 bit
+ * lane, CPA_TILE lanes per quad; h the four bytes of a hypothesis in
+ * one word. With VNNI a vpdpbusd adds the four products of 16 lanes at
+ * once, eight hypotheses at a time so their sums stay in registers.
+ *
+ */
+#ifdef __AVX512VNNI__
+
+static void dot_int8(const int8_t* x, const u32* h, u64 H, u64 quads, u64 kn, int32_t (*acc)[CPA_TILE]) {
+
+  __m512i a[8][2], x0, x1, hk;
+  u64 q, k, i;
+
+  for (k = 0; k + 8 <= kn; k += 8) {
+    for (i = 0; i < 8; i++) {
+      a[i][0] = _mm512_load_si512(acc[k + i]);
+      a[i][1] = _mm512_load_si512(acc[k + i] + 16);
+    }
+
+    for (q = 0; q < quads; q++) {
+      x0 = _mm512_load_si512(x + q * 4 * CPA_TILE);
+      x1 = _mm512_load_si512(x + q * 4 * CPA_TILE + 64);
+      for (i = 0; i < 8; i++) {
+        hk = _mm512_set1_epi32((int)h[q * H + k + i]);
+        a[i][0] = _mm512_dpbusd_epi32(a[i][0], hk, x0);
+        a[i][1] = _mm512_dpbusd_epi32(a[i][1], hk, x1);
+      }
+    }
+
+    for (i = 0; i < 8; i++) {
+      _mm512_store_si512(acc[k + i], a[i][0]);
+      _mm512_store_si512(acc[k + i] + 16, a[i][1]);
+    }
+  }
+
+  for (; k < kn; k++) {
+    a[0][0] = _mm512_load_si512(acc[k]);
+    a[0][1] = _mm512_load_si512(acc[k] + 16);
+    for (q = 0; q < quads; q++) {
+      hk = _mm512_set1_epi32((int)h[q * H + k]);
+      a[0][0] = _mm512_dpbusd_epi32(a[0][0], hk, _mm512_load_si512(x + q * 4 * CPA_TILE));
+      a[0][1] = _mm512_dpbusd_epi32(a[0][1], hk, _mm512_load_si512(x + q * 4 * CPA_TILE + 64));
+    }
+    _mm512_store_si512(acc[k], a[0][0]);
+    _mm512_store_si512(acc[k] + 16, a[0][1]);
+  }
+
+  return;
+}
+
+#else
+
+static void dot_int8(const int8_t* x, const u32* h, u64 H, u64 quads, u64 kn, int32_t (*acc)[CPA_TILE]) {
+
+  const int8_t* row;
+  u32 word;
+  int32_t h0, h1, h2, h3;
+  u64 q, k, j;
+
+  for (q = 0; q < quads; q++) {
+    row = x + q * 4 * CPA_TILE;
+    for (k = 0; k < kn; k++) {
+      if ((word = h[q * H + k]) == 0) continue;
+      h0 = word & 0xff;
+      h1 = (word >> 8) & 0xff;
+      h2 = (word >> 16) & 0xff;
+      h3 = word >> 24;
+      for (j = 0; j < CPA_TILE; j++) {
+        acc[k][j] += h0 * row[4 * j] + h1 * row[4 * j + 1] + h2 * row[4 * j + 2] + h3 * row[4 * j + 3];
+      }
+    }
+  }
+
+  return;
+}
+
+#endif
+
+
+/***
+ * cpa_worker_int8
+ *
+ * whole tiles of int8 columns: packed four traces to a lane, summed into
+ * int32 at most CPA_QUADS quads at a time (no product sum can overflow
+ * in between) and then added to the double sums, which hold integers
+ * exactly. The products are of the codes themselves, the reference is
+ * taken off after: sum h (x - r) = sum h x - r sum h. A worker that
+ * cannot allocate its buffers leaves the tiles to the others.
+ *
+ */
+static void* cpa_worker_int8(void* arg) {
+
+  cpa_job_t* job = arg;
+  cpa_t* c = job->c;
+  u64 H = c->hypotheses, tiles = (c->columns + CPA_TILE - 1) / CPA_TILE, quads = (job->count + 3) / 4;
+  u64 tile, col0, width, t, k, k0, kn, q0, qn, j;
+  int8_t* x = aligned_alloc(64, quads * 4 * CPA_TILE);
+  int32_t (*acc)[CPA_TILE] = aligned_alloc(64, CPA_HYPOTHESES * CPA_TILE * sizeof(int32_t));
+  int64_t sx[CPA_TILE], sxx[CPA_TILE], r[CPA_TILE], v;
+  const int8_t* row;
+
+  if (x == NULL || acc == NULL) goto done;
+
+  while ((tile = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < tiles) {
+    col0 = tile * CPA_TILE;
+    width = (c->columns - col0 < CPA_TILE) ? c->columns - col0 : CPA_TILE;
+
+    if (job->reference) {
+      for (j = 0; j < width; j++) c->ref_x[col0 + j] = job->traces8[col0 + j];
+    }
+
+    memset(x, 0, quads * 4 * CPA_TILE);
+    memset(sx, 0, sizeof(sx));
+    memset(sxx, 0, sizeof(sxx));
+    for (j = 0; j < width; j++) r[j] = (int64_t)c->ref_x[col0 + j];
+
+    for (t = 0; t < job->count; t++) {
+      row = job->traces8 + t * job->stride + col0;
+      for (j = 0; j < width; j++) {
+        x[(t / 4) * 4 * CPA_TILE + 4 * j + t % 4] = row[j];
+        v = row[j] - r[j];
+        sx[j] += v;
+        sxx[j] += v * v;
+      }
+    }
+
+    for (j = 0; j < width; j++) {
+      c->sum_x[col0 + j] += (double)sx[j];
+      c->sum_xx[col0 + j] += (double)sxx[j];
+    }
+
+    for (k0 = 0; k0 < H; k0 += CPA_HYPOTHESES) {
+      kn = (H - k0 < CPA_HYPOTHESES) ? H - k0 : CPA_HYPOTHESES;
+
+      for (q0 = 0; q0 < quads; q0 += CPA_QUADS) {
+        qn = (quads - q0 < CPA_QUADS) ? quads - q0 : CPA_QUADS;
+        memset(acc, 0, CPA_HYPOTHESES * CPA_TILE * sizeof(int32_t));
+
+        dot_int8(x + q0 * 4 * CPA_TILE, job->h8 + q0 * H + k0, H, qn, kn, acc);
+
+        for (k = 0; k < kn; k++) {
+          double* out = c->sum_hx + (k0 + k) * c->columns + col0;
+          for (j = 0; j < width; j++) out[j] += acc[k][j];
+        }
+      }
+
+      for (k = 0; k < kn; k++) {
+        double* out = c->sum_hx + (k0 + k) * c->columns + col0;
+        for (j = 0; j < width; j++) out[j] -= (double)(r[j] * (int64_t)job->sh8[k0 + k]);
+      }
+    }
+  }
+
+done:
+  free(x);
+  free(acc);
+
+  return NULL;
+}
+
+
+/***
+ * cpa_add_int8
+ *
+ * as cpa_add(), for count int8 traces (the scope's codes less 128) and
+ * unsigned byte hypotheses, summed exactly in integers. The sums, and so
+ * the correlations, are those of the float path on the same values.
+ *
+ */
+int cpa_add_int8(cpa_t* c, const int8_t* traces, u64 stride, u64 count, const u8* h) {
+
+  pthread_t thread[CPA_MAX_THREADS];
+  cpa_job_t job;
+  u64 i, k, threads, tiles = (c->columns + CPA_TILE - 1) / CPA_TILE, quads = (count + 3) / 4, H = c->hypotheses;
+  u64 *sh, *shh;
+  u32* h8;
+
+  if (count == 0) return 0;
+
+  // four traces' bytes of a hypothesis to a word, missing traces zero
+  h8 = calloc(quads * H, sizeof(u32));
+  sh = calloc(H, sizeof(u64));
+  shh = calloc(H, sizeof(u64));
+  if (h8 == NULL || sh == NULL || shh == NULL) {
+    free(h8);
+    free(sh);
+    free(shh);
+    return -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    for (k = 0; k < H; k++) h8[(i / 4) * H + k] |= (u32)h[i * H + k] << (8 * (i % 4));
+  }
+
+  for (k = 0; k < H; k++) {
+    for (i = 0; i < count; i++) {
+      sh[k] += h[i * H + k];
+      shh[k] += (u64)h[i * H + k] * h[i * H + k];
+    }
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.c       = c;
+  job.stride  = stride;
+  job.count   = count;
+  job.traces8 = traces;
+  job.h8      = h8;
+  job.sh8     = sh;
+  job.reference = (c->traces == 0);
+
+  threads = (tiles < c->threads) ? tiles : c->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, cpa_worker_int8, &job) != 0) break;
+  }
+
+  if (i == 0) cpa_worker_int8(&job);
+  threads = i;
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  // as in cpa_add(), the batch counts only once every tile is summed
+  if (job.next >= tiles) {
+    for (k = 0; k < H; k++) {
+      c->sum_h[k] += (double)sh[k];
+      c->sum_hh[k] += (double)shh[k];
+    }
+    c->traces += count;
+  }
+
+  free(h8);
+  free(sh);
+  free(shh);
+
+  return (job.next >= tiles) ? 0 : -1;
+}
+
+
+/***
+ * cpa_merge
+ *
+ * add the sums of another engine over other traces, with the same
+ * hypotheses and columns. Its sums are about its own reference; with
+ * e = its reference less this one, x - r = (x - r') + e and
+ *
+ *   sum x  += sum' x + n' e
+ *   sum xx += sum' xx + 2 e sum' x + n' e^2
+ *   sum hx += sum' hx + e sum' h
+ *
+ * an engine without traces takes the other's reference as it is.
+ *
+ */
+int cpa_merge(cpa_t* c, const cpa_t* other) {
+
+  double n = (double)other->traces, e;
+  u64 i, k;
+
+  if (other->hypotheses != c->hypotheses || other->columns != c->columns) return -1;
+  if (other->traces == 0) return 0;
+
+  if (c->traces == 0) memcpy(c->ref_x, other->ref_x, c->columns * sizeof(double));
+
+  for (i = 0; i < c->hypotheses; i++) {
+    c->sum_h[i] += other->sum_h[i];
+    c->sum_hh[i] += other->sum_hh[i];
+  }
+
+  for (i = 0; i < c->columns; i++) {
+    e = other->ref_x[i] - c->ref_x[i];
+    c->sum_x[i] += other->sum_x[i] + n * e;
+    c->sum_xx[i] += other->sum_xx[i] + 2 * e * other->sum_x[i] + n * e * e;
+    for (k = 0; k < c->hypotheses; k++) {
+      c->sum_hx[k * c->columns + i] += other->sum_hx[k * c->columns + i] + e * other->sum_h[k];
+    }
+  }
+
+  c->traces += other->traces;
+
+  return 0;
+}
+
+
+/***
+ * cpa_write
+ *
+ * the sums as a checkpoint, to a file or a socket
+ *
+ */
+int cpa_write(const cpa_t* c, FILE* fp) {
+
+  u64 header[3] = { c->hypotheses, c->columns, c->traces };
+  u64 H = c->hypotheses, C = c->columns;
+
+  return (fwrite(CPA_MAGIC, 8, 1, fp) == 1 &&
+          fwrite(header, sizeof(header), 1, fp) == 1 &&
+          fwrite(c->ref_x, sizeof(double), C, fp) == C &&
+          fwrite(c->sum_h, sizeof(double), H, fp) == H &&
+          fwrite(c->sum_hh, sizeof(double), H, fp) == H &&
+          fwrite(c->sum_x, sizeof(double), C, fp) == C &&
+          fwrite(c->sum_xx, sizeof(double), C, fp) == C &&
+          fwrite(c->sum_hx, sizeof(double), H * C, fp) == H * C) ? 0 : -1;
+}
+
+
+/***
+ * cpa_read
+ *
+ * an engine with the sums of a checkpoint
+ *
+ */
+int cpa_read(cpa_t* c, FILE* fp, u64 threads) {
+
+  char magic[8];
+  u64 header[3], H, C;
+
+  memset(c, 0, sizeof(cpa_t));
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, CPA_MAGIC, 8) != 0 ||
+      fread(header, sizeof(header), 1, fp) != 1 || cpa_alloc(c, header[0], header[1], threads) < 0) return -1;
+
+  c->traces = header[2];
+  H = c->hypotheses;
+  C = c->columns;
+
+  if (fread(c->ref_x, sizeof(double), C, fp) != C ||
+      fread(c->sum_h, sizeof(double), H, fp) != H ||
+      fread(c->sum_hh, sizeof(double), H, fp) != H ||
+      fread(c->sum_x, sizeof(double), C, fp) != C ||
+      fread(c->sum_xx, sizeof(double), C, fp) != C ||
+      fread(c->sum_hx, sizeof(double), H * C, fp) != H * C) {
+    cpa_free(c);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * cpa_correlation
+ *
+ * correlation of a hypothesis with every column, zero where either does
+ * not vary
+ *
+ */
+void cpa_correlation(const cpa_t* c, u64 hypothesis, float* r) {
+
+  double n = (double)c->traces, sh = c->sum_h[hypothesis];
+  double vh = n * c->sum_hh[hypothesis] - sh * sh, vx;
+  const double* shx = c->sum_hx + hypothesis * c->columns;
+  u64 j;
+
+  for (j = 0; j < c->columns; j++) {
+    vx = n * c->sum_xx[j] - c->sum_x[j] * c->sum_x[j];
+    r[j] = (vh > 0 && vx > 0) ? (float)((n * shx[j] - sh * c->sum_x[j]) / sqrt(vh * vx)) : 0.0f;
+  }
+
+  return;
+}
+
+
+/***
+ * cpa_correlation_at
+ *
+ * correlation of a hypothesis with one column
+ *
+ */
+double cpa_correlation_at(const cpa_t* c, u64 hypothesis, u64 column) {
+
+  double n = (double)c->traces, sh = c->sum_h[hypothesis];
+  double vh = n * c->sum_hh[hypothesis] - sh * sh;
+  double vx = n * c->sum_xx[column] - c->sum_x[column] * c->sum_x[column];
+
+  if (!(vh > 0 && vx > 0)) return 0;
+
+  return (n * c->sum_hx[hypothesis * c->columns + column] - sh * c->sum_x[column]) / sqrt(vh * vx);
+}
+
+
+/***
+ * cpa_peak
+ *
+ * the largest absolute correlation of a hypothesis, signed, and its
+ * column
+ *
+ */
+double cpa_peak(const cpa_t* c, u64 hypothesis, u64* column) {
+
+  double n = (double)c->traces, sh = c->sum_h[hypothesis];
+  double vh = n * c->sum_hh[hypothesis] - sh * sh, vx, r, best = 0;
+  const double* shx = c->sum_hx + hypothesis * c->columns;
+  u64 j;
+
+  *column = 0;
+  if (!(vh > 0)) return 0;
+
+  for (j = 0; j < c->columns; j++) {
+    vx = n * c->sum_xx[j] - c->sum_x[j] * c->sum_x[j];
+    if (!(vx > 0)) continue;
+
+    r = (n * shx[j] - sh * c->sum_x[j]) / sqrt(vh * vx);
+    if (fabs(r) > fabs(best)) {
+      best = r;
+      *column = j;
+    }
+  }
+
+  return best;
+}
@@ -0,0 +1,95 @@
+/*
+ * cpa.h
+ *
+ * streaming correlation of many hypotheses with many trace columns
+ *
+ * the engine keeps the sums that Pearson's correlation needs, for every
+ * hypothesis h and column x: n, sum h, sum h^2, sum x, sum x^2 and
+ * sum h x, so the correlations are available after any number of traces.
+ * Columns are the samples of the traces, or whatever a column function
+ * makes of them (the centered products of preprocess.h): it is called
+ * per tile of CPA_TILE columns for a batch of traces, into a buffer the
+ * size of that tile, so derived columns are never stored for the whole
+ * trace.
+ *
+ * the sums of x are taken about a reference per column, the column of
+ * the first trace, so that the double sums do not cancel when a column
+ * sits far from zero (a scope's DC offset): the correlation does not
+ * change when a constant is taken off a column. Every batch is summed in
+ * double per tile and then added to the sums, tiles run on worker
+ * threads.
+ *
+ * traces of 8 bit scope codes can go through an integer path instead, a
+ * quarter of the memory traffic: int8 samples, unsigned byte hypotheses
+ * (the correlation does not change when a constant is added to signed
+ * ones) and exact int32 sums of products, four traces per 32 bit lane
+ * with AVX-512 VNNI when the compiler targets it, flushed to the double
+ * sums every CPA_QUADS quads of traces. Its references are codes, so on
+ * integer valued traces and hypotheses both paths hold the same exact
+ * sums.
+ *
+ * the sums of separate runs over parts of a trace set merge into those
+ * of the whole set by moving them to one reference and adding them up,
+ * and are written to and read from a stream as a checkpoint:
+ *
+ *   "TRVCPA02" hypotheses columns traces | ref_x | sum_h | sum_hh |
+ *   sum_x | sum_xx | sum_hx                  (u64, then doubles)
+ *
+ */
+
+#ifndef CPA_H
+#define CPA_H
+
+#include <stdio.h>
+
+#include "trivium.h"
+
+#define CPA_MAGIC        "TRVCPA02"
+#define CPA_TILE         32            // columns per work item
+#define CPA_HYPOTHESES   64            // hypotheses per pass over a tile
+#define CPA_MAX_THREADS  256
+#define CPA_QUADS        16384         // 4 traces each; 4 * 255 * 128 * CPA_QUADS < 2^31
+
+
+/***
+ * cpa_columns_fn
+ *
+ * columns col0..col0+width-1 of count traces (stride floats apart) into
+ * out[t * CPA_TILE + j]
+ *
+ */
+typedef void (*cpa_columns_fn)(const void* ctx, const float* traces, u64 stride, u64 count,
+                               u64 col0, u64 width, float* out);
+
+
+typedef struct {
+  u64     hypotheses;
+  u64     columns;
+  u64     traces;
+  u64     threads;
+  double* ref_x;                        // [columns], set by the first trace
+  double* sum_h;                        // [hypotheses]
+  double* sum_hh;                       // [hypotheses]
+  double* sum_x;                        // [columns], of x - ref_x
+  double* sum_xx;                       // [columns]
+  double* sum_hx;                       // [hypotheses][columns], of h (x - ref_x)
+} cpa_t;
+
+
+int  cpa_alloc(cpa_t* c, u64 hypotheses, u64 columns, u64 threads);
+void cpa_free(cpa_t* c);
+
+int  cpa_add(cpa_t* c, const float* traces, u64 stride, u64 count, const float* h,
+             cpa_columns_fn columns, const void* ctx);
+
+int  cpa_add_int8(cpa_t* c, const int8_t* traces, u64 stride, u64 count, const u8* h);
+
+int  cpa_merge(cpa_t* c, const cpa_t* other);
+int  cpa_write(const cpa_t* c, FILE* fp);
+int  cpa_read(cpa_t* c, FILE* fp, u64 threads);
+
+void cpa_correlation(const cpa_t* c, u64 hypothesis, float* r);
+double cpa_correlation_at(const cpa_t* c, u64 hypothesis, u64 column);
+double cpa_peak(const cpa_t* c, u64 hypothesis, u64* column);
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * cpa_attack.c
+ *
+ * correlation attack on t1 of the first clocks, first order on the
+ * samples or second order on centered products of sample pairs, or a
+ * mutual information attack on either
+ *
+ *  build : gcc -O3 -march=native -pthread -o cpa_attack cpa_attack.c cpa.c mia.c preprocess.c \
+ *                                    stochastic.c targets.c traces.c trivium_word.c -lm
+ *  run   : ./cpa_attack [-c first:last] [-w first:count] [-n traces] [-b traces] [-t threads]
+ *                       [-k key] [-2 distance | -P pairs] [-M estimator] [-B bins]
+ *                       [-W model] [-8 step:zero] archive
+ *
+ *   -c clocks    clocks to attack (default 0:65)
+ *   -w window    samples to look at (default all)
+ *   -n traces    use at most this many traces
+ *   -b traces    traces per pass of the engine (default 4096)
+ *   -t threads   worker threads (default: online cpus)
+ *   -k key       the key, to rank the right guess; by default the key of
+ *                the archive if every trace has the same one
+ *   -2 distance  second order: every pair of window samples at most this
+ *                far apart
+ *   -P pairs     second order on the pairs of a file, one "a b" per line,
+ *                samples counted from the start of the window
+ *   -M estimator mutual information instead of correlation, estimated
+ *                from histograms (hist) or kernel densities (kde)
+ *   -B bins      histogram bins per column (default 16 for hist, 32 for
+ *                kde)
+ *   -W model     a leakage model from leakage_profile: the part of every
+ *                sample it predicts from the iv alone is subtracted first
+ *   -8 scale     first order on the scope's 8 bit codes through the
+ *                integer engine (cpa_add_int8()): a sample is code
+ *                (sample - zero) / step of the ADC, zero the level of code
+ *                0 and step its increment (yorigin - yreference *
+ *                yincrement and yincrement of the preamble, 1:0 for
+ *                traces of codes). Samples off the 256 codes are clipped
+ *                and counted. The correlations are those of the float
+ *                path, to the bit on traces of codes
+ *
+ * every guess of every target is one hypothesis, its predicted t1 bit
+ * per trace (see dpa_attack.c for the targets that qualify). A guess is
+ * scored by its peak correlation in the direction of the leak, since a
+ * guess and its complement only differ in sign: positive first order (a
+ * set bit raises the sample), negative second order (shares of a clear
+ * bit are equal, so their centered product is positive). The second
+ * order attack takes a first pass over the traces for the sample means.
+ *
+ * mutual information needs no leakage model and no sign, but for the
+ * same reason cannot tell a guess from its complement: both split the
+ * traces into the same two classes. Their scores tie and the right
+ * guess is still counted as ranked first. The first batch sets the
+ * histogram bins, so it should not be small.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "cpa.h"
+#include "mia.h"
+#include "preprocess.h"
+#include "stochastic.h"
+#include "targets.h"
+#include "traces.h"
+#include "util.h"
+
+
+typedef struct {
+  target_t target;
+  u64      first;                       // first hypothesis
+  u16      mask[1 << TARGET_TAPS];
+} selection_t;
+
+
+typedef struct {
+  u32   first_clock, last_clock;
+  u64   window, samples;
+  u64   traces;
+  u64   batch;
+  u64   threads;
+  u64   distance;
+  const char* pairs;
+  const char* model;
+  int   second;
+  int   mia;
+  int   estimator;
+  u64   bins;
+  int   has_key;
+  u8    key[KEYLENGTH];
+  int   int8;
+  float step, zero;                     // of the ADC, for int8
+} options_t;
+
+
+/***
+ * model_t
+ *
+ * the weights of a leakage model for the regressors that do not depend
+ * on the key, by attacked sample (zero outside the profiled window)
+ *
+ */
+typedef struct {
+  u32    clock;
+  u64    used;
+  u16    regressor[STOCHASTIC_REGRESSORS];
+  float* weight;                        // [used][samples]
+} model_t;
+
+
+
+/**************
+ * Hypotheses *
+ **************/
+
+
+
+static u64 selections_init(const options_t* o, selection_t* sel, u64* hypotheses) {
+
+  u64 n = 0;
+  u32 c;
+
+  *hypotheses = 0;
+
+  for (c = o->first_clock; c <= o->last_clock; c++) {
+    target_init(&sel[n].target, TARGET_T1, c);
+    if (sel[n].target.guess_bits == 0 || !target_depends_on_iv(&sel[n].target)) continue;
+
+    target_masks(&sel[n].target, sel[n].mask);
+    sel[n].first = *hypotheses;
+    *hypotheses += (u64)1 << sel[n].target.guess_bits;
+    n++;
+  }
+
+  return n;
+}
+
+
+/***
+ * predict_batch
+ *
+ * h[t * hypotheses + k], the predicted bit of hypothesis k for trace t
+ *
+ */
+static void predict_batch(const selection_t* sel, u64 targets, u64 hypotheses,
+                          const trace_info_t* info, u64 count, float* h) {
+
+  u64 n, t, g;
+
+  for (t = 0; t < count; t++) {
+    float* out = h + t * hypotheses;
+
+    for (n = 0; n < targets; n++) {
+      u16 mask = sel[n].mask[target_iv_bits(&sel[n].target, info[t].iv)];
+      for (g = 0; g < ((u64)1 << sel[n].target.guess_bits); g++) out[sel[n].first + g] = (float)((mask >> g) & 0x01);
+    }
+  }
+
+  return;
+}
+
+
+/***
+ * quantize_batch
+ *
+ * the window of a batch as int8 codes on the scale of the ADC, the
+ * hypotheses as bytes; returns the number of clipped samples
+ *
+ */
+static u64 quantize_batch(const options_t* o, const float* traces, u64 stride, u64 count, int8_t* codes,
+                          const float* h, u8* h8, u64 hypotheses) {
+
+  const float* x;
+  u64 t, j, clipped = 0;
+  long v;
+
+  for (t = 0; t < count; t++) {
+    for (x = traces + t * stride + o->window, j = 0; j < o->samples; j++) {
+      v = lroundf((x[j] - o->zero) / o->step) - 128;
+      if (v < -128 || v > 127) {
+        v = (v < -128) ? -128 : 127;
+        clipped++;
+      }
+      codes[t * o->samples + j] = (int8_t)v;
+    }
+  }
+
+  for (t = 0; t < count * hypotheses; t++) h8[t] = (u8)h[t];
+
+  return clipped;
+}
+
+
+
+/*********
+ * Model *
+ *********/
+
+
+
+static int model_init(const options_t* o, model_t* model) {
+
+  const u64 P = STOCHASTIC_REGRESSORS;
+  stochastic_t s;
+  u8 known[STOCHASTIC_REGRESSORS];
+  u64 i, j, m;
+
+  memset(model, 0, sizeof(model_t));
+  if (stochastic_load(&s, o->model) < 0) return -1;
+
+  model->clock = s.clock;
+  stochastic_known(s.clock, known);
+
+  for (i = 0; i < P; i++) {
+    if (known[i]) model->regressor[model->used++] = (u16)i;
+  }
+
+  model->weight = calloc(model->used * o->samples, sizeof(float));
+  if (model->weight == NULL) {
+    printf("[ERROR] out of memory\n");
+    stochastic_free(&s);
+    return -1;
+  }
+
+  for (j = 0; j < o->samples; j++) {
+    if (o->window + j < s.window || (m = o->window + j - s.window) >= s.samples) continue;
+    for (i = 0; i < model->used; i++) model->weight[i * o->samples + j] = (float)s.weight[m * (P + 1) + model->regressor[i]];
+  }
+
+  stochastic_free(&s);
+
+  return 0;
+}
+
+
+/***
+ * model_subtract
+ *
+ * take the predicted leakage of the known regressors off the window of
+ * every trace
+ *
+ */
+static void model_subtract(const options_t* o, const model_t* model, const trace_info_t* info,
+                           float* traces, u64 stride, u64 count) {
+
+  static const u8 zero[KEYLENGTH] = { 0 };
+  u8 bits[STOCHASTIC_REGRESSORS];
+  u64 t, i, j;
+
+  for (t = 0; t < count; t++) {
+    float* x = traces + t * stride + o->window;
+
+    stochastic_bits(model->clock, zero, info[t].iv, bits);
+
+    for (i = 0; i < model->used; i++) {
+      const float* w = model->weight + i * o->samples;
+      if (bits[model->regressor[i]] == 0) continue;
+      for (j = 0; j < o->samples; j++) x[j] -= w[j];
+    }
+  }
+
+  return;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+/***
+ * sample_means
+ *
+ * the mean of every window sample, first pass of the second order attack
+ *
+ */
+static int sample_means(const options_t* o, const model_t* model, trace_archive_t* a, u64 count,
+                        float* traces, trace_info_t* info, float* mean) {
+
+  double* sum = calloc(o->samples, sizeof(double));
+  u64 i, n, t, j;
+
+  if (sum == NULL) return -1;
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+    if (trace_archive_read(a, i, n, traces, info) < 0) {
+      free(sum);
+      return -1;
+    }
+    if (o->model) model_subtract(o, model, info, traces, a->format.samples, n);
+
+    for (t = 0; t < n; t++) {
+      const float* x = traces + t * a->format.samples + o->window;
+      for (j = 0; j < o->samples; j++) sum[j] += x[j];
+    }
+  }
+
+  for (j = 0; j < o->samples; j++) mean[j] = (float)(sum[j] / (double)count);
+  free(sum);
+
+  return 0;
+}
+
+
+/***
+ * score
+ *
+ * the score of a hypothesis and the column it peaks at
+ *
+ */
+static double score(const options_t* o, const cpa_t* c, const mia_t* m, u64 k, u64* column) {
+
+  if (o->mia) return mia_peak(m, k, o->estimator, column);
+
+  return (o->second ? -1.0 : 1.0) * cpa_peak(c, k, column);
+}
+
+
+static void report(const options_t* o, const cpa_t* c, const mia_t* m, const pairs_t* pairs,
+                   const selection_t* sel, u64 targets) {
+
+  u64 n, g, column, best_column = 0, ranked_first = 0, flat = 0;
+
+  printf("%lu traces, %lu hypotheses, %lu %s\n", o->mia ? m->traces : c->traces, sel[targets - 1].first +
+         ((u64)1 << sel[targets - 1].target.guess_bits), o->mia ? m->columns : c->columns,
+         o->second ? "sample pairs" : "samples");
+  printf("target  clock  bits  best  %-11s  %-13s %s\n", o->mia ? "information" : "correlation",
+         o->second ? "pair" : "sample", o->has_key ? "right  rank" : "");
+
+  for (n = 0; n < targets; n++) {
+    const target_t* t = &sel[n].target;
+    u64 guesses = (u64)1 << t->guess_bits, best = 0, rank = 1, correct;
+    double value[1 << TARGET_GUESS];
+    char where[32];
+    int zero = 1;
+
+    for (g = 0; g < guesses; g++) {
+      value[g] = score(o, c, m, sel[n].first + g, &column);
+      zero = zero && value[g] == 0;
+      if (g == 0 || value[g] > value[best]) {
+        best = g;
+        best_column = column;
+      }
+    }
+
+    if (o->second) {
+      snprintf(where, sizeof(where), "%lu,%lu", o->window + pairs->a[best_column], o->window + pairs->b[best_column]);
+    } else {
+      snprintf(where, sizeof(where), "%lu", o->window + best_column);
+    }
+
+    printf("t1      %5u  %4u  %4lu  %11.4f  %-13s", t->clock, t->guess_bits, best, value[best], where);
+
+    if (o->has_key && zero) {
+      // nothing to rank by
+      flat++;
+      printf(" %5lu  %4s", target_guess(t, o->key), "-");
+    } else if (o->has_key) {
+      correct = target_guess(t, o->key);
+      // complements tie under mutual information, up to rounding
+      for (g = 0; g < guesses; g++) rank += (value[g] > value[correct] * (1 + 1e-9));
+      ranked_first += (rank == 1);
+      printf(" %5lu  %4lu", correct, rank);
+    }
+
+    printf("\n");
+  }
+
+  if (flat > 0) printf("[ERROR] every guess of %lu targets scores 0, they are not ranked\n", flat);
+  if (o->has_key) printf("right guess ranked first for %lu of %lu targets\n", ranked_first, targets);
+
+  return;
+}
+
+
+static int attack(options_t* o, const char* path) {
+
+  trace_archive_t a;
+  selection_t sel[TARGET_CLOCKS];
+  pairs_t pairs;
+  cpa_t c;
+  mia_t m;
+  model_t model;
+  trace_info_t* info = NULL;
+  float *traces = NULL, *h = NULL;
+  int8_t* codes = NULL;
+  u8* h8 = NULL;
+  u64 targets, hypotheses, columns, i, n, count, t, clipped = 0;
+  double start = now(), engine = 0, t0;
+  int result = 1, same_key = 1;
+
+  memset(&pairs, 0, sizeof(pairs));
+  memset(&c, 0, sizeof(c));
+  memset(&m, 0, sizeof(m));
+  memset(&model, 0, sizeof(model));
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+  if (o->window >= a.format.samples) {
+    printf("[ERROR] the traces have %lu samples\n", a.format.samples);
+    goto done;
+  }
+  if (o->samples == 0 || o->window + o->samples > a.format.samples) o->samples = a.format.samples - o->window;
+
+  if (o->mia && (o->batch < MIA_FIRST_TRACES || count < MIA_FIRST_TRACES)) {
+    printf("[ERROR] mutual information sets its bins on a first batch of at least %d traces\n", MIA_FIRST_TRACES);
+    goto done;
+  }
+
+  targets = selections_init(o, sel, &hypotheses);
+  if (targets == 0) {
+    printf("[ERROR] t1 does not depend on both key and iv in these clocks\n");
+    goto done;
+  }
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info   = malloc(o->batch * sizeof(trace_info_t));
+  h      = malloc(o->batch * hypotheses * sizeof(float));
+
+  if (o->int8) {
+    codes = malloc(o->batch * o->samples);
+    h8 = malloc(o->batch * hypotheses);
+  }
+
+  if (traces == NULL || info == NULL || h == NULL || (o->int8 && (codes == NULL || h8 == NULL))) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (o->model && model_init(o, &model) < 0) goto done;
+
+  if (o->second) {
+    if ((o->pairs ? pairs_read(&pairs, o->samples, o->pairs) : pairs_window(&pairs, o->samples, o->distance)) < 0) goto done;
+    if (sample_means(o, &model, &a, count, traces, info, pairs.mean) < 0) goto done;
+  }
+
+  columns = o->second ? pairs.pairs : o->samples;
+  if ((o->mia ? mia_alloc(&m, hypotheses, 2, columns, o->bins, o->threads) : cpa_alloc(&c, hypotheses, columns, o->threads)) < 0) {
+    printf("[ERROR] out of memory for %lu hypotheses x %lu columns\n", hypotheses, columns);
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+    if (o->model) model_subtract(o, &model, info, traces, a.format.samples, n);
+
+    if (!o->has_key) {
+      if (i == 0) memcpy(o->key, info[0].key, KEYLENGTH);
+      for (t = 0; t < n && same_key; t++) same_key = (memcmp(info[t].key, o->key, KEYLENGTH) == 0);
+    }
+
+    predict_batch(sel, targets, hypotheses, info, n, h);
+
+    if (o->int8) clipped += quantize_batch(o, traces, a.format.samples, n, codes, h, h8, hypotheses);
+
+    t0 = now();
+    if ((o->int8 ? cpa_add_int8(&c, codes, o->samples, n, h8)
+       : o->mia  ? mia_add(&m, traces + o->window, a.format.samples, n, h, o->second ? pairs_columns : NULL, &pairs)
+                 : cpa_add(&c, traces + o->window, a.format.samples, n, h, o->second ? pairs_columns : NULL, &pairs)) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+    engine += now() - t0;
+  }
+
+  o->has_key = o->has_key || same_key;
+  if (clipped > 0) printf("[WARNING] %lu samples off the ADC's codes were clipped\n", clipped);
+  report(o, &c, &m, &pairs, sel, targets);
+  printf("%.3f s, %.3f s in the engine (%lu threads)\n", now() - start, engine, o->mia ? m.threads : c.threads);
+
+  result = 0;
+
+done:
+  cpa_free(&c);
+  mia_free(&m);
+  free(model.weight);
+  pairs_free(&pairs);
+  free(traces);
+  free(info);
+  free(h);
+  free(codes);
+  free(h8);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c first:last] [-w first:count] [-n traces] [-b traces] [-t threads]\n"
+         "       %*s [-k key] [-2 distance | -P pairs] [-M estimator] [-B bins]\n"
+         "       %*s [-W model] [-8 step:zero] archive\n", name, (int)strlen(name), "", (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u64 a, b;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.last_clock = TARGET_CLOCKS - 1;
+  o.batch = 4096;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "c:w:n:b:t:k:2:P:M:B:W:8:")) != -1) {
+    switch (option) {
+    case 'n': o.traces   = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch    = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads  = strtoul(optarg, NULL, 10);  break;
+    case '2': o.distance = strtoul(optarg, NULL, 10);  o.second = 1;  break;
+    case 'P': o.pairs    = optarg;                     o.second = 1;  break;
+    case 'B': o.bins     = strtoul(optarg, NULL, 10);  break;
+    case 'W': o.model    = optarg;                     break;
+    case '8':
+      if (sscanf(optarg, "%f:%f", &o.step, &o.zero) != 2 || !(o.step > 0)) {
+        printf("[ERROR] the scale is step:zero of the ADC, step positive\n");
+        return 2;
+      }
+      o.int8 = 1;
+      break;
+    case 'M':
+      if (mia_estimator_parse(optarg, &o.estimator) < 0) {
+        printf("[ERROR] unknown estimator %s, hist or kde\n", optarg);
+        return 2;
+      }
+      o.mia = 1;
+      break;
+    case 'c':
+      if (parse_range(optarg, &a, &b) < 0 || a > b || b >= TARGET_CLOCKS) {
+        printf("[ERROR] clocks must be within 0:%d\n", TARGET_CLOCKS - 1);
+        return 2;
+      }
+      o.first_clock = (u32)a;
+      o.last_clock = (u32)b;
+      break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 1 || o.batch == 0 || o.threads == 0 || (o.int8 && (o.second || o.mia))) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (o.bins == 0) o.bins = (o.estimator == MIA_KDE) ? 32 : 16;
+  if (o.bins < 2 || o.bins > MIA_MAX_BINS) {
+    printf("[ERROR] bins must be within 2..%d\n", MIA_MAX_BINS);
+    return 2;
+  }
+
+  return attack(&o, argv[optind]);
+}
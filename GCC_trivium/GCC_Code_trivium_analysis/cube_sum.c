@@ -0,0 +1,422 @@
+/*
+ * cube_sum.c
+ *
+ * cube sums of the first keystream bit of (reduced round) trivium: for
+ * every key, the xor of the first keystream bit over all 2^d assignments
+ * of the cube iv bits, i.e. one evaluation of the cube's superpoly
+ *
+ *  build : gcc -O3 -march=native -pthread -o cube_sum cube_sum.c trivium_word.c trivium_slice.c -lm
+ *  run   : ./cube_sum [-r rounds] [-w 64|256] [-t threads] [-k keys | -n count] [-s seed]
+ *                     [-i iv] [-c] cube
+ *
+ *   cube         comma separated iv bit indices, iv bit j is loaded into
+ *                s(94 + j), 0 <= j < 80, at most 60 of them
+ *   -r rounds    initialization rounds before the summed bit (default 1152)
+ *   -w lanes     bitsliced instances per clock, 64 or 256 (default 256)
+ *   -t threads   worker threads (default: online cpus)
+ *   -k keys      keys to evaluate, keys.txt format
+ *   -n count     number of random keys instead (default 16)
+ *   -s seed      seed of the random keys
+ *   -i iv        value of the non cube iv bits, file order hex (default 0)
+ *   -c           check every sum against the word oriented core (one iv
+ *                at a time, so only for small cubes)
+ *
+ * the first log2(lanes) cube bits are spread over the lanes, the rest
+ * are enumerated block by block. Every block is loaded and initialized
+ * from scratch, the iv bits take part from the first clocks on so no
+ * clocking is shared between blocks; the gray code order only means one
+ * state word changes from one block's load to the next. Blocks are
+ * handed out to the threads in chunks.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trivium.h"
+#include "util.h"
+
+#define IV_BITS      (8 * IVLENGTH)
+#define MAX_CUBE     60
+#define MAX_THREADS  256
+#define CHUNK_BLOCKS 1024
+
+#define LINE_MAX_LENGTH 256
+
+
+typedef struct {
+  u64  rounds;
+  u64  lanes;
+  u64  lane_bits;           // log2(lanes)
+  u64  d;
+  u64  cube[MAX_CUBE];      // iv bit indices
+  u8   iv[IVLENGTH];        // non cube iv bits
+  u64  keys;
+  u8 (*key)[KEYLENGTH];
+  u64  blocks;              // 2^(d - lane cube bits)
+  u64  chunks;              // work items per key
+  u64  next;                // next work item, shared by the workers
+  u8*  sum;                 // superpoly value per key
+} cube_t;
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+/***
+ * iv_bit_flip
+ *
+ * flip iv bit j (the one loaded into s(94 + j)) of a file order iv
+ *
+ */
+static void iv_bit_flip(u8* iv, u64 j) {
+  iv[IVLENGTH - 1 - j / 8] ^= (u8)(0x80 >> (j % 8));
+}
+
+
+
+/**********
+ * Engine *
+ **********/
+
+
+
+/***
+ * CUBE_WORKER
+ *
+ * worker thread for one lane width. Each work item is a range of gray
+ * code blocks of one key; its partial sum is xored into the key's sum.
+ *
+ */
+#define CUBE_WORKER(name, slice, lane_t)                                               \
+                                                                                       \
+  static void* name(void* arg) {                                                       \
+                                                                                       \
+    cube_t* job = arg;                                                                 \
+    slice##_t s;                                                                       \
+    trivium_word_t w;                                                                  \
+    u8 bits[STATEBITS];                                                                \
+    lane_t words[STATEBITS], acc, z, valid, zero = { 0 };                              \
+    u64 item, key, first, last, i, j, l, lane_cube, parity;                            \
+                                                                                       \
+    lane_cube = (job->d < job->lane_bits) ? job->d : job->lane_bits;                   \
+                                                                                       \
+    /* lanes beyond 2^d repeat assignments and are left out of the sum */             \
+    valid = zero;                                                                      \
+    for (l = 0; l < job->lanes && l < ((u64)1 << lane_cube); l++) {                    \
+      valid[l / 64] |= (u64)1 << (l % 64);                                             \
+    }                                                                                  \
+                                                                                       \
+    while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->keys * job->chunks) { \
+      key   = item / job->chunks;                                                      \
+      first = (item % job->chunks) * CHUNK_BLOCKS;                                     \
+      last  = first + CHUNK_BLOCKS;                                                    \
+      if (last > job->blocks) last = job->blocks;                                      \
+                                                                                       \
+      trivium_word_load(&w, job->key[key], job->iv);                                   \
+      trivium_word_bits(&w, bits);                                                     \
+      for (i = 0; i < STATEBITS; i++) words[i] = bits[i] ? ~zero : zero;               \
+                                                                                       \
+      /* cube bits: lane index bits first, then the gray code of the block */          \
+      for (j = 0; j < job->d; j++) words[ALEN + job->cube[j]] = zero;                  \
+                                                                                       \
+      for (j = 0; j < lane_cube; j++) {                                                \
+        for (l = 0; l < job->lanes; l++) {                                             \
+          if ((l >> j) & 0x01) words[ALEN + job->cube[j]][l / 64] |= (u64)1 << (l % 64); \
+        }                                                                              \
+      }                                                                                \
+                                                                                       \
+      for (j = 0; j < job->d - lane_cube; j++) {                                       \
+        if (((first ^ (first >> 1)) >> j) & 0x01) words[ALEN + job->cube[lane_cube + j]] = ~zero; \
+      }                                                                                \
+                                                                                       \
+      acc = zero;                                                                      \
+                                                                                       \
+      for (i = first; i < last; i++) {                                                 \
+        /* gray(i) = gray(i - 1) ^ (1 << ctz(i)) */                                    \
+        if (i > first) {                                                               \
+          j = lane_cube + (u64)__builtin_ctzll(i);                                     \
+          words[ALEN + job->cube[j]] ^= ~zero;                                         \
+        }                                                                              \
+                                                                                       \
+        slice##_load(&s, words);                                                       \
+        slice##_run(&s, job->rounds, NULL);                                            \
+        slice##_run(&s, 1, &z);                                                        \
+        acc ^= z;                                                                      \
+      }                                                                                \
+                                                                                       \
+      acc &= valid;                                                                    \
+      parity = 0;                                                                      \
+      for (l = 0; l < LANE_WORDS(lane_t); l++) parity ^= (u64)__builtin_parityll(acc[l]); \
+                                                                                       \
+      __atomic_fetch_xor(&job->sum[key], (u8)parity, __ATOMIC_RELAXED);                \
+    }                                                                                  \
+                                                                                       \
+    return NULL;                                                                       \
+  }
+
+CUBE_WORKER(worker64,  trivium_slice64,  lane64_t)
+CUBE_WORKER(worker256, trivium_slice256, lane256_t)
+
+
+/***
+ * cube_run
+ *
+ * evaluate the superpoly for every key of the job
+ *
+ */
+static int cube_run(cube_t* job, u64 threads) {
+
+  pthread_t thread[MAX_THREADS];
+  void* (*worker)(void*) = (job->lanes == 64) ? worker64 : worker256;
+  u64 i;
+
+  job->lane_bits = (job->lanes == 64) ? 6 : 8;
+  job->blocks = (job->d > job->lane_bits) ? (u64)1 << (job->d - job->lane_bits) : 1;
+  job->chunks = (job->blocks + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+  job->next = 0;
+  memset(job->sum, 0, job->keys);
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, worker, job) != 0) {
+      printf("[ERROR] could not start worker thread\n");
+      return -1;
+    }
+  }
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  return 0;
+}
+
+
+/***
+ * cube_check
+ *
+ * the same sum, one iv at a time with the word oriented core
+ *
+ */
+static u8 cube_check(const cube_t* job, u64 key) {
+
+  trivium_word_t s;
+  u8 iv[IVLENGTH];
+  u64 i, j, sum = 0;
+
+  for (i = 0; i < ((u64)1 << job->d); i++) {
+    memcpy(iv, job->iv, IVLENGTH);
+
+    for (j = 0; j < job->d; j++) {
+      u64 set = (job->iv[IVLENGTH - 1 - job->cube[j] / 8] >> (7 - job->cube[j] % 8)) & 0x01;
+      if (set ^ ((i >> j) & 0x01)) iv_bit_flip(iv, job->cube[j]);
+    }
+
+    trivium_word_load(&s, job->key[key], iv);
+    trivium_word_rounds(&s, job->rounds);
+    sum ^= trivium_word_step(&s, 1);
+  }
+
+  return (u8)sum;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+/***
+ * parse_cube
+ *
+ * comma separated list of distinct iv bit indices
+ *
+ */
+static int parse_cube(const char* text, cube_t* job) {
+
+  char* end;
+  u64 j, index;
+
+  job->d = 0;
+
+  while (*text) {
+    index = strtoul(text, &end, 10);
+    if (end == text || index >= IV_BITS || job->d == MAX_CUBE) return -1;
+
+    for (j = 0; j < job->d; j++) {
+      if (job->cube[j] == index) return -1;
+    }
+
+    job->cube[job->d++] = index;
+
+    text = end;
+    if (*text == ',') text++;
+    else if (*text != 0) return -1;
+  }
+
+  return job->d > 0 ? 0 : -1;
+}
+
+
+/***
+ * read_keys
+ *
+ * load every key of a keys.txt style file
+ *
+ */
+static int read_keys(const char* path, cube_t* job) {
+
+  FILE* fp = fopen(path, "r");
+  char buffer[LINE_MAX_LENGTH];
+  u8 (*grown)[KEYLENGTH];
+  u64 capacity = 0;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  job->keys = 0;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (buffer[0] == '\n' || buffer[0] == '\r') continue;
+
+    if (job->keys == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      grown = realloc(job->key, capacity * KEYLENGTH);
+      if (grown == NULL) {
+        printf("[ERROR] out of memory for the keys of %s\n", path);
+        fclose(fp);
+        return -1;
+      }
+      job->key = grown;
+    }
+
+    if (parse_bytes(buffer, job->key[job->keys], KEYLENGTH) < 0) {
+      printf("[ERROR] %s: malformed key on line %lu\n", path, job->keys + 1);
+      fclose(fp);
+      return -1;
+    }
+
+    job->keys++;
+  }
+
+  fclose(fp);
+
+  if (job->keys == 0) {
+    printf("[ERROR] no keys in %s\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-r rounds] [-w 64|256] [-t threads] [-k keys | -n count] [-s seed] [-i iv] [-c] cube\n", name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  cube_t job;
+  const char* keys_path = NULL;
+  u64 threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  u64 count = 16, seed = 0, i, j, mismatches = 0;
+  int check = 0, option;
+  double start, seconds;
+
+  memset(&job, 0, sizeof(job));
+  job.rounds = INIT_ROUNDS;
+  job.lanes = 256;
+
+  while ((option = getopt(argc, argv, "r:w:t:k:n:s:i:c")) != -1) {
+    switch (option) {
+    case 'r': job.rounds = strtoul(optarg, NULL, 10); break;
+    case 'w': job.lanes  = strtoul(optarg, NULL, 10); break;
+    case 't': threads    = strtoul(optarg, NULL, 10); break;
+    case 'k': keys_path  = optarg;                    break;
+    case 'n': count      = strtoul(optarg, NULL, 10); break;
+    case 's': seed       = strtoul(optarg, NULL, 0);  break;
+    case 'c': check      = 1;                         break;
+    case 'i':
+      if (strlen(optarg) != 2 * IVLENGTH || parse_bytes(optarg, job.iv, IVLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 1 || parse_cube(argv[optind], &job) < 0 ||
+      (job.lanes != 64 && job.lanes != 256) || threads == 0 || threads > MAX_THREADS || count == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (keys_path != NULL) {
+    if (read_keys(keys_path, &job) < 0) return 1;
+  } else {
+    job.keys = count;
+    job.key = malloc(count * KEYLENGTH);
+    if (job.key == NULL) {
+      printf("[ERROR] out of memory\n");
+      return 1;
+    }
+    for (i = 0; i < count; i++) {
+      for (j = 0; j < KEYLENGTH; j++) job.key[i][j] = (u8)splitmix64(&seed);
+    }
+  }
+
+  job.sum = malloc(job.keys);
+  if (job.sum == NULL) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  start = now();
+  if (cube_run(&job, threads) < 0) return 1;
+  seconds = now() - start;
+
+  for (i = 0; i < job.keys; i++) {
+    for (j = 0; j < KEYLENGTH; j++) printf("%02X", job.key[i][j]);
+    printf(" %u", job.sum[i]);
+
+    if (check) {
+      u8 expected = cube_check(&job, i);
+      if (expected != job.sum[i]) {
+        printf("  [ERROR] word core gives %u", expected);
+        mismatches++;
+      }
+    }
+
+    printf("\n");
+  }
+
+  printf("%lu keys, cube of %lu, %lu rounds, %lu lanes, %lu threads: %.3f s, "
+         "%.1f superpoly evaluations/s, %.3g ivs/s\n",
+         job.keys, job.d, job.rounds, job.lanes, threads, seconds,
+         job.keys / seconds, job.keys * ldexp(1.0, (int)job.d) / seconds);
+
+  if (check) printf("[%s] %lu mismatches against the word core\n", mismatches ? "ERROR" : "SUCCESS", mismatches);
+
+  free(job.key);
+  free(job.sum);
+
+  return mismatches ? 1 : 0;
+}
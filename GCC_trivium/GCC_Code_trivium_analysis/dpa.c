@@ -0,0 +1,207 @@
+/*
+ * dpa.c
+ *
+ * difference of means for many selection functions (see dpa.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dpa.h"
+
+
+typedef struct {
+  dpa_t*       d;
+  const float* traces;
+  u64          stride;                  // of the traces
+  u64          count;
+  u64          bytes;                   // selection bytes per function
+  const u8*    select;
+  u64          next;                    // next tile, shared by the workers
+} dpa_job_t;
+
+
+int dpa_alloc(dpa_t* d, u64 functions, u64 samples, u64 threads) {
+
+  memset(d, 0, sizeof(dpa_t));
+
+  if (functions == 0 || samples == 0) return -1;
+
+  d->functions = functions;
+  d->samples   = samples;
+  d->stride    = (samples + DPA_TILE - 1) / DPA_TILE * DPA_TILE;
+  d->threads   = (threads == 0) ? 1 : (threads > DPA_MAX_THREADS ? DPA_MAX_THREADS : threads);
+  d->ones      = calloc(functions, sizeof(u64));
+  d->reference = calloc(d->stride, sizeof(float));
+  d->sum       = calloc(functions * d->stride, sizeof(double));
+  d->total     = calloc(d->stride, sizeof(double));
+
+  if (d->ones == NULL || d->reference == NULL || d->sum == NULL || d->total == NULL) {
+    dpa_free(d);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void dpa_free(dpa_t* d) {
+
+  free(d->ones);
+  free(d->reference);
+  free(d->sum);
+  free(d->total);
+  memset(d, 0, sizeof(dpa_t));
+
+  return;
+}
+
+
+/***
+ * dpa_worker
+ *
+ * whole tiles of samples: for every 8 traces the 256 subset sums of the
+ * tile, then one lookup per function. The batch is summed in float, less
+ * the reference, and added to the double sums at the end. A worker that cannot allocate its
+ * tables leaves the tiles to the others.
+ *
+ */
+static void* dpa_worker(void* arg) {
+
+  dpa_job_t* job = arg;
+  dpa_t* d = job->d;
+  float (*table)[DPA_TILE] = aligned_alloc(64, 256 * DPA_TILE * sizeof(float));
+  float (*acc)[DPA_TILE] = aligned_alloc(64, d->functions * DPA_TILE * sizeof(float));
+  float total[DPA_TILE];
+  u64 tile, tiles = d->stride / DPA_TILE, j0, width, g, f, l, i, j;
+
+  if (table == NULL || acc == NULL) goto done;
+
+  while ((tile = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < tiles) {
+    j0 = tile * DPA_TILE;
+    width = (d->samples - j0 < DPA_TILE) ? d->samples - j0 : DPA_TILE;
+
+    memset(acc, 0, d->functions * DPA_TILE * sizeof(float));
+    memset(total, 0, sizeof(total));
+
+    for (g = 0; g < job->bytes; g++) {
+      // subset sums of the 8 traces, table[i] adding the lowest trace of i
+      // to table[i without it]
+      memset(table[0], 0, sizeof(table[0]));
+
+      for (l = 0; l < 8; l++) {
+        float* row = table[(u64)1 << l];
+        u64 t = 8 * g + l;
+
+        memset(row, 0, sizeof(table[0]));
+        if (t < job->count) {
+          const float* x = job->traces + t * job->stride + j0;
+          for (j = 0; j < width; j++) row[j] = x[j] - d->reference[j0 + j];
+        }
+      }
+
+      for (i = 3; i < 256; i++) {
+        const float* low = table[i & (0 - i)];
+        const float* rest = table[i & (i - 1)];
+
+        if ((i & (i - 1)) == 0) continue;
+        for (j = 0; j < DPA_TILE; j++) table[i][j] = rest[j] + low[j];
+      }
+
+      for (j = 0; j < DPA_TILE; j++) total[j] += table[255][j];
+
+      for (f = 0; f < d->functions; f++) {
+        u8 b = job->select[f * job->bytes + g];
+        const float* s = table[b];
+        float* a = acc[f];
+
+        if (b == 0) continue;
+        for (j = 0; j < DPA_TILE; j++) a[j] += s[j];
+      }
+    }
+
+    for (f = 0; f < d->functions; f++) {
+      double* sum = d->sum + f * d->stride + j0;
+      for (j = 0; j < DPA_TILE; j++) sum[j] += acc[f][j];
+    }
+
+    for (j = 0; j < DPA_TILE; j++) d->total[j0 + j] += total[j];
+  }
+
+done:
+  free(table);
+  free(acc);
+
+  return NULL;
+}
+
+
+/***
+ * dpa_add
+ *
+ * count traces of d->samples samples, stride floats apart, and for every
+ * function its selection of them: select[f * bytes + t / 8] bit t % 8
+ * for trace t, bytes = (count + 7) / 8. Bits past count must be zero.
+ *
+ */
+int dpa_add(dpa_t* d, const float* traces, u64 stride, u64 count, const u8* select) {
+
+  pthread_t thread[DPA_MAX_THREADS];
+  dpa_job_t job;
+  u64 i, threads, tiles = d->stride / DPA_TILE;
+
+  if (count == 0) return 0;
+
+  memset(&job, 0, sizeof(job));
+  job.d      = d;
+  job.traces = traces;
+  job.stride = stride;
+  job.count  = count;
+  job.bytes  = (count + 7) / 8;
+  job.select = select;
+
+  if (d->traces == 0) memcpy(d->reference, traces, d->samples * sizeof(float));
+
+  threads = (tiles < d->threads) ? tiles : d->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, dpa_worker, &job) != 0) break;
+  }
+
+  if (i == 0) dpa_worker(&job);
+  threads = i;
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  // every tile was taken unless no worker could start, then nothing was added
+  if (job.next < tiles) return -1;
+
+  for (i = 0; i < d->functions * job.bytes; i++) d->ones[i / job.bytes] += (u64)__builtin_popcount(select[i]);
+  d->traces += count;
+
+  return 0;
+}
+
+
+/***
+ * dpa_difference
+ *
+ * mean of the selected traces minus mean of the others; zero while
+ * either side is empty
+ *
+ */
+void dpa_difference(const dpa_t* d, u64 function, float* out) {
+
+  const double* sum = d->sum + function * d->stride;
+  u64 ones = d->ones[function], zeros = d->traces - ones, j;
+
+  for (j = 0; j < d->samples; j++) {
+    out[j] = (ones == 0 || zeros == 0) ? 0.0f :
+             (float)(sum[j] / (double)ones - (d->total[j] - sum[j]) / (double)zeros);
+  }
+
+  return;
+}
@@ -0,0 +1,47 @@
+/*
+ * dpa.h
+ *
+ * difference of means for many selection functions in one pass
+ *
+ * a selection function splits the traces in two by a predicted bit; the
+ * engine keeps, per function, the sum of the traces it selects and
+ * their number, so the difference of means is available at any time.
+ * Selections are given bit packed, one byte per 8 traces, and every
+ * byte is applied with one lookup in the 256 subset sums of its 8
+ * traces, computed once per tile of DPA_TILE samples for all functions.
+ *
+ * the sums are of the traces less the first one, so a DC offset does not
+ * eat the precision of the float batch sums; the difference of means is
+ * the same either way.
+ *
+ */
+
+#ifndef DPA_H
+#define DPA_H
+
+#include "trivium.h"
+
+#define DPA_TILE         32            // samples per work item
+#define DPA_MAX_THREADS  256
+
+
+typedef struct {
+  u64     functions;
+  u64     samples;
+  u64     stride;                       // samples rounded up to DPA_TILE
+  u64     traces;
+  u64     threads;
+  u64*    ones;                         // traces selected, per function
+  float*  reference;                    // [stride], the first trace
+  double* sum;                          // [functions][stride] of the selected traces
+  double* total;                        // [stride] of all traces
+} dpa_t;
+
+
+int  dpa_alloc(dpa_t* d, u64 functions, u64 samples, u64 threads);
+void dpa_free(dpa_t* d);
+
+int  dpa_add(dpa_t* d, const float* traces, u64 stride, u64 count, const u8* select);
+void dpa_difference(const dpa_t* d, u64 function, float* out);
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * dpa_attack.c
+ *
+ * difference of means attack on the targets of the first clocks, every
+ * guess of every target in one pass over a trace archive
+ *
+ *  build : gcc -O3 -march=native -pthread -o dpa_attack dpa_attack.c dpa.c targets.c traces.c -lm
+ *  run   : ./dpa_attack [-T targets] [-c first:last] [-w first:count] [-n traces] [-b traces]
+ *                       [-t threads] [-k key] [-a] [-o differences] archive
+ *
+ *   -T targets   comma separated targets of targets.h (default t1)
+ *   -c clocks    clocks to attack (default 0:65)
+ *   -w window    samples to look at (default all)
+ *   -n traces    use at most this many traces
+ *   -b traces    traces per pass of the engine (default 4096)
+ *   -t threads   worker threads (default: online cpus)
+ *   -k key       the key, to rank the right guess; by default the key of
+ *                the archive if every trace has the same one
+ *   -a           rank guesses by the largest absolute difference instead
+ *                of the largest positive one
+ *   -o file      write every difference of means trace as float32
+ *
+ * a target has to depend on both the key and the iv to split the traces
+ * differently per guess; in the first clocks only t1 does (the key sits
+ * in the first register, the iv in the second), the others are skipped.
+ * The and1 term can still be attacked as part of t1, whose guesses
+ * cover its two key bits.
+ *
+ * a guess is scored by the peak of its difference of means. Guesses that
+ * only differ in key bits the target is linear in split the traces the
+ * same way with the two halves swapped, so only the signed peak (a one
+ * drawing more current) tells them apart. Guesses that split the traces
+ * identically tie, and the right guess is ranked first among its ties.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "dpa.h"
+#include "targets.h"
+#include "traces.h"
+#include "util.h"
+
+#define MAX_TARGETS (TARGET_KINDS * TARGET_CLOCKS)
+
+
+typedef struct {
+  target_t target;
+  u64      first;                       // first selection function
+  u16      mask[1 << TARGET_TAPS];      // value of every guess, per iv taps
+} selection_t;
+
+
+typedef struct {
+  u64   kinds;                          // bit per TARGET_* kind
+  u32   first_clock, last_clock;
+  u64   window, samples;
+  u64   traces;
+  u64   batch;
+  u64   threads;
+  int   absolute;
+  int   has_key;
+  u8    key[KEYLENGTH];
+  const char* output;
+} options_t;
+
+
+
+/**************
+ * Selections *
+ **************/
+
+
+
+/***
+ * selections_init
+ *
+ * every target asked for that depends on the key and the iv, with its
+ * guesses numbered consecutively
+ *
+ */
+static u64 selections_init(const options_t* o, selection_t* sel, u64* functions) {
+
+  u64 n = 0;
+  u32 kind, c;
+
+  *functions = 0;
+
+  for (kind = 0; kind < TARGET_KINDS; kind++) {
+    if (!((o->kinds >> kind) & 0x01)) continue;
+
+    for (c = o->first_clock; c <= o->last_clock; c++) {
+      target_init(&sel[n].target, kind, c);
+      if (sel[n].target.guess_bits == 0 || !target_depends_on_iv(&sel[n].target)) continue;
+
+      target_masks(&sel[n].target, sel[n].mask);
+
+      sel[n].first = *functions;
+      *functions += (u64)1 << sel[n].target.guess_bits;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+
+/***
+ * select_batch
+ *
+ * the bit packed selections of a batch of traces
+ *
+ */
+static void select_batch(const selection_t* sel, u64 targets, u64 functions,
+                         const trace_info_t* info, u64 count, u8* select) {
+
+  u64 bytes = (count + 7) / 8, n, t, g;
+
+  memset(select, 0, functions * bytes);
+
+  for (n = 0; n < targets; n++) {
+    u64 guesses = (u64)1 << sel[n].target.guess_bits;
+    u8* out = select + sel[n].first * bytes;
+
+    for (t = 0; t < count; t++) {
+      u16 mask = sel[n].mask[target_iv_bits(&sel[n].target, info[t].iv)];
+      u8 bit = (u8)(1 << (t % 8));
+
+      for (g = 0; g < guesses; g++) {
+        if ((mask >> g) & 0x01) out[g * bytes + t / 8] |= bit;
+      }
+    }
+  }
+
+  return;
+}
+
+
+
+/**********
+ * Report *
+ **********/
+
+
+
+/***
+ * peak
+ *
+ * score of a difference of means trace and where it is reached
+ *
+ */
+static double peak(const float* diff, u64 samples, int absolute, u64* where) {
+
+  double best = -INFINITY, v;
+  u64 j;
+
+  *where = 0;
+
+  for (j = 0; j < samples; j++) {
+    v = absolute ? fabs(diff[j]) : diff[j];
+    if (v > best) {
+      best = v;
+      *where = j;
+    }
+  }
+
+  return best;
+}
+
+
+static int report(const options_t* o, const dpa_t* d, const selection_t* sel, u64 targets) {
+
+  float* diff = malloc(d->samples * sizeof(float));
+  FILE* fp = NULL;
+  u64 n, g, where, best_at = 0, ranked_first = 0, correct = 0;
+  int result = 1;
+
+  if (diff == NULL) goto done;
+
+  if (o->output != NULL && (fp = fopen(o->output, "wb")) == NULL) {
+    printf("[ERROR] could not create %s\n", o->output);
+    goto done;
+  }
+
+  printf("%lu traces, %lu selection functions, samples %lu..%lu\n",
+         d->traces, d->functions, o->window, o->window + d->samples - 1);
+  printf("target  clock  bits  best  peak        sample    margin    %s\n", o->has_key ? "right  rank" : "");
+
+  for (n = 0; n < targets; n++) {
+    const target_t* t = &sel[n].target;
+    u64 guesses = (u64)1 << t->guess_bits, rank = 1;
+    double score[1 << TARGET_GUESS], best = -INFINITY, second = -INFINITY;
+    u64 best_guess = 0;
+
+    for (g = 0; g < guesses; g++) {
+      dpa_difference(d, sel[n].first + g, diff);
+      score[g] = peak(diff, d->samples, o->absolute, &where);
+
+      if (score[g] > best) {
+        second = best;
+        best = score[g];
+        best_guess = g;
+        best_at = where;
+      } else if (score[g] > second) {
+        second = score[g];
+      }
+
+      if (fp != NULL && fwrite(diff, sizeof(float), d->samples, fp) != d->samples) {
+        printf("[ERROR] could not write %s\n", o->output);
+        goto done;
+      }
+    }
+
+    printf("%-6s  %5u  %4u  %4lu  %10.4g  %6lu  %10.4g", target_name(t->kind), t->clock, t->guess_bits,
+           best_guess, best, o->window + best_at, guesses > 1 ? best - second : 0.0);
+
+    if (o->has_key) {
+      correct = target_guess(t, o->key);
+      for (g = 0; g < guesses; g++) rank += (score[g] > score[correct]);
+      ranked_first += (rank == 1);
+      printf("  %5lu  %4lu", correct, rank);
+    }
+
+    printf("\n");
+  }
+
+  if (o->has_key) printf("right guess ranked first for %lu of %lu targets\n", ranked_first, targets);
+
+  result = 0;
+
+done:
+  if (fp != NULL) fclose(fp);
+  free(diff);
+
+  return result;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int attack(options_t* o, const char* path) {
+
+  trace_archive_t a;
+  selection_t* sel = malloc(MAX_TARGETS * sizeof(selection_t));
+  dpa_t d;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  u8* select = NULL;
+  u64 targets, functions, i, n, count;
+  double start = now(), engine = 0, t0;
+  int result = 1, same_key = 1;
+
+  if (sel == NULL || trace_archive_open(&a, path, o->threads) < 0) {
+    free(sel);
+    return 1;
+  }
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+  if (o->window >= a.format.samples) {
+    printf("[ERROR] the traces have %lu samples\n", a.format.samples);
+    goto done;
+  }
+  if (o->samples == 0 || o->window + o->samples > a.format.samples) o->samples = a.format.samples - o->window;
+
+  targets = selections_init(o, sel, &functions);
+  if (targets == 0) {
+    printf("[ERROR] none of the targets depends on both key and iv in these clocks\n");
+    goto done;
+  }
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info   = malloc(o->batch * sizeof(trace_info_t));
+  select = malloc(functions * ((o->batch + 7) / 8));
+
+  if (traces == NULL || info == NULL || select == NULL || dpa_alloc(&d, functions, o->samples, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) break;
+
+    if (!o->has_key) {
+      u64 t;
+      for (t = 0; t < n && same_key; t++) same_key = (memcmp(info[t].key, info[0].key, KEYLENGTH) == 0);
+      if (i == 0) memcpy(o->key, info[0].key, KEYLENGTH);
+      else same_key = same_key && memcmp(info[0].key, o->key, KEYLENGTH) == 0;
+    }
+
+    select_batch(sel, targets, functions, info, n, select);
+
+    t0 = now();
+    if (dpa_add(&d, traces + o->window, a.format.samples, n, select) < 0) {
+      printf("[ERROR] out of memory\n");
+      break;
+    }
+    engine += now() - t0;
+  }
+
+  if (i == count) {
+    o->has_key = o->has_key || same_key;
+    result = report(o, &d, sel, targets);
+    printf("%.3f s, %.3f s in the engine (%lu threads)\n", now() - start, engine, d.threads);
+  }
+
+  dpa_free(&d);
+
+done:
+  free(sel);
+  free(traces);
+  free(info);
+  free(select);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static int parse_kinds(const char* text, u64* kinds) {
+
+  char name[16];
+  u32 kind;
+  u64 length;
+
+  *kinds = 0;
+
+  while (*text) {
+    length = strcspn(text, ",");
+    if (length == 0 || length >= sizeof(name)) return -1;
+
+    memcpy(name, text, length);
+    name[length] = 0;
+    if (target_parse(name, &kind) < 0) return -1;
+    *kinds |= (u64)1 << kind;
+
+    text += length;
+    if (*text == ',') text++;
+  }
+
+  return *kinds ? 0 : -1;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-T targets] [-c first:last] [-w first:count] [-n traces] [-b traces]\n"
+         "       %*s [-t threads] [-k key] [-a] [-o differences] archive\n", name, (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u64 a, b;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.kinds = 1 << TARGET_T1;
+  o.last_clock = TARGET_CLOCKS - 1;
+  o.batch = 4096;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "T:c:w:n:b:t:k:ao:")) != -1) {
+    switch (option) {
+    case 'n': o.traces  = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch   = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);  break;
+    case 'a': o.absolute = 1;                          break;
+    case 'o': o.output  = optarg;                      break;
+    case 'T':
+      if (parse_kinds(optarg, &o.kinds) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'c':
+      if (parse_range(optarg, &a, &b) < 0 || a > b || b >= TARGET_CLOCKS) {
+        printf("[ERROR] clocks must be within 0:%d\n", TARGET_CLOCKS - 1);
+        return 2;
+      }
+      o.first_clock = (u32)a;
+      o.last_clock = (u32)b;
+      break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 1 || o.batch == 0 || o.threads == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return attack(&o, argv[optind]);
+}
@@ -0,0 +1,470 @@
+/*
+ * dsp.c
+ *
+ * streaming preprocessing of raw traces (see dsp.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "dsp.h"
+
+#define DSP_BLOCK 16                    // traces per work item
+
+
+static const char* kind_names[] = { "none", "lowpass", "highpass", "bandpass" };
+
+
+const char* dsp_kind_name(u32 kind) {
+  return (kind <= DSP_BANDPASS) ? kind_names[kind] : "unknown";
+}
+
+
+int dsp_kind_parse(const char* name, u32* kind) {
+
+  u32 i;
+
+  for (i = 0; i <= DSP_BANDPASS; i++) {
+    if (strcmp(name, kind_names[i]) == 0) {
+      *kind = i;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+
+/**********
+ * Design *
+ **********/
+
+
+
+/***
+ * sinc_lowpass
+ *
+ * blackman windowed sinc of a cutoff in cycles per sample, unit gain at
+ * dc, added into h with a sign
+ *
+ */
+static void sinc_lowpass(double* h, u64 taps, double cutoff, double sign) {
+
+  double x, w, sum = 0;
+  double* t = malloc(taps * sizeof(double));
+  u64 n, half = (taps - 1) / 2;
+
+  if (t == NULL) return;
+
+  for (n = 0; n < taps; n++) {
+    x = (double)n - (double)half;
+    w = 0.42 - 0.5 * cos(2 * M_PI * n / (taps - 1)) + 0.08 * cos(4 * M_PI * n / (taps - 1));
+    t[n] = w * ((x == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x));
+    sum += t[n];
+  }
+
+  for (n = 0; n < taps; n++) h[n] += sign * t[n] / sum;
+  free(t);
+
+  return;
+}
+
+
+static int design_fir(dsp_t* d) {
+
+  const dsp_config_t* c = &d->config;
+  double* h;
+  double edge;
+  u64 n;
+
+  if (c->fir == DSP_NONE) {
+    // average every factor samples, block j being samples j f..j f + f - 1
+    d->taps = c->factor;
+    d->half = 0;
+  } else {
+    edge = (c->fir == DSP_HIGHPASS) ? c->low : (c->fir == DSP_LOWPASS) ? c->high : fmin(c->low, c->high);
+    d->taps = c->taps ? c->taps : (u64)(4 * c->rate / edge) | 0x01;
+    if (c->taps == 0 && d->taps > d->samples) d->taps = (d->samples - 1) | 0x01;
+    if (d->taps % 2 == 0 || d->taps < 3) {
+      printf("[ERROR] the fir needs an odd number of taps, 3 or more\n");
+      return -1;
+    }
+    d->half = (d->taps - 1) / 2;
+  }
+
+  d->h = calloc(d->taps, sizeof(float));
+  h = calloc(d->taps, sizeof(double));
+  if (d->h == NULL || h == NULL) {
+    free(h);
+    printf("[ERROR] out of memory\n");
+    return -1;
+  }
+
+  switch (c->fir) {
+  case DSP_NONE:
+    for (n = 0; n < d->taps; n++) h[n] = 1.0 / d->taps;
+    break;
+  case DSP_LOWPASS:
+    sinc_lowpass(h, d->taps, c->high / c->rate, 1);
+    break;
+  case DSP_HIGHPASS:
+    h[d->half] = 1;
+    sinc_lowpass(h, d->taps, c->low / c->rate, -1);
+    break;
+  case DSP_BANDPASS:
+    sinc_lowpass(h, d->taps, c->high / c->rate, 1);
+    sinc_lowpass(h, d->taps, c->low / c->rate, -1);
+    break;
+  }
+
+  // the taps are symmetric, so convolution and correlation agree
+  for (n = 0; n < d->taps; n++) d->h[n] = (float)h[n];
+  free(h);
+
+  return 0;
+}
+
+
+/***
+ * design_iir
+ *
+ * second order butterworth, the bilinear transform of the analog
+ * prototype (Q = 1 / sqrt 2)
+ *
+ */
+static void design_iir(dsp_t* d) {
+
+  const dsp_config_t* c = &d->config;
+  double w = 2 * M_PI * c->iir_cutoff / c->rate;
+  double alpha = sin(w) / (2 * M_SQRT1_2), a0 = 1 + alpha;
+
+  if (c->iir == DSP_LOWPASS) {
+    d->b[0] = (1 - cos(w)) / 2 / a0;
+    d->b[1] = (1 - cos(w)) / a0;
+  } else {
+    d->b[0] = (1 + cos(w)) / 2 / a0;
+    d->b[1] = -(1 + cos(w)) / a0;
+  }
+  d->b[2] = d->b[0];
+  d->a[0] = -2 * cos(w) / a0;
+  d->a[1] = (1 - alpha) / a0;
+
+  return;
+}
+
+
+/***
+ * dsp_init
+ *
+ * check a configuration and design its filters for traces of a number of
+ * samples
+ *
+ */
+int dsp_init(dsp_t* d, const dsp_config_t* c, u64 samples) {
+
+  const dsp_config_t* k = &d->config;
+  double nyquist = c->rate / 2, fitting;
+
+  memset(d, 0, sizeof(dsp_t));
+  d->config = *c;
+  d->samples = samples;
+
+  if (k->factor == 0) d->config.factor = 1;
+
+  if (samples == 0 || !(k->rate > 0) || k->iir > DSP_HIGHPASS || k->fir > DSP_BANDPASS || k->offset < 0) {
+    printf("[ERROR] the input needs a sample rate and samples\n");
+    return -1;
+  }
+
+  if ((k->iir != DSP_NONE && !(k->iir_cutoff > 0 && k->iir_cutoff < nyquist)) ||
+      ((k->fir == DSP_LOWPASS || k->fir == DSP_BANDPASS) && !(k->high > 0 && k->high < nyquist)) ||
+      ((k->fir == DSP_HIGHPASS || k->fir == DSP_BANDPASS) && !(k->low > 0 && k->low < nyquist)) ||
+      (k->fir == DSP_BANDPASS && !(k->low < k->high))) {
+    printf("[ERROR] cutoffs must lie between 0 and %g Hz, low below high\n", nyquist);
+    return -1;
+  }
+
+  if (k->iir != DSP_NONE) design_iir(d);
+  if ((k->fir != DSP_NONE || k->factor > 1) && design_fir(d) < 0) {
+    dsp_free(d);
+    return -1;
+  }
+
+  d->decimated = (samples + k->factor - 1) / k->factor;
+  d->phase = (d->h != NULL) ? d->decimated + (d->taps - 1) / k->factor + 1 + 2 * DSP_LANES : 0;
+  d->out = d->decimated;
+
+  // input sample i covers [i, i + 1); a centered fir output j is centered
+  // on input j f + 1/2 and covers f input samples around it
+  if (k->clock > 0) {
+    d->period = k->rate / k->clock / k->factor;
+    d->first = (k->offset + ((d->half > 0) ? (k->factor - 1) / 2.0 : 0)) / k->factor;
+    fitting = floor((d->decimated - d->first) / d->period);
+
+    if (fitting < 1 || (double)k->cycles > fitting) {
+      printf("[ERROR] %lu samples after the offset hold %.0f clock cycles\n", samples, fmax(fitting, 0));
+      dsp_free(d);
+      return -1;
+    }
+    d->out = k->cycles ? k->cycles : (u64)fitting;
+  }
+
+  d->scratch = ((k->iir != DSP_NONE) ? samples : 0) + k->factor * d->phase +
+               ((k->clock > 0) ? d->decimated : 0);
+
+  return 0;
+}
+
+
+void dsp_free(dsp_t* d) {
+
+  free(d->h);
+  memset(d, 0, sizeof(dsp_t));
+
+  return;
+}
+
+
+
+/**********
+ * Stages *
+ **********/
+
+
+
+/***
+ * iir
+ *
+ * direct form II transposed in double, started in the steady state of
+ * the first sample so a trace does not open with a step
+ *
+ */
+static void iir(const dsp_t* d, const float* x, float* y, u64 n) {
+
+  double gain = (d->b[0] + d->b[1] + d->b[2]) / (1 + d->a[0] + d->a[1]);
+  double y0 = gain * x[0], z2 = d->b[2] * x[0] - d->a[1] * y0, z1 = d->b[1] * x[0] - d->a[0] * y0 + z2, v;
+  u64 i;
+
+  for (i = 0; i < n; i++) {
+    v = d->b[0] * x[i] + z1;
+    z1 = d->b[1] * x[i] - d->a[0] * v + z2;
+    z2 = d->b[2] * x[i] - d->a[1] * v;
+    y[i] = (float)v;
+  }
+
+  return;
+}
+
+
+typedef float lanes_t __attribute__((vector_size(4 * DSP_LANES)));
+
+
+static inline lanes_t load_lanes(const float* p) {
+
+  lanes_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+
+/***
+ * fir
+ *
+ * the decimated outputs only. The trace, extended at both ends by its
+ * edge samples, is first split into its factor phases, phase p holding
+ * samples p, p + f, p + 2 f, ...; tap k of consecutive outputs then
+ * reads consecutive samples of phase k mod f, so the outputs are the
+ * vector lanes and no sum runs across them. Two vectors of outputs at a
+ * time hide the latency of the multiply-adds.
+ *
+ */
+static void fir(const dsp_t* d, const float* x, float* y, float* phases) {
+
+  const u64 f = d->config.factor;
+  lanes_t acc[2];
+  const float* p;
+  u64 i, j, k, l, m, q;
+
+  for (q = 0; q < f; q++) {
+    for (m = 0, i = q; m < d->phase; m++, i += f) {
+      j = (i < d->half) ? 0 : i - d->half;
+      phases[q * d->phase + m] = x[(j < d->samples) ? j : d->samples - 1];
+    }
+  }
+
+  for (j = 0; j < d->decimated; j += 2 * DSP_LANES) {
+    acc[0] = acc[1] = (lanes_t){ 0 };
+
+    // tap k = i f + q reads phase q from output j + i on
+    for (q = 0; q < f; q++) {
+      p = phases + q * d->phase + j;
+      for (i = 0, k = q; k < d->taps; i++, k += f) {
+        acc[0] += d->h[k] * load_lanes(p + i);
+        acc[1] += d->h[k] * load_lanes(p + i + DSP_LANES);
+      }
+    }
+
+    m = (d->decimated - j < 2 * DSP_LANES) ? d->decimated - j : 2 * DSP_LANES;
+    for (l = 0; l < m; l++) y[j + l] = acc[l / DSP_LANES][l % DSP_LANES];
+  }
+
+  return;
+}
+
+
+/***
+ * integrate
+ *
+ * the mean of every clock cycle, the samples cut by an edge weighted by
+ * their share
+ *
+ */
+static void integrate(const dsp_t* d, const float* x, float* y) {
+
+  double start, end, sum;
+  u64 c, i, last;
+
+  for (c = 0; c < d->out; c++) {
+    start = d->first + c * d->period;
+    end = start + d->period;
+    i = (u64)start;
+    last = (u64)end;
+
+    if (i == last) {
+      y[c] = x[i];
+      continue;
+    }
+
+    sum = x[i] * (i + 1 - start);
+    for (i++; i < last; i++) sum += x[i];
+    if (last < d->decimated) sum += x[last] * (end - last);
+
+    y[c] = (float)(sum / d->period);
+  }
+
+  return;
+}
+
+
+/***
+ * dsp_trace
+ *
+ * one trace through the chain, out of d->out samples; scratch holds
+ * d->scratch floats
+ *
+ */
+void dsp_trace(const dsp_t* d, const float* in, float* out, float* scratch) {
+
+  const dsp_config_t* c = &d->config;
+  const float* x = in;
+  float* y;
+
+  if (c->iir != DSP_NONE) {
+    iir(d, x, scratch, d->samples);
+    x = scratch;
+    scratch += d->samples;
+  }
+
+  if (d->h != NULL) {
+    y = (c->clock > 0) ? scratch + c->factor * d->phase : out;
+    fir(d, x, y, scratch);
+    x = y;
+  }
+
+  if (c->clock > 0) integrate(d, x, out);
+  else if (x != out) memcpy(out, x, d->out * sizeof(float));
+
+  return;
+}
+
+
+
+/***********
+ * Batches *
+ ***********/
+
+
+
+typedef struct {
+  const dsp_t* d;
+  const float* in;
+  float*       out;
+  u64          count;
+  u64          next;                    // next block of traces, shared by the workers
+  int          error;
+} dsp_job_t;
+
+
+static void* dsp_worker(void* arg) {
+
+  dsp_job_t* job = arg;
+  const dsp_t* d = job->d;
+  float* scratch = malloc((d->scratch ? d->scratch : 1) * sizeof(float));
+  u64 b, t, last;
+
+  if (scratch == NULL) {
+    job->error = 1;
+    return NULL;
+  }
+
+  while ((b = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) * DSP_BLOCK < job->count) {
+    last = ((b + 1) * DSP_BLOCK < job->count) ? (b + 1) * DSP_BLOCK : job->count;
+    for (t = b * DSP_BLOCK; t < last; t++) dsp_trace(d, job->in + t * d->samples, job->out + t * d->out, scratch);
+  }
+
+  free(scratch);
+
+  return NULL;
+}
+
+
+/***
+ * dsp_run
+ *
+ * count traces back to back, split over threads
+ *
+ */
+int dsp_run(const dsp_t* d, const float* in, u64 count, float* out, u64 threads) {
+
+  pthread_t thread[DSP_MAX_THREADS];
+  dsp_job_t job;
+  u64 i, blocks = (count + DSP_BLOCK - 1) / DSP_BLOCK;
+
+  memset(&job, 0, sizeof(job));
+  job.d     = d;
+  job.in    = in;
+  job.out   = out;
+  job.count = count;
+
+  threads = (threads == 0) ? 1 : (threads > DSP_MAX_THREADS) ? DSP_MAX_THREADS : threads;
+  if (threads > blocks) threads = blocks;
+
+  if (threads <= 1) {
+    dsp_worker(&job);
+  } else {
+    for (i = 0; i < threads; i++) {
+      if (pthread_create(&thread[i], NULL, dsp_worker, &job) != 0) break;
+    }
+
+    // whatever could not get a thread is done by the ones that did
+    if (i == 0) dsp_worker(&job);
+    threads = i;
+
+    for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+  }
+
+  if (job.error) {
+    printf("[ERROR] out of memory\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * dsp.h
+ *
+ * filtering, decimation and clock cycle integration of raw traces
+ *
+ * the scope samples far above the 48 MHz clock of the PIC, so most of a
+ * raw trace is redundant. Every trace goes through the same chain:
+ *
+ *   iir        one biquad (Butterworth low or high pass), e.g. to take
+ *              out the baseline drift; it runs forward in time and so
+ *              delays what it passes
+ *   fir        a windowed sinc low, high or band pass of odd length,
+ *              centered so it shifts nothing; decimating without one
+ *              averages every factor samples
+ *   decimate   every factor-th filtered sample, only those computed
+ *   integrate  the mean of every clock cycle, a cycle being rate /
+ *              clock (decimated) samples from the trigger offset on,
+ *              the samples cut by its edges weighted by their share;
+ *              the mean keeps the scope's units whatever the rate
+ *
+ * traces are independent, so a batch is split over threads by trace.
+ * The fir computes vectors of DSP_LANES outputs from the polyphase split
+ * of the trace (gcc vector extensions, as the bitsliced core).
+ *
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include "trivium.h"
+
+#define DSP_LANES       16
+#define DSP_MAX_THREADS 256
+#define DSP_CLOCK       48e6           // #use delay(clock=48000000)
+
+enum {
+  DSP_NONE     = 0,
+  DSP_LOWPASS  = 1,
+  DSP_HIGHPASS = 2,
+  DSP_BANDPASS = 3
+};
+
+
+/***
+ * dsp_config_t
+ *
+ * frequencies in Hz; a band pass fir keeps low..high, a low pass keeps
+ * below high and a high pass above low. The offset of the first clock
+ * edge is in input samples.
+ *
+ */
+typedef struct {
+  double rate;                          // of the input samples
+  u32    iir;                           // DSP_NONE, DSP_LOWPASS or DSP_HIGHPASS
+  double iir_cutoff;
+  u32    fir;                           // DSP_NONE, DSP_LOWPASS, DSP_HIGHPASS or DSP_BANDPASS
+  double low, high;
+  u64    taps;                          // fir length, odd (0 for about 4 rate / cutoff)
+  u64    factor;                        // decimation, 1 for none
+  double clock;                         // 0 for no integration
+  double offset;
+  u64    cycles;                        // integrated, 0 for as many as fit
+} dsp_config_t;
+
+
+typedef struct {
+  dsp_config_t config;
+  u64    samples;                       // per input trace
+  u64    decimated;                     // after the fir and decimation
+  u64    out;                           // per output trace
+  u64    taps;                          // fir length
+  u64    half;                          // delay of the fir, (taps - 1) / 2
+  float* h;                             // [taps]
+  u64    phase;                         // samples per polyphase branch
+  double b[3], a[2];                    // iir, a[0] normalized away
+  double period, first;                 // a clock cycle and the first edge, decimated samples
+  u64    scratch;                       // floats dsp_trace() needs
+} dsp_t;
+
+
+const char* dsp_kind_name(u32 kind);
+int  dsp_kind_parse(const char* name, u32* kind);
+
+int  dsp_init(dsp_t* d, const dsp_config_t* c, u64 samples);
+void dsp_free(dsp_t* d);
+
+void dsp_trace(const dsp_t* d, const float* in, float* out, float* scratch);
+int  dsp_run(const dsp_t* d, const float* in, u64 count, float* out, u64 threads);
+
+#endif
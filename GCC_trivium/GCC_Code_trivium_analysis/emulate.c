@@ -0,0 +1,532 @@
+/*
+ * emulate.c
+ *
+ * simulated power traces of the real firmware: the compiled image runs
+ * on the instruction level emulator (see pic18.h), driven over its uart
+ * as collect.m drives the board, one leakage sample per instruction
+ * cycle into an archive (traces.h)
+ *
+ *  build : gcc -O3 -march=native -pthread -o emulate emulate.c pic18.c traces.c -lm
+ *  run   : ./emulate [-k keys] [-i ivs] [-p plains] [-n traces] [-g trigger] [-w first[:count]]
+ *                    [-r repeats] [-s sigma] [-S seed] [-x cipher] [-c codec] [-q bits]
+ *                    [-l cycles] [-t threads] firmware.hex archive
+ *
+ *   -k keys      keys.txt of the traces
+ *   -i ivs       ivs.txt of the traces
+ *   -p plains    send the lines of this file instead of key and iv, as
+ *                the 32 byte input firmware reads a plain text; -k / -i
+ *                then only label the traces
+ *   -n traces    stop after this many (default: the lines sent)
+ *   -g trigger   PIN_B0 (default), a function of the firmware's .sym
+ *                file (e.g. ip_cipher) or a program address (0x872)
+ *   -w window    cycles from the trigger: the first and the count, by
+ *                default all of them up to the end of the encryption
+ *   -r repeats   encryptions per line (default 1)
+ *   -s sigma     gaussian noise added to every sample (default 0)
+ *   -S seed      of the noise (default 1)
+ *   -x cipher    where the board's replies go, one line per line sent
+ *   -c codec     of the archive: float, quant or rice (default float)
+ *   -q bits      quantization bits (default 8)
+ *   -l cycles    give up on an encryption after this many (default 10^9)
+ *   -t threads   emulated boards (default: online cpus)
+ *
+ * every line goes out as the key and iv in hex (40 characters, what the
+ * 128 byte input firmware and acquire -d send) or as the plain text
+ * line. The board then encrypts until the window of the first trigger
+ * is recorded, is sent 'z' and its reply is read until it waits for the
+ * next line. Without a count the window ends where the firmware next
+ * polls the uart, measured once on the first line.
+ *
+ * the emulator is exact in cycles, so simulated and real traces line up
+ * one sample per cycle (DSP_CLOCK / 4 on the scope's time axis). Every
+ * thread runs its own board and takes lines from a shared counter;
+ * traces are written in line order and the noise is drawn in that order,
+ * so the archive does not depend on the thread count.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pic18.h"
+#include "traces.h"
+#include "util.h"
+
+#define LINE_MAX_LENGTH 512
+#define EMULATE_BATCH   64              // lines per thread and batch
+#define MAX_THREADS     256
+
+
+typedef struct {
+  FILE* keys;
+  FILE* ivs;
+  FILE* plains;
+  u64   traces;
+  u32   trigger;
+  u64   first, count;
+  u64   repeats;
+  double sigma;
+  u64   seed;
+  FILE* cipher;
+  u32   codec;
+  u32   qbits;
+  u64   limit;
+  u64   threads;
+} options_t;
+
+
+typedef struct {
+  char  text[LINE_MAX_LENGTH];          // what is sent
+  char  reply[PIC18_TX + 1];
+  trace_info_t info;
+} line_t;
+
+
+typedef struct {
+  const options_t* o;
+  pic18_t* boards;
+  line_t*  lines;
+  float*   traces;                      // [lines * repeats][count]
+  u64      count;                       // lines of the batch
+  u64      board;                       // next free board
+  u64      next;
+  int      error;
+} job_t;
+
+
+
+/*********
+ * Board *
+ *********/
+
+
+
+/***
+ * boot
+ *
+ * reset and run until the firmware waits for its first line
+ *
+ */
+static int boot(const options_t* o, pic18_t* p) {
+
+  pic18_reset(p);
+
+  if (pic18_run(p, o->limit) != PIC18_POLL) {
+    printf("[ERROR] the firmware does not read the uart within %lu cycles\n", o->limit);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * run_line
+ *
+ * one line and the window of its first trigger; trace NULL measures the
+ * window, its length in *length
+ *
+ */
+static int run_line(const options_t* o, pic18_t* p, const char* text, u64 count, float* trace, char* reply,
+                    u64* length) {
+
+  u64 limit = p->cycles + o->limit;
+  int stopping = 0;
+  u32 event;
+
+  if (pic18_send(p, (const u8*)text, strlen(text)) < 0) {
+    printf("[ERROR] line of %lu characters, the uart queue holds %d\n", strlen(text), PIC18_UART);
+    return -1;
+  }
+
+  pic18_arm(p, o->trigger, o->first, count, trace);
+
+  for (;;) {
+    event = pic18_run(p, limit);
+
+    if (event == PIC18_POLL && stopping) break;
+
+    if (event == PIC18_POLL && !(p->recording && trace == NULL)) {
+      p->poll_pass = 1;
+      continue;
+    }
+
+    if (event == PIC18_POLL || event == PIC18_WINDOW) {
+      // the encryption under way is the last
+      if (length != NULL) *length = p->filled;
+      p->recording = 0;
+      p->tx_length = 0;
+      pic18_send(p, (const u8*)"z", 1);
+      stopping = 1;
+      continue;
+    }
+
+    if (event == PIC18_LIMIT) {
+      printf("[ERROR] no %s within %lu cycles of line %s\n", stopping ? "reply" : "trigger", o->limit, text);
+    } else {
+      printf("[ERROR] the firmware %s at 0x%04X\n", (event == PIC18_SLEEP) ? "sleeps" : "faults", p->pc);
+    }
+    return -1;
+  }
+
+  if (reply != NULL) {
+    memcpy(reply, p->tx, p->tx_length);
+    reply[p->tx_length] = 0;
+  }
+
+  return 0;
+}
+
+
+static void* emulate_worker(void* arg) {
+
+  job_t* job = arg;
+  const options_t* o = job->o;
+  pic18_t* p = job->boards + __atomic_fetch_add(&job->board, 1, __ATOMIC_RELAXED);
+  u64 i, r;
+
+  while (!job->error && (i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+    for (r = 0; r < o->repeats; r++) {
+      if (run_line(o, p, job->lines[i].text, o->count, job->traces + (i * o->repeats + r) * o->count,
+                   job->lines[i].reply, NULL) < 0) {
+        job->error = 1;
+        break;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+
+/*********
+ * Lines *
+ *********/
+
+
+
+/***
+ * next_text
+ *
+ * the next line of a file without its end, skipping blank lines
+ *
+ */
+static int next_text(FILE* fp, char* out) {
+
+  u64 n;
+
+  while (fgets(out, LINE_MAX_LENGTH, fp) != NULL) {
+    n = strlen(out);
+    while (n > 0 && (out[n - 1] == '\n' || out[n - 1] == '\r')) out[--n] = 0;
+    if (n > 0) return 0;
+  }
+
+  return -1;
+}
+
+
+/***
+ * next_line
+ *
+ * what to send next and the key and iv to label it with, 1 at the end of
+ * the files
+ *
+ */
+static int next_line(const options_t* o, line_t* line) {
+
+  char text[LINE_MAX_LENGTH];
+  u64 i;
+
+  memset(&line->info, 0, sizeof(trace_info_t));
+
+  if ((o->keys != NULL && (next_text(o->keys, text) < 0 || parse_bytes(text, line->info.key, KEYLENGTH) < 0)) ||
+      (o->ivs != NULL && (next_text(o->ivs, text) < 0 || parse_bytes(text, line->info.iv, IVLENGTH) < 0))) return 1;
+
+  if (o->plains != NULL) return (next_text(o->plains, line->text) < 0) ? 1 : 0;
+
+  for (i = 0; i < KEYLENGTH; i++) sprintf(line->text + 2 * i, "%02X", line->info.key[i]);
+  for (i = 0; i < IVLENGTH; i++) sprintf(line->text + 2 * (KEYLENGTH + i), "%02X", line->info.iv[i]);
+
+  return 0;
+}
+
+
+/***
+ * gauss
+ *
+ * standard normal sample (Box-Muller)
+ *
+ */
+static double gauss(u64* state) {
+
+  double u1 = ((splitmix64(state) >> 11) + 1.0) * 0x1.0p-53;
+  double u2 = (splitmix64(state) >> 11) * 0x1.0p-53;
+
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int emulate(options_t* o, const char* firmware, const char* path) {
+
+  trace_writer_t w;
+  pthread_t thread[MAX_THREADS];
+  job_t job;
+  line_t first;
+  u64 lines, left, total = 0, noise = o->seed, cycles = 0, i, j, n;
+  double start;
+  int open = 0, end = 0, result = 1;
+
+  memset(&job, 0, sizeof(job));
+  job.o = o;
+  job.boards = malloc(o->threads * sizeof(pic18_t));
+  job.lines = malloc(o->threads * EMULATE_BATCH * sizeof(line_t));
+
+  if (job.boards == NULL || job.lines == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (pic18_load(&job.boards[0], firmware) < 0) goto done;
+  for (i = 1; i < o->threads; i++) {
+    memcpy(job.boards[i].rom, job.boards[0].rom, sizeof(job.boards[0].rom));
+    memcpy(job.boards[i].kind, job.boards[0].kind, sizeof(job.boards[0].kind));
+  }
+  for (i = 0; i < o->threads; i++) {
+    if (boot(o, &job.boards[i]) < 0) goto done;
+  }
+
+  start = now();
+
+  // the whole window, measured on the first line
+  if (o->count == 0) {
+    if (next_line(o, &first) != 0) {
+      printf("[ERROR] no line to send\n");
+      goto done;
+    }
+    if (run_line(o, &job.boards[0], first.text, (u64)-1, NULL, NULL, &o->count) < 0) goto done;
+    if (o->count == 0) {
+      printf("[ERROR] the window is empty\n");
+      goto done;
+    }
+    printf("%lu cycles from the trigger to the end of the encryption\n", o->count + o->first);
+    job.lines[0] = first;
+    job.count = 1;
+  }
+
+  job.traces = malloc(o->threads * EMULATE_BATCH * o->repeats * o->count * sizeof(float));
+  if (job.traces == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (trace_writer_open(&w, path, o->count, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+  open = 1;
+
+  while (!end && total < o->traces) {
+    left = o->traces - total;
+    lines = left / o->repeats + (left % o->repeats != 0);
+    if (lines > o->threads * EMULATE_BATCH) lines = o->threads * EMULATE_BATCH;
+
+    for (; job.count < lines; job.count++) {
+      if (next_line(o, &job.lines[job.count]) != 0) {
+        end = 1;
+        break;
+      }
+    }
+    if (job.count == 0) break;
+
+    for (i = 0; i < o->threads; i++) cycles -= job.boards[i].cycles;
+
+    job.board = job.next = 0;
+    for (i = 0; i < o->threads; i++) {
+      if (pthread_create(&thread[i], NULL, emulate_worker, &job) != 0) break;
+    }
+    if (i == 0) emulate_worker(&job);
+    n = i;
+    for (i = 0; i < n; i++) pthread_join(thread[i], NULL);
+    if (job.error) goto done;
+
+    for (i = 0; i < o->threads; i++) cycles += job.boards[i].cycles;
+
+    for (i = 0; i < job.count * o->repeats && total < o->traces; i++, total++) {
+      float* trace = job.traces + i * o->count;
+      if (o->sigma > 0) {
+        for (j = 0; j < o->count; j++) trace[j] += (float)(o->sigma * gauss(&noise));
+      }
+      if (trace_writer_add(&w, trace, &job.lines[i / o->repeats].info) < 0) goto done;
+    }
+
+    if (o->cipher != NULL) {
+      for (i = 0; i < job.count; i++) fprintf(o->cipher, "%s\n", job.lines[i].reply);
+    }
+
+    job.count = 0;
+    printf("%8lu traces  %8.1f encryptions/s  %6.1f M cycles/s\n", total, total / o->repeats / (now() - start),
+           1e-6 * cycles / (now() - start));
+    fflush(stdout);
+  }
+
+  printf("%lu traces of %lu samples in %.1f s\n", total, o->count, now() - start);
+  result = 0;
+
+done:
+  if (open && trace_writer_close(&w) < 0) result = 1;
+  free(job.boards);
+  free(job.lines);
+  free(job.traces);
+
+  return result;
+}
+
+
+/***
+ * parse_trigger
+ *
+ * PIN_B0, a program address or a function in the ROM allocation of the
+ * .sym file next to the image
+ *
+ */
+static int parse_trigger(const char* text, const char* firmware, u32* address) {
+
+  char path[LINE_MAX_LENGTH], line[LINE_MAX_LENGTH], name[LINE_MAX_LENGTH];
+  const char* dot = strrchr(firmware, '.');
+  u64 length = dot ? (u64)(dot - firmware) : strlen(firmware);
+  unsigned int value;
+  int rom = 0;
+  FILE* fp;
+
+  if (strcmp(text, "PIN_B0") == 0) {
+    *address = PIC18_NOWHERE;
+    return 0;
+  }
+
+  if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+    *address = (u32)strtoul(text, NULL, 16) & ~1u;
+    return 0;
+  }
+
+  if (length + 5 > sizeof(path)) return -1;
+  snprintf(path, sizeof(path), "%.*s.sym", (int)length, firmware);
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    printf("[ERROR] could not open %s for the address of %s\n", path, text);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strncmp(line, "ROM Allocation", 14) == 0) rom = 1;
+    else if (rom && sscanf(line, "%x %s", &value, name) == 2 && strcmp(name, text) == 0) {
+      fclose(fp);
+      *address = value;
+      return 0;
+    }
+  }
+
+  fclose(fp);
+  printf("[ERROR] %s is not a function of %s\n", text, path);
+
+  return -1;
+}
+
+
+static void usage(const char* name) {
+
+  int w = (int)strlen(name);
+
+  printf("usage: %s [-k keys] [-i ivs] [-p plains] [-n traces] [-g trigger] [-w first[:count]]\n"
+         "       %*s [-r repeats] [-s sigma] [-S seed] [-x cipher] [-c codec] [-q bits]\n"
+         "       %*s [-l cycles] [-t threads] firmware.hex archive\n", name, w, "", w, "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  const char *cipher = NULL, *trigger = "PIN_B0";
+  char* end;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int option, result;
+
+  memset(&o, 0, sizeof(o));
+  o.repeats = 1;
+  o.seed = 1;
+  o.codec = TRACE_FLOAT;
+  o.qbits = 8;
+  o.limit = 1000000000;
+  o.threads = (cpus > 0) ? (u64)cpus : 1;
+
+  while ((option = getopt(argc, argv, "k:i:p:n:g:w:r:s:S:x:c:q:l:t:")) != -1) {
+    switch (option) {
+    case 'n': o.traces  = strtoul(optarg, NULL, 10);  break;
+    case 'g': trigger   = optarg;                     break;
+    case 'r': o.repeats = strtoul(optarg, NULL, 10);  break;
+    case 's': o.sigma   = atof(optarg);               break;
+    case 'S': o.seed    = strtoul(optarg, NULL, 10);  break;
+    case 'x': cipher    = optarg;                     break;
+    case 'q': o.qbits   = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'l': o.limit   = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);  break;
+    case 'w':
+      o.first = strtoul(optarg, &end, 10);
+      if (*end == ':') o.count = strtoul(end + 1, NULL, 10);
+      break;
+    case 'k':
+    case 'i':
+    case 'p':
+      if ((*(option == 'k' ? &o.keys : (option == 'i' ? &o.ivs : &o.plains)) = fopen(optarg, "r")) == NULL) {
+        printf("[ERROR] could not open %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 'c':
+      if (trace_codec_parse(optarg, &o.codec) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (o.traces == 0) o.traces = (u64)-1;
+  if (o.threads > MAX_THREADS) o.threads = MAX_THREADS;
+
+  if (optind != argc - 2 || o.repeats == 0 || o.threads == 0 || o.limit == 0 ||
+      (o.plains == NULL && (o.keys == NULL || o.ivs == NULL))) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (parse_trigger(trigger, argv[optind], &o.trigger) < 0) return 2;
+
+  if (cipher != NULL && (o.cipher = fopen(cipher, "a")) == NULL) {
+    printf("[ERROR] could not open %s\n", cipher);
+    return 2;
+  }
+
+  result = emulate(&o, argv[optind], argv[optind + 1]);
+
+  if (o.keys != NULL) fclose(o.keys);
+  if (o.ivs != NULL) fclose(o.ivs);
+  if (o.plains != NULL) fclose(o.plains);
+  if (o.cipher != NULL) fclose(o.cipher);
+
+  return result;
+}
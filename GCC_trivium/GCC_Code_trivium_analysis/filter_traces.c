@@ -0,0 +1,222 @@
+/*
+ * filter_traces.c
+ *
+ * filter, decimate and integrate raw float32 traces per clock cycle (see
+ * dsp.h), into raw traces again or straight into a trace archive
+ *
+ *  build : gcc -O3 -march=native -pthread -o filter_traces filter_traces.c dsp.c traces.c -lm
+ *  run   : ./filter_traces [options] samples raw out
+ *
+ *   -r rate      input sample rate in Hz (default 1e9)
+ *   -H cutoff    iir high pass, e.g. 1e5 to take out the baseline drift
+ *   -L cutoff    iir low pass instead
+ *   -f kind      fir lowpass, highpass or bandpass
+ *   -l low       fir low edge in Hz (highpass, bandpass)
+ *   -u high      fir high edge in Hz (lowpass, bandpass)
+ *   -T taps      fir length, odd (default about 4 rate / edge)
+ *   -m factor    keep every factor-th sample (default 1)
+ *   -C clock     integrate every cycle of this clock in Hz, e.g. 48e6, or
+ *                12e6 for the PIC's instruction cycles
+ *   -o offset    input samples from the trigger to the first clock edge
+ *   -y cycles    clock cycles to integrate (default as many as fit)
+ *   -a           write a trace archive (see traces.h) instead of raw
+ *   -c codec     archive codec, float, quant or rice (default float)
+ *   -q bits      archive quantization bits (default 12)
+ *   -k keys      keys of the traces for the archive, keys.txt format
+ *   -i ivs       ivs of the traces for the archive, ivs.txt format
+ *   -b traces    traces per batch (default 1024)
+ *   -t threads   worker threads (default: online cpus)
+ *
+ * the chain runs iir, fir with decimation, integration, each only if
+ * asked for; decimating without a fir averages every factor samples.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "traces.h"
+#include "util.h"
+
+
+typedef struct {
+  dsp_config_t config;
+  int   archive;
+  u32   codec;
+  u32   qbits;
+  FILE* keys;
+  FILE* ivs;
+  u64   batch;
+  u64   threads;
+} options_t;
+
+
+static int filter(const options_t* o, u64 samples, const char* raw, const char* path) {
+
+  dsp_t d;
+  trace_writer_t w;
+  trace_info_t info;
+  FILE *in = NULL, *out = NULL;
+  float *traces = NULL, *filtered = NULL;
+  u64 n, t, total = 0;
+  double start = now(), busy = 0, mark;
+  int result = 1, writing = 0;
+
+  if (dsp_init(&d, &o->config, samples) < 0) return 1;
+
+  in = fopen(raw, "rb");
+  traces = malloc(o->batch * samples * sizeof(float));
+  filtered = malloc(o->batch * d.out * sizeof(float));
+
+  if (in == NULL || traces == NULL || filtered == NULL) {
+    printf("[ERROR] could not read %s\n", raw);
+    goto done;
+  }
+
+  if (o->archive) {
+    if (trace_writer_open(&w, path, d.out, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+    writing = 1;
+  } else if ((out = fopen(path, "wb")) == NULL) {
+    printf("[ERROR] could not create %s\n", path);
+    goto done;
+  }
+
+  printf("%lu samples to %lu", samples, d.out);
+  if (d.h != NULL) printf(", fir %s of %lu taps, decimation %lu", dsp_kind_name(o->config.fir), d.taps, d.config.factor);
+  if (o->config.iir != DSP_NONE) printf(", iir %s", dsp_kind_name(o->config.iir));
+  if (o->config.clock > 0) printf(", %.3f samples per clock cycle", d.period * d.config.factor);
+  printf("\n");
+
+  while ((n = fread(traces, samples * sizeof(float), o->batch, in)) > 0) {
+    mark = now();
+    if (dsp_run(&d, traces, n, filtered, o->threads) < 0) goto done;
+    busy += now() - mark;
+
+    if (!o->archive) {
+      if (fwrite(filtered, d.out * sizeof(float), n, out) != n) {
+        printf("[ERROR] could not write %s\n", path);
+        goto done;
+      }
+    } else {
+      for (t = 0; t < n; t++) {
+        memset(&info, 0, sizeof(info));
+        if ((o->keys != NULL && next_hex(o->keys, info.key, KEYLENGTH) < 0) ||
+            (o->ivs != NULL && next_hex(o->ivs, info.iv, IVLENGTH) < 0)) {
+          printf("[ERROR] no key or iv for trace %lu\n", total + t);
+          goto done;
+        }
+        if (trace_writer_add(&w, filtered + t * d.out, &info) < 0) goto done;
+      }
+    }
+
+    total += n;
+  }
+
+  if (writing) {
+    writing = 0;
+    if (trace_writer_close(&w) < 0) goto done;
+  }
+
+  printf("%lu traces, %.1f times smaller, %.3f s (%.1f MB/s filtering on %lu threads)\n", total,
+         (double)samples / d.out, now() - start, busy > 0 ? total * samples * sizeof(float) / busy / 1e6 : 0.0,
+         o->threads);
+
+  result = 0;
+
+done:
+  if (writing) trace_writer_close(&w);
+  if (in != NULL) fclose(in);
+  if (out != NULL && fclose(out) != 0) result = 1;
+  free(traces);
+  free(filtered);
+  dsp_free(&d);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-r rate] [-H cutoff | -L cutoff] [-f kind] [-l low] [-u high] [-T taps] [-m factor]\n"
+         "       %*s [-C clock] [-o offset] [-y cycles] [-a] [-c codec] [-q bits] [-k keys] [-i ivs]\n"
+         "       %*s [-b traces] [-t threads] samples raw out\n", name, (int)strlen(name), "", (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u64 samples;
+  int option, result;
+
+  memset(&o, 0, sizeof(o));
+  o.config.rate = 1e9;
+  o.config.factor = 1;
+  o.codec = TRACE_FLOAT;
+  o.qbits = 12;
+  o.batch = 1024;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "r:H:L:f:l:u:T:m:C:o:y:ac:q:k:i:b:t:")) != -1) {
+    switch (option) {
+    case 'r': o.config.rate   = atof(optarg);               break;
+    case 'l': o.config.low    = atof(optarg);               break;
+    case 'u': o.config.high   = atof(optarg);               break;
+    case 'T': o.config.taps   = strtoul(optarg, NULL, 10);  break;
+    case 'm': o.config.factor = strtoul(optarg, NULL, 10);  break;
+    case 'C': o.config.clock  = atof(optarg);               break;
+    case 'o': o.config.offset = atof(optarg);               break;
+    case 'y': o.config.cycles = strtoul(optarg, NULL, 10);  break;
+    case 'a': o.archive       = 1;                          break;
+    case 'q': o.qbits         = (u32)atoi(optarg);          break;
+    case 'b': o.batch         = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads       = strtoul(optarg, NULL, 10);  break;
+    case 'H':
+    case 'L':
+      o.config.iir = (option == 'H') ? DSP_HIGHPASS : DSP_LOWPASS;
+      o.config.iir_cutoff = atof(optarg);
+      break;
+    case 'f':
+      if (dsp_kind_parse(optarg, &o.config.fir) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'c':
+      if (trace_codec_parse(optarg, &o.codec) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+    case 'i':
+      if ((option == 'k' ? (o.keys = fopen(optarg, "r")) : (o.ivs = fopen(optarg, "r"))) == NULL) {
+        printf("[ERROR] could not open %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (argc - optind != 3 || o.batch == 0 || o.threads == 0 || o.config.factor == 0 ||
+      (samples = strtoul(argv[optind], NULL, 10)) == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  result = filter(&o, samples, argv[optind + 1], argv[optind + 2]);
+
+  if (o.keys != NULL) fclose(o.keys);
+  if (o.ivs != NULL) fclose(o.ivs);
+
+  return result;
+}
@@ -0,0 +1,127 @@
+/*
+ * fisher.c
+ *
+ * Fisher z confidence bands and trace count prediction (see fisher.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "fisher.h"
+
+#define R_LIMIT 0.999999
+
+
+/***
+ * normal_quantile
+ *
+ * the x with Phi(x) = p, from Acklam's rational approximation refined by
+ * one Halley step on erfc (about 1e-15 relative)
+ *
+ */
+double normal_quantile(double p) {
+
+  static const double a[6] = { -3.969683028665376e+01,  2.209460984245205e+02, -2.759285104469687e+02,
+                                1.383577518672690e+02, -3.066479806614716e+01,  2.506628277459239e+00 };
+  static const double b[5] = { -5.447609879822406e+01,  1.615858368580409e+02, -1.556989798598866e+02,
+                                6.680131188771972e+01, -1.328068155288572e+01 };
+  static const double c[6] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00,  4.374664141464968e+00,  2.938163982698783e+00 };
+  static const double d[4] = {  7.784695709041462e-03,  3.224671290700398e-01,  2.445134137142996e+00,
+                                3.754408661907416e+00 };
+  double q, t, x, e, u;
+
+  if (p <= 0) return -HUGE_VAL;
+  if (p >= 1) return HUGE_VAL;
+
+  if (p < 0.02425) {
+    q = sqrt(-2 * log(p));
+    x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+        ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  } else if (p > 1 - 0.02425) {
+    q = sqrt(-2 * log(1 - p));
+    x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+         ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  } else {
+    q = p - 0.5;
+    t = q * q;
+    x = (((((a[0] * t + a[1]) * t + a[2]) * t + a[3]) * t + a[4]) * t + a[5]) * q /
+        (((((b[0] * t + b[1]) * t + b[2]) * t + b[3]) * t + b[4]) * t + 1);
+  }
+
+  e = 0.5 * erfc(-x / sqrt(2)) - p;
+  u = e * sqrt(2 * M_PI) * exp(x * x / 2);
+
+  return x - u / (1 + x * u / 2);
+}
+
+
+/***
+ * fisher_band
+ *
+ * the band of the given confidence around a correlation after a number
+ * of traces (the whole [-1, 1] below four traces)
+ *
+ */
+void fisher_band(double r, u64 traces, double confidence, fisher_band_t* band) {
+
+  double z, half;
+
+  band->r = r;
+  band->lower = -1;
+  band->upper = 1;
+
+  if (traces < 4) return;
+
+  z = atanh(fmax(fmin(r, R_LIMIT), -R_LIMIT));
+  half = normal_quantile((1 + confidence) / 2) / sqrt((double)(traces - 3));
+
+  band->lower = tanh(z - half);
+  band->upper = tanh(z + half);
+
+  return;
+}
+
+
+/***
+ * fisher_bands
+ *
+ * the band of every hypothesis of a correlation engine at its peak
+ * column, band[hypotheses]
+ *
+ */
+void fisher_bands(const cpa_t* c, double confidence, fisher_band_t* band) {
+
+  u64 k, column;
+
+  for (k = 0; k < c->hypotheses; k++) {
+    fisher_band(cpa_peak(c, k, &column), c->traces, confidence, &band[k]);
+    band[k].column = column;
+  }
+
+  return;
+}
+
+
+/***
+ * fisher_traces
+ *
+ * the traces after which a hypothesis correlating right beats one
+ * correlating wrong in all of a number of comparisons with the given
+ * probability; HUGE_VAL if it does not correlate better
+ *
+ */
+double fisher_traces(double right, double wrong, double probability, u64 comparisons) {
+
+  double dz = atanh(fmax(fmin(right, R_LIMIT), -R_LIMIT)) - atanh(fmax(fmin(wrong, R_LIMIT), -R_LIMIT));
+  double q;
+
+  if (!(dz > 0)) return HUGE_VAL;
+
+  q = normal_quantile(1 - (1 - probability) / (double)(comparisons ? comparisons : 1));
+  if (q < 0) q = 0;
+
+  return ceil(3 + 2 * q * q / (dz * dz));
+}
@@ -0,0 +1,47 @@
+/*
+ * fisher.h
+ *
+ * confidence bands of streaming correlations and the traces an attack
+ * needs, from the Fisher z transform
+ *
+ * after n traces z = atanh(r) is close to normal with mean atanh(rho)
+ * and variance 1 / (n - 3), whatever the true correlation rho. A band of
+ * confidence c is therefore tanh(z -+ q / sqrt(n - 3)) with q the normal
+ * quantile of (1 + c) / 2.
+ *
+ * the right hypothesis beats a wrong one once z_right - z_wrong > 0,
+ * which after n traces happens with probability
+ * Phi((z_right - z_wrong) / sqrt(2 / (n - 3))). Solving for n with the
+ * correlations measured so far predicts the traces needed for a success
+ * probability; with several comparisons that must all go right each is
+ * asked for 1 - (1 - p) / comparisons (union bound).
+ *
+ * the bands are those of each hypothesis' peak column. Picking the peak
+ * out of many columns biases it upwards a little, so predictions from
+ * few traces are optimistic.
+ *
+ */
+
+#ifndef FISHER_H
+#define FISHER_H
+
+#include "trivium.h"
+#include "cpa.h"
+
+
+typedef struct {
+  double r;                             // at the peak column
+  u64    column;
+  double lower;
+  double upper;
+} fisher_band_t;
+
+
+double normal_quantile(double p);
+
+void   fisher_band(double r, u64 traces, double confidence, fisher_band_t* band);
+void   fisher_bands(const cpa_t* c, double confidence, fisher_band_t* band);
+
+double fisher_traces(double right, double wrong, double probability, u64 comparisons);
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * fold.c
+ *
+ * folding of repeated captures into mean and variance traces (see
+ * fold.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "fold.h"
+
+
+int fold_alloc(fold_t* f, u64 samples, int global, double sigmas) {
+
+  memset(f, 0, sizeof(*f));
+  f->samples = samples;
+  f->global = global;
+  f->sigmas = sigmas;
+
+  f->reference = calloc(samples, sizeof(double));
+  f->out = malloc(samples * sizeof(float));
+
+  if (f->reference == NULL || f->out == NULL) {
+    fold_free(f);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void drop_groups(fold_t* f) {
+
+  u64 i;
+
+  for (i = 0; i < f->groups; i++) {
+    free(f->group[i].mean);
+    free(f->group[i].m2);
+  }
+  f->groups = 0;
+
+  if (f->slot != NULL) memset(f->slot, 0, f->slots * sizeof(u64));
+
+  return;
+}
+
+
+void fold_free(fold_t* f) {
+
+  drop_groups(f);
+  free(f->group);
+  free(f->slot);
+  free(f->reference);
+  free(f->out);
+
+  f->group = NULL;
+  f->slot = NULL;
+  f->reference = NULL;
+  f->out = NULL;
+  f->capacity = f->slots = 0;
+
+  return;
+}
+
+
+
+/**********
+ * Groups *
+ **********/
+
+
+
+static inline int same_pair(const trace_info_t* a, const trace_info_t* b) {
+  return memcmp(a->key, b->key, KEYLENGTH) == 0 && memcmp(a->iv, b->iv, IVLENGTH) == 0;
+}
+
+
+// fnv-1a over key and iv
+static u64 pair_hash(const trace_info_t* info) {
+
+  u64 h = 0xCBF29CE484222325ull, i;
+
+  for (i = 0; i < KEYLENGTH; i++) h = (h ^ info->key[i]) * 0x100000001B3ull;
+  for (i = 0; i < IVLENGTH; i++) h = (h ^ info->iv[i]) * 0x100000001B3ull;
+
+  return h;
+}
+
+
+/***
+ * rehash
+ *
+ * a table of twice the slots, at least four times the open groups
+ *
+ */
+static int rehash(fold_t* f) {
+
+  u64 slots = f->slots ? 2 * f->slots : 1024, *slot = calloc(slots, sizeof(u64)), i, s;
+
+  if (slot == NULL) return -1;
+
+  for (i = 0; i < f->groups; i++) {
+    for (s = pair_hash(&f->group[i].info) & (slots - 1); slot[s] != 0; s = (s + 1) & (slots - 1));
+    slot[s] = i + 1;
+  }
+
+  free(f->slot);
+  f->slot = slot;
+  f->slots = slots;
+
+  return 0;
+}
+
+
+/***
+ * find_group
+ *
+ * the open group of a pair, opened if there is none; -1 out of memory
+ *
+ */
+static int64_t find_group(fold_t* f, const trace_info_t* info) {
+
+  fold_group_t* g;
+  u64 s = 0;
+
+  if (!f->global) {
+    if (f->groups > 0 && same_pair(&f->group[0].info, info)) return 0;
+  } else {
+    if (4 * (f->groups + 1) > f->slots && rehash(f) < 0) return -1;
+
+    for (s = pair_hash(info) & (f->slots - 1); f->slot[s] != 0; s = (s + 1) & (f->slots - 1)) {
+      if (same_pair(&f->group[f->slot[s] - 1].info, info)) return (int64_t)(f->slot[s] - 1);
+    }
+  }
+
+  if (f->groups == f->capacity) {
+    g = realloc(f->group, (f->capacity ? 2 * f->capacity : 16) * sizeof(fold_group_t));
+    if (g == NULL) return -1;
+    f->group = g;
+    f->capacity = f->capacity ? 2 * f->capacity : 16;
+  }
+
+  g = &f->group[f->groups];
+  memset(g, 0, sizeof(*g));
+  g->info = *info;
+  g->mean = calloc(f->samples, sizeof(double));
+  g->m2 = calloc(f->samples, sizeof(double));
+
+  if (g->mean == NULL || g->m2 == NULL) {
+    free(g->mean);
+    free(g->m2);
+    return -1;
+  }
+
+  if (f->global) f->slot[s] = f->groups + 1;
+
+  return (int64_t)f->groups++;
+}
+
+
+/***
+ * write_group
+ *
+ * the mean and the unbiased variance of a group; a group whose every
+ * capture was rejected has nothing to write
+ *
+ */
+static int write_group(fold_t* f, const fold_group_t* g) {
+
+  double noise = 0;
+  u64 i;
+
+  if (g->n == 0) return 0;
+
+  for (i = 0; i < f->samples; i++) f->out[i] = (float)g->mean[i];
+  if (trace_writer_add(f->mean, f->out, &g->info) < 0) return -1;
+
+  for (i = 0; i < f->samples; i++) {
+    f->out[i] = (g->n > 1) ? (float)(g->m2[i] / (g->n - 1)) : 0.0f;
+    noise += f->out[i];
+  }
+  if (f->variance != NULL && trace_writer_add(f->variance, f->out, &g->info) < 0) return -1;
+
+  if (f->counts != NULL) {
+    for (i = 0; i < KEYLENGTH; i++) fprintf(f->counts, "%02X", g->info.key[i]);
+    fprintf(f->counts, " ");
+    for (i = 0; i < IVLENGTH; i++) fprintf(f->counts, "%02X", g->info.iv[i]);
+    fprintf(f->counts, " %lu %lu\n", g->n, g->rejected);
+  }
+
+  if (g->n > 1) {
+    f->noise += noise / f->samples;
+    f->noisy++;
+    f->folded += g->n;
+  }
+  f->written++;
+
+  return 0;
+}
+
+
+
+/************
+ * Outliers *
+ ************/
+
+
+
+/***
+ * outlier
+ *
+ * score a capture against the reference; kept captures update the
+ * reference and, from the second on, the score statistics
+ *
+ */
+static int outlier(fold_t* f, const float* trace) {
+
+  double score = 0, d, sd;
+  u64 i, scores = f->kept ? f->kept - 1 : 0;
+
+  if (f->kept > 0) {
+    for (i = 0; i < f->samples; i++) {
+      d = trace[i] - f->reference[i];
+      score += d * d;
+    }
+    score /= f->samples;
+
+    if (scores >= FOLD_WARMUP) {
+      sd = sqrt(f->score_m2 / (scores - 1));
+      if (score > f->score_mean + f->sigmas * sd) return 1;
+    }
+
+    d = score - f->score_mean;
+    f->score_mean += d / (scores + 1);
+    f->score_m2 += d * (score - f->score_mean);
+  }
+
+  f->kept++;
+  for (i = 0; i < f->samples; i++) f->reference[i] += (trace[i] - f->reference[i]) / f->kept;
+
+  return 0;
+}
+
+
+
+/********
+ * Fold *
+ ********/
+
+
+
+/***
+ * fold_add
+ *
+ * one capture; a capture of another pair first writes the open group,
+ * unless global
+ *
+ */
+int fold_add(fold_t* f, const float* trace, const trace_info_t* info) {
+
+  fold_group_t* g;
+  int64_t k;
+  double d;
+  u64 i;
+
+  if (!f->global && f->groups > 0 && !same_pair(&f->group[0].info, info) && fold_flush(f) < 0) return -1;
+
+  if ((k = find_group(f, info)) < 0) {
+    printf("[ERROR] out of memory\n");
+    return -1;
+  }
+  g = &f->group[k];
+  f->captures++;
+
+  if (f->sigmas > 0 && outlier(f, trace)) {
+    g->rejected++;
+    f->rejected++;
+    return 0;
+  }
+
+  g->n++;
+  for (i = 0; i < f->samples; i++) {
+    d = trace[i] - g->mean[i];
+    g->mean[i] += d / g->n;
+    g->m2[i] += d * (trace[i] - g->mean[i]);
+  }
+
+  return 0;
+}
+
+
+/***
+ * fold_flush
+ *
+ * write every open group
+ *
+ */
+int fold_flush(fold_t* f) {
+
+  u64 i;
+  int result = 0;
+
+  for (i = 0; i < f->groups && result == 0; i++) result = write_group(f, &f->group[i]);
+  drop_groups(f);
+
+  return result;
+}
+
+
+void fold_report(const fold_t* f) {
+
+  double n = f->noisy ? (double)f->folded / f->noisy : 0;
+
+  printf("%lu captures, %lu rejected, %lu groups, %.2f kept per group\n", f->captures, f->rejected, f->written,
+         f->written ? (double)(f->captures - f->rejected) / f->written : 0.0);
+
+  if (f->noisy > 0) {
+    printf("noise variance %.4g per capture, %.4g in a folded trace of %.1f captures (%.1f dB)\n",
+           f->noise / f->noisy, f->noise / f->noisy / n, n, 10 * log10(n));
+  }
+
+  return;
+}
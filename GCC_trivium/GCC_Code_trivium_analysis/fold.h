@@ -0,0 +1,93 @@
+/*
+ * fold.h
+ *
+ * folding of repeated captures: the firmware encrypts the same key and
+ * iv until it is sent 'z', so acquire -r and emulate -r record several
+ * traces of every pair. Folding keeps one trace per pair, the mean of
+ * its captures, and per sample their variance; averaging n captures
+ * divides the noise variance by n, for the attack engines that scan one
+ * trace per pair.
+ *
+ * every group keeps its count, mean and M2 per sample, updated capture
+ * by capture (Welford), so nothing is buffered:
+ *
+ *   n += 1,  d = x - mean,  mean += d / n,  M2 += d (x - mean)
+ *
+ * a group is written when a capture of another pair arrives, or, with
+ * global set, only at the end: then captures of a pair that are not
+ * adjacent fold together too, at the cost of every group held in memory.
+ * Groups come out in the order their pairs first appear.
+ *
+ * outliers (a missed trigger, a glitch) are taken against the running
+ * mean of every kept capture, whatever its key: the score of a capture
+ * is its mean squared distance from it, and after FOLD_WARMUP captures a
+ * score more than sigmas standard deviations above the mean kept score
+ * drops the capture. Rejected captures change neither the groups nor
+ * the statistics.
+ *
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdio.h>
+
+#include "traces.h"
+
+#define FOLD_WARMUP 16
+
+
+typedef struct {
+  trace_info_t info;
+  u64     n;
+  u64     rejected;
+  double* mean;                         // [samples]
+  double* m2;                           // [samples]
+} fold_group_t;
+
+
+/***
+ * fold_t
+ *
+ * the caller opens the writers: mean takes the folded traces, variance
+ * (optional) their variances in the same order, counts (optional) a
+ * line "key iv n rejected" per group
+ *
+ */
+typedef struct {
+  u64     samples;
+  int     global;
+  double  sigmas;                       // 0: keep every capture
+
+  trace_writer_t* mean;
+  trace_writer_t* variance;
+  FILE*   counts;
+
+  fold_group_t* group;                  // open groups, in order of appearance
+  u64     groups, capacity;
+  u64*    slot;                         // open addressing on key and iv, group + 1
+  u64     slots;
+
+  double* reference;                    // [samples], mean of the kept captures
+  u64     kept;
+  double  score_mean, score_m2;
+  float*  out;                          // [samples]
+
+  u64     captures;
+  u64     rejected;
+  u64     written;                      // groups
+  double  noise;                        // summed mean variance of the groups of n > 1
+  u64     noisy;                        // and their number
+  u64     folded;                       // captures in them
+} fold_t;
+
+
+int  fold_alloc(fold_t* f, u64 samples, int global, double sigmas);
+void fold_free(fold_t* f);
+
+int  fold_add(fold_t* f, const float* trace, const trace_info_t* info);
+int  fold_flush(fold_t* f);
+
+void fold_report(const fold_t* f);
+
+#endif
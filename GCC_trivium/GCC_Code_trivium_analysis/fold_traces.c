@@ -0,0 +1,174 @@
+/*
+ * fold_traces.c
+ *
+ * fold the repeated captures of every key and iv of an archive into one
+ * mean trace, with their variance in a second archive (see fold.h)
+ *
+ *  build : gcc -O3 -march=native -o fold_traces fold_traces.c fold.c traces.c -lm
+ *  run   : ./fold_traces [-g] [-z sigmas] [-v variance] [-x counts] [-c codec] [-q bits]
+ *                        [-n traces] [-b traces] [-t threads] archive out
+ *
+ *   -g           fold every capture of a pair, not only adjacent ones
+ *                (holds every group in memory)
+ *   -z sigmas    drop captures this many standard deviations further
+ *                from the running mean than usual (default 0, keep all)
+ *   -v variance  archive of the variance traces, in the order of out
+ *   -x counts    "key iv captures rejected" per folded trace
+ *   -c codec     of the output archives: float, quant or rice (default
+ *                float, the means are finer than the scope's codes)
+ *   -q bits      quantization bits (default 12)
+ *   -n traces    fold at most this many captures
+ *   -b traces    captures per read (default 4096)
+ *   -t threads   decoding threads (default: online cpus)
+ *
+ * acquire -r and emulate -r write the repeats of a pair next to each
+ * other, which is all the default needs; acquire -m folds while it
+ * captures instead.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "fold.h"
+#include "traces.h"
+#include "util.h"
+
+
+typedef struct {
+  int    global;
+  double sigmas;
+  const char* variance;
+  const char* counts;
+  u32    codec;
+  u32    qbits;
+  u64    traces;
+  u64    batch;
+  u64    threads;
+} options_t;
+
+
+static int fold_archive(const options_t* o, const char* path, const char* out) {
+
+  trace_archive_t a;
+  trace_writer_t mean, variance;
+  fold_t f;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  u64 i, n, t, count;
+  double start = now();
+  int result = 1, means = 0, variances = 0;
+
+  memset(&f, 0, sizeof(f));
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info = malloc(o->batch * sizeof(trace_info_t));
+
+  if (traces == NULL || info == NULL || fold_alloc(&f, a.format.samples, o->global, o->sigmas) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (trace_writer_open(&mean, out, a.format.samples, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+  means = 1;
+  f.mean = &mean;
+
+  if (o->variance != NULL) {
+    if (trace_writer_open(&variance, o->variance, a.format.samples, TRACE_CHUNK, o->codec, o->qbits) < 0) goto done;
+    variances = 1;
+    f.variance = &variance;
+  }
+
+  if (o->counts != NULL && (f.counts = fopen(o->counts, "w")) == NULL) {
+    printf("[ERROR] could not create %s\n", o->counts);
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+    for (t = 0; t < n; t++) {
+      if (fold_add(&f, traces + t * a.format.samples, &info[t]) < 0) goto done;
+    }
+  }
+
+  if (fold_flush(&f) < 0) goto done;
+
+  fold_report(&f);
+  printf("%lu traces of %lu samples in %.1f s\n", f.written, a.format.samples, now() - start);
+
+  result = 0;
+
+done:
+  if (means && trace_writer_close(&mean) < 0) result = 1;
+  if (variances && trace_writer_close(&variance) < 0) result = 1;
+  if (f.counts != NULL && fclose(f.counts) != 0) result = 1;
+  fold_free(&f);
+  free(traces);
+  free(info);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  int w = (int)strlen(name);
+
+  printf("usage: %s [-g] [-z sigmas] [-v variance] [-x counts] [-c codec] [-q bits]\n"
+         "       %*s [-n traces] [-b traces] [-t threads] archive out\n", name, w, "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.codec = TRACE_FLOAT;
+  o.qbits = 12;
+  o.batch = 4096;
+  o.threads = (cpus > 0) ? (u64)cpus : 1;
+
+  while ((option = getopt(argc, argv, "gz:v:x:c:q:n:b:t:")) != -1) {
+    switch (option) {
+    case 'g': o.global   = 1;                          break;
+    case 'z': o.sigmas   = atof(optarg);               break;
+    case 'v': o.variance = optarg;                     break;
+    case 'x': o.counts   = optarg;                     break;
+    case 'q': o.qbits    = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'n': o.traces   = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch    = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads  = strtoul(optarg, NULL, 10);  break;
+    case 'c':
+      if (trace_codec_parse(optarg, &o.codec) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 2 || o.batch == 0 || o.threads == 0 || o.sigmas < 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return fold_archive(&o, argv[optind], argv[optind + 1]);
+}
@@ -0,0 +1,257 @@
+/*
+ * gen_campaign.c
+ *
+ * generate the keys, ivs and plain texts of an acquisition campaign (see
+ * campaign.h)
+ *
+ *  build : gcc -O3 -march=native -pthread -o gen_campaign gen_campaign.c campaign.c
+ *  run   : ./gen_campaign [options] binary campaign
+ *          ./gen_campaign [options] text directory
+ *          ./gen_campaign info campaign [first [count]]
+ *
+ *   -d design    uniform, tvla, walking or chosen (default uniform)
+ *   -n records   records in the campaign (default 1000000)
+ *   -s seed      generator seed (default 1)
+ *   -k key       fixed key (default drawn from the seed, zero for walking)
+ *   -i iv        fixed iv (default drawn from the seed, zero for walking
+ *                and chosen)
+ *   -p plain     fixed plain text, 128 hex digits (default all zero)
+ *   -P           draw the plain text of every record (uniform, tvla)
+ *   -c cube      iv bits the chosen design runs through, comma separated
+ *                state order indices as cube_sum takes them
+ *   -w stride    bits between walking records (default 9)
+ *   -t threads   generating threads (default: online cpus)
+ *
+ * text writes keys.txt, ivs.txt and plain.txt into an existing directory,
+ * with groups.txt for tvla; info prints a campaign's header and records
+ * (default the first 8).
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "campaign.h"
+#include "util.h"
+
+
+typedef struct {
+  campaign_t c;
+  int   has_key, has_iv, has_plain;
+  u8    key[KEYLENGTH];
+  u8    iv[IVLENGTH];
+  u8    plain[CAMPAIGN_PLAIN];
+  u64   threads;
+} options_t;
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+static void print_hex(const u8* bytes, u64 length) {
+
+  u64 i;
+
+  for (i = 0; i < length; i++) printf("%02X", bytes[i]);
+
+  return;
+}
+
+
+/***
+ * parse_cube
+ *
+ * comma separated list of iv bit indices
+ *
+ */
+static int parse_cube(const char* text, campaign_t* c) {
+
+  char* end;
+  u64 index;
+
+  c->cube_bits = 0;
+
+  while (*text) {
+    index = strtoul(text, &end, 10);
+    if (end == text || index >= 8 * IVLENGTH || c->cube_bits == CAMPAIGN_MAX_CUBE) return -1;
+
+    c->cube[c->cube_bits++] = (u8)index;
+
+    text = end;
+    if (*text == ',') text++;
+    else if (*text != 0) return -1;
+  }
+
+  return c->cube_bits > 0 ? 0 : -1;
+}
+
+
+
+/*********
+ * Modes *
+ *********/
+
+
+
+static int info(const char* path, u64 first, u64 count) {
+
+  campaign_file_t f;
+  campaign_record_t r;
+  const campaign_t* c = &f.campaign;
+  u64 i;
+  u32 j;
+
+  if (campaign_open(&f, path) < 0) return 1;
+
+  printf("design  %s\n", campaign_design_name(c->design));
+  printf("records %lu\n", c->records);
+  printf("seed    %lu\n", c->seed);
+  printf("key     ");
+  print_hex(c->key, KEYLENGTH);
+  printf("\niv      ");
+  print_hex(c->iv, IVLENGTH);
+  printf("\nplain   %s\n", (c->flags & CAMPAIGN_RANDOM_PLAIN) ? "random" : "fixed");
+  if (c->design == CAMPAIGN_WALKING) printf("stride  %u\n", c->stride);
+  if (c->design == CAMPAIGN_CHOSEN) {
+    printf("cube    ");
+    for (j = 0; j < c->cube_bits; j++) printf("%s%u", j ? "," : "", c->cube[j]);
+    printf("\n");
+  }
+
+  if (first >= c->records) count = 0;
+  else if (count > c->records - first) count = c->records - first;
+
+  if (count > 0) printf("\n  record  key                   iv                    group\n");
+
+  for (i = first; i < first + count; i++) {
+    if (campaign_read(&f, i, 1, &r) < 0) {
+      campaign_close(&f);
+      return 1;
+    }
+    printf("%8lu  ", i);
+    print_hex(r.key, KEYLENGTH);
+    printf("  ");
+    print_hex(r.iv, IVLENGTH);
+    printf("  %u\n", r.group);
+  }
+
+  campaign_close(&f);
+
+  return 0;
+}
+
+
+static int generate(options_t* o, int text, const char* path) {
+
+  campaign_t* c = &o->c;
+  double start = now(), seconds;
+  int result;
+
+  if (o->has_key) memcpy(c->key, o->key, KEYLENGTH);
+  if (o->has_iv) memcpy(c->iv, o->iv, IVLENGTH);
+  if (o->has_plain) memcpy(c->plain, o->plain, CAMPAIGN_PLAIN);
+
+  result = text ? campaign_write_text(c, path, o->threads) : campaign_write(c, path, o->threads);
+  if (result < 0) return 1;
+
+  seconds = now() - start;
+  printf("%lu %s records in %.3f s, %.2f million records/s\n", c->records, campaign_design_name(c->design),
+         seconds, c->records / seconds / 1e6);
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-d design] [-n records] [-s seed] [-k key] [-i iv] [-p plain] [-P]\n"
+         "       %*s [-c cube] [-w stride] [-t threads] binary|text path\n"
+         "       %s info campaign [first [count]]\n", name, (int)strlen(name), "", name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u32 design = CAMPAIGN_UNIFORM, flags = 0, stride = 9;
+  u64 records = 1000000, seed = 1;
+  const char* cube = NULL;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "d:n:s:k:i:p:Pc:w:t:")) != -1) {
+    switch (option) {
+    case 'n': records   = strtoul(optarg, NULL, 10);   break;
+    case 's': seed      = strtoul(optarg, NULL, 0);    break;
+    case 'w': stride    = (u32)strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);   break;
+    case 'P': flags    |= CAMPAIGN_RANDOM_PLAIN;       break;
+    case 'c': cube      = optarg;                      break;
+    case 'd':
+      if (campaign_design_parse(optarg, &design) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    case 'i':
+      if (strlen(optarg) != 2 * IVLENGTH || parse_bytes(optarg, o.iv, IVLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_iv = 1;
+      break;
+    case 'p':
+      if (strlen(optarg) != 2 * CAMPAIGN_PLAIN || parse_bytes(optarg, o.plain, CAMPAIGN_PLAIN) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_plain = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind < argc && strcmp(argv[optind], "info") == 0 && argc - optind >= 2 && argc - optind <= 4) {
+    return info(argv[optind + 1], (argc - optind >= 3) ? strtoul(argv[optind + 2], NULL, 10) : 0,
+                (argc - optind >= 4) ? strtoul(argv[optind + 3], NULL, 10) : 8);
+  }
+
+  campaign_init(&o.c, design, records, seed);
+  o.c.flags = flags;
+  o.c.stride = stride;
+
+  if (argc - optind != 2 || o.threads == 0 || (strcmp(argv[optind], "binary") != 0 && strcmp(argv[optind], "text") != 0) ||
+      (cube != NULL && parse_cube(cube, &o.c) < 0)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return generate(&o, strcmp(argv[optind], "text") == 0, argv[optind + 1]);
+}
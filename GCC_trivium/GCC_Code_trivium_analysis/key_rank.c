@@ -0,0 +1,452 @@
+/*
+ * key_rank.c
+ *
+ * how far is the correct key from the top of the attack's key ranking
+ *
+ *  build : gcc -O3 -march=native -pthread -o key_rank key_rank.c rank.c -lm
+ *  run   : ./key_rank -k key [-n traces] [-b bins] scores
+ *          ./key_rank -S [-a attacks] [-n counts] [-e sigma] [-w bits] [-b bins] [-t threads] [-s seed]
+ *
+ * rank mode reads a score table, one line per subkey (in the order of
+ * rank.h) holding its 2^bits scores, larger is better, '#' starts a
+ * comment. With -n the scores are correlations after that many traces
+ * and are turned into log likelihoods first. It prints log2 of the rank
+ * of key and the bounds of the estimate.
+ *
+ * simulation mode (-S) runs many attacks on simulated leakage in
+ * parallel and reports guessing entropy and success rates against the
+ * number of traces:
+ *
+ *   -a attacks   simulated attacks per trace count (default 100)
+ *   -n counts    comma separated trace counts (default 10,20,50,100,200,500)
+ *   -e sigma     noise standard deviation (default 4)
+ *   -w bits      subkey width, dividing 80 (default 8)
+ *
+ * every subkey k of an attack leaks HW(x ^ k) + noise for random inputs
+ * x, and is scored by the correlation with HW(x ^ g) for every guess g
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rank.h"
+#include "util.h"
+
+#define MAX_COUNTS  32
+#define MAX_THREADS 256
+
+#define LINE_MAX_LENGTH (1 << 20)
+
+
+typedef struct {
+  u64      attacks;
+  u64      counts;
+  u64      count[MAX_COUNTS];     // ascending trace counts
+  double   sigma;
+  u64      width;
+  u64      bins;
+  u64      seed;
+  u64      next;
+  rank_t*  rank;                  // [attack][count]
+  double*  first;                 // fraction of subkeys ranked first, [attack][count]
+  double*  seconds;               // time spent in rank_estimate(), [attack][count]
+  int      error;                 // set when rank_estimate() fails
+} simulation_t;
+
+
+
+/*************
+ * Rank mode *
+ *************/
+
+
+
+/***
+ * read_scores
+ *
+ * parse a score table file, one subkey per line
+ *
+ */
+static int read_scores(const char* path, score_table_t* t, u64 traces) {
+
+  FILE* fp = fopen(path, "r");
+  char* line = malloc(LINE_MAX_LENGTH);
+  char *p, *end;
+  double* values = malloc(((u64)1 << MAX_SUBKEYBITS) * sizeof(double));
+  double* scores[MAX_SUBKEYS];
+  u64 bits[MAX_SUBKEYS], subkeys = 0, count, i, number = 0;
+  int result = -1;
+
+  if (fp == NULL || line == NULL || values == NULL) {
+    printf("[ERROR] could not read %s\n", path);
+    goto done;
+  }
+
+  while (fgets(line, LINE_MAX_LENGTH, fp) != NULL) {
+    number++;
+    if ((p = strchr(line, '#')) != NULL) *p = 0;
+
+    for (p = line, count = 0; ; p = end) {
+      double v = strtod(p, &end);
+      if (end == p) break;
+      if (count == ((u64)1 << MAX_SUBKEYBITS)) goto malformed;
+      values[count++] = traces ? fisher_score(v, traces) : v;
+    }
+
+    if (count == 0) continue;
+    if ((count & (count - 1)) != 0 || count == 1 || subkeys == MAX_SUBKEYS) goto malformed;
+
+    bits[subkeys] = (u64)__builtin_ctzll(count);
+    scores[subkeys] = malloc(count * sizeof(double));
+    if (scores[subkeys] == NULL) goto done;
+    memcpy(scores[subkeys], values, count * sizeof(double));
+    subkeys++;
+  }
+
+  if (score_table_alloc(t, subkeys, bits) < 0) {
+    printf("[ERROR] %s: the subkeys must cover at most %d key bits\n", path, KEYBITS);
+    goto done;
+  }
+
+  for (i = 0; i < subkeys; i++) memcpy(t->score[i], scores[i], ((u64)1 << bits[i]) * sizeof(double));
+
+  result = 0;
+  goto done;
+
+malformed:
+  printf("[ERROR] %s:%lu: a subkey needs 2^bits scores, 2 <= 2^bits <= %d\n", path, number, 1 << MAX_SUBKEYBITS);
+
+done:
+  for (i = 0; i < subkeys; i++) free(scores[i]);
+  if (fp != NULL) fclose(fp);
+  free(line);
+  free(values);
+
+  return result;
+}
+
+
+static int rank_mode(const char* path, const u8* key, u64 traces, u64 bins) {
+
+  score_table_t t;
+  u64 correct[MAX_SUBKEYS], i;
+  rank_t rank;
+  double start;
+
+  if (read_scores(path, &t, traces) < 0) return 1;
+
+  subkey_values(&t, key, correct);
+
+  start = now();
+  if (rank_estimate(&t, correct, bins, &rank) < 0) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  printf("%lu subkeys covering %lu key bits\n", t.subkeys, score_table_covered(&t));
+  for (i = 0; i < t.subkeys; i++) printf("  subkey %2lu: %2lu bits, correct value %lu\n", i, t.bits[i], correct[i]);
+  printf("log2 rank %.2f, between %.2f and %.2f (%.3f ms)\n",
+         rank.estimate, rank.lower, rank.upper, 1e3 * (now() - start));
+
+  score_table_free(&t);
+
+  return 0;
+}
+
+
+
+/*******************
+ * Simulation mode *
+ *******************/
+
+
+
+/***
+ * gauss
+ *
+ * standard normal sample (Box-Muller)
+ *
+ */
+static double gauss(u64* state) {
+
+  double u1 = ((splitmix64(state) >> 11) + 1.0) * 0x1.0p-53;
+  double u2 = (splitmix64(state) >> 11) * 0x1.0p-53;
+
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+/***
+ * simulate
+ *
+ * worker: whole attacks, each with its own key and generator, taken
+ * from a shared counter. Traces are folded into per input sums so that
+ * scoring all guesses costs 4^bits whatever the trace count.
+ *
+ */
+static void* simulate(void* arg) {
+
+  simulation_t* sim = arg;
+  u64 values = (u64)1 << sim->width, subkeys = KEYBITS / sim->width;
+  u64 bits[MAX_SUBKEYS], correct[MAX_SUBKEYS], attack, i, k, x, g, c, traces, first;
+  double *n = calloc(subkeys * values, sizeof(double));
+  double *sl = calloc(subkeys * values, sizeof(double));
+  double sll[MAX_SUBKEYS], start;
+  score_table_t t;
+  u64 state;
+
+  for (i = 0; i < subkeys; i++) bits[i] = sim->width;
+
+  // the other workers take the attacks of one that cannot start
+  if (n == NULL || sl == NULL || score_table_alloc(&t, subkeys, bits) < 0) {
+    free(n);
+    free(sl);
+    return NULL;
+  }
+
+  while (!__atomic_load_n(&sim->error, __ATOMIC_RELAXED) &&
+         (attack = __atomic_fetch_add(&sim->next, 1, __ATOMIC_RELAXED)) < sim->attacks) {
+    state = sim->seed ^ (0xA5A5A5A5A5A5A5A5ULL * (attack + 1));
+
+    memset(n, 0, subkeys * values * sizeof(double));
+    memset(sl, 0, subkeys * values * sizeof(double));
+    memset(sll, 0, sizeof(sll));
+
+    for (i = 0; i < subkeys; i++) correct[i] = splitmix64(&state) & (values - 1);
+
+    for (c = 0, traces = 0; c < sim->counts; c++) {
+      // add traces up to the next count
+      for (; traces < sim->count[c]; traces++) {
+        for (i = 0; i < subkeys; i++) {
+          double l;
+
+          x = splitmix64(&state) & (values - 1);
+          l = __builtin_popcountll(x ^ correct[i]) + sim->sigma * gauss(&state);
+
+          n[i * values + x] += 1;
+          sl[i * values + x] += l;
+          sll[i] += l * l;
+        }
+      }
+
+      // correlation of every guess, from the per input sums
+      for (i = 0, first = 0; i < subkeys; i++) {
+        double sum_l = 0, best = -2;
+
+        for (x = 0; x < values; x++) sum_l += sl[i * values + x];
+
+        for (g = 0; g < values; g++) {
+          double sh = 0, shh = 0, shl = 0, h, r, vh, vl;
+
+          for (x = 0; x < values; x++) {
+            h = __builtin_popcountll(x ^ g);
+            sh  += n[i * values + x] * h;
+            shh += n[i * values + x] * h * h;
+            shl += sl[i * values + x] * h;
+          }
+
+          vh = traces * shh - sh * sh;
+          vl = traces * sll[i] - sum_l * sum_l;
+          r = (vh > 0 && vl > 0) ? (traces * shl - sh * sum_l) / sqrt(vh * vl) : 0;
+
+          t.score[i][g] = fisher_score(r, traces);
+          if (t.score[i][g] > best) best = t.score[i][g];
+        }
+
+        if (t.score[i][correct[i]] >= best) first++;
+      }
+
+      k = attack * sim->counts + c;
+
+      start = now();
+      if (rank_estimate(&t, correct, sim->bins, &sim->rank[k]) < 0) {
+        printf("[ERROR] out of memory\n");
+        __atomic_store_n(&sim->error, 1, __ATOMIC_RELAXED);
+        goto done;
+      }
+      sim->seconds[k] = now() - start;
+
+      sim->first[k] = (double)first / subkeys;
+    }
+  }
+
+done:
+  score_table_free(&t);
+  free(n);
+  free(sl);
+
+  return NULL;
+}
+
+
+/***
+ * parse_counts
+ *
+ * ascending comma separated trace counts
+ *
+ */
+static int parse_counts(const char* text, simulation_t* sim) {
+
+  char* end;
+
+  sim->counts = 0;
+
+  while (*text) {
+    if (sim->counts == MAX_COUNTS) return -1;
+
+    sim->count[sim->counts] = strtoul(text, &end, 10);
+    if (end == text || sim->count[sim->counts] < 4) return -1;
+    if (sim->counts > 0 && sim->count[sim->counts] <= sim->count[sim->counts - 1]) return -1;
+    sim->counts++;
+
+    text = end;
+    if (*text == ',') text++;
+    else if (*text != 0) return -1;
+  }
+
+  return sim->counts > 0 ? 0 : -1;
+}
+
+
+static int simulation_mode(simulation_t* sim, u64 threads) {
+
+  pthread_t thread[MAX_THREADS];
+  u64 i, a, k, cells = sim->attacks * sim->counts;
+  double start, seconds, evaluation = 0;
+
+  sim->rank    = malloc(cells * sizeof(rank_t));
+  sim->first   = malloc(cells * sizeof(double));
+  sim->seconds = calloc(cells, sizeof(double));
+  sim->next    = 0;
+  sim->error   = 0;
+
+  if (sim->rank == NULL || sim->first == NULL || sim->seconds == NULL) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  start = now();
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, simulate, sim) != 0) {
+      printf("[ERROR] could not start worker thread\n");
+      return 1;
+    }
+  }
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  if (sim->error) return 1;
+  if (sim->next < sim->attacks) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  seconds = now() - start;
+
+  printf("%lu attacks, %lu bit subkeys, sigma %.2f\n", sim->attacks, sim->width, sim->sigma);
+  printf("  traces  log2 GE  mean log2 rank  subkeys first   SR rank 1   SR rank <= 2^32\n");
+
+  for (k = 0; k < sim->counts; k++) {
+    double mean = 0, ge = 0, first = 0, sr1 = 0, sr32 = 0;
+
+    for (a = 0; a < sim->attacks; a++) {
+      const rank_t* r = &sim->rank[a * sim->counts + k];
+
+      mean  += r->estimate;
+      ge    += exp2(r->estimate);
+      first += sim->first[a * sim->counts + k];
+      sr1   += (r->upper < 0.5);
+      sr32  += (r->upper <= 32);
+      evaluation += sim->seconds[a * sim->counts + k];
+    }
+
+    printf("  %6lu  %7.2f  %14.2f  %13.3f  %10.3f  %16.3f\n", sim->count[k],
+           log2(ge / sim->attacks), mean / sim->attacks, first / sim->attacks,
+           sr1 / sim->attacks, sr32 / sim->attacks);
+  }
+
+  printf("%lu threads: %.3f s, %.3f ms per rank evaluation\n", threads, seconds, 1e3 * evaluation / cells);
+
+  free(sim->rank);
+  free(sim->first);
+  free(sim->seconds);
+
+  return 0;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s -k key [-n traces] [-b bins] scores\n"
+         "       %s -S [-a attacks] [-n counts] [-e sigma] [-w bits] [-b bins] [-t threads] [-s seed]\n",
+         name, name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  simulation_t sim;
+  const char* counts = NULL;
+  u64 threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  u8 key[KEYLENGTH];
+  int has_key = 0, simulation = 0, option;
+
+  memset(&sim, 0, sizeof(sim));
+  sim.attacks = 100;
+  sim.sigma = 4;
+  sim.width = 8;
+  sim.bins = RANK_BINS;
+
+  while ((option = getopt(argc, argv, "k:n:b:Sa:e:w:t:s:")) != -1) {
+    switch (option) {
+    case 'S': simulation  = 1;                             break;
+    case 'n': counts      = optarg;                        break;
+    case 'b': sim.bins    = strtoul(optarg, NULL, 10);     break;
+    case 'a': sim.attacks = strtoul(optarg, NULL, 10);     break;
+    case 'e': sim.sigma   = strtod(optarg, NULL);          break;
+    case 'w': sim.width   = strtoul(optarg, NULL, 10);     break;
+    case 't': threads     = strtoul(optarg, NULL, 10);     break;
+    case 's': sim.seed    = strtoul(optarg, NULL, 0);      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (sim.bins < 2 || threads == 0 || threads > MAX_THREADS) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (simulation) {
+    if (optind != argc || parse_counts(counts ? counts : "10,20,50,100,200,500", &sim) < 0 || sim.attacks == 0 ||
+        sim.width == 0 || sim.width > 12 || KEYBITS % sim.width != 0) {
+      usage(argv[0]);
+      return 2;
+    }
+    return simulation_mode(&sim, threads);
+  }
+
+  if (optind != argc - 1 || !has_key) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return rank_mode(argv[optind], key, counts ? strtoul(counts, NULL, 10) : 0, sim.bins);
+}
@@ -0,0 +1,286 @@
+/*
+ * key_search.c
+ *
+ * joint guesses of the key bits t1 sees over a range of clocks, by
+ * branch and prune enumeration (see prune.h)
+ *
+ *  build : gcc -O3 -march=native -pthread -o key_search key_search.c prune.c monitor.c fisher.c cpa.c \
+ *                                     rank.c targets.c traces.c -lm
+ *  run   : ./key_search [-c first:last] [-w first:count] [-n traces] [-b traces] [-s sigmas]
+ *                       [-l leaves] [-L nodes] [-k key] [-t threads] archive
+ *
+ *   -c clocks    clocks whose t1 makes the levels, in order (default 0:15)
+ *   -w window    samples to correlate with (default all)
+ *   -n traces    use at most this many traces
+ *   -b traces    traces per pass (default 4096)
+ *   -s sigmas    prune guesses whose peak correlation is below this many
+ *                standard deviations of noise, tanh(s / sqrt(n - 3))
+ *                (default 3)
+ *   -l leaves    best surviving guesses to print (default 16)
+ *   -L nodes     stop after this many nodes (default 1e9, 0 for no limit)
+ *   -k key       known key, to tell where the right guess ended up
+ *   -t threads   worker threads (default: online cpus)
+ *
+ * the correlations come from one pass over the archive; the enumeration
+ * only looks them up. Guesses print as key bits 0..79 in state order
+ * (key bit j is s(j + 1), see rank.h), x where the clocks see no bit.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "prune.h"
+#include "monitor.h"
+#include "traces.h"
+#include "util.h"
+
+
+typedef struct {
+  u32   first_clock, last_clock;
+  u64   window, samples;
+  u64   traces;
+  u64   batch;
+  double sigmas;
+  u64   leaves;
+  u64   limit;
+  int   has_key;
+  u8    key[KEYLENGTH];
+  u64   threads;
+} options_t;
+
+
+
+/**********
+ * Report *
+ **********/
+
+
+
+static void print_guess(const prune_t* p, const u64* key) {
+
+  u32 j;
+
+  for (j = 0; j < KEYBITS; j++) {
+    putchar(prune_key_bit(p->chunk, j) ? '0' + prune_key_bit(key, j) : 'x');
+  }
+
+  return;
+}
+
+
+static int same_chunk(const prune_t* p, const u64* a, const u64* b) {
+  return ((a[0] ^ b[0]) & p->chunk[0]) == 0 && ((a[1] ^ b[1]) & p->chunk[1]) == 0;
+}
+
+
+static void report(const options_t* o, const prune_t* p, const monitor_t* m) {
+
+  u64 right[2], i, level, better = 0, tied = 0;
+  double score;
+
+  printf("%lu nodes, %lu pruned, %lu surviving guesses%s\n\n", p->nodes, p->pruned, p->survivors,
+         p->truncated ? " (node limit reached)" : "");
+
+  if (o->has_key) prune_key_of(o->key, right);
+
+  printf("rank       score  key bits\n");
+  for (i = 0; i < p->leaves; i++) {
+    printf("%4lu  %10.2f  ", i + 1, p->leaf[i].score);
+    print_guess(p, p->leaf[i].key);
+    if (o->has_key && same_chunk(p, p->leaf[i].key, right)) printf("  right");
+    printf("\n");
+  }
+
+  if (!o->has_key) return;
+
+  printf("\n");
+  if (!prune_check(p, o->key, &level, &score)) {
+    printf("the right guess was pruned at clock %u\n", m->target[level].target.clock);
+    return;
+  }
+
+  // guesses differing in bits no prediction depends on tie, up to rounding
+  for (i = 0; i < p->leaves; i++) {
+    if (p->leaf[i].score > score * (1 + 1e-9)) better++;
+    else if (p->leaf[i].score >= score * (1 - 1e-9)) tied++;
+  }
+
+  if (better == p->leaves && p->leaves < p->survivors) {
+    printf("the right guess (score %.2f) survives below the %lu printed\n", score, p->leaves);
+  } else {
+    printf("the right guess (score %.2f) ranks %lu of %lu, tied with %lu%s\n", score, better + 1, p->survivors,
+           tied ? tied - 1 : 0, (tied == p->leaves - better && p->leaves < p->survivors) ? " or more" : "");
+  }
+
+  return;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int search(options_t* o, const char* path) {
+
+  trace_archive_t a;
+  monitor_t m;
+  prune_t p;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  u8* ivs = NULL;
+  double (*r)[1 << TARGET_GUESS] = NULL, threshold, start = now(), enumeration;
+  u64 i, n, t, g, count;
+  int result = 1;
+
+  memset(&m, 0, sizeof(m));
+  memset(&p, 0, sizeof(p));
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+  if (o->window >= a.format.samples || count < 4) {
+    printf("[ERROR] the archive has %lu traces of %lu samples\n", a.format.traces, a.format.samples);
+    goto done;
+  }
+  if (o->samples == 0 || o->window + o->samples > a.format.samples) o->samples = a.format.samples - o->window;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info   = malloc(o->batch * sizeof(trace_info_t));
+  ivs    = malloc(o->batch * IVLENGTH);
+
+  if (traces == NULL || info == NULL || ivs == NULL ||
+      monitor_init(&m, o->first_clock, o->last_clock, o->samples, o->batch, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+    for (t = 0; t < n; t++) memcpy(ivs + t * IVLENGTH, info[t].iv, IVLENGTH);
+
+    if (monitor_add(&m, traces + o->window, a.format.samples, n, ivs) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+  }
+
+  fisher_bands(&m.cpa, MONITOR_CONFIDENCE, m.band);
+
+  threshold = tanh(o->sigmas / sqrt((double)(count - 3)));
+  r = malloc(m.targets * sizeof(*r));
+
+  if (r == NULL || prune_init(&p, count, threshold, o->leaves, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+  p.limit = o->limit;
+
+  for (i = 0; i < m.targets; i++) {
+    for (g = 0; g < ((u64)1 << m.target[i].target.guess_bits); g++) r[i][g] = m.band[m.target[i].first + g].r;
+    prune_add_level(&p, &m.target[i].target, r[i]);
+  }
+
+  printf("%lu traces, %lu samples, t1 of %lu clocks, %u key bits jointly\n", count, o->samples, m.targets,
+         __builtin_popcountll(p.chunk[0]) + __builtin_popcountll(p.chunk[1]));
+  printf("guesses need a correlation of %.4f (%.1f sigma)\n", threshold, o->sigmas);
+
+  enumeration = now();
+  if (prune_run(&p) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+  enumeration = now() - enumeration;
+
+  report(o, &p, &m);
+  printf("\n%.3f s, %.3f s enumerating (%lu threads)\n", now() - start, enumeration, p.threads);
+
+  result = 0;
+
+done:
+  prune_free(&p);
+  monitor_free(&m);
+  free(r);
+  free(traces);
+  free(info);
+  free(ivs);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c first:last] [-w first:count] [-n traces] [-b traces] [-s sigmas]\n"
+         "       %*s [-l leaves] [-L nodes] [-k key] [-t threads] archive\n", name, (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  u64 a, b;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.last_clock = 15;
+  o.batch = 4096;
+  o.sigmas = 3;
+  o.leaves = 16;
+  o.limit = 1000000000;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "c:w:n:b:s:l:L:k:t:")) != -1) {
+    switch (option) {
+    case 'n': o.traces  = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch   = strtoul(optarg, NULL, 10);  break;
+    case 's': o.sigmas  = atof(optarg);               break;
+    case 'l': o.leaves  = strtoul(optarg, NULL, 10);  break;
+    case 'L': o.limit   = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);  break;
+    case 'c':
+      if (parse_range(optarg, &a, &b) < 0 || a > b || b >= TARGET_CLOCKS) {
+        printf("[ERROR] clocks must be within 0:%d\n", TARGET_CLOCKS - 1);
+        return 2;
+      }
+      o.first_clock = (u32)a;
+      o.last_clock = (u32)b;
+      break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 1 || o.batch == 0 || o.threads == 0 || o.leaves == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return search(&o, argv[optind]);
+}
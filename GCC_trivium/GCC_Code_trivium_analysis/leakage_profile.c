@@ -0,0 +1,265 @@
+/*
+ * leakage_profile.c
+ *
+ * stochastic model profiling: regress every sample of a trace archive on
+ * the state bits before a clock and its t1, t2 and t3 (see stochastic.h)
+ *
+ *  build : gcc -O3 -march=native -pthread -o leakage_profile leakage_profile.c stochastic.c cpa.c \
+ *                                         traces.c trivium_word.c -lm
+ *  run   : ./leakage_profile [-c clock] [-w first:count] [-n traces] [-b traces] [-t threads]
+ *                            [-r rows] archive model
+ *
+ *   -c clock     the state before this clock (default 0, the loaded key
+ *                and iv)
+ *   -w window    samples to profile (default all)
+ *   -n traces    use at most this many traces
+ *   -b traces    traces per pass (default 4096)
+ *   -t threads   worker threads (default: online cpus)
+ *   -r rows      rows of each table (default 16)
+ *
+ * the archive needs random keys as well as ivs, or the key bits cannot be
+ * told apart from the intercept. The model file holds the weight of
+ * every bit at every sample; the report lists the samples the model
+ * explains best, with their strongest bits, and the bits with the
+ * largest weight anywhere, which is the weight map folded over time.
+ * cpa_attack -W uses the model.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "stochastic.h"
+#include "traces.h"
+#include "util.h"
+
+#define STRONGEST 3
+
+
+typedef struct {
+  u32   clock;
+  u64   window, samples;
+  u64   traces;
+  u64   batch;
+  u64   threads;
+  u64   rows;
+} options_t;
+
+
+
+/**********
+ * Report *
+ **********/
+
+
+
+/***
+ * select_top
+ *
+ * indices of the rows largest values, largest first
+ *
+ */
+static u64 select_top(const double* value, u64 count, u64 rows, u64* top) {
+
+  u64 i, j, n = 0;
+
+  for (i = 0; i < count; i++) {
+    for (j = n; j > 0 && value[top[j - 1]] < value[i]; j--) {
+      if (j < rows) top[j] = top[j - 1];
+    }
+    if (j < rows) {
+      top[j] = i;
+      if (n < rows) n++;
+    }
+  }
+
+  return n;
+}
+
+
+static void report(const options_t* o, const stochastic_t* s) {
+
+  const u64 P = STOCHASTIC_REGRESSORS;
+  double* peak = calloc(P, sizeof(double));
+  double magnitude[STOCHASTIC_REGRESSORS];
+  u64* at = calloc(P, sizeof(u64));
+  u64* top = malloc((o->rows > P ? o->rows : P) * sizeof(u64));
+  u64 strongest[STRONGEST], i, j, n, r;
+  char name[16];
+
+  if (peak == NULL || at == NULL || top == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  printf("%lu traces, %lu samples, state before clock %u\n\n", s->traces, s->samples, s->clock);
+
+  printf("sample     r2  strongest bits\n");
+  n = select_top(s->r2, s->samples, o->rows, top);
+
+  for (r = 0; r < n; r++) {
+    const double* w = s->weight + top[r] * (P + 1);
+
+    for (i = 0; i < P; i++) magnitude[i] = fabs(w[i]);
+    select_top(magnitude, P, STRONGEST, strongest);
+
+    printf("%6lu  %.3f ", o->window + top[r], s->r2[top[r]]);
+    for (i = 0; i < STRONGEST; i++) {
+      stochastic_name(strongest[i], name, sizeof(name));
+      printf(" %5s %+8.4f", name, w[strongest[i]]);
+    }
+    printf("\n");
+  }
+
+  for (j = 0; j < s->samples; j++) {
+    for (i = 0; i < P; i++) {
+      if (fabs(s->weight[j * (P + 1) + i]) > fabs(peak[i])) {
+        peak[i] = s->weight[j * (P + 1) + i];
+        at[i] = j;
+      }
+    }
+  }
+
+  for (i = 0; i < P; i++) magnitude[i] = fabs(peak[i]);
+  n = select_top(magnitude, P, o->rows, top);
+
+  printf("\nbit    weight  sample\n");
+  for (r = 0; r < n; r++) {
+    stochastic_name(top[r], name, sizeof(name));
+    printf("%-5s %+8.4f  %6lu\n", name, peak[top[r]], o->window + at[top[r]]);
+  }
+
+done:
+  free(peak);
+  free(at);
+  free(top);
+
+  return;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int profile(options_t* o, const char* path, const char* model) {
+
+  trace_archive_t a;
+  stochastic_t s;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  u8* bits = NULL;
+  u64 i, n, t, count;
+  double start = now();
+  int result = 1;
+
+  memset(&s, 0, sizeof(s));
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+  if (o->window >= a.format.samples) {
+    printf("[ERROR] the traces have %lu samples\n", a.format.samples);
+    goto done;
+  }
+  if (o->samples == 0 || o->window + o->samples > a.format.samples) o->samples = a.format.samples - o->window;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info   = malloc(o->batch * sizeof(trace_info_t));
+  bits   = malloc(o->batch * STOCHASTIC_REGRESSORS);
+
+  if (traces == NULL || info == NULL || bits == NULL || stochastic_alloc(&s, o->clock, o->samples, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  s.window = o->window;
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+
+    for (t = 0; t < n; t++) stochastic_bits(o->clock, info[t].key, info[t].iv, bits + t * STOCHASTIC_REGRESSORS);
+
+    if (stochastic_add(&s, traces + o->window, a.format.samples, n, bits) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+  }
+
+  if (stochastic_solve(&s) < 0) {
+    printf("[ERROR] the bit covariance is singular, more traces are needed\n");
+    goto done;
+  }
+
+  if (stochastic_save(&s, model) < 0) goto done;
+
+  report(o, &s);
+  printf("\n%.3f s (%lu threads)\n", now() - start, s.threads);
+
+  result = 0;
+
+done:
+  stochastic_free(&s);
+  free(traces);
+  free(info);
+  free(bits);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c clock] [-w first:count] [-n traces] [-b traces] [-t threads]\n"
+         "       %*s [-r rows] archive model\n", name, (int)strlen(name), "");
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.batch = 4096;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  o.rows = 16;
+
+  while ((option = getopt(argc, argv, "c:w:n:b:t:r:")) != -1) {
+    switch (option) {
+    case 'c': o.clock   = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'n': o.traces  = strtoul(optarg, NULL, 10);       break;
+    case 'b': o.batch   = strtoul(optarg, NULL, 10);       break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);       break;
+    case 'r': o.rows    = strtoul(optarg, NULL, 10);       break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 2 || o.batch == 0 || o.threads == 0 || o.rows == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  return profile(&o, argv[optind], argv[optind + 1]);
+}
@@ -0,0 +1,467 @@
+/*
+ * mia.c
+ *
+ * streaming mutual information engine (see mia.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "mia.h"
+
+// margin around the range of the first batch, as a fraction of it
+#define RANGE_MARGIN 0.1f
+
+// traces counted at a time, one bit each
+#define MIA_CHUNK 512
+#define MIA_WORDS (MIA_CHUNK / 64)
+
+
+typedef struct {
+  mia_t*         m;
+  const float*   traces;
+  u64            stride;
+  u64            count;
+  const float*   h;
+  cpa_columns_fn columns;
+  const void*    ctx;
+  int            ranges;                // first batch: set the bins only
+  u64            items;
+  u64            next;                  // next work item, shared by the workers
+} mia_job_t;
+
+
+int mia_alloc(mia_t* m, u64 hypotheses, u64 classes, u64 columns, u64 bins, u64 threads) {
+
+  memset(m, 0, sizeof(mia_t));
+
+  if (hypotheses == 0 || columns == 0 || classes < 2 || classes > MIA_MAX_CLASSES || bins < 2 || bins > MIA_MAX_BINS) {
+    return -1;
+  }
+
+  m->hypotheses = hypotheses;
+  m->classes    = classes;
+  m->columns    = columns;
+  m->bins       = bins;
+  m->threads    = (threads == 0) ? 1 : (threads > MIA_MAX_THREADS ? MIA_MAX_THREADS : threads);
+  m->low        = calloc(columns, sizeof(float));
+  m->scale      = calloc(columns, sizeof(float));
+  m->sum_x      = calloc(columns, sizeof(double));
+  m->sum_xx     = calloc(columns, sizeof(double));
+  m->column     = calloc(columns * bins, sizeof(u32));
+  m->joint      = calloc(hypotheses * columns * (classes - 1) * bins, sizeof(u32));
+
+  if (m->low == NULL || m->scale == NULL || m->sum_x == NULL || m->sum_xx == NULL || m->column == NULL ||
+      m->joint == NULL) {
+    mia_free(m);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void mia_free(mia_t* m) {
+
+  free(m->low);
+  free(m->scale);
+  free(m->sum_x);
+  free(m->sum_xx);
+  free(m->column);
+  free(m->joint);
+  memset(m, 0, sizeof(mia_t));
+
+  return;
+}
+
+
+
+/************
+ * Counting *
+ ************/
+
+
+
+/***
+ * set_ranges
+ *
+ * bins over the range of a tile in the first batch, with a margin
+ *
+ */
+static void set_ranges(mia_t* m, const float* x, u64 stride, u64 count, u64 col0, u64 width) {
+
+  float low[MIA_TILE], high[MIA_TILE], span;
+  u64 t, j;
+
+  for (j = 0; j < width; j++) low[j] = high[j] = x[j];
+
+  for (t = 1; t < count; t++) {
+    const float* row = x + t * stride;
+    for (j = 0; j < width; j++) {
+      low[j]  = (row[j] < low[j])  ? row[j] : low[j];
+      high[j] = (row[j] > high[j]) ? row[j] : high[j];
+    }
+  }
+
+  for (j = 0; j < width; j++) {
+    span = high[j] - low[j];
+    m->low[col0 + j]   = low[j] - RANGE_MARGIN * span;
+    m->scale[col0 + j] = (span > 0) ? (float)m->bins / ((1 + 2 * RANGE_MARGIN) * span) : 0.0f;
+  }
+
+  return;
+}
+
+
+/***
+ * mia_worker
+ *
+ * work items are a tile of columns and a block of hypotheses, the blocks
+ * of a tile next to each other. The tile is made (or read in place) and
+ * counted MIA_CHUNK traces at a time: every column and bin becomes a bit
+ * mask of the traces that fall into it, every hypothesis and class one
+ * of the traces it puts there, and a joint count is the popcount of the
+ * two anded, 64 traces per instruction. The first block of a tile also
+ * counts the column histograms. A worker that cannot allocate its
+ * buffers leaves the items to the others.
+ *
+ */
+static void* mia_worker(void* arg) {
+
+  mia_job_t* job = arg;
+  mia_t* m = job->m;
+  u64 H = m->hypotheses, K = m->classes - 1, B = m->bins;
+  u64 blocks = job->ranges ? 1 : (H + MIA_HYPOTHESES - 1) / MIA_HYPOTHESES;
+  u64 item, tile, block, col0, width, t, t0, tn, words, k, k0, kn, j, b, c, w, stride, cls, sum;
+  float* buffer = job->columns ? aligned_alloc(64, job->count * MIA_TILE * sizeof(float)) : NULL;
+  u64* in_bin = aligned_alloc(64, MIA_TILE * B * MIA_WORDS * sizeof(u64));
+  u64* in_class = aligned_alloc(64, MIA_HYPOTHESES * K * MIA_WORDS * sizeof(u64));
+  double sx[MIA_TILE], sxx[MIA_TILE];
+  const float* x;
+  long v;
+
+  if ((job->columns && buffer == NULL) || in_bin == NULL || in_class == NULL) goto done;
+
+  while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->items) {
+    tile  = item / blocks;
+    block = item % blocks;
+    col0  = tile * MIA_TILE;
+    width = (m->columns - col0 < MIA_TILE) ? m->columns - col0 : MIA_TILE;
+    k0    = block * MIA_HYPOTHESES;
+    kn    = (H - k0 < MIA_HYPOTHESES) ? H - k0 : MIA_HYPOTHESES;
+
+    if (job->columns) {
+      memset(buffer, 0, job->count * MIA_TILE * sizeof(float));
+      job->columns(job->ctx, job->traces, job->stride, job->count, col0, width, buffer);
+      x = buffer;
+      stride = MIA_TILE;
+    } else {
+      x = job->traces + col0;
+      stride = job->stride;
+    }
+
+    if (job->ranges) {
+      set_ranges(m, x, stride, job->count, col0, width);
+      continue;
+    }
+
+    memset(sx, 0, sizeof(sx));
+    memset(sxx, 0, sizeof(sxx));
+
+    for (t0 = 0; t0 < job->count; t0 += MIA_CHUNK) {
+      tn = (job->count - t0 < MIA_CHUNK) ? job->count - t0 : MIA_CHUNK;
+      words = (tn + 63) / 64;
+
+      memset(in_bin, 0, width * B * MIA_WORDS * sizeof(u64));
+      memset(in_class, 0, kn * K * MIA_WORDS * sizeof(u64));
+
+      for (t = 0; t < tn; t++) {
+        const float* row = x + (t0 + t) * stride;
+
+        for (j = 0; j < width; j++) {
+          v = (long)((row[j] - m->low[col0 + j]) * m->scale[col0 + j]);
+          b = (u64)((v < 0) ? 0 : (v >= (long)B ? (long)B - 1 : v));
+          in_bin[(j * B + b) * MIA_WORDS + t / 64] |= (u64)1 << (t % 64);
+        }
+
+        for (k = 0; k < kn; k++) {
+          float value = job->h[(t0 + t) * H + k0 + k];
+          cls = (value < 1) ? 0 : (value >= (float)K ? K : (u64)value);
+          if (cls > 0) in_class[(k * K + cls - 1) * MIA_WORDS + t / 64] |= (u64)1 << (t % 64);
+        }
+      }
+
+      if (block == 0) {
+        for (t = 0; t < tn; t++) {
+          const float* row = x + (t0 + t) * stride;
+          for (j = 0; j < width; j++) {
+            sx[j] += row[j];
+            sxx[j] += (double)row[j] * row[j];
+          }
+        }
+
+        for (j = 0; j < width; j++) {
+          for (b = 0; b < B; b++) {
+            const u64* bits = in_bin + (j * B + b) * MIA_WORDS;
+            for (sum = 0, w = 0; w < words; w++) sum += (u64)__builtin_popcountll(bits[w]);
+            m->column[(col0 + j) * B + b] += (u32)sum;
+          }
+        }
+      }
+
+      for (k = 0; k < kn; k++) {
+        for (c = 0; c < K; c++) {
+          const u64* members = in_class + (k * K + c) * MIA_WORDS;
+          u32* joint = m->joint + ((k0 + k) * m->columns + col0) * K * B + c * B;
+
+          for (j = 0; j < width; j++) {
+            for (b = 0; b < B; b++) {
+              const u64* bits = in_bin + (j * B + b) * MIA_WORDS;
+              for (sum = 0, w = 0; w < MIA_WORDS; w++) sum += (u64)__builtin_popcountll(members[w] & bits[w]);
+              joint[j * K * B + b] += (u32)sum;
+            }
+          }
+        }
+      }
+    }
+
+    if (block == 0) {
+      for (j = 0; j < width; j++) {
+        m->sum_x[col0 + j] += sx[j];
+        m->sum_xx[col0 + j] += sxx[j];
+      }
+    }
+  }
+
+done:
+  free(buffer);
+  free(in_bin);
+  free(in_class);
+
+  return NULL;
+}
+
+
+static int run(mia_job_t* job) {
+
+  pthread_t thread[MIA_MAX_THREADS];
+  u64 i, threads = (job->items < job->m->threads) ? job->items : job->m->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, mia_worker, job) != 0) break;
+  }
+
+  if (i == 0) mia_worker(job);
+  threads = i;
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  // every item was taken unless no worker could start, then nothing was counted
+  return (job->next < job->items) ? -1 : 0;
+}
+
+
+/***
+ * mia_add
+ *
+ * count traces, stride floats apart, with their hypotheses
+ * h[t * hypotheses + k]. The first batch also fixes the bins, so it
+ * should hold enough traces to show the range of every column; one of
+ * fewer than MIA_FIRST_TRACES is refused.
+ *
+ */
+int mia_add(mia_t* m, const float* traces, u64 stride, u64 count, const float* h,
+            cpa_columns_fn columns, const void* ctx) {
+
+  mia_job_t job;
+  u64 tiles = (m->columns + MIA_TILE - 1) / MIA_TILE;
+
+  if (count == 0) return 0;
+  if (m->traces == 0 && count < MIA_FIRST_TRACES) return -1;
+
+  memset(&job, 0, sizeof(job));
+  job.m       = m;
+  job.traces  = traces;
+  job.stride  = stride;
+  job.count   = count;
+  job.h       = h;
+  job.columns = columns;
+  job.ctx     = ctx;
+
+  if (m->traces == 0) {
+    job.ranges = 1;
+    job.items  = tiles;
+    if (run(&job) < 0) return -1;
+
+    job.ranges = 0;
+    job.next   = 0;
+  }
+
+  job.items = tiles * ((m->hypotheses + MIA_HYPOTHESES - 1) / MIA_HYPOTHESES);
+  if (run(&job) < 0) return -1;
+
+  m->traces += count;
+
+  return 0;
+}
+
+
+
+/**************
+ * Estimators *
+ **************/
+
+
+
+int mia_estimator_parse(const char* name, int* estimator) {
+
+  if (strcmp(name, "hist") == 0) {
+    *estimator = MIA_HISTOGRAM;
+  } else if (strcmp(name, "kde") == 0) {
+    *estimator = MIA_KDE;
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * kernel
+ *
+ * weights of the gaussian kernel of a column in bins, Silverman's
+ * bandwidth 1.06 sigma n^(-1/5); returns the radius, 0 when the kernel
+ * is narrower than a bin and the histogram is used as it is
+ *
+ */
+static long kernel(const mia_t* m, u64 j, double* weight) {
+
+  double n = (double)m->traces, mean = m->sum_x[j] / n;
+  double variance = m->sum_xx[j] / n - mean * mean;
+  double width = 1.06 * sqrt(variance > 0 ? variance : 0) * pow(n, -0.2) * m->scale[j];
+  long d, radius;
+
+  if (!(width >= 0.5)) return 0;
+
+  radius = (long)ceil(3 * width);
+  if (radius >= (long)m->bins) radius = (long)m->bins - 1;
+
+  for (d = -radius; d <= radius; d++) weight[d + radius] = exp(-0.5 * (d / width) * (d / width));
+
+  return radius;
+}
+
+
+/***
+ * information
+ *
+ * mutual information in bits between the class of a hypothesis and a
+ * column
+ *
+ */
+static double information(const mia_t* m, u64 k, u64 j, const double* weight, long radius) {
+
+  u64 K = m->classes - 1, B = m->bins, c, b;
+  const u32* column = m->column + j * B;
+  const u32* joint = m->joint + (k * m->columns + j) * K * B;
+  double count[MIA_MAX_CLASSES * MIA_MAX_BINS], smooth[MIA_MAX_CLASSES * MIA_MAX_BINS];
+  double p_class[MIA_MAX_CLASSES], p_bin[MIA_MAX_BINS], *p = count, total = 0, result = 0;
+  long d, from, to;
+
+  for (b = 0; b < B; b++) count[b] = column[b];
+
+  for (c = 1; c <= K; c++) {
+    for (b = 0; b < B; b++) {
+      count[c * B + b] = joint[(c - 1) * B + b];
+      count[b] -= joint[(c - 1) * B + b];
+    }
+  }
+
+  if (radius > 0) {
+    for (c = 0; c <= K; c++) {
+      for (b = 0; b < B; b++) {
+        from = ((long)b - radius < 0) ? 0 : (long)b - radius;
+        to   = ((long)b + radius >= (long)B) ? (long)B - 1 : (long)b + radius;
+
+        smooth[c * B + b] = 0;
+        for (d = from; d <= to; d++) smooth[c * B + b] += count[c * B + d] * weight[d - (long)b + radius];
+      }
+    }
+    p = smooth;
+  }
+
+  memset(p_bin, 0, sizeof(p_bin));
+
+  for (c = 0; c <= K; c++) {
+    p_class[c] = 0;
+    for (b = 0; b < B; b++) {
+      p_class[c] += p[c * B + b];
+      p_bin[b] += p[c * B + b];
+    }
+    total += p_class[c];
+  }
+
+  if (!(total > 0)) return 0;
+
+  for (c = 0; c <= K; c++) {
+    for (b = 0; b < B; b++) {
+      if (p[c * B + b] > 0) result += p[c * B + b] * log2(p[c * B + b] * total / (p_class[c] * p_bin[b]));
+    }
+  }
+
+  return result / total;
+}
+
+
+/***
+ * mia_information
+ *
+ * mutual information of a hypothesis with every column
+ *
+ */
+void mia_information(const mia_t* m, u64 hypothesis, int estimator, float* out) {
+
+  double weight[2 * MIA_MAX_BINS] = { 0 };
+  long radius;
+  u64 j;
+
+  for (j = 0; j < m->columns; j++) {
+    radius = (estimator == MIA_KDE) ? kernel(m, j, weight) : 0;
+    out[j] = (float)information(m, hypothesis, j, weight, radius);
+  }
+
+  return;
+}
+
+
+/***
+ * mia_peak
+ *
+ * the largest mutual information of a hypothesis and its column
+ *
+ */
+double mia_peak(const mia_t* m, u64 hypothesis, int estimator, u64* column) {
+
+  double weight[2 * MIA_MAX_BINS] = { 0 }, value, best = 0;
+  long radius;
+  u64 j;
+
+  *column = 0;
+
+  for (j = 0; j < m->columns; j++) {
+    radius = (estimator == MIA_KDE) ? kernel(m, j, weight) : 0;
+    value = information(m, hypothesis, j, weight, radius);
+
+    if (value > best) {
+      best = value;
+      *column = j;
+    }
+  }
+
+  return best;
+}
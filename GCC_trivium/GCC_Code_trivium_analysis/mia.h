@@ -0,0 +1,70 @@
+/*
+ * mia.h
+ *
+ * streaming mutual information of many hypotheses with many trace
+ * columns
+ *
+ * correlation only sees leakage that grows linearly with the predicted
+ * value; mutual information sees any dependency of the sample on the
+ * class the hypothesis puts a trace in. The engine keeps a histogram of
+ * every column (bins over the range of the first batch, of at least
+ * MIA_FIRST_TRACES traces; outliers land in the end bins) and one per
+ * hypothesis and class: class 0 is the column histogram minus the
+ * others and is not stored. The information is estimated from the
+ * histograms directly, or from a binned kernel density estimate that
+ * smooths them with a gaussian of Silverman's bandwidth.
+ *
+ * the inputs are those of the correlation engine: traces, hypotheses
+ * h[t * hypotheses + k] (the class is the integer part) and an optional
+ * cpa_columns_fn. Work items are a tile of columns and a block of
+ * hypotheses; every item owns its histograms, so threads never share a
+ * counter and there is nothing to merge.
+ *
+ */
+
+#ifndef MIA_H
+#define MIA_H
+
+#include "trivium.h"
+#include "cpa.h"
+
+#define MIA_TILE         CPA_TILE      // columns per work item
+#define MIA_HYPOTHESES   64            // hypotheses per work item
+#define MIA_MAX_BINS     256
+#define MIA_MAX_CLASSES  16
+#define MIA_MAX_THREADS  256
+#define MIA_FIRST_TRACES 64            // at least, in the first batch
+
+enum {
+  MIA_HISTOGRAM = 0,
+  MIA_KDE       = 1,
+};
+
+
+typedef struct {
+  u64     hypotheses;
+  u64     classes;
+  u64     columns;
+  u64     bins;
+  u64     traces;
+  u64     threads;
+  float*  low;                          // [columns], first bin
+  float*  scale;                        // [columns], bins per unit
+  double* sum_x;                        // [columns]
+  double* sum_xx;                       // [columns]
+  u32*    column;                       // [columns][bins]
+  u32*    joint;                        // [hypotheses][columns][classes - 1][bins]
+} mia_t;
+
+
+int  mia_alloc(mia_t* m, u64 hypotheses, u64 classes, u64 columns, u64 bins, u64 threads);
+void mia_free(mia_t* m);
+
+int  mia_add(mia_t* m, const float* traces, u64 stride, u64 count, const float* h,
+             cpa_columns_fn columns, const void* ctx);
+
+int    mia_estimator_parse(const char* name, int* estimator);
+void   mia_information(const mia_t* m, u64 hypothesis, int estimator, float* out);
+double mia_peak(const mia_t* m, u64 hypothesis, int estimator, u64* column);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ * monitor.c
+ *
+ * early stopping correlation attack (see monitor.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "monitor.h"
+
+
+/***
+ * alike
+ *
+ * guesses whose predictions agree for every iv cannot be told apart, each
+ * is represented by the first of them
+ *
+ */
+static void alike(monitor_target_t* t) {
+
+  u64 g, h;
+  u32 p;
+
+  for (g = 0; g < ((u64)1 << t->target.guess_bits); g++) {
+    for (h = 0; h < g; h++) {
+      for (p = 0; p < (1u << TARGET_TAPS); p++) {
+        if (((t->mask[p] >> g) ^ (t->mask[p] >> h)) & 0x01) break;
+      }
+      if (p == (1u << TARGET_TAPS)) break;
+    }
+    t->same[g] = (u8)h;
+  }
+
+  return;
+}
+
+
+int monitor_init(monitor_t* m, u32 first_clock, u32 last_clock, u64 samples, u64 batch, u64 threads) {
+
+  u64 bits[KEYBITS / MONITOR_SUBKEY_BITS], i;
+  monitor_target_t* t;
+  u32 c;
+
+  memset(m, 0, sizeof(monitor_t));
+  m->rank = -1;
+  m->probability = MONITOR_PROBABILITY;
+
+  for (c = first_clock; c <= last_clock && c < TARGET_CLOCKS; c++) {
+    t = &m->target[m->targets];
+    target_init(&t->target, TARGET_T1, c);
+    if (t->target.guess_bits == 0 || !target_depends_on_iv(&t->target)) continue;
+
+    target_masks(&t->target, t->mask);
+    alike(t);
+    t->first = m->hypotheses;
+    m->hypotheses += (u64)1 << t->target.guess_bits;
+    m->targets++;
+  }
+
+  for (i = 0; i < KEYBITS / MONITOR_SUBKEY_BITS; i++) bits[i] = MONITOR_SUBKEY_BITS;
+
+  m->batch = batch;
+  m->h = malloc(batch * m->hypotheses * sizeof(float));
+  m->band = malloc(m->hypotheses * sizeof(fisher_band_t));
+
+  if (m->targets == 0 || m->h == NULL || m->band == NULL || cpa_alloc(&m->cpa, m->hypotheses, samples, threads) < 0 ||
+      score_table_alloc(&m->table, KEYBITS / MONITOR_SUBKEY_BITS, bits) < 0) {
+    monitor_free(m);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void monitor_free(monitor_t* m) {
+
+  cpa_free(&m->cpa);
+  score_table_free(&m->table);
+  free(m->h);
+  free(m->band);
+  memset(m, 0, sizeof(monitor_t));
+
+  return;
+}
+
+
+/***
+ * monitor_add
+ *
+ * count traces (at most the batch of monitor_init()), stride floats
+ * apart, and their ivs back to back in file order
+ *
+ */
+int monitor_add(monitor_t* m, const float* traces, u64 stride, u64 count, const u8* ivs) {
+
+  u64 n, t, g;
+
+  if (count > m->batch) return -1;
+
+  for (t = 0; t < count; t++) {
+    float* out = m->h + t * m->hypotheses;
+
+    for (n = 0; n < m->targets; n++) {
+      const monitor_target_t* s = &m->target[n];
+      u16 mask = s->mask[target_iv_bits(&s->target, ivs + t * IVLENGTH)];
+
+      for (g = 0; g < ((u64)1 << s->target.guess_bits); g++) out[s->first + g] = (float)((mask >> g) & 0x01);
+    }
+  }
+
+  return cpa_add(&m->cpa, traces, stride, count, m->h, NULL, NULL);
+}
+
+
+/***
+ * key_scores
+ *
+ * score both values of every key bit by the targets it enters, with the
+ * other bits of each guess at the known key, and add the bits up into
+ * the subkeys of the table
+ *
+ */
+static void key_scores(monitor_t* m, const fisher_band_t* band) {
+
+  double bit[KEYBITS][2];
+  u64 n, g, b, v, i, o, right;
+  u32 j;
+
+  memset(bit, 0, sizeof(bit));
+
+  for (n = 0; n < m->targets; n++) {
+    const monitor_target_t* s = &m->target[n];
+    right = target_guess(&s->target, m->key);
+
+    for (b = 0; b < s->target.guess_bits; b++) {
+      g = right ^ ((u64)1 << b);
+      v = (right >> b) & 0x01;
+      j = s->target.key[b];
+
+      bit[j][v]     += fisher_score(band[s->first + right].r, m->cpa.traces);
+      bit[j][v ^ 1] += fisher_score(band[s->first + g].r, m->cpa.traces);
+    }
+  }
+
+  for (i = 0; i < m->table.subkeys; i++) {
+    o = i * MONITOR_SUBKEY_BITS;
+
+    for (v = 0; v < ((u64)1 << MONITOR_SUBKEY_BITS); v++) {
+      m->table.score[i][v] = 0;
+      for (b = 0; b < MONITOR_SUBKEY_BITS; b++) m->table.score[i][v] += bit[o + b][(v >> (MONITOR_SUBKEY_BITS - 1 - b)) & 0x01];
+    }
+  }
+
+  return;
+}
+
+
+/***
+ * best_other
+ *
+ * the guess correlating best among those predicting unlike a given one
+ *
+ */
+static u64 best_other(const monitor_target_t* s, const fisher_band_t* band, u64 guess) {
+
+  u64 g, best = guess;
+
+  for (g = 0; g < ((u64)1 << s->target.guess_bits); g++) {
+    if (s->same[g] == s->same[guess]) continue;
+    if (best == guess || band[s->first + g].r > band[s->first + best].r) best = g;
+  }
+
+  return best;
+}
+
+
+/***
+ * rival
+ *
+ * the guess correlating best at a column among those predicting unlike a
+ * given one
+ *
+ */
+static u64 rival(const monitor_t* m, const monitor_target_t* s, u64 guess, u64 column) {
+
+  double r, best = -HUGE_VAL;
+  u64 g, found = guess;
+
+  for (g = 0; g < ((u64)1 << s->target.guess_bits); g++) {
+    if (s->same[g] == s->same[guess]) continue;
+    r = cpa_correlation_at(&m->cpa, s->first + g, column);
+    if (r > best) {
+      best = r;
+      found = g;
+    }
+  }
+
+  return found;
+}
+
+
+/***
+ * monitor_check
+ *
+ * the state of the attack after the traces added so far
+ *
+ */
+int monitor_check(monitor_t* m, monitor_report_t* report) {
+
+  const fisher_band_t* band = m->band;
+  double n = (double)m->cpa.traces, margin, needed;
+  u64 values[KEYBITS / MONITOR_SUBKEY_BITS], k, g, top, right, wrong, column;
+  fisher_band_t other;
+
+  memset(report, 0, sizeof(monitor_report_t));
+  report->traces = m->cpa.traces;
+  report->margin = HUGE_VAL;
+
+  if (m->cpa.traces < 4) return 0;
+
+  fisher_bands(&m->cpa, MONITOR_CONFIDENCE, m->band);
+
+  for (k = 0; k < m->targets; k++) {
+    const monitor_target_t* s = &m->target[k];
+
+    for (g = 1, top = 0; g < ((u64)1 << s->target.guess_bits); g++) {
+      if (band[s->first + g].r > band[s->first + top].r) top = g;
+    }
+
+    wrong = best_other(s, band, top);
+    margin = (atanh(fmin(band[s->first + top].r, 0.999999)) - atanh(fmax(band[s->first + wrong].r, -0.999999))) / sqrt(2 / (n - 3));
+
+    if (k == 0 || band[s->first + top].r > report->peak) {
+      report->peak = band[s->first + top].r;
+      report->peak_clock = s->target.clock;
+    }
+
+    if (margin < report->margin) {
+      report->margin = margin;
+      report->margin_clock = s->target.clock;
+    }
+
+    // without a key the best guess stands in for the right one
+    right = m->has_key ? target_guess(&s->target, m->key) : top;
+    column = band[s->first + right].column;
+    wrong = rival(m, s, right, column);
+
+    fisher_band(cpa_correlation_at(&m->cpa, s->first + wrong, column), m->cpa.traces, MONITOR_CONFIDENCE, &other);
+    other.column = column;
+
+    needed = fmax(fisher_traces(band[s->first + right].r, other.r, m->probability, m->targets),
+                  fisher_traces(band[s->first + right].r, 0, m->probability, m->hypotheses * m->cpa.columns));
+
+    if (k == 0 || needed > report->needed) {
+      report->needed = needed;
+      report->needed_clock = s->target.clock;
+      report->right = band[s->first + right];
+      report->wrong = other;
+    }
+
+    if (m->has_key) report->first += (s->same[top] == s->same[right]);
+  }
+
+  if (m->has_key) {
+    key_scores(m, band);
+    subkey_values(&m->table, m->key, values);
+    if (rank_estimate(&m->table, values, RANK_BINS, &report->rank) < 0) return -1;
+    report->ranked = 1;
+  }
+
+  report->success = (m->margin > 0 && report->margin >= m->margin) ||
+                    (report->ranked && m->rank >= 0 && report->rank.upper <= m->rank);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * monitor.h
+ *
+ * a correlation attack on t1 that runs alongside the acquisition and
+ * says when to stop
+ *
+ * traces are added as they arrive; every check scores the guesses of
+ * every target by their peak correlation (positive, a set bit raises
+ * the sample) and reports
+ *
+ *   peak     the largest correlation of any target's best guess
+ *   margin   for the least clear target, the distance between its best
+ *            guess and the best one predicting differently (a key bit
+ *            under an and with a zero cannot be told) in standard
+ *            deviations of the difference of their Fisher z
+ *            (2 / (traces - 3))
+ *   needed   the traces after which, with the configured probability
+ *            (fisher.h), every target's right guess beats both the best
+ *            distinguishable rival at its peak sample and the noise of
+ *            every other hypothesis and sample (correlation 0, one
+ *            comparison each), from the correlations so far; the best
+ *            guess stands in for the right one without a key. The 95%
+ *            bands of the right guess and the rival of the target
+ *            needing the most traces come with it
+ *   rank     with a known key, log2 of its rank (rank.h) over scores
+ *            per key bit. t1 only fixes sums of key bits, so a bit is
+ *            scored around the known key: a value scores the guesses
+ *            (fisher_score()) of the targets the bit enters, with their
+ *            other bits right. The rank is that of the attack linearized
+ *            at the key, keys differing in several bits are scored as
+ *            the sum of the single flips
+ *
+ * the attack has succeeded once every target's margin reaches the
+ * configured number of deviations, or with a known key once the rank is
+ * at most the configured log2 rank.
+ *
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include "trivium.h"
+#include "cpa.h"
+#include "rank.h"
+#include "targets.h"
+#include "fisher.h"
+
+#define MONITOR_SUBKEY_BITS 8
+#define MONITOR_CONFIDENCE  0.95
+#define MONITOR_PROBABILITY 0.9
+
+
+typedef struct {
+  target_t target;
+  u64      first;                       // first hypothesis
+  u16      mask[1 << TARGET_TAPS];
+  u8       same[1 << TARGET_GUESS];     // the first guess predicting alike
+} monitor_target_t;
+
+
+typedef struct {
+  u64    traces;
+  double peak;
+  u32    peak_clock;
+  double margin;
+  u32    margin_clock;                  // the least clear target
+  int    ranked;                        // the key is known
+  rank_t rank;
+  u64    first;                         // targets whose right guess is best
+  double needed;                        // traces for the success probability
+  u32    needed_clock;
+  fisher_band_t right, wrong;           // of the target needing the most traces
+  int    success;
+} monitor_report_t;
+
+
+typedef struct {
+  u64              targets;
+  monitor_target_t target[TARGET_CLOCKS];
+  u64              hypotheses;
+  cpa_t            cpa;
+  score_table_t    table;
+  double           margin;              // success thresholds
+  double           rank;
+  double           probability;         // of success, for the trace prediction
+  int              has_key;
+  u8               key[KEYLENGTH];
+  float*           h;                   // [batch][hypotheses]
+  u64              batch;
+  fisher_band_t*   band;                // [hypotheses]
+} monitor_t;
+
+
+int  monitor_init(monitor_t* m, u32 first_clock, u32 last_clock, u64 samples, u64 batch, u64 threads);
+void monitor_free(monitor_t* m);
+
+int  monitor_add(monitor_t* m, const float* traces, u64 stride, u64 count, const u8* ivs);
+int  monitor_check(monitor_t* m, monitor_report_t* report);
+
+#endif
@@ -0,0 +1,1093 @@
+/*
+ * pic18.c
+ *
+ * PIC18F2550 instruction level emulator (see pic18.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pic18.h"
+#include "util.h"
+
+// special function registers
+#define PORTB    0xF81
+#define LATB     0xF8A
+#define TRISB    0xF93
+#define PIR1     0xF9E
+#define TXSTA    0xFAC
+#define TXREG    0xFAD
+#define RCREG    0xFAE
+#define STATUS   0xFD8
+#define FSR2L    0xFD9
+#define BSR      0xFE0
+#define FSR1L    0xFE1
+#define WREG     0xFE8
+#define FSR0L    0xFE9
+#define PRODL    0xFF3
+#define PRODH    0xFF4
+#define TABLAT   0xFF5
+#define TBLPTRL  0xFF6
+#define TBLPTRH  0xFF7
+#define TBLPTRU  0xFF8
+#define PCL      0xFF9
+#define PCLATH   0xFFA
+#define PCLATU   0xFFB
+#define STKPTR   0xFFC
+#define TOSL     0xFFD
+#define TOSH     0xFFE
+#define TOSU     0xFFF
+
+// STATUS
+#define FLAG_C   0x01
+#define FLAG_DC  0x02
+#define FLAG_Z   0x04
+#define FLAG_OV  0x08
+#define FLAG_N   0x10
+
+#define RCIF     0x20
+#define TXIF     0x10
+#define TRMT     0x02
+
+#define W        p->ram[WREG]
+#define ROM_MASK (PIC18_ROM / 2 - 1)
+
+// instruction handlers
+enum {
+  K_NOP, K_SLEEP, K_PUSH, K_POP, K_DAW, K_TBLRD, K_TBLWT, K_RETURN, K_FAULT,
+  K_MOVLB, K_MULWF, K_SUBLW, K_IORLW, K_XORLW, K_ANDLW, K_RETLW, K_MULLW, K_MOVLW, K_ADDLW,
+  K_DECF, K_IORWF, K_ANDWF, K_XORWF, K_COMF, K_ADDWFC, K_ADDWF, K_INCF, K_DECFSZ,
+  K_RRCF, K_RLCF, K_SWAPF, K_INCFSZ, K_RRNCF, K_RLNCF, K_INFSNZ, K_DCFSNZ,
+  K_MOVF, K_SUBFWB, K_SUBWFB, K_SUBWF,
+  K_CPFSLT, K_CPFSEQ, K_CPFSGT, K_TSTFSZ, K_SETF, K_CLRF, K_NEGF, K_MOVWF,
+  K_BTG, K_BSF, K_BCF, K_BTFSS, K_BTFSC, K_MOVFF, K_BRA, K_RCALL,
+  K_BZ, K_BNZ, K_BC, K_BNC, K_BOV, K_BNOV, K_BN, K_BNN,
+  K_CALL, K_GOTO, K_LFSR,
+  KINDS,
+  K_POLLS = 0x80                        // may read RCIF
+};
+
+
+static inline u32 hw(u32 x) {
+
+  return (u32)__builtin_popcount(x);
+}
+
+
+
+/**********
+ * Memory *
+ **********/
+
+
+
+/***
+ * indirect
+ *
+ * the address an INDF, POSTINC, POSTDEC, PREINC or PLUSW register stands
+ * for, its FSR moved as the access does
+ *
+ */
+static u32 indirect(pic18_t* p, u32 a) {
+
+  u32 base, mode, fsr, ea;
+
+  if (a >= 0xFEB && a <= 0xFEF) base = FSR0L, mode = 0xFEF - a;
+  else if (a >= 0xFE3 && a <= 0xFE7) base = FSR1L, mode = 0xFE7 - a;
+  else if (a >= 0xFDB && a <= 0xFDF) base = FSR2L, mode = 0xFDF - a;
+  else return a;
+
+  fsr = p->ram[base] | (u32)(p->ram[base + 1] & 0x0F) << 8;
+  ea = fsr;
+
+  switch (mode) {
+  case 1: fsr++;                                    break;
+  case 2: fsr--;                                    break;
+  case 3: ea = ++fsr;                               break;
+  case 4: ea = fsr + (u32)(int32_t)(int8_t)W;       break;
+  }
+
+  p->ram[base] = (u8)fsr;
+  p->ram[base + 1] = (u8)((fsr >> 8) & 0x0F);
+
+  return ea & 0xFFF;
+}
+
+
+static inline u32 resolve(pic18_t* p, u32 a) {
+
+  return (a >= 0xFDB && a <= 0xFEF) ? indirect(p, a) : a;
+}
+
+
+/***
+ * file
+ *
+ * the data address of a file register operand: the access bank (the
+ * first 0x60 bytes and the sfrs) or the bank in BSR
+ *
+ */
+static inline u32 file(pic18_t* p, u32 op) {
+
+  u32 f = op & 0xFF;
+
+  if (op & 0x100) return resolve(p, (u32)(p->ram[BSR] & 0x0F) << 8 | f);
+
+  return (f < 0x60) ? f : resolve(p, 0xF00 | f);
+}
+
+
+static void start_window(pic18_t* p) {
+
+  p->armed = 0;
+  p->recording = 1;
+  p->filled = 0;
+
+  return;
+}
+
+
+static u8 sfr_read(pic18_t* p, u32 a) {
+
+  u32 sp = p->ram[STKPTR] & 0x1F;
+  u8 v;
+
+  switch (a) {
+  case PCL:
+    p->ram[PCLATH] = (u8)(p->pc >> 8);
+    p->ram[PCLATU] = (u8)(p->pc >> 16);
+    return (u8)p->pc;
+  case TOSL:  return (u8)p->stack[sp];
+  case TOSH:  return (u8)(p->stack[sp] >> 8);
+  case TOSU:  return (u8)(p->stack[sp] >> 16);
+  case PORTB: return p->ram[LATB] & (u8)~p->ram[TRISB];
+  case PIR1:
+    v = p->ram[PIR1] & (u8)~RCIF;
+    return (p->rx_head != p->rx_tail) ? v | RCIF : v;
+  case RCREG:
+    if (p->rx_head == p->rx_tail) return p->ram[RCREG];
+    p->ram[RCREG] = p->rx[p->rx_tail++ % PIC18_UART];
+    return p->ram[RCREG];
+  }
+
+  return p->ram[a];
+}
+
+
+static void sfr_write(pic18_t* p, u32 a, u8 v) {
+
+  u32 sp = p->ram[STKPTR] & 0x1F;
+  u8 old;
+
+  switch (a) {
+  case PCL:
+    p->pc = ((u32)p->ram[PCLATU] << 16 | (u32)p->ram[PCLATH] << 8 | v) & 0x1FFFFE;
+    p->ram[PCL] = v;
+    p->flush = 1;
+    return;
+  case TOSL:   p->stack[sp] = (p->stack[sp] & 0x1FFF00) | v;                   return;
+  case TOSH:   p->stack[sp] = (p->stack[sp] & 0x1F00FF) | (u32)v << 8;         return;
+  case TOSU:   p->stack[sp] = (p->stack[sp] & 0x00FFFF) | (u32)(v & 0x1F) << 16; return;
+  case STKPTR: p->ram[STKPTR] = (p->ram[STKPTR] & 0xC0) | (v & 0x1F);          return;
+  case TXREG:
+    if (p->tx_length < PIC18_TX) p->tx[p->tx_length++] = v;
+    return;
+  case PORTB:
+  case LATB:
+    old = p->ram[LATB];
+    p->ram[LATB] = v;
+    if (p->armed && p->watch == PIC18_NOWHERE && !(old & 0x01) && (v & 0x01) && !(p->ram[TRISB] & 0x01)) start_window(p);
+    return;
+  case PIR1:
+  case RCREG:
+    return;
+  }
+
+  p->ram[a] = v;
+
+  return;
+}
+
+
+// the sfrs whose reads or writes do more than the memory access
+static const u8 special[0x100] = {
+  [PORTB & 0xFF] = 1, [LATB & 0xFF] = 1, [PIR1 & 0xFF] = 1, [TXREG & 0xFF] = 1, [RCREG & 0xFF] = 1,
+  [PCL & 0xFF] = 1, [STKPTR & 0xFF] = 1, [TOSL & 0xFF] = 1, [TOSH & 0xFF] = 1, [TOSU & 0xFF] = 1
+};
+
+
+/***
+ * get, put
+ *
+ * the run loop keeps the program counter in a register, handed to the
+ * sfrs that read or write it
+ *
+ */
+static inline u8 get(pic18_t* p, u32 a, u32 pc) {
+
+  if (a < 0xF00 || !special[a & 0xFF]) return p->ram[a];
+
+  p->pc = pc;
+
+  return sfr_read(p, a);
+}
+
+
+static inline void put(pic18_t* p, u32 a, u8 v, u32* pc) {
+
+  if (a < 0xF00 || !special[a & 0xFF]) {
+    p->ram[a] = v;
+    return;
+  }
+
+  p->pc = *pc;
+  sfr_write(p, a, v);
+  *pc = p->pc;
+
+  return;
+}
+
+
+static inline void push(pic18_t* p, u32 address) {
+
+  u32 sp = (p->ram[STKPTR] & 0x1F) + 1;
+
+  if (sp > PIC18_STACK) {
+    p->event = PIC18_FAULT;
+    return;
+  }
+
+  p->stack[sp] = address;
+  p->ram[STKPTR] = (p->ram[STKPTR] & 0xE0) | (u8)sp;
+
+  return;
+}
+
+
+static inline u32 pop(pic18_t* p) {
+
+  u32 sp = p->ram[STKPTR] & 0x1F;
+
+  if (sp == 0) {
+    p->event = PIC18_FAULT;
+    return 0;
+  }
+
+  p->ram[STKPTR] = (p->ram[STKPTR] & 0xE0) | (u8)(sp - 1);
+
+  return p->stack[sp];
+}
+
+
+
+/*********
+ * Flags *
+ *********/
+
+
+
+static inline void flags_zn(pic18_t* p, u8 r) {
+
+  u8 s = p->ram[STATUS] & (u8)~(FLAG_Z | FLAG_N);
+
+  if (r == 0) s |= FLAG_Z;
+  if (r & 0x80) s |= FLAG_N;
+  p->ram[STATUS] = s;
+
+  return;
+}
+
+
+/***
+ * add
+ *
+ * a + b + carry with every flag; subtraction is the addition of the
+ * complement, carry set meaning no borrow
+ *
+ */
+static inline u8 add(pic18_t* p, u32 a, u32 b, u32 carry) {
+
+  u32 r = a + b + carry;
+  u8 s = p->ram[STATUS] & 0xE0;
+
+  if (r > 0xFF) s |= FLAG_C;
+  if ((a & 0x0F) + (b & 0x0F) + carry > 0x0F) s |= FLAG_DC;
+  if ((r & 0xFF) == 0) s |= FLAG_Z;
+  if (~(a ^ b) & (a ^ r) & 0x80) s |= FLAG_OV;
+  if (r & 0x80) s |= FLAG_N;
+  p->ram[STATUS] = s;
+
+  return (u8)r;
+}
+
+
+/***
+ * skip
+ *
+ * step over the next instruction, its extra cycles
+ *
+ */
+static inline u32 skip(const pic18_t* p, u32* pc) {
+
+  u16 next = p->rom[(*pc >> 1) & ROM_MASK];
+  int two = (next & 0xF000) == 0xC000 || (next & 0xFE00) == 0xEC00 || (next & 0xFF00) == 0xEF00 ||
+            (next & 0xFFC0) == 0xEE00;
+
+  *pc += two ? 4 : 2;
+
+  return two ? 2 : 1;
+}
+
+
+static inline int polls_rx(u32 op) {
+
+  if (op == 0xCF9E) return 1;                                    // MOVFF from PIR1
+  if (op & 0x100) return 0;                                      // banked, not PIR1
+  if ((op & 0xE000) == 0xA000) return ((op >> 9) & 0x07) == 5;   // BTFSS / BTFSC of RCIF
+
+  return (op & 0xFC00) == 0x5000;                                // MOVF
+}
+
+
+/***
+ * record
+ *
+ * the leakage of the cycles of one instruction into the window
+ *
+ */
+static inline void record(pic18_t* p, u32 leak, u32 leak2, u32 cycles) {
+
+  u32 i;
+
+  for (i = 0; i < cycles; i++) {
+    if (p->skip) {
+      p->skip--;
+      continue;
+    }
+    if (p->trace != NULL) p->trace[p->filled] = (float)(i == 0 ? leak : (i == 1 ? leak2 : 0));
+    p->filled++;
+    if (--p->left == 0) {
+      p->recording = 0;
+      p->event = PIC18_WINDOW;
+      return;
+    }
+  }
+
+  return;
+}
+
+
+
+/************
+ * Decoding *
+ ************/
+
+
+
+/***
+ * decode
+ *
+ * the handler of an instruction word, K_POLLS added when it may poll
+ * RCIF; second words of two word instructions decode as whatever they
+ * look like but are never dispatched
+ *
+ */
+static u8 decode(u32 op) {
+
+  static const u8 literal[8] = { K_SUBLW, K_IORLW, K_XORLW, K_ANDLW, K_RETLW, K_MULLW, K_MOVLW, K_ADDLW };
+  static const u8 byte[24] = {
+    K_FAULT,  K_DECF,   K_FAULT,  K_FAULT,  K_IORWF,  K_ANDWF,  K_XORWF,  K_COMF,
+    K_ADDWFC, K_ADDWF,  K_INCF,   K_DECFSZ, K_RRCF,   K_RLCF,   K_SWAPF,  K_INCFSZ,
+    K_RRNCF,  K_RLNCF,  K_INFSNZ, K_DCFSNZ, K_MOVF,   K_SUBFWB, K_SUBWFB, K_SUBWF
+  };
+  static const u8 move[8] = { K_CPFSLT, K_CPFSEQ, K_CPFSGT, K_TSTFSZ, K_SETF, K_CLRF, K_NEGF, K_MOVWF };
+  static const u8 bit[5] = { K_BTG, K_BSF, K_BCF, K_BTFSS, K_BTFSC };
+  static const u8 branch[8] = { K_BZ, K_BNZ, K_BC, K_BNC, K_BOV, K_BNOV, K_BN, K_BNN };
+  u8 kind = ((op & 0xFF) == 0x9E && polls_rx(op)) ? K_POLLS : 0;
+
+  if (op < 0x0100) {
+    switch (op) {
+    case 0x0000: case 0x0004:                     return K_NOP;          // NOP, CLRWDT
+    case 0x0003:                                  return K_SLEEP;
+    case 0x0005:                                  return K_PUSH;
+    case 0x0006:                                  return K_POP;
+    case 0x0007:                                  return K_DAW;
+    case 0x0008: case 0x0009: case 0x000A: case 0x000B: return K_TBLRD;
+    case 0x000C: case 0x000D: case 0x000E: case 0x000F: return K_TBLWT;
+    case 0x0010: case 0x0011: case 0x0012: case 0x0013: return K_RETURN;  // RETFIE, RETURN
+    default:                                      return K_FAULT;        // RESET and the undefined
+    }
+  }
+
+  if (op < 0x0200) return (op & 0xF0) ? K_FAULT : K_MOVLB;
+  if (op < 0x0400) return K_MULWF;
+  if (op >= 0x0800 && op < 0x1000) return literal[(op >> 8) & 0x07];
+  if (op < 0x6000) return kind | byte[op >> 10];
+  if (op < 0x7000) return move[(op >> 9) & 0x07];
+  if (op < 0xC000) return kind | bit[(op >> 12) - 0x7];
+  if (op < 0xD000) return kind | K_MOVFF;
+  if (op < 0xE000) return (op & 0x0800) ? K_RCALL : K_BRA;
+  if (op < 0xE800) return branch[(op >> 8) & 0x07];
+  if ((op & 0xFE00) == 0xEC00) return K_CALL;
+  if ((op & 0xFF00) == 0xEF00) return K_GOTO;
+  if ((op & 0xFFC0) == 0xEE00) return K_LFSR;
+  if (op >= 0xF000) return K_NOP;
+
+  return K_FAULT;                                                        // extended set, off
+}
+
+
+
+/********
+ * Core *
+ ********/
+
+
+
+/***
+ * pic18_load
+ *
+ * the program memory from an Intel hex image (INHX32); configuration
+ * words and eeprom data are ignored
+ *
+ */
+int pic18_load(pic18_t* p, const char* path) {
+
+  FILE* fp = fopen(path, "r");
+  char line[600];
+  u8 image[PIC18_ROM], record_bytes[256];
+  u32 base = 0, address, length, type, sum, i;
+  int done = 0;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  memset(image, 0xFF, sizeof(image));
+
+  while (!done && fgets(line, sizeof(line), fp) != NULL) {
+    if (line[0] != ':') continue;
+
+    if (parse_bytes(line + 1, record_bytes, 4) < 0) goto bad;
+    length = record_bytes[0];
+    if (parse_bytes(line + 1, record_bytes, length + 5) < 0) goto bad;
+
+    for (sum = 0, i = 0; i < length + 5; i++) sum += record_bytes[i];
+    if ((sum & 0xFF) != 0) goto bad;
+
+    address = (u32)record_bytes[1] << 8 | record_bytes[2];
+    type = record_bytes[3];
+
+    switch (type) {
+    case 0:
+      for (i = 0; i < length; i++) {
+        if (base + address + i < PIC18_ROM) image[base + address + i] = record_bytes[4 + i];
+      }
+      break;
+    case 1:
+      done = 1;
+      break;
+    case 2:
+      base = ((u32)record_bytes[4] << 8 | record_bytes[5]) << 4;
+      break;
+    case 4:
+      base = ((u32)record_bytes[4] << 8 | record_bytes[5]) << 16;
+      break;
+    }
+  }
+
+  fclose(fp);
+
+  for (i = 0; i < PIC18_ROM / 2; i++) {
+    p->rom[i] = (u16)(image[2 * i] | image[2 * i + 1] << 8);
+    p->kind[i] = decode(p->rom[i]);
+  }
+  pic18_reset(p);
+
+  return 0;
+
+bad:
+  printf("[ERROR] %s is not an Intel hex image\n", path);
+  fclose(fp);
+
+  return -1;
+}
+
+
+/***
+ * pic18_flash
+ *
+ * program words at a byte address, for code built on the host rather
+ * than loaded from an image
+ *
+ */
+void pic18_flash(pic18_t* p, u32 address, const u16* words, u64 count) {
+
+  u64 i, w;
+
+  for (i = 0; i < count; i++) {
+    w = ((address >> 1) + i) & ROM_MASK;
+    p->rom[w] = words[i];
+    p->kind[w] = decode(words[i]);
+  }
+
+  return;
+}
+
+
+/***
+ * pic18_reset
+ *
+ * power on: program counter, data memory and queues cleared, the sfrs
+ * the firmware relies on at their reset values
+ *
+ */
+void pic18_reset(pic18_t* p) {
+
+  memset(p->ram, 0, sizeof(p->ram));
+  memset(p->stack, 0, sizeof(p->stack));
+  memset(p->shadow, 0, sizeof(p->shadow));
+
+  p->ram[TRISB] = 0xFF;
+  p->ram[PIR1] = TXIF;
+  p->ram[TXSTA] = TRMT;
+
+  p->pc = 0;
+  p->cycles = 0;
+  p->rx_head = p->rx_tail = 0;
+  p->tx_length = 0;
+  p->poll_pass = 0;
+  p->flush = 0;
+  p->armed = 0;
+  p->recording = 0;
+  p->watch = PIC18_NOWHERE;
+  p->event = 0;
+
+  return;
+}
+
+
+/***
+ * pic18_send
+ *
+ * queue bytes for the uart
+ *
+ */
+int pic18_send(pic18_t* p, const u8* bytes, u64 length) {
+
+  u64 i;
+
+  if (p->rx_head - p->rx_tail + length > PIC18_UART) return -1;
+  for (i = 0; i < length; i++) p->rx[p->rx_head++ % PIC18_UART] = bytes[i];
+
+  return 0;
+}
+
+
+/***
+ * pic18_arm
+ *
+ * record the next trigger: count cycles after skip, from the instruction
+ * at address or the one that raises PIN_B0 (PIC18_NOWHERE); a NULL
+ * trace only counts them
+ *
+ */
+void pic18_arm(pic18_t* p, u32 address, u64 skip, u64 count, float* trace) {
+
+  p->armed = (count > 0);
+  p->recording = 0;
+  p->watch = address;
+  p->skip = skip;
+  p->left = count;
+  p->trace = trace;
+  p->filled = 0;
+
+  return;
+}
+
+
+/***
+ * pic18_run
+ *
+ * execute until an event or until the cycle count reaches limit. Every
+ * handler ends in its own copy of the dispatch (computed goto), which
+ * the branch predictor follows far better than one shared switch.
+ *
+ */
+u32 pic18_run(pic18_t* p, u64 limit) {
+
+  static const void* const handler[KINDS] = {
+    [K_NOP]    = &&nop,    [K_SLEEP]  = &&sleep,  [K_PUSH]   = &&push,   [K_POP]    = &&pop,
+    [K_DAW]    = &&daw,    [K_TBLRD]  = &&tblrd,  [K_TBLWT]  = &&tblwt,  [K_RETURN] = &&ret,
+    [K_FAULT]  = &&fault,  [K_MOVLB]  = &&movlb,  [K_MULWF]  = &&mulwf,  [K_SUBLW]  = &&sublw,
+    [K_IORLW]  = &&iorlw,  [K_XORLW]  = &&xorlw,  [K_ANDLW]  = &&andlw,  [K_RETLW]  = &&retlw,
+    [K_MULLW]  = &&mullw,  [K_MOVLW]  = &&movlw,  [K_ADDLW]  = &&addlw,  [K_DECF]   = &&decf,
+    [K_IORWF]  = &&iorwf,  [K_ANDWF]  = &&andwf,  [K_XORWF]  = &&xorwf,  [K_COMF]   = &&comf,
+    [K_ADDWFC] = &&addwfc, [K_ADDWF]  = &&addwf,  [K_INCF]   = &&incf,   [K_DECFSZ] = &&decfsz,
+    [K_RRCF]   = &&rrcf,   [K_RLCF]   = &&rlcf,   [K_SWAPF]  = &&swapf,  [K_INCFSZ] = &&incfsz,
+    [K_RRNCF]  = &&rrncf,  [K_RLNCF]  = &&rlncf,  [K_INFSNZ] = &&infsnz, [K_DCFSNZ] = &&dcfsnz,
+    [K_MOVF]   = &&movf,   [K_SUBFWB] = &&subfwb, [K_SUBWFB] = &&subwfb, [K_SUBWF]  = &&subwf,
+    [K_CPFSLT] = &&cpfslt, [K_CPFSEQ] = &&cpfseq, [K_CPFSGT] = &&cpfsgt, [K_TSTFSZ] = &&tstfsz,
+    [K_SETF]   = &&setf,   [K_CLRF]   = &&clrf,   [K_NEGF]   = &&negf,   [K_MOVWF]  = &&movwf,
+    [K_BTG]    = &&btg,    [K_BSF]    = &&bsf,    [K_BCF]    = &&bcf,    [K_BTFSS]  = &&btfss,
+    [K_BTFSC]  = &&btfsc,  [K_MOVFF]  = &&movff,  [K_BRA]    = &&bra,    [K_RCALL]  = &&rcall,
+    [K_BZ]     = &&bz,     [K_BNZ]    = &&bnz,    [K_BC]     = &&bc,     [K_BNC]    = &&bnc,
+    [K_BOV]    = &&bov,    [K_BNOV]   = &&bnov,   [K_BN]     = &&bn,     [K_BNN]    = &&bnn,
+    [K_CALL]   = &&call,   [K_GOTO]   = &&go,     [K_LFSR]   = &&lfsr
+  };
+  u32 pc = p->pc, op, kind, a, k, r, leak, leak2, cycles, event;
+  u64 clock = p->cycles;
+  u8 v;
+
+#define DISPATCH()                                                                     \
+  do {                                                                                 \
+    if (clock >= limit) {                                                              \
+      p->pc = pc;                                                                      \
+      p->cycles = clock;                                                               \
+      return PIC18_LIMIT;                                                              \
+    }                                                                                  \
+    if (p->armed && pc == p->watch) start_window(p);                                   \
+    op = p->rom[(pc >> 1) & ROM_MASK];                                                 \
+    kind = p->kind[(pc >> 1) & ROM_MASK];                                              \
+    if ((kind & K_POLLS) && p->rx_head == p->rx_tail) {                                \
+      if (!p->poll_pass) {                                                             \
+        p->pc = pc;                                                                    \
+        p->cycles = clock;                                                             \
+        return PIC18_POLL;                                                             \
+      }                                                                                \
+      p->poll_pass = 0;                                                                \
+    }                                                                                  \
+    pc += 2;                                                                           \
+    cycles = 1;                                                                        \
+    leak = leak2 = 0;                                                                  \
+    goto *handler[kind & ~K_POLLS];                                                    \
+  } while (0)
+
+#define NEXT()                                                                         \
+  do {                                                                                 \
+    if (p->flush) {                                                                    \
+      p->flush = 0;                                                                    \
+      cycles++;                                                                        \
+    }                                                                                  \
+    clock += cycles;                                                                   \
+    if (p->recording) record(p, leak, leak2, cycles);                                  \
+    if (p->event) {                                                                    \
+      event = p->event;                                                                \
+      p->event = 0;                                                                    \
+      p->pc = pc;                                                                      \
+      p->cycles = clock;                                                               \
+      return event;                                                                    \
+    }                                                                                  \
+    DISPATCH();                                                                        \
+  } while (0)
+
+  DISPATCH();
+
+  // control
+nop:
+  NEXT();
+sleep:
+  p->event = PIC18_SLEEP;
+  NEXT();
+fault:
+  p->event = PIC18_FAULT;
+  NEXT();
+push:
+  push(p, pc);
+  NEXT();
+pop:
+  pop(p);
+  NEXT();
+daw:
+  v = W;
+  r = v;
+  if ((v & 0x0F) > 9 || (p->ram[STATUS] & FLAG_DC)) r += 0x06;
+  if (((r >> 4) & 0x0F) > 9 || (p->ram[STATUS] & FLAG_C) || r > 0xFF) r += 0x60;
+  p->ram[STATUS] = (p->ram[STATUS] & (u8)~FLAG_C) | ((r > 0xFF) ? FLAG_C : 0);
+  W = (u8)r;
+  leak = hw(v ^ W);
+  NEXT();
+tblrd:
+  a = (u32)p->ram[TBLPTRU] << 16 | (u32)p->ram[TBLPTRH] << 8 | p->ram[TBLPTRL];
+  if (op == 0x000B) a++;
+  v = (a < PIC18_ROM) ? (u8)(p->rom[a >> 1] >> (8 * (a & 1))) : 0;
+  leak2 = hw(v) + hw(v ^ p->ram[TABLAT]);
+  p->ram[TABLAT] = v;
+  if (op == 0x0009) a++;
+  if (op == 0x000A) a--;
+  p->ram[TBLPTRL] = (u8)a;
+  p->ram[TBLPTRH] = (u8)(a >> 8);
+  p->ram[TBLPTRU] = (u8)((a >> 16) & 0x3F);
+  cycles = 2;
+  NEXT();
+tblwt:                                                                          // no self programming
+  cycles = 2;
+  NEXT();
+ret:                                                                            // RETURN, RETFIE
+  pc = pop(p);
+  if (op & 0x01) {
+    W = p->shadow[0];
+    p->ram[STATUS] = p->shadow[1];
+    p->ram[BSR] = p->shadow[2];
+  }
+  cycles = 2;
+  NEXT();
+
+  // literals
+movlb:
+  p->ram[BSR] = op & 0x0F;
+  leak = hw(op & 0x0F);
+  NEXT();
+sublw:
+  k = op & 0xFF;
+  v = W;
+  W = add(p, k, (u8)~v, 1);
+  goto literal;
+iorlw:
+  k = op & 0xFF;
+  v = W;
+  W = v | (u8)k;
+  flags_zn(p, W);
+  goto literal;
+xorlw:
+  k = op & 0xFF;
+  v = W;
+  W = v ^ (u8)k;
+  flags_zn(p, W);
+  goto literal;
+andlw:
+  k = op & 0xFF;
+  v = W;
+  W = v & (u8)k;
+  flags_zn(p, W);
+  goto literal;
+retlw:
+  k = op & 0xFF;
+  v = W;
+  W = (u8)k;
+  pc = pop(p);
+  cycles = 2;
+  goto literal;
+movlw:
+  k = op & 0xFF;
+  v = W;
+  W = (u8)k;
+  goto literal;
+addlw:
+  k = op & 0xFF;
+  v = W;
+  W = add(p, v, k, 0);
+literal:
+  leak = hw(k) + hw(v ^ W);
+  NEXT();
+mullw:
+  r = (op & 0xFF) * (u32)W;
+  leak = hw(op & 0xFF) + hw((u8)r ^ p->ram[PRODL]) + hw((r >> 8) ^ p->ram[PRODH]);
+  p->ram[PRODL] = (u8)r;
+  p->ram[PRODH] = (u8)(r >> 8);
+  NEXT();
+mulwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u32)v * W;
+  leak = hw(v) + hw((u8)r ^ p->ram[PRODL]) + hw((r >> 8) ^ p->ram[PRODH]);
+  p->ram[PRODL] = (u8)r;
+  p->ram[PRODH] = (u8)(r >> 8);
+  NEXT();
+
+  // byte oriented, the result to WREG or the file register
+decf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, 0xFF, 0);
+  goto store;
+iorwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = v | W;
+  flags_zn(p, (u8)r);
+  goto store;
+andwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = v & W;
+  flags_zn(p, (u8)r);
+  goto store;
+xorwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = v ^ W;
+  flags_zn(p, (u8)r);
+  goto store;
+comf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)~v;
+  flags_zn(p, (u8)r);
+  goto store;
+addwfc:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, W, p->ram[STATUS] & FLAG_C);
+  goto store;
+addwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, W, 0);
+  goto store;
+incf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, 1, 0);
+  goto store;
+decfsz:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v - 1);
+  if (r == 0) cycles += skip(p, &pc);
+  goto store;
+rrcf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (v >> 1) | (p->ram[STATUS] & FLAG_C) << 7;
+  p->ram[STATUS] = (p->ram[STATUS] & (u8)~FLAG_C) | (v & 0x01);
+  flags_zn(p, (u8)r);
+  goto store;
+rlcf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v << 1) | (p->ram[STATUS] & FLAG_C);
+  p->ram[STATUS] = (p->ram[STATUS] & (u8)~FLAG_C) | (v >> 7);
+  flags_zn(p, (u8)r);
+  goto store;
+swapf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v << 4 | v >> 4);
+  goto store;
+incfsz:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v + 1);
+  if (r == 0) cycles += skip(p, &pc);
+  goto store;
+rrncf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v >> 1 | v << 7);
+  flags_zn(p, (u8)r);
+  goto store;
+rlncf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v << 1 | v >> 7);
+  flags_zn(p, (u8)r);
+  goto store;
+infsnz:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v + 1);
+  if (r != 0) cycles += skip(p, &pc);
+  goto store;
+dcfsnz:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = (u8)(v - 1);
+  if (r != 0) cycles += skip(p, &pc);
+  goto store;
+movf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = v;
+  flags_zn(p, (u8)r);
+  goto store;
+subfwb:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, W, (u8)~v, p->ram[STATUS] & FLAG_C);
+  goto store;
+subwfb:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, (u8)~W, p->ram[STATUS] & FLAG_C);
+  goto store;
+subwf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, v, (u8)~W, 1);
+store:
+  if (op & 0x200) {
+    leak = hw(v) + hw((u8)r ^ p->ram[a]);
+    put(p, a, (u8)r, &pc);
+  } else {
+    leak = hw(v) + hw((u8)r ^ W);
+    W = (u8)r;
+  }
+  NEXT();
+
+  // byte oriented, compares and moves
+cpfslt:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (v < W) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+cpfseq:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (v == W) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+cpfsgt:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (v > W) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+tstfsz:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (v == 0) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+setf:
+  a = file(p, op);
+  leak = hw(p->ram[a] ^ 0xFF);
+  put(p, a, 0xFF, &pc);
+  NEXT();
+clrf:
+  a = file(p, op);
+  leak = hw(p->ram[a]);
+  put(p, a, 0, &pc);
+  p->ram[STATUS] |= FLAG_Z;
+  NEXT();
+negf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  r = add(p, 0, (u8)~v, 1);
+  leak = hw(v) + hw(v ^ r);
+  put(p, a, (u8)r, &pc);
+  NEXT();
+movwf:
+  a = file(p, op);
+  leak = hw(W) + hw(p->ram[a] ^ W);
+  put(p, a, W, &pc);
+  NEXT();
+
+  // bit oriented
+btg:
+  a = file(p, op);
+  v = get(p, a, pc);
+  put(p, a, v ^ (u8)(1u << ((op >> 9) & 0x07)), &pc);
+  leak = hw(v) + 1;
+  NEXT();
+bsf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  k = 1u << ((op >> 9) & 0x07);
+  put(p, a, v | (u8)k, &pc);
+  leak = hw(v) + !(v & k);
+  NEXT();
+bcf:
+  a = file(p, op);
+  v = get(p, a, pc);
+  k = 1u << ((op >> 9) & 0x07);
+  put(p, a, v & (u8)~k, &pc);
+  leak = hw(v) + !!(v & k);
+  NEXT();
+btfss:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (v & (1u << ((op >> 9) & 0x07))) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+btfsc:
+  a = file(p, op);
+  v = get(p, a, pc);
+  if (!(v & (1u << ((op >> 9) & 0x07)))) cycles += skip(p, &pc);
+  leak = hw(v);
+  NEXT();
+
+movff:
+  k = p->rom[(pc >> 1) & ROM_MASK];
+  pc += 2;
+  v = get(p, resolve(p, op & 0xFFF), pc);
+  a = resolve(p, k & 0xFFF);
+  leak = hw(v);
+  leak2 = hw(v) + hw(v ^ p->ram[a]);
+  if (a != PCL && a != TOSL && a != TOSH && a != TOSU) put(p, a, v, &pc);
+  cycles = 2;
+  NEXT();
+
+  // branches
+rcall:
+  push(p, pc);
+bra:
+  pc = (pc + 2 * (u32)(((int32_t)(op << 21)) >> 21)) & 0x1FFFFE;
+  cycles = 2;
+  NEXT();
+bz:
+  k = p->ram[STATUS] & FLAG_Z;
+  goto branch;
+bnz:
+  k = !(p->ram[STATUS] & FLAG_Z);
+  goto branch;
+bc:
+  k = p->ram[STATUS] & FLAG_C;
+  goto branch;
+bnc:
+  k = !(p->ram[STATUS] & FLAG_C);
+  goto branch;
+bov:
+  k = p->ram[STATUS] & FLAG_OV;
+  goto branch;
+bnov:
+  k = !(p->ram[STATUS] & FLAG_OV);
+  goto branch;
+bn:
+  k = p->ram[STATUS] & FLAG_N;
+  goto branch;
+bnn:
+  k = !(p->ram[STATUS] & FLAG_N);
+branch:
+  if (k) {
+    pc = (pc + 2 * (u32)(int32_t)(int8_t)(op & 0xFF)) & 0x1FFFFE;
+    cycles = 2;
+  }
+  NEXT();
+call:
+  k = p->rom[(pc >> 1) & ROM_MASK];
+  pc += 2;
+  if (op & 0x100) {
+    p->shadow[0] = W;
+    p->shadow[1] = p->ram[STATUS];
+    p->shadow[2] = p->ram[BSR];
+  }
+  push(p, pc);
+  pc = ((k & 0x0FFF) << 8 | (op & 0xFF)) << 1;
+  cycles = 2;
+  NEXT();
+go:
+  k = p->rom[(pc >> 1) & ROM_MASK];
+  pc = ((k & 0x0FFF) << 8 | (op & 0xFF)) << 1;
+  cycles = 2;
+  NEXT();
+lfsr:
+  k = p->rom[(pc >> 1) & ROM_MASK];
+  pc += 2;
+  a = (op >> 4) & 0x03;
+  a = (a == 0) ? FSR0L : ((a == 1) ? FSR1L : FSR2L);
+  r = (op & 0x0F) << 8 | (k & 0xFF);
+  leak = hw(r);
+  p->ram[a] = (u8)r;
+  p->ram[a + 1] = (u8)(r >> 8);
+  cycles = 2;
+  NEXT();
+
+#undef DISPATCH
+#undef NEXT
+}
@@ -0,0 +1,97 @@
+/*
+ * pic18.h
+ *
+ * instruction level emulator of the PIC18F2550 the firmware runs on
+ *
+ * the core executes the compiled image (main.hex) instruction by
+ * instruction, counting instruction cycles as the chip does (48 MHz
+ * clock, four clocks per cycle): one per instruction, two for taken
+ * branches, calls, returns, table reads, MOVFF, LFSR and writes of PCL,
+ * two or three for a skip over one or two words. The standard
+ * instruction set is complete; the extended one is off in the fuses
+ * (NOXINST). Modelled peripherals are the ones the firmware touches:
+ *
+ *   uart    RCREG reads the host's queue, RCIF is set while it is not
+ *           empty; TXREG appends to the host's buffer, TXIF and TRMT are
+ *           always set (no baud rate timing)
+ *   PIN_B0  LATB bit 0, a rising edge while TRISB makes it an output is
+ *           the scope's trigger
+ *
+ * there are no interrupts, timers or watchdog, so delay loops simply
+ * run. Every instruction cycle has one leakage sample: the Hamming
+ * weight of the value on the data bus (the file register read or the
+ * literal) plus the Hamming distance of the register written, WREG or
+ * the file register; the second cycle of MOVFF is its write, other extra
+ * cycles (flushes, the skipped word) leak nothing.
+ *
+ * the host drives the core with pic18_run(), which returns on events:
+ * the firmware polls RCIF with nothing queued, the recorded window of a
+ * trigger is complete, or the cycle limit is reached.
+ *
+ */
+
+#ifndef PIC18_H
+#define PIC18_H
+
+#include "trivium.h"
+
+#define PIC18_ROM         0x8000        // bytes of program memory
+#define PIC18_RAM         0x1000        // data address space
+#define PIC18_SFR         0xF60         // first special function register
+#define PIC18_STACK       31
+#define PIC18_UART        256           // bytes of the receive queue
+#define PIC18_TX          4096          // bytes of the transmit buffer
+#define PIC18_NOWHERE     0xFFFFFFFF    // no trigger address
+
+enum {
+  PIC18_LIMIT  = 0,                     // the cycle limit was reached
+  PIC18_POLL   = 1,                     // RCIF polled with an empty queue
+  PIC18_WINDOW = 2,                     // the window is recorded
+  PIC18_SLEEP  = 3,
+  PIC18_FAULT  = 4                      // stack over or underflow, RESET
+};
+
+
+/***
+ * pic18_t
+ *
+ * a POLL event leaves the polling instruction unexecuted: the host
+ * queues bytes for it, or sets poll_pass to let it see the empty queue
+ * once. A trigger, the pin or reaching the watched address, starts the
+ * window when armed: skip cycles are dropped, count recorded into trace.
+ *
+ */
+typedef struct {
+  u16    rom[PIC18_ROM / 2];
+  u8     kind[PIC18_ROM / 2];           // decoded handler of every word
+  u8     ram[PIC18_RAM];                // sfrs in place, w at WREG
+  u32    pc;                            // byte address
+  u32    stack[PIC18_STACK + 1];        // [1..31]
+  u8     shadow[3];                     // w, status, bsr of the fast calls
+  u64    cycles;
+  u32    flush;                         // a write of PCL costs a cycle
+
+  u8     rx[PIC18_UART];
+  u32    rx_head, rx_tail;
+  u8     tx[PIC18_TX];
+  u64    tx_length;
+  int    poll_pass;
+
+  int    armed;
+  u32    watch;                         // trigger address, PIC18_NOWHERE for PIN_B0
+  u64    skip, left;
+  float* trace;
+  u64    filled;
+  int    recording;
+  u32    event;
+} pic18_t;
+
+
+int  pic18_load(pic18_t* p, const char* path);
+void pic18_flash(pic18_t* p, u32 address, const u16* words, u64 count);
+void pic18_reset(pic18_t* p);
+int  pic18_send(pic18_t* p, const u8* bytes, u64 length);
+void pic18_arm(pic18_t* p, u32 address, u64 skip, u64 count, float* trace);
+u32  pic18_run(pic18_t* p, u64 limit);
+
+#endif
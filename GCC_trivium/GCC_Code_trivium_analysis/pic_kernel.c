@@ -0,0 +1,624 @@
+/*
+ * pic_kernel.c
+ *
+ * byte aligned trivium kernel for the firmware: generates the PIC18
+ * code of trivium_byte_step() (see trivium.h), runs it on the emulator
+ * (pic18.h) against the portable core and the word core, and checks its
+ * cycle counts against the ones recorded below
+ *
+ *  build : gcc -O2 -o pic_kernel pic_kernel.c pic18.c trivium_byte.c trivium_word.c -lm
+ *  run   : ./pic_kernel [-n keys] [-b bytes] [-S seed] [-f firmware.hex] [-o include]
+ *
+ *   -n keys      random keys and ivs to check (default 64)
+ *   -b bytes     keystream bytes per key (default 16, the block of the 32
+ *                byte input firmware; 64 for the 128 byte one)
+ *   -S seed      of the keys and ivs (default 1)
+ *   -f firmware  also time one pass of this image's repeat loop, the
+ *                stock kernel, for comparison
+ *   -o include   write the kernel as a CCS include (trivium8.h)
+ *
+ * the firmware's update() goes through gsb() / psb(), divisions and
+ * modulo on 16 bit longs, and a 36 byte scw() rotation for every bit.
+ * The kernel keeps the registers byte aligned instead, so eight clocks
+ * are 15 unaligned tap bytes (two MULLW each, the multiplier does the
+ * shifts), a few xors and a one byte move of every register. It is
+ * straight line code: the cycle counts do not depend on key or iv, which
+ * is checked too, and the traces of all encryptions line up.
+ *
+ * the code sits at KERNEL_ORIGIN, state and scratch in bank 2 (free in
+ * both firmwares). Both entries are called with CALL ..,FAST and return
+ * with RETURN FAST, so w, status and bsr survive for the compiled code
+ *
+ *   step  eight clocks, the keystream byte in z
+ *   init  144 steps, the initialization
+ *
+ * exit status is 0 only if every keystream byte and cycle count matches.
+ * A change of the kernel that moves a count must update STEP_CYCLES /
+ * INIT_CYCLES with it.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "pic18.h"
+#include "trivium.h"
+#include "util.h"
+
+#define KERNEL_ORIGIN 0x4000
+#define KERNEL_WORDS  512
+#define KERNEL_RAM    0x200
+#define KERNEL_BANK   (KERNEL_RAM >> 8)
+
+// recorded cycle counts of one call, CALL and RETURN FAST included
+#define STEP_CYCLES   225
+#define INIT_CYCLES   32118
+
+// the register bytes, then the scratch registers
+#define RAM_A   (KERNEL_RAM)
+#define RAM_B   (RAM_A + ABYTES)
+#define RAM_C   (RAM_B + BBYTES)
+#define RAM_T1  (RAM_C + CBYTES)
+#define RAM_T2  (RAM_T1 + 1)
+#define RAM_T3  (RAM_T1 + 2)
+#define RAM_U   (RAM_T1 + 3)
+#define RAM_X   (RAM_T1 + 4)
+#define RAM_Z   (RAM_T1 + 5)
+#define RAM_N   (RAM_T1 + 6)
+#define RAM_END (RAM_T1 + 7)
+
+#define PRODL   0xFF3
+#define PRODH   0xFF4
+#define STATUS  0xFD8
+#define BSR     0xFE0
+#define WREG    0xFE8
+
+// bit position of the (i + 1)th state bit of a register of n bytes
+#define AT(n, i) (8 * (n) - 1 - (i))
+
+// the host's stub: CALL init,FAST / SLEEP / CALL step,FAST / SLEEP
+#define STUB_INIT 0x0000
+#define STUB_STEP 0x0006
+
+// a repeat loop pass of the stock firmware is longer than this
+#define STOCK_GAP 100000
+
+
+typedef struct {
+  u16  word[KERNEL_WORDS];
+  char text[KERNEL_WORDS][24];          // listing, empty for second words
+  u32  count;
+  u32  step, init;                      // entry points, byte addresses
+} kernel_t;
+
+
+
+/**************
+ * Assembling *
+ **************/
+
+
+
+static inline u32 here(const kernel_t* k) {
+  return KERNEL_ORIGIN + 2 * k->count;
+}
+
+
+static void emit(kernel_t* k, u16 word, const char* format, ...) {
+
+  va_list args;
+
+  if (k->count == KERNEL_WORDS) return;
+
+  k->text[k->count][0] = 0;
+  if (format != NULL) {
+    va_start(args, format);
+    vsnprintf(k->text[k->count], sizeof(k->text[0]), format, args);
+    va_end(args);
+  }
+  k->word[k->count++] = word;
+
+  return;
+}
+
+
+/***
+ * file_op
+ *
+ * byte oriented file register operation, d < 0 for MOVWF which has no
+ * destination bit. Bank 2 is banked, the sfrs go through the access
+ * bank; listed as the CCS listing does (x for banked)
+ *
+ */
+static void file_op(kernel_t* k, u16 base, const char* name, u32 f, int d) {
+
+  int banked = f < PIC18_SFR;
+  u16 word = base | (banked ? 0x0100 : 0) | (f & 0xFF) | (d > 0 ? 0x0200 : 0);
+
+  if (d < 0) emit(k, word, banked ? "%-6s x%02X" : "%-6s %03X", name, banked ? f & 0xFF : f);
+  else emit(k, word, banked ? "%-6s x%02X,%c" : "%-6s %03X,%c", name, banked ? f & 0xFF : f, d ? 'F' : 'W');
+
+  return;
+}
+
+
+#define MOVF(k, f, d)   file_op(k, 0x5000, "MOVF",   f, d)
+#define MOVWF(k, f)     file_op(k, 0x6E00, "MOVWF",  f, -1)
+#define XORWF(k, f, d)  file_op(k, 0x1800, "XORWF",  f, d)
+#define IORWF(k, f, d)  file_op(k, 0x1000, "IORWF",  f, d)
+#define ANDWF(k, f, d)  file_op(k, 0x1400, "ANDWF",  f, d)
+#define DECFSZ(k, f, d) file_op(k, 0x2C00, "DECFSZ", f, d)
+
+#define MOVLW(k, l)     emit(k, (u16)(0x0E00 | ((l) & 0xFF)), "%-6s %02X", "MOVLW", (l) & 0xFF)
+#define MULLW(k, l)     emit(k, (u16)(0x0D00 | ((l) & 0xFF)), "%-6s %02X", "MULLW", (l) & 0xFF)
+#define MOVLB(k, l)     emit(k, (u16)(0x0100 | ((l) & 0x0F)), "%-6s %X",   "MOVLB", (l) & 0x0F)
+#define RETURN(k, s)    emit(k, (u16)(0x0012 | (s)), (s) ? "RETURN 1" : "RETURN 0")
+#define SLEEP(k)        emit(k, 0x0003, "SLEEP")
+
+
+/***
+ * relative
+ *
+ * RCALL / BRA to a byte address
+ *
+ */
+static void relative(kernel_t* k, u16 base, const char* name, u32 target) {
+
+  int32_t n = ((int32_t)target - (int32_t)here(k) - 2) / 2;
+
+  emit(k, (u16)(base | (n & 0x7FF)), "%-6s %04X", name, target);
+
+  return;
+}
+
+
+static void call(kernel_t* k, u32 target, int fast) {
+
+  emit(k, (u16)(0xEC00 | (fast ? 0x0100 : 0) | ((target >> 1) & 0xFF)), "%-6s %04X,%d", "CALL", target, fast);
+  emit(k, (u16)(0xF000 | ((target >> 9) & 0x0FFF)), NULL);
+
+  return;
+}
+
+
+
+/**********
+ * Kernel *
+ **********/
+
+
+
+/***
+ * grab
+ *
+ * the tap byte at bit q of a register into w: the multiplier shifts the
+ * low byte right (PRODH) and the high byte left (PRODL)
+ *
+ */
+static void grab(kernel_t* k, u32 r, unsigned q) {
+
+  unsigned j = q >> 3, s = q & 7;
+
+  MOVF(k, r + j, 0);
+  if (s == 0) return;
+
+  MULLW(k, 1 << (8 - s));
+  MOVF(k, PRODH, 0);
+  MOVWF(k, RAM_X);
+  MOVF(k, r + j + 1, 0);
+  MULLW(k, 1 << (8 - s));
+  MOVF(k, PRODL, 0);
+  IORWF(k, RAM_X, 0);
+
+  return;
+}
+
+
+// t = x ^ y
+static void linear(kernel_t* k, u32 t, u32 rx, unsigned x, u32 ry, unsigned y) {
+
+  grab(k, rx, x);
+  MOVWF(k, t);
+  grab(k, ry, y);
+  XORWF(k, t, 1);
+
+  return;
+}
+
+
+// t ^= (x & y) ^ w
+static void feedback(kernel_t* k, u32 t, u32 rx, unsigned x, unsigned y, u32 rw, unsigned w) {
+
+  grab(k, rx, x);
+  MOVWF(k, RAM_U);
+  grab(k, rx, y);
+  ANDWF(k, RAM_U, 0);
+  XORWF(k, t, 1);
+  grab(k, rw, w);
+  XORWF(k, t, 1);
+
+  return;
+}
+
+
+// every byte down one, the feedback byte on top
+static void shift(kernel_t* k, u32 r, unsigned n, u32 t) {
+
+  unsigned i;
+
+  for (i = 0; i + 1 < n; i++) {
+    MOVF(k, r + i + 1, 0);
+    MOVWF(k, r + i);
+  }
+  MOVF(k, t, 0);
+  MOVWF(k, r + n - 1);
+
+  return;
+}
+
+
+/***
+ * generate
+ *
+ * the eight clock pass first, as trivium_byte_step() computes it, then
+ * the two entries around it
+ *
+ */
+static void generate(kernel_t* k) {
+
+  u32 pass = here(k), loop;
+
+  linear(k, RAM_T1, RAM_A, AT(ABYTES, 65), RAM_A, AT(ABYTES, 92));
+  linear(k, RAM_T2, RAM_B, AT(BBYTES, 68), RAM_B, AT(BBYTES, 83));
+  linear(k, RAM_T3, RAM_C, AT(CBYTES, 65), RAM_C, AT(CBYTES, 110));
+
+  MOVF(k, RAM_T1, 0);
+  XORWF(k, RAM_T2, 0);
+  XORWF(k, RAM_T3, 0);
+  MOVWF(k, RAM_Z);
+
+  feedback(k, RAM_T1, RAM_A, AT(ABYTES, 90),  AT(ABYTES, 91),  RAM_B, AT(BBYTES, 77));
+  feedback(k, RAM_T2, RAM_B, AT(BBYTES, 81),  AT(BBYTES, 82),  RAM_C, AT(CBYTES, 86));
+  feedback(k, RAM_T3, RAM_C, AT(CBYTES, 108), AT(CBYTES, 109), RAM_A, AT(ABYTES, 68));
+
+  shift(k, RAM_A, ABYTES, RAM_T3);
+  shift(k, RAM_B, BBYTES, RAM_T1);
+  shift(k, RAM_C, CBYTES, RAM_T2);
+  RETURN(k, 0);
+
+  k->step = here(k);
+  MOVLB(k, KERNEL_BANK);
+  relative(k, 0xD800, "RCALL", pass);
+  RETURN(k, 1);
+
+  k->init = here(k);
+  MOVLB(k, KERNEL_BANK);
+  MOVLW(k, INIT_ROUNDS / 8);
+  MOVWF(k, RAM_N);
+  loop = here(k);
+  relative(k, 0xD800, "RCALL", pass);
+  DECFSZ(k, RAM_N, 1);
+  relative(k, 0xD000, "BRA", loop);
+  RETURN(k, 1);
+
+  return;
+}
+
+
+
+/**************
+ * Emulation *
+ **************/
+
+
+
+/***
+ * board
+ *
+ * the kernel at its origin and the host's stub at the reset vector
+ *
+ */
+static void board(pic18_t* p, const kernel_t* k) {
+
+  kernel_t stub;
+
+  memset(&stub, 0, sizeof(stub));
+  call(&stub, k->init, 1);
+  SLEEP(&stub);
+  call(&stub, k->step, 1);
+  SLEEP(&stub);
+
+  memset(p, 0, sizeof(*p));
+  pic18_flash(p, KERNEL_ORIGIN, k->word, k->count);
+  pic18_flash(p, STUB_INIT, stub.word, stub.count);
+  pic18_reset(p);
+
+  return;
+}
+
+
+/***
+ * call_kernel
+ *
+ * run one entry through its stub; returns the cycles of the call
+ * without the stub's SLEEP, -1 if it does not come back with w, status
+ * and bsr as they were
+ *
+ */
+static int64_t call_kernel(pic18_t* p, u32 stub) {
+
+  u8 w = 0xA5, status = 0x1B, bsr = 0x0F;
+  u64 start;
+
+  p->ram[WREG] = w;
+  p->ram[STATUS] = status;
+  p->ram[BSR] = bsr;
+  p->pc = stub;
+  start = p->cycles;
+
+  if (pic18_run(p, p->cycles + 1000000) != PIC18_SLEEP) return -1;
+  if (p->ram[WREG] != w || p->ram[STATUS] != status || p->ram[BSR] != bsr) return -1;
+
+  return (int64_t)(p->cycles - start - 1);
+}
+
+
+/***
+ * check
+ *
+ * keystream and cycles of the kernel on the emulator for n random keys
+ * and ivs
+ *
+ */
+static int check(const kernel_t* k, u64 n, u64 bytes, u64 seed) {
+
+  pic18_t* p = malloc(sizeof(pic18_t));
+  trivium_byte_t s;
+  u8 key[KEYLENGTH], iv[IVLENGTH], *word = malloc(bytes), *byte = malloc(bytes);
+  u64 i, j, mismatches = 0, portable = 0, init_off = 0, step_off = 0;
+  int64_t cycles;
+  int result = -1;
+
+  if (p == NULL || word == NULL || byte == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  board(p, k);
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < KEYLENGTH; j++) key[j] = (u8)splitmix64(&seed);
+    for (j = 0; j < IVLENGTH; j++) iv[j] = (u8)splitmix64(&seed);
+
+    trivium_word_keystream(key, iv, word, bytes);
+    trivium_byte_keystream(key, iv, byte, bytes);
+    portable += (memcmp(word, byte, bytes) != 0);
+
+    trivium_byte_load(&s, key, iv);
+    memcpy(p->ram + RAM_A, &s, sizeof(s));
+
+    if ((cycles = call_kernel(p, STUB_INIT)) < 0) goto broken;
+    init_off += (cycles != INIT_CYCLES);
+
+    for (j = 0; j < bytes; j++) {
+      if ((cycles = call_kernel(p, STUB_STEP)) < 0) goto broken;
+      step_off += (cycles != STEP_CYCLES);
+      mismatches += (p->ram[RAM_Z] != word[j]);
+    }
+  }
+
+  printf("[%s] portable %lu keys, %lu bytes each, %lu mismatches against the word core\n",
+         portable ? "ERROR" : "SUCCESS", n, bytes, portable);
+  printf("[%s] kernel   %lu keys, %lu bytes each, %lu mismatches on the emulator\n",
+         mismatches ? "ERROR" : "SUCCESS", n, bytes, mismatches);
+  printf("[%s] init     %ld cycles, %lu calls off the recorded %d\n",
+         init_off ? "ERROR" : "SUCCESS", (long)call_kernel(p, STUB_INIT), init_off, INIT_CYCLES);
+  printf("[%s] step     %ld cycles, %lu calls off the recorded %d\n",
+         step_off ? "ERROR" : "SUCCESS", (long)call_kernel(p, STUB_STEP), step_off, STEP_CYCLES);
+
+  result = (portable || mismatches || init_off || step_off) ? -1 : 0;
+  goto done;
+
+broken:
+  printf("[ERROR] the kernel does not return to its caller intact\n");
+
+done:
+  free(p);
+  free(word);
+  free(byte);
+
+  return result;
+}
+
+
+/***
+ * stock_cycles
+ *
+ * one pass of a firmware's repeat loop: the firmware is fed '0' while
+ * it waits at the same getc, until a poll comes back to the same place
+ * after more than STOCK_GAP cycles, i.e. after an encryption
+ *
+ */
+static int stock_cycles(const char* firmware, u64* cycles) {
+
+  pic18_t* p = malloc(sizeof(pic18_t));
+  u64 start, i;
+  u32 pc;
+  int result = -1;
+
+  if (p == NULL) {
+    printf("[ERROR] out of memory\n");
+    return -1;
+  }
+
+  if (pic18_load(p, firmware) < 0) goto done;
+
+  if (pic18_run(p, 1000000000) != PIC18_POLL) {
+    printf("[ERROR] %s does not read the uart\n", firmware);
+    goto done;
+  }
+
+  for (i = 0; i < 256; i++) {
+    pc = p->pc;
+    start = p->cycles;
+    p->poll_pass = 1;
+
+    if (pic18_run(p, p->cycles + 1000000000) != PIC18_POLL) break;
+
+    if (p->pc != pc) continue;
+    if (p->cycles - start > STOCK_GAP) {
+      *cycles = p->cycles - start;
+      result = 0;
+      goto done;
+    }
+    pic18_send(p, (const u8*)"0", 1);
+  }
+
+  printf("[ERROR] %s does not come back to its repeat loop\n", firmware);
+
+done:
+  free(p);
+
+  return result;
+}
+
+
+
+/**********
+ * Output *
+ **********/
+
+
+
+/***
+ * write_include
+ *
+ * the kernel for the CCS firmware: the words with #rom at the origin
+ * (reserved with #org), the registers with #locate, loading in C and
+ * the two entries as FAST calls. The firmware keeps key and iv reversed
+ * against the file order, so load() turns them around
+ *
+ */
+static int write_include(const kernel_t* k, const char* path) {
+
+  FILE* fp = fopen(path, "w");
+  u32 i;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  fprintf(fp, "/*\n"
+              " * trivium8.h\n"
+              " *\n"
+              " * generated by GCC_Code_trivium_analysis/pic_kernel.c, do not edit: the\n"
+              " * byte aligned trivium kernel (trivium_byte.c) as PIC18 code, verified\n"
+              " * on the emulator at %d cycles per step and %d for the initialization\n"
+              " *\n"
+              " *   trivium8_load(key, iv)  key and iv as setup() takes them\n"
+              " *   trivium8_init()         144 steps, 1152 clocks\n"
+              " *   trivium8_step()         8 clocks, the keystream byte in trivium8_z\n"
+              " *\n"
+              " */\n\n", STEP_CYCLES, INIT_CYCLES);
+
+  fprintf(fp, "#org 0x%04X, 0x%04X {}\n", KERNEL_ORIGIN, KERNEL_ORIGIN + 2 * k->count - 1);
+  fprintf(fp, "#rom 0x%04X = {\n", KERNEL_ORIGIN);
+  for (i = 0; i < k->count; i++) {
+    fprintf(fp, "  0x%04X%s", k->word[i], (i + 1 < k->count) ? "," : " ");
+    if (k->text[i][0]) fprintf(fp, "    // %04X:  %s", KERNEL_ORIGIN + 2 * i, k->text[i]);
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "}\n\n");
+
+  fprintf(fp, "u8 trivium8_a[%d];\n#locate trivium8_a = 0x%03X\n", ABYTES, RAM_A);
+  fprintf(fp, "u8 trivium8_b[%d];\n#locate trivium8_b = 0x%03X\n", BBYTES, RAM_B);
+  fprintf(fp, "u8 trivium8_c[%d];\n#locate trivium8_c = 0x%03X\n", CBYTES, RAM_C);
+  fprintf(fp, "u8 trivium8_scratch[%d];\n#locate trivium8_scratch = 0x%03X\n", RAM_Z - RAM_T1, RAM_T1);
+  fprintf(fp, "u8 trivium8_z;\n#locate trivium8_z = 0x%03X\n", RAM_Z);
+  fprintf(fp, "u8 trivium8_n;\n#locate trivium8_n = 0x%03X\n\n\n", RAM_N);
+
+  fprintf(fp, "void trivium8_load(u8* key, u8* iv) {\n\n"
+              "  int i;\n\n"
+              "  memset(trivium8_a, 0, %d);\n"
+              "  memset(trivium8_b, 0, %d);\n"
+              "  memset(trivium8_c, 0, %d);\n\n"
+              "  for (i = 0; i < %d; i++) trivium8_a[%d - i] = key[i];\n"
+              "  for (i = 0; i < %d; i++) trivium8_b[%d - i] = iv[i];\n"
+              "  trivium8_c[0] = 0x0E;\n\n"
+              "  return;\n"
+              "}\n\n\n", ABYTES, BBYTES, CBYTES, KEYLENGTH, ABYTES - 1, IVLENGTH, BBYTES - 1);
+
+  fprintf(fp, "void trivium8_init(void) {\n"
+              "#asm\n"
+              "  CALL 0x%04X, 1\n"
+              "#endasm\n"
+              "}\n\n\n", k->init);
+  fprintf(fp, "void trivium8_step(void) {\n"
+              "#asm\n"
+              "  CALL 0x%04X, 1\n"
+              "#endasm\n"
+              "}\n", k->step);
+
+  fclose(fp);
+
+  return 0;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-n keys] [-b bytes] [-S seed] [-f firmware.hex] [-o include]\n", name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  kernel_t k;
+  const char *firmware = NULL, *include = NULL;
+  u64 n = 64, bytes = 16, seed = 1, stock, ours;
+  int option, result;
+
+  while ((option = getopt(argc, argv, "n:b:S:f:o:")) != -1) {
+    switch (option) {
+    case 'n': n        = strtoul(optarg, NULL, 10);  break;
+    case 'b': bytes    = strtoul(optarg, NULL, 10);  break;
+    case 'S': seed     = strtoul(optarg, NULL, 10);  break;
+    case 'f': firmware = optarg;                     break;
+    case 'o': include  = optarg;                     break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc || n == 0 || bytes == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  memset(&k, 0, sizeof(k));
+  generate(&k);
+  printf("%u words, %d bytes of ram at 0x%03X\n", k.count, RAM_END - KERNEL_RAM, KERNEL_RAM);
+
+  result = (check(&k, n, bytes, seed) < 0);
+
+  ours = INIT_CYCLES + bytes * STEP_CYCLES;
+  printf("%lu cycles for an encryption of %lu bytes, %.2f ms at 12 MIPS\n", ours, bytes, ours / 12e3);
+
+  if (firmware != NULL) {
+    if (stock_cycles(firmware, &stock) < 0) return 1;
+    printf("%lu cycles for a pass of the stock repeat loop, %.2f ms at 12 MIPS, %.0fx the kernel\n",
+           stock, stock / 12e3, (double)stock / ours);
+  }
+
+  if (include != NULL && write_include(&k, include) < 0) return 1;
+
+  return result;
+}
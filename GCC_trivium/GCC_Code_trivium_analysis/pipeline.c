@@ -0,0 +1,375 @@
+/*
+ * pipeline.c
+ *
+ * staged pipeline runtime (see pipeline.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "util.h"
+
+#define SPINS     64                    // tries before a waiting thread sleeps
+#define NAP_NS    20000
+
+
+typedef struct {
+  pipeline_t* p;
+  u64         stage;
+  u64         worker;
+} worker_arg_t;
+
+
+static u64 nanoseconds(void) {
+
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return (u64)t.tv_sec * 1000000000ULL + (u64)t.tv_nsec;
+}
+
+
+static void back_off(u64 tries) {
+
+  struct timespec nap = { 0, NAP_NS };
+
+  if (tries < SPINS) sched_yield();
+  else nanosleep(&nap, NULL);
+
+  return;
+}
+
+
+int pipeline_init(pipeline_t* p, u64 batch, u64 depth, double interval) {
+
+  memset(p, 0, sizeof(pipeline_t));
+  p->batch = batch;
+  p->depth = depth ? depth : 1;
+  p->interval = interval;
+
+  return (batch == 0) ? -1 : 0;
+}
+
+
+void pipeline_free(pipeline_t* p) {
+
+  u64 i;
+
+  for (i = 0; i < p->stages; i++) queue_free(&p->queue[i]);
+
+  if (p->pool != NULL) {
+    for (i = 0; i < p->batches; i++) {
+      free(p->pool[i].trace);
+      free(p->pool[i].spare);
+      free(p->pool[i].info);
+    }
+    free(p->pool);
+  }
+
+  memset(p, 0, sizeof(pipeline_t));
+
+  return;
+}
+
+
+/***
+ * pipeline_add
+ *
+ * the next stage, the source first and the sink last; samples is what
+ * each of its traces has when it hands the batch on
+ *
+ */
+pipeline_stage_t* pipeline_add(pipeline_t* p, const char* name, u64 threads, pipeline_fn process, void* ctx,
+                               u64 samples) {
+
+  pipeline_stage_t* s;
+
+  if (p->stages == PIPELINE_MAX_STAGES || threads == 0 || threads > PIPELINE_MAX_THREADS) return NULL;
+
+  s = &p->stage[p->stages++];
+  memset(s, 0, sizeof(pipeline_stage_t));
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  s->threads = threads;
+  s->process = process;
+  s->ctx = ctx;
+  s->samples = samples;
+
+  return s;
+}
+
+
+void pipeline_stop(pipeline_t* p) {
+
+  __atomic_store_n(&p->stop, 1, __ATOMIC_RELAXED);
+
+  return;
+}
+
+
+/***
+ * batch_swap
+ *
+ * make the spare buffer, filled by a stage, the batch's traces
+ *
+ */
+void batch_swap(batch_t* b, u64 samples) {
+
+  float* t = b->trace;
+
+  b->trace = b->spare;
+  b->spare = t;
+  b->samples = samples;
+
+  return;
+}
+
+
+
+/***********
+ * Workers *
+ ***********/
+
+
+
+static void* stage_worker(void* arg) {
+
+  worker_arg_t* w = arg;
+  pipeline_t* p = w->p;
+  pipeline_stage_t* s = &p->stage[w->stage];
+  queue_t* in = &p->queue[w->stage];
+  queue_t* out = &p->queue[(w->stage + 1) % p->stages];
+  const pipeline_stage_t* upstream = (w->stage > 0) ? &p->stage[w->stage - 1] : NULL;
+  void* item;
+  batch_t* b;
+  u64 t0, t1, tries;
+  int result;
+
+  for (;;) {
+    t0 = nanoseconds();
+
+    for (tries = 0; queue_pop(in, &item) < 0; tries++) {
+      if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) goto done;
+
+      // once the stage before is done, nothing more arrives
+      if (upstream != NULL && __atomic_load_n(&upstream->done, __ATOMIC_ACQUIRE)) {
+        if (queue_pop(in, &item) == 0) break;
+        goto done;
+      }
+      back_off(tries);
+    }
+    b = item;
+
+    t1 = nanoseconds();
+    __atomic_fetch_add(&s->wait_in, t1 - t0, __ATOMIC_RELAXED);
+
+    result = s->process(s, b, w->worker);
+
+    t0 = nanoseconds();
+    __atomic_fetch_add(&s->busy, t0 - t1, __ATOMIC_RELAXED);
+
+    if (result <= 0) {
+      // the batch goes back empty; queue 0 has room for every batch
+      b->count = 0;
+      while (queue_push(&p->queue[0], b) < 0) back_off(SPINS);
+      if (result < 0) {
+        __atomic_store_n(&p->error, 1, __ATOMIC_RELAXED);
+        pipeline_stop(p);
+      }
+      goto done;
+    }
+
+    __atomic_fetch_add(&s->batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->traces, b->count, __ATOMIC_RELAXED);
+
+    for (tries = 0; queue_push(out, b) < 0; tries++) {
+      if (__atomic_load_n(&p->stop, __ATOMIC_RELAXED)) goto done;
+      back_off(tries);
+    }
+
+    __atomic_fetch_add(&s->wait_out, nanoseconds() - t0, __ATOMIC_RELAXED);
+  }
+
+done:
+  if (__atomic_sub_fetch(&s->live, 1, __ATOMIC_ACQ_REL) == 0) __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+
+
+/***********
+ * Metrics *
+ ***********/
+
+
+
+static void print_progress(const pipeline_t* p, double elapsed, u64* last, double seconds) {
+
+  u64 i, traces;
+
+  printf("%8.1f s ", elapsed);
+  for (i = 0; i < p->stages; i++) {
+    traces = __atomic_load_n(&p->stage[i].traces, __ATOMIC_RELAXED);
+    printf(" | %s %7.0f/s", p->stage[i].name, (traces - last[i]) / seconds);
+    if (i + 1 < p->stages) printf(" [%2lu]", queue_depth(&p->queue[i + 1]));
+    last[i] = traces;
+  }
+  printf("\n");
+  fflush(stdout);
+
+  return;
+}
+
+
+/***
+ * print_summary
+ *
+ * per stage: traces per second of the run, utilization (busy time over
+ * threads and run time), what one thread manages when busy, the waits,
+ * and the mean depth of the queue in front of it
+ *
+ */
+static void print_summary(const pipeline_t* p, double elapsed, const double* depth, u64 samples) {
+
+  const pipeline_stage_t* s;
+  double utilization, worst = -1;
+  u64 i, bottleneck = 0;
+
+  printf("\nstage       threads    traces   traces/s   busy  per thread/s  wait in  wait out  queue\n");
+
+  for (i = 0; i < p->stages; i++) {
+    s = &p->stage[i];
+    utilization = 1e-9 * s->busy / (s->threads * elapsed);
+    if (utilization > worst) {
+      worst = utilization;
+      bottleneck = i;
+    }
+
+    printf("%-10s  %7lu  %8lu  %9.0f  %4.0f%%  %12.0f  %6.2fs  %7.2fs", s->name, s->threads, s->traces,
+           s->traces / elapsed, 100 * utilization, s->busy ? s->traces / (1e-9 * s->busy) : 0.0,
+           1e-9 * s->wait_in, 1e-9 * s->wait_out);
+    if (i > 0) printf("  %5.1f/%lu", samples ? depth[i] / samples : 0.0, p->depth);
+    printf("\n");
+  }
+
+  printf("\nbottleneck: %s (%.0f%% busy)\n", p->stage[bottleneck].name, 100 * worst);
+
+  return;
+}
+
+
+/***
+ * pipeline_run
+ *
+ * allocate the batches, start every stage's threads and wait for the
+ * traces to run through; 0 when the source ran out, -1 on an error
+ *
+ */
+int pipeline_run(pipeline_t* p) {
+
+  pthread_t thread[PIPELINE_MAX_STAGES][PIPELINE_MAX_THREADS];
+  worker_arg_t arg[PIPELINE_MAX_STAGES][PIPELINE_MAX_THREADS];
+  u64 started[PIPELINE_MAX_STAGES] = { 0 }, last[PIPELINE_MAX_STAGES] = { 0 };
+  double depth[PIPELINE_MAX_STAGES] = { 0 };
+  u64 i, j, capacity = 0, threads = 0, samples = 0, running;
+  double start, mark, elapsed;
+  int result = -1;
+
+  if (p->stages < 2) {
+    printf("[ERROR] a pipeline needs a source and a sink\n");
+    return -1;
+  }
+
+  for (i = 0; i < p->stages; i++) {
+    if (p->stage[i].samples > capacity) capacity = p->stage[i].samples;
+    threads += p->stage[i].threads;
+  }
+
+  // enough to fill every queue and keep every thread busy
+  p->batches = p->depth * (p->stages - 1) + threads;
+  p->pool = calloc(p->batches, sizeof(batch_t));
+  if (p->pool == NULL) goto fail;
+
+  for (i = 0; i < p->stages; i++) {
+    int single = (i > 0 && p->stage[i - 1].threads == 1 && p->stage[i].threads == 1);
+    if (queue_init(&p->queue[i], (i == 0) ? p->batches : p->depth, single) < 0) goto fail;
+  }
+
+  for (i = 0; i < p->batches; i++) {
+    batch_t* b = &p->pool[i];
+    b->trace = malloc(p->batch * capacity * sizeof(float));
+    b->spare = malloc(p->batch * capacity * sizeof(float));
+    b->info = malloc(p->batch * sizeof(trace_info_t));
+    b->capacity = p->batch;
+    if (b->trace == NULL || b->spare == NULL || b->info == NULL) goto fail;
+    queue_push(&p->queue[0], b);
+  }
+
+  start = mark = now();
+
+  for (i = 0; i < p->stages; i++) {
+    p->stage[i].live = p->stage[i].threads;
+    for (j = 0; j < p->stage[i].threads && !__atomic_load_n(&p->error, __ATOMIC_RELAXED); j++) {
+      arg[i][j].p = p;
+      arg[i][j].stage = i;
+      arg[i][j].worker = j;
+      if (pthread_create(&thread[i][j], NULL, stage_worker, &arg[i][j]) != 0) {
+        printf("[ERROR] could not start a thread of stage %s\n", p->stage[i].name);
+        __atomic_store_n(&p->error, 1, __ATOMIC_RELAXED);
+        pipeline_stop(p);
+        break;
+      }
+    }
+    started[i] = j;
+
+    // threads that never started are not live; whoever brings the count to
+    // zero, they or the started ones on their way out, marks the stage done
+    if (j < p->stage[i].threads &&
+        __atomic_sub_fetch(&p->stage[i].live, p->stage[i].threads - j, __ATOMIC_ACQ_REL) == 0) {
+      __atomic_store_n(&p->stage[i].done, 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  // sample the queues while the stages run
+  for (;;) {
+    for (running = 0, i = 0; i < p->stages; i++) running += !__atomic_load_n(&p->stage[i].done, __ATOMIC_ACQUIRE);
+    if (running == 0) break;
+
+    usleep(10000);
+    samples++;
+    for (i = 1; i < p->stages; i++) depth[i] += queue_depth(&p->queue[i]);
+
+    if (p->interval > 0 && now() - mark >= p->interval) {
+      print_progress(p, now() - start, last, now() - mark);
+      mark = now();
+    }
+  }
+
+  for (i = 0; i < p->stages; i++) {
+    for (j = 0; j < started[i]; j++) pthread_join(thread[i][j], NULL);
+  }
+  elapsed = now() - start;
+
+  if (p->error) goto fail;
+
+  for (i = 0; i < p->stages; i++) {
+    if (p->stage[i].finish != NULL) p->stage[i].finish(&p->stage[i]);
+  }
+
+  print_summary(p, elapsed, depth, samples);
+  result = 0;
+
+fail:
+  if (result < 0 && !p->error) printf("[ERROR] out of memory\n");
+
+  return result;
+}
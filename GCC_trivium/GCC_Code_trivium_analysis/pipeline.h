@@ -0,0 +1,102 @@
+/*
+ * pipeline.h
+ *
+ * staged processing of trace batches, every stage on its own threads
+ *
+ * a pipeline is a source stage, any number of middle stages and a sink,
+ * connected by bounded queues (queue.h) of batches. Queue i feeds stage
+ * i; queue 0 feeds the source with empty batches and takes back the
+ * batches the sink is done with, so the batches in flight are fixed
+ * and a slow stage fills the queue in front of it until the stages
+ * before it wait: backpressure without any locks. A queue between two
+ * single threaded stages is a spsc ring, any other an mpmc queue.
+ *
+ * stages see whole batches and may run on several threads, so batches
+ * can overtake each other; each carries the index of its first trace.
+ * A stage works on the batch in place, or into its spare buffer which
+ * it then swaps in, and sets the batch's samples per trace when it
+ * changes them.
+ *
+ * every stage counts its batches and traces and the time its threads
+ * spend working, waiting for input and waiting for room downstream; the
+ * run prints them and the queue depths as it goes, and at the end the
+ * utilization of every stage, the busiest being the bottleneck.
+ *
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "trivium.h"
+#include "traces.h"
+#include "queue.h"
+
+#define PIPELINE_MAX_STAGES  16
+#define PIPELINE_MAX_THREADS 64         // per stage
+
+
+typedef struct {
+  u64           first;                  // index of the first trace
+  u64           count;
+  u64           capacity;               // traces it holds
+  u64           samples;                // per trace, as it is now
+  float*        trace;                  // [capacity][samples of the widest stage]
+  float*        spare;                  // as large, for stages not working in place
+  trace_info_t* info;                   // [capacity]
+} batch_t;
+
+
+typedef struct pipeline_stage_s pipeline_stage_t;
+
+/***
+ * pipeline_fn
+ *
+ * one batch through a stage on one of its workers: 1 when done, 0 from
+ * the source at the end of the traces, -1 on an error (which stops the
+ * pipeline)
+ *
+ */
+typedef int (*pipeline_fn)(pipeline_stage_t* s, batch_t* b, u64 worker);
+
+
+struct pipeline_stage_s {
+  char        name[32];
+  u64         threads;
+  pipeline_fn process;
+  void        (*finish)(pipeline_stage_t* s);   // after the last batch, may be NULL
+  void*       ctx;
+  u64         samples;                  // per trace it hands on
+
+  u64         batches, traces;          // counters, updated atomically
+  u64         busy, wait_in, wait_out;  // nanoseconds over all threads
+  u64         live;                     // threads still running
+  int         done;
+};
+
+
+typedef struct {
+  u64              stages;
+  pipeline_stage_t stage[PIPELINE_MAX_STAGES];
+  u64              batch;               // traces per batch
+  u64              depth;               // batches per queue
+  u64              batches;             // in flight
+  queue_t          queue[PIPELINE_MAX_STAGES];
+  batch_t*         pool;
+  double           interval;            // seconds between progress lines, 0 for none
+  int              stop;
+  int              error;
+} pipeline_t;
+
+
+int  pipeline_init(pipeline_t* p, u64 batch, u64 depth, double interval);
+void pipeline_free(pipeline_t* p);
+
+pipeline_stage_t* pipeline_add(pipeline_t* p, const char* name, u64 threads, pipeline_fn process, void* ctx,
+                               u64 samples);
+
+int  pipeline_run(pipeline_t* p);
+void pipeline_stop(pipeline_t* p);
+
+void batch_swap(batch_t* b, u64 samples);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * preprocess.c
+ *
+ * centered products of sample pairs (see preprocess.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "preprocess.h"
+#include "cpa.h"
+
+#define LINE_MAX_LENGTH 256
+
+
+static int pairs_alloc(pairs_t* p, u64 pairs, u64 samples) {
+
+  memset(p, 0, sizeof(pairs_t));
+
+  p->samples = samples;
+  p->a       = malloc(pairs * sizeof(u32));
+  p->b       = malloc(pairs * sizeof(u32));
+  p->mean    = calloc(samples, sizeof(float));
+
+  if (p->a == NULL || p->b == NULL || p->mean == NULL) {
+    pairs_free(p);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void pairs_free(pairs_t* p) {
+
+  free(p->a);
+  free(p->b);
+  free(p->mean);
+  memset(p, 0, sizeof(pairs_t));
+
+  return;
+}
+
+
+/***
+ * pairs_window
+ *
+ * every pair of samples at most distance apart (distance 0 squares
+ * each sample)
+ *
+ */
+int pairs_window(pairs_t* p, u64 samples, u64 distance) {
+
+  u64 d, i, n = 0, pairs = 0;
+
+  if (distance >= samples) distance = samples - 1;
+  for (d = 0; d <= distance; d++) pairs += samples - d;
+
+  if (pairs_alloc(p, pairs, samples) < 0) return -1;
+
+  for (d = 0; d <= distance; d++) {
+    for (i = 0; i + d < samples; i++, n++) {
+      p->a[n] = (u32)i;
+      p->b[n] = (u32)(i + d);
+    }
+  }
+
+  p->pairs = pairs;
+
+  return 0;
+}
+
+
+/***
+ * pairs_read
+ *
+ * one pair "a b" per line, '#' starts a comment
+ *
+ */
+int pairs_read(pairs_t* p, u64 samples, const char* path) {
+
+  FILE* fp = fopen(path, "r");
+  char line[LINE_MAX_LENGTH], *hash;
+  unsigned long a, b;
+  u64 capacity = 0, number = 0;
+  u32* grown;
+
+  memset(p, 0, sizeof(pairs_t));
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  if (pairs_alloc(p, 1, samples) < 0) goto memory;
+  capacity = 1;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    number++;
+    if ((hash = strchr(line, '#')) != NULL) *hash = 0;
+    if (strspn(line, " \t\r\n") == strlen(line)) continue;
+
+    if (sscanf(line, "%lu %lu", &a, &b) != 2 || a >= samples || b >= samples) {
+      printf("[ERROR] %s:%lu: a pair of samples below %lu expected\n", path, number, samples);
+      goto fail;
+    }
+
+    if (p->pairs == capacity) {
+      // the old arrays stay in p until both grew, pairs_free() takes them on failure
+      if ((grown = realloc(p->a, 2 * capacity * sizeof(u32))) == NULL) goto memory;
+      p->a = grown;
+      if ((grown = realloc(p->b, 2 * capacity * sizeof(u32))) == NULL) goto memory;
+      p->b = grown;
+      capacity *= 2;
+    }
+
+    p->a[p->pairs] = (u32)a;
+    p->b[p->pairs] = (u32)b;
+    p->pairs++;
+  }
+
+  fclose(fp);
+
+  if (p->pairs == 0) {
+    printf("[ERROR] %s holds no pairs\n", path);
+    pairs_free(p);
+    return -1;
+  }
+
+  return 0;
+
+memory:
+  printf("[ERROR] out of memory\n");
+fail:
+  fclose(fp);
+  pairs_free(p);
+
+  return -1;
+}
+
+
+/***
+ * pairs_columns
+ *
+ * the centered products of pairs col0..col0+width-1 for count traces, as
+ * a cpa_columns_fn with the pair set as context
+ *
+ */
+void pairs_columns(const void* ctx, const float* traces, u64 stride, u64 count,
+                   u64 col0, u64 width, float* out) {
+
+  const pairs_t* p = ctx;
+  const u32 *a = p->a + col0, *b = p->b + col0;
+  u64 t, j;
+
+  // runs of consecutive samples at a fixed distance, as pairs_window() makes
+  for (j = 0; j < width && a[j] == a[0] + j && b[j] == b[0] + j; j++);
+
+  if (width == CPA_TILE && j == CPA_TILE) {
+    const float *ma = p->mean + a[0], *mb = p->mean + b[0];
+
+    for (t = 0; t < count; t++) {
+      const float *xa = traces + t * stride + a[0], *xb = traces + t * stride + b[0];
+      float* o = out + t * CPA_TILE;
+
+      for (j = 0; j < CPA_TILE; j++) o[j] = (xa[j] - ma[j]) * (xb[j] - mb[j]);
+    }
+
+    return;
+  }
+
+  for (t = 0; t < count; t++) {
+    const float* x = traces + t * stride;
+    float* o = out + t * CPA_TILE;
+
+    for (j = 0; j < width; j++) o[j] = (x[a[j]] - p->mean[a[j]]) * (x[b[j]] - p->mean[b[j]]);
+  }
+
+  return;
+}
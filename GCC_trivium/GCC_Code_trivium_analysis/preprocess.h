@@ -0,0 +1,41 @@
+/*
+ * preprocess.h
+ *
+ * centered products of sample pairs, for second order attacks on masked
+ * implementations
+ *
+ * when a bit is split into shares that leak at samples a and b, neither
+ * sample alone depends on the bit, but (x_a - mean_a) (x_b - mean_b)
+ * does. A pair set lists the (a, b) pairs to combine, in the order of
+ * the columns they become, and pairs_columns() is the cpa_columns_fn
+ * that makes a tile of them for a batch of traces; the quadratic trace
+ * is never stored.
+ *
+ * pairs_window() orders the pairs by distance and then by first sample,
+ * so a tile of columns reads two runs of consecutive samples and is
+ * computed with straight vector loads; pairs from a file take a gather.
+ *
+ */
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include "trivium.h"
+
+typedef struct {
+  u64     pairs;
+  u32*    a;                            // first sample of every pair
+  u32*    b;                            // second sample
+  float*  mean;                         // [samples], set by the caller
+  u64     samples;
+} pairs_t;
+
+
+int  pairs_window(pairs_t* p, u64 samples, u64 distance);
+int  pairs_read(pairs_t* p, u64 samples, const char* path);
+void pairs_free(pairs_t* p);
+
+void pairs_columns(const void* ctx, const float* traces, u64 stride, u64 count,
+                   u64 col0, u64 width, float* out);
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * prune.c
+ *
+ * branch and prune key enumeration with work stealing (see prune.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "prune.h"
+#include "rank.h"
+
+#define DEQUE_INITIAL 256
+
+
+typedef struct {
+  u32    level;                         // next level to expand
+  u64    key[2];
+  double score;
+} node_t;
+
+
+typedef struct {
+  pthread_mutex_t lock;
+  node_t*         node;
+  u64             top, bottom;          // owner at the bottom, thieves at the top
+  u64             capacity;
+} deque_t;
+
+
+typedef struct prune_job_s prune_job_t;
+
+typedef struct {
+  prune_job_t*  job;
+  u64           id;
+  deque_t       deque;
+  prune_leaf_t* leaf;                   // [keep], best first
+  u64           leaves, survivors, nodes, pruned;
+  int           error;
+} worker_t;
+
+
+struct prune_job_s {
+  prune_t* p;
+  u64      fresh[PRUNE_MAX_LEVELS][TARGET_GUESS];  // key bits a level guesses first
+  u64      fresh_bits[PRUNE_MAX_LEVELS];
+  u64      pending;                     // nodes pushed and not expanded yet
+  u64      visited;
+  u64      stop;
+  worker_t worker[PRUNE_MAX_THREADS];
+};
+
+
+int prune_init(prune_t* p, u64 traces, double threshold, u64 keep, u64 threads) {
+
+  memset(p, 0, sizeof(prune_t));
+  p->traces = traces;
+  p->threshold = threshold;
+  p->keep = keep ? keep : 1;
+  p->threads = (threads == 0) ? 1 : (threads > PRUNE_MAX_THREADS) ? PRUNE_MAX_THREADS : threads;
+
+  p->leaf = calloc(p->keep, sizeof(prune_leaf_t));
+
+  return (p->leaf == NULL) ? -1 : 0;
+}
+
+
+void prune_free(prune_t* p) {
+
+  free(p->leaf);
+  memset(p, 0, sizeof(prune_t));
+
+  return;
+}
+
+
+/***
+ * prune_add_level
+ *
+ * the next target and the correlation of each of its guesses, both kept
+ * by reference until prune_run()
+ *
+ */
+int prune_add_level(prune_t* p, const target_t* t, const double* r) {
+
+  u32 b;
+
+  if (p->levels == PRUNE_MAX_LEVELS) return -1;
+
+  p->target[p->levels] = t;
+  p->r[p->levels] = r;
+  p->levels++;
+
+  for (b = 0; b < t->guess_bits; b++) p->chunk[t->key[b] / 64] |= (u64)1 << (t->key[b] % 64);
+
+  return 0;
+}
+
+
+int prune_key_bit(const u64* key, u32 j) {
+  return (int)((key[j / 64] >> (j % 64)) & 0x01);
+}
+
+
+/***
+ * prune_key_of
+ *
+ * the key bits of a key in file order
+ *
+ */
+void prune_key_of(const u8* key, u64* bits) {
+
+  u32 j;
+
+  bits[0] = bits[1] = 0;
+
+  for (j = 0; j < 8 * KEYLENGTH; j++) {
+    bits[j / 64] |= (u64)((key[KEYLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << (j % 64);
+  }
+
+  return;
+}
+
+
+static u64 guess_of(const target_t* t, const u64* key) {
+
+  u64 g = 0;
+  u32 b;
+
+  for (b = 0; b < t->guess_bits; b++) g |= (u64)prune_key_bit(key, t->key[b]) << b;
+
+  return g;
+}
+
+
+/***
+ * prune_check
+ *
+ * walk the path of a key (file order): 1 with its score if it survives
+ * every level, 0 with the level that prunes it
+ *
+ */
+int prune_check(const prune_t* p, const u8* key, u64* level, double* score) {
+
+  u64 bits[2], l;
+  double r;
+
+  prune_key_of(key, bits);
+  *score = 0;
+
+  for (l = 0; l < p->levels; l++) {
+    r = p->r[l][guess_of(p->target[l], bits)];
+    if (r < p->threshold) {
+      *level = l;
+      return 0;
+    }
+    *score += fisher_score(r, p->traces);
+  }
+
+  *level = p->levels;
+
+  return 1;
+}
+
+
+
+/**********
+ * Deques *
+ **********/
+
+
+
+static int deque_push(deque_t* d, const node_t* n) {
+
+  node_t* grown;
+  int result = 0;
+
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom == d->capacity) {
+    if (d->top > 0) {
+      memmove(d->node, d->node + d->top, (d->bottom - d->top) * sizeof(node_t));
+      d->bottom -= d->top;
+      d->top = 0;
+    } else {
+      grown = realloc(d->node, 2 * d->capacity * sizeof(node_t));
+      if (grown == NULL) {
+        result = -1;
+        goto done;
+      }
+      d->node = grown;
+      d->capacity *= 2;
+    }
+  }
+
+  d->node[d->bottom++] = *n;
+
+done:
+  pthread_mutex_unlock(&d->lock);
+
+  return result;
+}
+
+
+/***
+ * deque_pop
+ *
+ * the newest node for the owner (depth first), or with steal the oldest
+ * for a thief, which is the root of the largest subtree left
+ *
+ */
+static int deque_pop(deque_t* d, node_t* n, int steal) {
+
+  int found = 0;
+
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom > d->top) {
+    *n = steal ? d->node[d->top++] : d->node[--d->bottom];
+    if (d->top == d->bottom) d->top = d->bottom = 0;
+    found = 1;
+  }
+
+  pthread_mutex_unlock(&d->lock);
+
+  return found;
+}
+
+
+
+/**********
+ * Engine *
+ **********/
+
+
+
+/***
+ * insert_leaf
+ *
+ * into a list of at most keep leaves, best first
+ *
+ */
+static void insert_leaf(prune_leaf_t* leaf, u64* count, u64 keep, const prune_leaf_t* x) {
+
+  u64 i;
+
+  if (*count == keep && !(x->score > leaf[keep - 1].score)) return;
+
+  i = (*count < keep) ? (*count)++ : keep - 1;
+  for (; i > 0 && leaf[i - 1].score < x->score; i--) leaf[i] = leaf[i - 1];
+  leaf[i] = *x;
+
+  return;
+}
+
+
+/***
+ * expand
+ *
+ * the children of a node: every value of the bits its level guesses
+ * first, each checked against the threshold
+ *
+ */
+static void expand(worker_t* w, const node_t* n) {
+
+  prune_job_t* job = w->job;
+  const prune_t* p = job->p;
+  const u32 l = n->level;
+  const target_t* t = p->target[l];
+  node_t child;
+  u64 v, b, j;
+  double r;
+
+  w->nodes++;
+
+  for (v = 0; v < ((u64)1 << job->fresh_bits[l]); v++) {
+    child.key[0] = n->key[0];
+    child.key[1] = n->key[1];
+
+    for (b = 0; b < job->fresh_bits[l]; b++) {
+      j = job->fresh[l][b];
+      if ((v >> b) & 0x01) child.key[j / 64] |= (u64)1 << (j % 64);
+    }
+
+    r = p->r[l][guess_of(t, child.key)];
+
+    if (r < p->threshold) {
+      w->pruned++;
+      continue;
+    }
+
+    child.level = l + 1;
+    child.score = n->score + fisher_score(r, p->traces);
+
+    if (child.level == p->levels) {
+      prune_leaf_t leaf = { { child.key[0], child.key[1] }, child.score };
+      insert_leaf(w->leaf, &w->leaves, p->keep, &leaf);
+      w->survivors++;
+      continue;
+    }
+
+    __atomic_fetch_add(&job->pending, 1, __ATOMIC_RELAXED);
+    if (deque_push(&w->deque, &child) < 0) {
+      __atomic_fetch_sub(&job->pending, 1, __ATOMIC_RELAXED);
+      w->error = 1;
+      __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  return;
+}
+
+
+static void* prune_worker(void* arg) {
+
+  worker_t* w = arg;
+  prune_job_t* job = w->job;
+  const prune_t* p = job->p;
+  node_t n;
+  u64 i, victim;
+  int found;
+
+  while (!__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) {
+    found = deque_pop(&w->deque, &n, 0);
+
+    for (i = 1; !found && i < p->threads; i++) {
+      victim = (w->id + i) % p->threads;
+      found = deque_pop(&job->worker[victim].deque, &n, 1);
+    }
+
+    if (!found) {
+      if (__atomic_load_n(&job->pending, __ATOMIC_ACQUIRE) == 0) break;
+      sched_yield();
+      continue;
+    }
+
+    if (p->limit && __atomic_fetch_add(&job->visited, 1, __ATOMIC_RELAXED) >= p->limit) {
+      __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_sub(&job->pending, 1, __ATOMIC_RELEASE);
+      break;
+    }
+
+    expand(w, &n);
+    __atomic_fetch_sub(&job->pending, 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+
+/***
+ * prune_run
+ *
+ * enumerate every path through the levels added so far, keeping the best
+ * leaves and counting the rest
+ *
+ */
+int prune_run(prune_t* p) {
+
+  prune_job_t* job = calloc(1, sizeof(prune_job_t));
+  pthread_t thread[PRUNE_MAX_THREADS];
+  u64 seen[2] = { 0, 0 }, l, b, i, k, threads = 0;
+  node_t root;
+  int result = -1;
+
+  if (job == NULL) return -1;
+  job->p = p;
+
+  // the bits each level guesses first
+  for (l = 0; l < p->levels; l++) {
+    const target_t* t = p->target[l];
+
+    for (b = 0; b < t->guess_bits; b++) {
+      if (prune_key_bit(seen, t->key[b])) continue;
+      seen[t->key[b] / 64] |= (u64)1 << (t->key[b] % 64);
+      job->fresh[l][job->fresh_bits[l]++] = t->key[b];
+    }
+  }
+
+  for (i = 0; i < p->threads; i++) {
+    worker_t* w = &job->worker[i];
+    w->job = job;
+    w->id = i;
+    w->deque.capacity = DEQUE_INITIAL;
+    w->deque.node = malloc(DEQUE_INITIAL * sizeof(node_t));
+    w->leaf = calloc(p->keep, sizeof(prune_leaf_t));
+    pthread_mutex_init(&w->deque.lock, NULL);
+    if (w->deque.node == NULL || w->leaf == NULL) goto done;
+  }
+
+  p->leaves = p->survivors = p->nodes = p->pruned = 0;
+  p->truncated = 0;
+
+  if (p->levels == 0) {
+    result = 0;
+    goto done;
+  }
+
+  memset(&root, 0, sizeof(root));
+  job->pending = 1;
+  deque_push(&job->worker[0].deque, &root);
+
+  for (threads = 1; threads < p->threads; threads++) {
+    if (pthread_create(&thread[threads], NULL, prune_worker, &job->worker[threads]) != 0) break;
+  }
+
+  prune_worker(&job->worker[0]);
+
+  for (i = 1; i < threads; i++) pthread_join(thread[i], NULL);
+
+  // merge the workers' best leaves
+  for (i = 0; i < p->threads; i++) {
+    worker_t* w = &job->worker[i];
+
+    if (w->error) goto done;
+
+    for (k = 0; k < w->leaves; k++) insert_leaf(p->leaf, &p->leaves, p->keep, &w->leaf[k]);
+
+    p->survivors += w->survivors;
+    p->nodes     += w->nodes;
+    p->pruned    += w->pruned;
+  }
+
+  p->truncated = (int)job->stop;
+  result = 0;
+
+done:
+  for (i = 0; i < p->threads; i++) {
+    free(job->worker[i].deque.node);
+    free(job->worker[i].leaf);
+    if (job->worker[i].job != NULL) pthread_mutex_destroy(&job->worker[i].deque.lock);
+  }
+  free(job);
+
+  return result;
+}
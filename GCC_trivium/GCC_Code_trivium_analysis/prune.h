@@ -0,0 +1,76 @@
+/*
+ * prune.h
+ *
+ * branch and prune enumeration of joint key guesses over a sequence of
+ * targets
+ *
+ * one target only sees the few key bits of its clock, and the pairs
+ * multiplied in t1 leave its guesses ambiguous. Walking the targets in
+ * order (clock by clock) each level adds the key bits its target sees
+ * and has not been guessed yet, so a path through all levels assigns the
+ * whole chunk of key bits the targets cover, 16 to 24 bits and more
+ * jointly, while every level stays checkable on its own: a branch whose
+ * guess for the level correlates below the threshold is dropped with
+ * its whole subtree.
+ *
+ * surviving paths are scored by the sum of fisher_score() over their
+ * levels. Workers walk the tree depth first from their own deque and
+ * steal the shallowest node of another worker's deque when they run
+ * out, which keeps them busy however unevenly the pruning cuts the tree.
+ *
+ */
+
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include "trivium.h"
+#include "targets.h"
+
+#define PRUNE_MAX_LEVELS  256
+#define PRUNE_MAX_THREADS 256
+
+
+/***
+ * prune_leaf_t
+ *
+ * a surviving guess of the chunk: key bit j (state order, as in
+ * target_t) is bit j % 64 of key[j / 64]
+ *
+ */
+typedef struct {
+  u64    key[2];
+  double score;
+} prune_leaf_t;
+
+
+typedef struct {
+  u64             levels;
+  const target_t* target[PRUNE_MAX_LEVELS];
+  const double*   r[PRUNE_MAX_LEVELS];  // correlation of every guess of the level
+  u64             traces;               // behind the correlations
+  double          threshold;            // least correlation a level's guess needs
+  u64             keep;                 // best leaves kept
+  u64             limit;                // nodes visited at most, 0 for no limit
+  u64             threads;
+
+  u64             chunk[2];             // key bits the levels cover
+  prune_leaf_t*   leaf;                 // [keep], best first
+  u64             leaves;               // kept
+  u64             survivors;            // paths through every level
+  u64             nodes;
+  u64             pruned;
+  int             truncated;            // the limit was reached
+} prune_t;
+
+
+int  prune_init(prune_t* p, u64 traces, double threshold, u64 keep, u64 threads);
+void prune_free(prune_t* p);
+
+int  prune_add_level(prune_t* p, const target_t* t, const double* r);
+int  prune_run(prune_t* p);
+
+int  prune_key_bit(const u64* key, u32 j);
+void prune_key_of(const u8* key, u64* bits);
+int  prune_check(const prune_t* p, const u8* key, u64* level, double* score);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * queue.c
+ *
+ * bounded lock-free spsc and mpmc queues (see queue.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "queue.h"
+
+
+/***
+ * queue_init
+ *
+ * capacity rounded up to a power of two
+ *
+ */
+int queue_init(queue_t* q, u64 capacity, int single) {
+
+  u64 size = 1, i;
+
+  memset(q, 0, sizeof(queue_t));
+
+  while (size < capacity) size *= 2;
+
+  q->slot = calloc(size, sizeof(queue_slot_t));
+  if (q->slot == NULL) return -1;
+
+  for (i = 0; i < size; i++) q->slot[i].sequence = i;
+  q->mask = size - 1;
+  q->single = single;
+
+  return 0;
+}
+
+
+void queue_free(queue_t* q) {
+
+  free(q->slot);
+  memset(q, 0, sizeof(queue_t));
+
+  return;
+}
+
+
+int queue_push(queue_t* q, void* item) {
+
+  queue_slot_t* s;
+  u64 head, sequence;
+
+  if (q->single) {
+    head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) > q->mask) return -1;
+    q->slot[head & q->mask].item = item;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+  for (;;) {
+    s = &q->slot[head & q->mask];
+    sequence = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+
+    if (sequence == head) {
+      // the slot is free for this lap; claim the position
+      if (__atomic_compare_exchange_n(&q->head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if ((int64_t)(sequence - head) < 0) {
+      return -1;                        // the consumer of the last lap is not done
+    } else {
+      head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+  }
+
+  s->item = item;
+  __atomic_store_n(&s->sequence, head + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+int queue_pop(queue_t* q, void** item) {
+
+  queue_slot_t* s;
+  u64 tail, sequence;
+
+  if (q->single) {
+    tail = q->tail;
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) return -1;
+    *item = q->slot[tail & q->mask].item;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+  for (;;) {
+    s = &q->slot[tail & q->mask];
+    sequence = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+
+    if (sequence == tail + 1) {
+      if (__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if ((int64_t)(sequence - (tail + 1)) < 0) {
+      return -1;                        // nothing pushed at this position yet
+    } else {
+      tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  *item = s->item;
+  // free for the push one lap later
+  __atomic_store_n(&s->sequence, tail + q->mask + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+/***
+ * queue_depth
+ *
+ * items in the queue, exact only when nobody is pushing or popping
+ *
+ */
+u64 queue_depth(const queue_t* q) {
+
+  u64 head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+  u64 tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+  return (head > tail) ? head - tail : 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * queue.h
+ *
+ * bounded lock-free queues of pointers between threads
+ *
+ * the capacity is a power of two and every slot is used. A queue with
+ * one producer and one consumer thread is a plain ring: each side owns
+ * its own index and only reads the other's. With several producers or
+ * consumers every slot carries a sequence number that says whose turn
+ * it is (Vyukov's bounded queue): a thread claims a position with a
+ * compare and swap on the shared index, and the slot's sequence tells
+ * it whether the position is still in use from the lap before.
+ *
+ * push and pop never wait; they fail on a full or empty queue and the
+ * caller decides how to back off.
+ *
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "trivium.h"
+
+#define QUEUE_CACHELINE 64
+
+
+typedef struct {
+  u64   sequence;
+  void* item;
+} queue_slot_t;
+
+
+typedef struct {
+  queue_slot_t* slot;
+  u64           mask;                   // capacity - 1
+  int           single;                 // one producer and one consumer
+  u64           head __attribute__((aligned(QUEUE_CACHELINE)));  // next push
+  u64           tail __attribute__((aligned(QUEUE_CACHELINE)));  // next pop
+} queue_t;
+
+
+int  queue_init(queue_t* q, u64 capacity, int single);
+void queue_free(queue_t* q);
+
+int  queue_push(queue_t* q, void* item);
+int  queue_pop(queue_t* q, void** item);
+u64  queue_depth(const queue_t* q);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * rank.c
+ *
+ * histogram convolution key rank estimation (see rank.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rank.h"
+
+
+/***
+ * score_table_alloc
+ *
+ * room for the scores of subkeys of the given widths
+ *
+ */
+int score_table_alloc(score_table_t* t, u64 subkeys, const u64* bits) {
+
+  u64 i, covered = 0;
+
+  memset(t, 0, sizeof(score_table_t));
+
+  if (subkeys == 0 || subkeys > MAX_SUBKEYS) return -1;
+
+  for (i = 0; i < subkeys; i++) {
+    if (bits[i] == 0 || bits[i] > MAX_SUBKEYBITS) return -1;
+    covered += bits[i];
+  }
+
+  if (covered > KEYBITS) return -1;
+
+  t->subkeys = subkeys;
+
+  for (i = 0; i < subkeys; i++) {
+    t->bits[i] = bits[i];
+    t->score[i] = calloc((u64)1 << bits[i], sizeof(double));
+
+    if (t->score[i] == NULL) {
+      score_table_free(t);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+void score_table_free(score_table_t* t) {
+
+  u64 i;
+
+  for (i = 0; i < t->subkeys; i++) free(t->score[i]);
+  memset(t, 0, sizeof(score_table_t));
+
+  return;
+}
+
+
+/***
+ * score_table_covered
+ *
+ * number of key bits covered by the subkeys
+ *
+ */
+u64 score_table_covered(const score_table_t* t) {
+
+  u64 i, covered = 0;
+
+  for (i = 0; i < t->subkeys; i++) covered += t->bits[i];
+
+  return covered;
+}
+
+
+/***
+ * subkey_values
+ *
+ * the subkey values of a key given in file order
+ *
+ */
+void subkey_values(const score_table_t* t, const u8* key, u64* values) {
+
+  u64 i, b, j = 0;
+
+  for (i = 0; i < t->subkeys; i++) {
+    values[i] = 0;
+
+    for (b = 0; b < t->bits[i]; b++, j++) {
+      values[i] = (values[i] << 1) | ((key[KEYLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01);
+    }
+  }
+
+  return;
+}
+
+
+/***
+ * rank_estimate
+ *
+ * bound the rank of the correct subkey values with histograms of the
+ * given number of bins per subkey.
+ *
+ * with a common bin width w a key in total bin B has a score in
+ * [B w, (B + n) w) for n subkeys, so keys in bins >= c + n are certainly
+ * ranked before the correct key (bin c) and keys in bins <= c - n
+ * certainly after it. The subkey histograms have at most 2^bits non
+ * empty bins, which keeps the convolution cheap without an FFT.
+ *
+ */
+int rank_estimate(const score_table_t* t, const u64* correct, u64 bins, rank_t* rank) {
+
+  double lo[MAX_SUBKEYS], width = 0, better = 0, estimate = 0, notworse = 0;
+  double *h, *next, *count;
+  u64 *bin, i, k, b, size = 1, nonzero, c = 0, n = t->subkeys, uncovered;
+  int result = -1;
+
+  if (bins < 2) return -1;
+
+  // common bin width from the widest subkey score range
+  for (i = 0; i < n; i++) {
+    double min = t->score[i][0], max = t->score[i][0];
+
+    for (k = 1; k < ((u64)1 << t->bits[i]); k++) {
+      if (t->score[i][k] < min) min = t->score[i][k];
+      if (t->score[i][k] > max) max = t->score[i][k];
+    }
+
+    lo[i] = min;
+    if (max - min > width) width = max - min;
+  }
+
+  width = (width > 0) ? width / (double)(bins - 1) : 1.0;
+
+  h     = calloc(n * (bins - 1) + 1, sizeof(double));
+  next  = calloc(n * (bins - 1) + 1, sizeof(double));
+  count = calloc(bins, sizeof(double));
+  bin   = malloc(bins * sizeof(u64));
+
+  if (h == NULL || next == NULL || count == NULL || bin == NULL) goto done;
+
+  h[0] = 1;
+
+  for (i = 0; i < n; i++) {
+    memset(count, 0, bins * sizeof(double));
+
+    for (k = 0; k < ((u64)1 << t->bits[i]); k++) {
+      b = (u64)((t->score[i][k] - lo[i]) / width);
+      if (b > bins - 1) b = bins - 1;
+      count[b] += 1;
+      if (k == correct[i]) c += b;
+    }
+
+    // sparse list of the occupied bins
+    for (k = 0, nonzero = 0; k < bins; k++) {
+      if (count[k] > 0) bin[nonzero++] = k;
+    }
+
+    memset(next, 0, (size + bins - 1) * sizeof(double));
+
+    for (k = 0; k < nonzero; k++) {
+      double m = count[bin[k]];
+      double* out = next + bin[k];
+
+      for (b = 0; b < size; b++) out[b] += m * h[b];
+    }
+
+    size += bins - 1;
+
+    { double* swap = h; h = next; next = swap; }
+  }
+
+  for (b = 0; b < size; b++) {
+    if (b >= c + n) better += h[b];
+    if (b > c) estimate += h[b];
+    if (b + n > c) notworse += h[b];
+  }
+
+  // keys in the correct key's own bin count half
+  estimate += (h[c] - 1) / 2;
+
+  uncovered = KEYBITS - score_table_covered(t);
+
+  rank->lower    = log2(1 + better) + uncovered;
+  rank->estimate = log2(1 + estimate) + uncovered;
+  rank->upper    = log2(notworse) + uncovered;
+
+  result = 0;
+
+done:
+  free(h);
+  free(next);
+  free(count);
+  free(bin);
+
+  return result;
+}
+
+
+/***
+ * fisher_score
+ *
+ * log likelihood ratio of a correlation against no correlation after a
+ * number of traces, from the Fisher z transform (z is normal with
+ * variance 1 / (traces - 3)); keeps the sign so that anti correlated
+ * hypotheses score low
+ *
+ */
+double fisher_score(double r, u64 traces) {
+
+  double z;
+
+  if (r > 0.999999)  r = 0.999999;
+  if (r < -0.999999) r = -0.999999;
+
+  z = atanh(r);
+
+  return (traces > 3 ? (double)(traces - 3) : 1.0) * z * fabs(z) / 2;
+}
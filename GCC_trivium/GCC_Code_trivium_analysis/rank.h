@@ -0,0 +1,62 @@
+/*
+ * rank.h
+ *
+ * key rank estimation from per subkey score tables
+ *
+ * the 80 key bits are split into subkeys of up to 16 bits, taken in
+ * state order: key bit j is the one setup() loads into s(j + 1), and a
+ * subkey covering bits o..o+b-1 has the value sum bit(o + t) << (b - 1 - t).
+ * For 8 bit subkeys subkey i is therefore byte 9 - i of the key as it is
+ * written in keys.txt.
+ *
+ * scores are additive log likelihoods, larger is better. The rank of the
+ * correct key is bounded with the histogram convolution method: every
+ * subkey's scores are binned with a common bin width, the histograms are
+ * convolved, and the keys in bins that the binning error cannot move
+ * past the correct key are counted.
+ *
+ */
+
+#ifndef RANK_H
+#define RANK_H
+
+#include "trivium.h"
+
+#define KEYBITS        (8 * KEYLENGTH)
+#define MAX_SUBKEYS    KEYBITS
+#define MAX_SUBKEYBITS 16
+#define RANK_BINS      4096
+
+
+typedef struct {
+  u64     subkeys;
+  u64     bits[MAX_SUBKEYS];       // width of each subkey
+  double* score[MAX_SUBKEYS];      // 2^bits scores per subkey
+} score_table_t;
+
+/***
+ * rank_t
+ *
+ * log2 of the rank of the correct key (1 = first guess), with the bounds
+ * the histogram resolution allows; key bits not covered by any subkey
+ * are assumed to be brute forced and multiply the rank
+ *
+ */
+typedef struct {
+  double lower;
+  double estimate;
+  double upper;
+} rank_t;
+
+
+int  score_table_alloc(score_table_t* t, u64 subkeys, const u64* bits);
+void score_table_free(score_table_t* t);
+u64  score_table_covered(const score_table_t* t);
+
+void subkey_values(const score_table_t* t, const u8* key, u64* values);
+
+int  rank_estimate(const score_table_t* t, const u64* correct, u64 bins, rank_t* rank);
+
+double fisher_score(double r, u64 traces);
+
+#endif
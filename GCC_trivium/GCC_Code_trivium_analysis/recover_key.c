@@ -0,0 +1,443 @@
+/*
+ * recover_key.c
+ *
+ * key recovery from a (partially) recovered internal state: the state is
+ * clocked back to the layout setup() leaves, which gives key and iv, and
+ * the result is checked against known keystream
+ *
+ *  build : gcc -O3 -march=native -pthread -o recover_key recover_key.c trivium_word.c trivium_slice.c
+ *  run   : ./recover_key [-r rounds] [-c clock] [-i iv] [-z keystream] [-w 64|256] [-t threads] state
+ *          ./recover_key -p key:iv [-c clock]
+ *
+ *   state        s1..s288, either 72 hex digits (s1 is the most significant
+ *                bit of the first digit) or 288 characters 0, 1 or x, where
+ *                x marks a bit the attack did not recover (at most 48)
+ *   -r rounds    initialization rounds of the cipher (default 1152)
+ *   -c clock     clocks between setup() and the state (default: rounds,
+ *                i.e. the state that produces the first keystream bit)
+ *   -i iv        known iv in file order, other ivs are rejected
+ *   -z hex       known keystream from the first byte on, as in cipher.txt
+ *                for an all zero plain text
+ *   -w lanes     candidates per bitsliced instance, 64 or 256 (default 256)
+ *   -t threads   worker threads (default: online cpus)
+ *   -p key:iv    print the state of a key and iv at the clock and exit
+ *
+ * every assignment of the unknown bits is tested: the first log2(lanes)
+ * unknown bits are spread over the lanes, the rest are walked in gray
+ * code order. Known keystream is checked first by clocking forward, which
+ * rejects nearly every wrong candidate after a few dozen clocks; the
+ * survivors are clocked back, checked against the setup() layout (and
+ * the iv) and finally re-encrypted with the word oriented core.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trivium.h"
+#include "util.h"
+
+#define MAX_UNKNOWN   48
+#define MAX_THREADS   256
+#define MAX_KEYSTREAM 64
+#define CHUNK_BLOCKS  256
+
+// keystream bits used by the forward filter
+#define FILTER_BITS 64
+
+
+typedef struct {
+  u64  rounds;
+  u64  clock;
+  u64  lanes;
+  u64  lane_bits;
+  u8   state[STATEBITS];         // known bits, unknown ones are 0
+  u64  u;
+  u64  unknown[MAX_UNKNOWN];     // state bit indices
+  int  has_iv;
+  u8   iv[IVLENGTH];
+  u64  zbytes;
+  u8   z[MAX_KEYSTREAM];
+  u64  blocks;
+  u64  next;
+  u64  found;
+  pthread_mutex_t lock;
+} recover_t;
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+/***
+ * keystream_bit
+ *
+ * bit k of the known keystream, first bit in the lsb of the first byte
+ *
+ */
+static u64 keystream_bit(const recover_t* job, u64 k) {
+  return (job->z[k / 8] >> (k % 8)) & 0x01;
+}
+
+
+/***
+ * print_state
+ *
+ * s1..s288 as 72 hex digits
+ *
+ */
+static void print_state(const u8* bits) {
+
+  u64 i;
+
+  for (i = 0; i < STATEBITS; i += 4) {
+    printf("%X", 8 * bits[i] + 4 * bits[i + 1] + 2 * bits[i + 2] + bits[i + 3]);
+  }
+
+  return;
+}
+
+
+static void print_hex(const u8* data, u64 length) {
+
+  u64 i;
+
+  for (i = 0; i < length; i++) printf("%02X", data[i]);
+
+  return;
+}
+
+
+/***
+ * candidate
+ *
+ * full check of one candidate state with the word oriented core, prints
+ * it if it clocks back to a key and iv that reproduce the keystream
+ *
+ */
+static void candidate(recover_t* job, const u8* bits) {
+
+  trivium_word_t s;
+  u8 key[KEYLENGTH], iv[IVLENGTH], z[MAX_KEYSTREAM];
+
+  trivium_word_from_bits(&s, bits);
+  trivium_word_back(&s, job->clock);
+
+  if (!trivium_word_loaded(&s, key, iv)) return;
+  if (job->has_iv && memcmp(iv, job->iv, IVLENGTH) != 0) return;
+
+  if (job->zbytes > 0) {
+    trivium_word_keystream_rounds(key, iv, job->rounds, z, job->zbytes);
+    if (memcmp(z, job->z, job->zbytes) != 0) return;
+  }
+
+  pthread_mutex_lock(&job->lock);
+
+  printf("key ");
+  print_hex(key, KEYLENGTH);
+  printf(" iv ");
+  print_hex(iv, IVLENGTH);
+  printf(" state ");
+  print_state(bits);
+  printf("\n");
+
+  job->found++;
+
+  pthread_mutex_unlock(&job->lock);
+
+  return;
+}
+
+
+
+/**********
+ * Engine *
+ **********/
+
+
+
+/***
+ * RECOVER_WORKER
+ *
+ * worker thread for one lane width, each work item is a range of gray
+ * code blocks of the unknown bits
+ *
+ */
+#define RECOVER_WORKER(name, slice, lane_t)                                            \
+                                                                                       \
+  static void* name(void* arg) {                                                       \
+                                                                                       \
+    recover_t* job = arg;                                                              \
+    slice##_t s;                                                                       \
+    lane_t words[STATEBITS], back[STATEBITS], z[FILTER_BITS];                          \
+    lane_t valid, alive, zero = { 0 };                                                 \
+    u8 bits[STATEBITS];                                                                \
+    u64 item, first, last, i, j, l, lane_unknown, skip, offset, filter, any;           \
+                                                                                       \
+    lane_unknown = (job->u < job->lane_bits) ? job->u : job->lane_bits;                \
+                                                                                       \
+    valid = zero;                                                                      \
+    for (l = 0; l < job->lanes && l < ((u64)1 << lane_unknown); l++) {                 \
+      valid[l / 64] |= (u64)1 << (l % 64);                                             \
+    }                                                                                  \
+                                                                                       \
+    /* keystream bits that can be checked by clocking the state forward */            \
+    skip   = (job->clock <= job->rounds) ? job->rounds - job->clock : 0;               \
+    offset = (job->clock <= job->rounds) ? 0 : job->clock - job->rounds;               \
+    filter = (8 * job->zbytes > offset) ? 8 * job->zbytes - offset : 0;                \
+    if (filter > FILTER_BITS) filter = FILTER_BITS;                                    \
+                                                                                       \
+    while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) * CHUNK_BLOCKS < job->blocks) { \
+      first = item * CHUNK_BLOCKS;                                                     \
+      last  = first + CHUNK_BLOCKS;                                                    \
+      if (last > job->blocks) last = job->blocks;                                      \
+                                                                                       \
+      for (i = 0; i < STATEBITS; i++) words[i] = job->state[i] ? ~zero : zero;         \
+                                                                                       \
+      for (j = 0; j < lane_unknown; j++) {                                             \
+        words[job->unknown[j]] = zero;                                                 \
+        for (l = 0; l < job->lanes; l++) {                                             \
+          if ((l >> j) & 0x01) words[job->unknown[j]][l / 64] |= (u64)1 << (l % 64);   \
+        }                                                                              \
+      }                                                                                \
+                                                                                       \
+      for (j = 0; j < job->u - lane_unknown; j++) {                                    \
+        if (((first ^ (first >> 1)) >> j) & 0x01) words[job->unknown[lane_unknown + j]] = ~zero; \
+      }                                                                                \
+                                                                                       \
+      for (i = first; i < last; i++) {                                                 \
+        if (i > first) words[job->unknown[lane_unknown + (u64)__builtin_ctzll(i)]] ^= ~zero; \
+                                                                                       \
+        alive = valid;                                                                 \
+                                                                                       \
+        if (filter > 0) {                                                              \
+          slice##_load(&s, words);                                                     \
+          slice##_run(&s, skip, NULL);                                                 \
+          slice##_run(&s, filter, z);                                                  \
+          for (j = 0; j < filter; j++) {                                               \
+            alive &= keystream_bit(job, offset + j) ? z[j] : ~z[j];                    \
+          }                                                                            \
+        }                                                                              \
+                                                                                       \
+        any = 0;                                                                       \
+        for (l = 0; l < LANE_WORDS(lane_t); l++) any |= alive[l];                      \
+        if (any == 0) continue;                                                        \
+                                                                                       \
+        /* clock back and keep the candidates with the setup() layout */              \
+        slice##_load(&s, words);                                                       \
+        slice##_back(&s, job->clock);                                                  \
+        slice##_bits(&s, back);                                                        \
+                                                                                       \
+        for (j = 8 * KEYLENGTH; j < ALEN; j++) alive &= ~back[j];                      \
+        for (j = ALEN + 8 * IVLENGTH; j < STATEBITS - 3; j++) alive &= ~back[j];       \
+        for (j = STATEBITS - 3; j < STATEBITS; j++) alive &= back[j];                  \
+                                                                                       \
+        if (job->has_iv) {                                                             \
+          for (j = 0; j < 8 * IVLENGTH; j++) {                                         \
+            alive &= ((job->iv[IVLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) ? back[ALEN + j] : ~back[ALEN + j]; \
+          }                                                                            \
+        }                                                                              \
+                                                                                       \
+        for (l = 0; l < job->lanes; l++) {                                             \
+          if (!((alive[l / 64] >> (l % 64)) & 0x01)) continue;                         \
+          for (j = 0; j < STATEBITS; j++) bits[j] = (words[j][l / 64] >> (l % 64)) & 0x01; \
+          candidate(job, bits);                                                        \
+        }                                                                              \
+      }                                                                                \
+    }                                                                                  \
+                                                                                       \
+    return NULL;                                                                       \
+  }
+
+RECOVER_WORKER(worker64,  trivium_slice64,  lane64_t)
+RECOVER_WORKER(worker256, trivium_slice256, lane256_t)
+
+
+/***
+ * recover_run
+ *
+ * test every assignment of the unknown bits
+ *
+ */
+static int recover_run(recover_t* job, u64 threads) {
+
+  pthread_t thread[MAX_THREADS];
+  void* (*worker)(void*) = (job->lanes == 64) ? worker64 : worker256;
+  u64 i;
+
+  job->lane_bits = (job->lanes == 64) ? 6 : 8;
+  job->blocks = (job->u > job->lane_bits) ? (u64)1 << (job->u - job->lane_bits) : 1;
+  job->next = 0;
+  job->found = 0;
+  pthread_mutex_init(&job->lock, NULL);
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, worker, job) != 0) {
+      printf("[ERROR] could not start worker thread\n");
+      return -1;
+    }
+  }
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  pthread_mutex_destroy(&job->lock);
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+/***
+ * parse_state
+ *
+ * 72 hex digits, or 288 characters of 0, 1 and x
+ *
+ */
+static int parse_state(const char* text, recover_t* job) {
+
+  u64 i, length = strlen(text);
+  int v;
+
+  job->u = 0;
+
+  if (length == STATEBITS / 4) {
+    for (i = 0; i < STATEBITS; i++) {
+      v = hex_value(text[i / 4]);
+      if (v < 0) return -1;
+      job->state[i] = (v >> (3 - i % 4)) & 0x01;
+    }
+    return 0;
+  }
+
+  if (length != STATEBITS) return -1;
+
+  for (i = 0; i < STATEBITS; i++) {
+    if (text[i] == '0' || text[i] == '1') {
+      job->state[i] = (u8)(text[i] - '0');
+    } else if (text[i] == 'x' || text[i] == 'X') {
+      if (job->u == MAX_UNKNOWN) return -1;
+      job->state[i] = 0;
+      job->unknown[job->u++] = i;
+    } else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/***
+ * print_at_clock
+ *
+ * the state of a key and iv after a number of clocks, for experiments
+ *
+ */
+static int print_at_clock(const char* text, u64 clock) {
+
+  trivium_word_t s;
+  u8 key[KEYLENGTH], iv[IVLENGTH], bits[STATEBITS];
+
+  if (strlen(text) != 2 * KEYLENGTH + 1 + 2 * IVLENGTH || text[2 * KEYLENGTH] != ':' ||
+      parse_bytes(text, key, KEYLENGTH) < 0 || parse_bytes(text + 2 * KEYLENGTH + 1, iv, IVLENGTH) < 0) {
+    return -1;
+  }
+
+  trivium_word_load(&s, key, iv);
+  trivium_word_rounds(&s, clock);
+  trivium_word_bits(&s, bits);
+
+  print_state(bits);
+  printf("\n");
+
+  return 0;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-r rounds] [-c clock] [-i iv] [-z keystream] [-w 64|256] [-t threads] state\n"
+         "       %s -p key:iv [-c clock]\n", name, name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  recover_t job;
+  const char* print = NULL;
+  u64 threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  int clock_given = 0, option;
+  double start, seconds;
+
+  memset(&job, 0, sizeof(job));
+  job.rounds = INIT_ROUNDS;
+  job.lanes = 256;
+
+  while ((option = getopt(argc, argv, "r:c:i:z:w:t:p:")) != -1) {
+    switch (option) {
+    case 'r': job.rounds = strtoul(optarg, NULL, 10); break;
+    case 'c': job.clock  = strtoul(optarg, NULL, 10); clock_given = 1; break;
+    case 'w': job.lanes  = strtoul(optarg, NULL, 10); break;
+    case 't': threads    = strtoul(optarg, NULL, 10); break;
+    case 'p': print      = optarg;                    break;
+    case 'i':
+      if (strlen(optarg) != 2 * IVLENGTH || parse_bytes(optarg, job.iv, IVLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      job.has_iv = 1;
+      break;
+    case 'z':
+      job.zbytes = strlen(optarg) / 2;
+      if (strlen(optarg) % 2 || job.zbytes > MAX_KEYSTREAM || parse_bytes(optarg, job.z, job.zbytes) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!clock_given) job.clock = job.rounds;
+
+  if (print != NULL) {
+    if (print_at_clock(print, job.clock) < 0) {
+      usage(argv[0]);
+      return 2;
+    }
+    return 0;
+  }
+
+  if (optind != argc - 1 || parse_state(argv[optind], &job) < 0 ||
+      (job.lanes != 64 && job.lanes != 256) || threads == 0 || threads > MAX_THREADS) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  start = now();
+  if (recover_run(&job, threads) < 0) return 1;
+  seconds = now() - start;
+
+  printf("%lu unknown bits, %lu candidates clocked back %lu clocks, %lu threads: %.3f s, %.3g candidates/s\n",
+         job.u, (u64)1 << job.u, job.clock, threads, seconds, ((u64)1 << job.u) / seconds);
+  printf("[%s] %lu matching key%s\n", job.found ? "SUCCESS" : "ERROR", job.found, job.found == 1 ? "" : "s");
+
+  return job.found ? 0 : 1;
+}
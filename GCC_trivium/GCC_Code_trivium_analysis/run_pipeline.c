@@ -0,0 +1,955 @@
+/*
+ * run_pipeline.c
+ *
+ * read, align, filter, select and attack traces in one staged pipeline
+ * (see pipeline.h), as a description file lays it out
+ *
+ *  build : gcc -O3 -march=native -pthread -o run_pipeline run_pipeline.c pipeline.c queue.c dsp.c monitor.c \
+ *                                       fisher.c cpa.c rank.c targets.c traces.c -lm
+ *  run   : ./run_pipeline description
+ *
+ * the description has one setting or stage per line, # starting a
+ * comment:
+ *
+ *   batch n          traces per batch (default 256)
+ *   depth n          batches per queue (default 4)
+ *   progress s       seconds between progress lines (default 1, 0 none)
+ *   stage kind [threads=n] [name=value ...]
+ *
+ * stages, in the order they run, the first of them a source:
+ *
+ *   archive  path= [traces=]            traces of a trace archive
+ *   raw      path= samples= [ivs=] [keys=] [traces=]
+ *                                       raw float32 traces, as the
+ *                                       scope dumps them (one thread)
+ *   align    window=first:count shift=  shift every trace by at most
+ *                                       shift samples to correlate best
+ *                                       with the first one in the window
+ *   filter   rate= iir= iir_cutoff= fir= low= high= taps= factor=
+ *            clock= offset= cycles=     the dsp.h chain, names as in
+ *                                       dsp_config_t
+ *   poi      window=first:count | file= the samples to keep, a window or
+ *                                       one index per line of a file
+ *   cpa      [clocks=first:last] [key=] [engine=]
+ *                                       the t1 attack of attack_monitor
+ *                                       (one thread, engine threads)
+ *   store    path=                      raw float32 traces in their
+ *                                       original order, ivs to path.ivs
+ *
+ * e.g.
+ *
+ *   batch 256
+ *   stage archive path=campaign.trc threads=2
+ *   stage align window=400:200 shift=16 threads=2
+ *   stage filter rate=1e9 fir=lowpass high=24e6 factor=10 threads=2
+ *   stage cpa clocks=0:65
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "dsp.h"
+#include "monitor.h"
+#include "traces.h"
+#include "util.h"
+
+#define LINE_MAX_LENGTH 1024
+#define MAX_PARAMS      16
+
+
+typedef struct {
+  u64   count;
+  char* name[MAX_PARAMS];
+  char* value[MAX_PARAMS];
+  int   used[MAX_PARAMS];
+} params_t;
+
+
+/***
+ * setup_fn
+ *
+ * a stage from its parameters, given the samples per trace it receives
+ * and updating them to what it hands on
+ *
+ */
+typedef int (*setup_fn)(pipeline_t* p, params_t* a, u64 threads, u64* samples);
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+static const char* param(params_t* a, const char* name) {
+
+  u64 i;
+
+  for (i = 0; i < a->count; i++) {
+    if (strcmp(a->name[i], name) == 0) {
+      a->used[i] = 1;
+      return a->value[i];
+    }
+  }
+
+  return NULL;
+}
+
+
+static int param_u64(params_t* a, const char* name, u64* out) {
+
+  const char* text = param(a, name);
+  char* end;
+
+  if (text == NULL) return 0;
+  *out = strtoul(text, &end, 10);
+
+  return (end == text || *end != 0) ? -1 : 1;
+}
+
+
+static int param_double(params_t* a, const char* name, double* out) {
+
+  const char* text = param(a, name);
+  char* end;
+
+  if (text == NULL) return 0;
+  *out = strtod(text, &end);
+
+  return (end == text || *end != 0) ? -1 : 1;
+}
+
+
+
+/***********
+ * Sources *
+ ***********/
+
+
+
+typedef struct {
+  trace_archive_t a;
+  u64 traces;
+  u64 next;                             // next trace, shared by the workers
+} archive_t;
+
+
+static int archive_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  archive_t* x = s->ctx;
+  u64 first = __atomic_fetch_add(&x->next, b->capacity, __ATOMIC_RELAXED);
+
+  (void)worker;
+
+  if (first >= x->traces) return 0;
+
+  b->first = first;
+  b->count = (x->traces - first < b->capacity) ? x->traces - first : b->capacity;
+  b->samples = x->a.format.samples;
+
+  return (trace_archive_read(&x->a, b->first, b->count, b->trace, b->info) < 0) ? -1 : 1;
+}
+
+
+static void archive_release(void* ctx) {
+
+  archive_t* x = ctx;
+
+  trace_archive_close(&x->a);
+  free(x);
+
+  return;
+}
+
+
+static int archive_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  archive_t* x = calloc(1, sizeof(archive_t));
+  const char* path = param(a, "path");
+  pipeline_stage_t* s;
+
+  if (x == NULL || path == NULL || param_u64(a, "traces", &x->traces) < 0) {
+    free(x);
+    return -1;
+  }
+
+  // the stage's threads read batches side by side, one decoder each
+  if (trace_archive_open(&x->a, path, 1) < 0) {
+    free(x);
+    return -1;
+  }
+
+  if (x->traces == 0 || x->traces > x->a.format.traces) x->traces = x->a.format.traces;
+  *samples = x->a.format.samples;
+
+  s = pipeline_add(p, "archive", threads, archive_process, x, *samples);
+  if (s == NULL) {
+    archive_release(x);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+typedef struct {
+  FILE* fp;
+  FILE* ivs;
+  FILE* keys;
+  u64   samples;
+  u64   traces;                         // at most, 0 for all
+  u64   next;
+} raw_t;
+
+
+static int raw_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  raw_t* x = s->ctx;
+  u64 n = b->capacity, t;
+
+  (void)worker;
+
+  if (x->traces && x->traces - x->next < n) n = x->traces - x->next;
+  if (n == 0) return 0;
+
+  n = fread(b->trace, x->samples * sizeof(float), n, x->fp);
+  if (n == 0) return 0;
+
+  memset(b->info, 0, n * sizeof(trace_info_t));
+  for (t = 0; t < n; t++) {
+    if ((x->ivs != NULL && next_hex(x->ivs, b->info[t].iv, IVLENGTH) < 0) ||
+        (x->keys != NULL && next_hex(x->keys, b->info[t].key, KEYLENGTH) < 0)) {
+      printf("[ERROR] no key or iv for trace %lu\n", x->next + t);
+      return -1;
+    }
+  }
+
+  b->first = x->next;
+  b->count = n;
+  b->samples = x->samples;
+  x->next += n;
+
+  return 1;
+}
+
+
+static void raw_release(void* ctx) {
+
+  raw_t* x = ctx;
+
+  if (x->fp != NULL) fclose(x->fp);
+  if (x->ivs != NULL) fclose(x->ivs);
+  if (x->keys != NULL) fclose(x->keys);
+  free(x);
+
+  return;
+}
+
+
+static int raw_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  raw_t* x = calloc(1, sizeof(raw_t));
+  const char *path = param(a, "path"), *ivs = param(a, "ivs"), *keys = param(a, "keys");
+
+  if (x == NULL) return -1;
+
+  if (path == NULL || threads != 1 || param_u64(a, "samples", &x->samples) <= 0 || x->samples == 0 ||
+      param_u64(a, "traces", &x->traces) < 0) {
+    printf("[ERROR] raw needs path= and samples=, and runs on one thread\n");
+    raw_release(x);
+    return -1;
+  }
+
+  x->fp = fopen(path, "rb");
+  if (ivs != NULL) x->ivs = fopen(ivs, "r");
+  if (keys != NULL) x->keys = fopen(keys, "r");
+
+  if (x->fp == NULL || (ivs != NULL && x->ivs == NULL) || (keys != NULL && x->keys == NULL)) {
+    printf("[ERROR] could not open %s or its keys and ivs\n", path);
+    raw_release(x);
+    return -1;
+  }
+
+  *samples = x->samples;
+
+  if (pipeline_add(p, "raw", 1, raw_process, x, *samples) == NULL) {
+    raw_release(x);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/**********
+ * Stages *
+ **********/
+
+
+
+typedef struct {
+  u64             first, width;         // window of the reference
+  u64             shift;                // at most, either way
+  u64             samples;
+  float*          reference;            // [width], centered
+  int             referenced;
+  pthread_mutex_t lock;
+  u64             moved;                // traces shifted
+  u64             bound;                // traces that wanted more than shift
+} align_t;
+
+
+/***
+ * best_shift
+ *
+ * the shift within the bound whose window correlates best with the
+ * reference: the reference being centered, its covariance with the
+ * window is the dot product, divided by the window's deviation
+ *
+ */
+static int64_t best_shift(const align_t* x, const float* trace) {
+
+  double best = -INFINITY, dot, sum, squares, score;
+  int64_t s, found = 0;
+  u64 i;
+
+  for (s = -(int64_t)x->shift; s <= (int64_t)x->shift; s++) {
+    const float* w = trace + x->first + s;
+
+    dot = sum = squares = 0;
+    for (i = 0; i < x->width; i++) {
+      dot += x->reference[i] * w[i];
+      sum += w[i];
+      squares += w[i] * w[i];
+    }
+
+    squares -= sum * sum / x->width;
+    score = (squares > 0) ? dot / sqrt(squares) : 0;
+    if (score > best) {
+      best = score;
+      found = s;
+    }
+  }
+
+  return found;
+}
+
+
+static int align_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  align_t* x = s->ctx;
+  const float* in;
+  float* out;
+  double mean = 0;
+  int64_t shift, j;
+  u64 t, i, moved = 0, bound = 0;
+
+  (void)worker;
+
+  // the first trace to arrive is the reference
+  pthread_mutex_lock(&x->lock);
+  if (!x->referenced) {
+    for (i = 0; i < x->width; i++) mean += b->trace[x->first + i];
+    mean /= x->width;
+    for (i = 0; i < x->width; i++) x->reference[i] = (float)(b->trace[x->first + i] - mean);
+    x->referenced = 1;
+  }
+  pthread_mutex_unlock(&x->lock);
+
+  for (t = 0; t < b->count; t++) {
+    in = b->trace + t * x->samples;
+    out = b->spare + t * x->samples;
+    shift = best_shift(x, in);
+
+    moved += (shift != 0);
+    bound += ((u64)llabs(shift) == x->shift && x->shift > 0);
+
+    // edge samples fill what the shift uncovers
+    for (i = 0; i < x->samples; i++) {
+      j = (int64_t)i + shift;
+      out[i] = in[(j < 0) ? 0 : ((u64)j >= x->samples) ? x->samples - 1 : (u64)j];
+    }
+  }
+
+  batch_swap(b, x->samples);
+  __atomic_fetch_add(&x->moved, moved, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&x->bound, bound, __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+
+static void align_finish(pipeline_stage_t* s) {
+
+  align_t* x = s->ctx;
+
+  printf("align: %lu of %lu traces shifted, %lu by the full %lu samples\n", x->moved, s->traces, x->bound, x->shift);
+
+  return;
+}
+
+
+static void align_release(void* ctx) {
+
+  align_t* x = ctx;
+
+  pthread_mutex_destroy(&x->lock);
+  free(x->reference);
+  free(x);
+
+  return;
+}
+
+
+static int align_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  align_t* x = calloc(1, sizeof(align_t));
+  const char* window = param(a, "window");
+  pipeline_stage_t* s;
+
+  if (x == NULL) return -1;
+  pthread_mutex_init(&x->lock, NULL);
+  x->samples = *samples;
+
+  if (window == NULL || parse_range(window, &x->first, &x->width) < 0 || param_u64(a, "shift", &x->shift) <= 0 ||
+      x->width == 0 || x->first < x->shift || x->first + x->width + x->shift > *samples) {
+    printf("[ERROR] align needs window=first:count and shift=, the window shifted staying in the trace\n");
+    align_release(x);
+    return -1;
+  }
+
+  x->reference = malloc(x->width * sizeof(float));
+  s = (x->reference == NULL) ? NULL : pipeline_add(p, "align", threads, align_process, x, *samples);
+  if (s == NULL) {
+    align_release(x);
+    return -1;
+  }
+  s->finish = align_finish;
+
+  return 0;
+}
+
+
+typedef struct {
+  dsp_t  d;
+  float* scratch[PIPELINE_MAX_THREADS];
+  u64    threads;
+} filter_t;
+
+
+static int filter_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  filter_t* x = s->ctx;
+  u64 t;
+
+  for (t = 0; t < b->count; t++) {
+    dsp_trace(&x->d, b->trace + t * x->d.samples, b->spare + t * x->d.out, x->scratch[worker]);
+  }
+  batch_swap(b, x->d.out);
+
+  return 1;
+}
+
+
+static void filter_release(void* ctx) {
+
+  filter_t* x = ctx;
+  u64 i;
+
+  for (i = 0; i < x->threads; i++) free(x->scratch[i]);
+  dsp_free(&x->d);
+  free(x);
+
+  return;
+}
+
+
+static int kind_param(params_t* a, const char* name, u32* kind) {
+
+  const char* text = param(a, name);
+
+  if (text == NULL) return 0;
+
+  return (dsp_kind_parse(text, kind) < 0) ? -1 : 1;
+}
+
+
+static int filter_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  filter_t* x = calloc(1, sizeof(filter_t));
+  dsp_config_t c;
+  u64 i;
+
+  if (x == NULL) return -1;
+
+  memset(&c, 0, sizeof(c));
+  c.rate = 1e9;
+  c.factor = 1;
+
+  if (param_double(a, "rate", &c.rate) < 0 || kind_param(a, "iir", &c.iir) < 0 ||
+      param_double(a, "iir_cutoff", &c.iir_cutoff) < 0 || kind_param(a, "fir", &c.fir) < 0 ||
+      param_double(a, "low", &c.low) < 0 || param_double(a, "high", &c.high) < 0 ||
+      param_u64(a, "taps", &c.taps) < 0 || param_u64(a, "factor", &c.factor) < 0 ||
+      param_double(a, "clock", &c.clock) < 0 || param_double(a, "offset", &c.offset) < 0 ||
+      param_u64(a, "cycles", &c.cycles) < 0 || dsp_init(&x->d, &c, *samples) < 0) {
+    free(x);
+    return -1;
+  }
+
+  x->threads = threads;
+  for (i = 0; i < threads; i++) {
+    x->scratch[i] = malloc((x->d.scratch ? x->d.scratch : 1) * sizeof(float));
+    if (x->scratch[i] == NULL) {
+      filter_release(x);
+      return -1;
+    }
+  }
+
+  // a batch must also hold the filtered traces
+  if (pipeline_add(p, "filter", threads, filter_process, x, (x->d.out > *samples) ? x->d.out : *samples) == NULL) {
+    filter_release(x);
+    return -1;
+  }
+  *samples = x->d.out;
+
+  return 0;
+}
+
+
+typedef struct {
+  u64* index;                           // samples kept
+  u64  count;
+} poi_t;
+
+
+static int poi_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  poi_t* x = s->ctx;
+  u64 t, j;
+
+  (void)worker;
+
+  for (t = 0; t < b->count; t++) {
+    const float* in = b->trace + t * b->samples;
+    float* out = b->spare + t * x->count;
+    for (j = 0; j < x->count; j++) out[j] = in[x->index[j]];
+  }
+  batch_swap(b, x->count);
+
+  return 1;
+}
+
+
+static void poi_release(void* ctx) {
+
+  poi_t* x = ctx;
+
+  free(x->index);
+  free(x);
+
+  return;
+}
+
+
+static int poi_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  poi_t* x = calloc(1, sizeof(poi_t));
+  const char *window = param(a, "window"), *file = param(a, "file");
+  FILE* fp;
+  u64 first, count, i, v;
+
+  if (x == NULL) return -1;
+
+  if (window != NULL && file == NULL && parse_range(window, &first, &count) == 0 && count > 0 &&
+      first + count <= *samples) {
+    x->index = malloc(count * sizeof(u64));
+    if (x->index != NULL) {
+      for (i = 0; i < count; i++) x->index[i] = first + i;
+      x->count = count;
+    }
+  } else if (file != NULL && window == NULL && (fp = fopen(file, "r")) != NULL) {
+    x->index = malloc(*samples * sizeof(u64));
+    while (x->index != NULL && x->count < *samples && fscanf(fp, "%lu", &v) == 1) {
+      if (v >= *samples) {
+        x->count = 0;
+        break;
+      }
+      x->index[x->count++] = v;
+    }
+    fclose(fp);
+  }
+
+  if (x->count == 0) {
+    printf("[ERROR] poi needs window=first:count or file= with samples below %lu\n", *samples);
+    poi_release(x);
+    return -1;
+  }
+
+  if (pipeline_add(p, "poi", threads, poi_process, x, *samples) == NULL) {
+    poi_release(x);
+    return -1;
+  }
+  *samples = x->count;
+
+  return 0;
+}
+
+
+
+/*********
+ * Sinks *
+ *********/
+
+
+
+typedef struct {
+  monitor_t m;
+  u8*       ivs;                        // [batch][IVLENGTH]
+  u64       samples;
+} attack_t;
+
+
+static int cpa_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  attack_t* x = s->ctx;
+  u64 t;
+
+  (void)worker;
+
+  for (t = 0; t < b->count; t++) memcpy(x->ivs + t * IVLENGTH, b->info[t].iv, IVLENGTH);
+
+  return (monitor_add(&x->m, b->trace, b->samples, b->count, x->ivs) < 0) ? -1 : 1;
+}
+
+
+static void cpa_finish(pipeline_stage_t* s) {
+
+  attack_t* x = s->ctx;
+  monitor_report_t r;
+
+  if (monitor_check(&x->m, &r) < 0) {
+    printf("[ERROR] out of memory\n");
+    return;
+  }
+
+  printf("cpa: %lu traces, peak %.4f at clock %u, margin %.2f at clock %u", r.traces, r.peak, r.peak_clock,
+         r.margin, r.margin_clock);
+  if (isinf(r.needed)) printf(", needed -");
+  else printf(", needed %.0f", r.needed);
+  if (r.ranked) printf(", %lu/%lu targets right first, log2 rank %.1f", r.first, x->m.targets, r.rank.estimate);
+  printf("%s\n", r.success ? ", success" : "");
+
+  return;
+}
+
+
+static void cpa_release(void* ctx) {
+
+  attack_t* x = ctx;
+
+  monitor_free(&x->m);
+  free(x->ivs);
+  free(x);
+
+  return;
+}
+
+
+static int cpa_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  attack_t* x = calloc(1, sizeof(attack_t));
+  const char *clocks = param(a, "clocks"), *key = param(a, "key");
+  u64 first = 0, last = TARGET_CLOCKS - 1, engine = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  pipeline_stage_t* s;
+
+  if (x == NULL) return -1;
+
+  if (threads != 1 || (clocks != NULL && (parse_range(clocks, &first, &last) < 0 || first > last || last >= TARGET_CLOCKS)) ||
+      (key != NULL && (strlen(key) != 2 * KEYLENGTH || parse_bytes(key, x->m.key, KEYLENGTH) < 0)) ||
+      param_u64(a, "engine", &engine) < 0 || engine == 0) {
+    printf("[ERROR] cpa takes clocks=first:last within 0:%d, key= and engine=, on one thread\n", TARGET_CLOCKS - 1);
+    free(x);
+    return -1;
+  }
+
+  x->ivs = malloc(p->batch * IVLENGTH);
+  if (x->ivs == NULL || monitor_init(&x->m, (u32)first, (u32)last, *samples, p->batch, engine) < 0) {
+    free(x->ivs);
+    free(x);
+    return -1;
+  }
+
+  // monitor_init() clears the monitor, the key goes in after it
+  x->m.margin = 5;
+  x->m.rank = -1;
+  x->m.probability = MONITOR_PROBABILITY;
+  x->m.has_key = (key != NULL);
+  if (key != NULL) parse_bytes(key, x->m.key, KEYLENGTH);
+
+  s = pipeline_add(p, "cpa", 1, cpa_process, x, *samples);
+  if (s == NULL) {
+    cpa_release(x);
+    return -1;
+  }
+  s->finish = cpa_finish;
+
+  return 0;
+}
+
+
+typedef struct {
+  int fd;
+  int ivs;
+  u64 samples;
+} store_t;
+
+
+static int store_process(pipeline_stage_t* s, batch_t* b, u64 worker) {
+
+  store_t* x = s->ctx;
+  char line[2 * IVLENGTH + 1];
+  u64 t, j, size = b->count * x->samples * sizeof(float);
+  static const char digits[] = "0123456789ABCDEF";
+
+  (void)worker;
+
+  // batches arrive in any order, each goes where its first trace belongs
+  if (pwrite(x->fd, b->trace, size, (off_t)(b->first * x->samples * sizeof(float))) != (ssize_t)size) {
+    printf("[ERROR] could not store traces %lu..%lu\n", b->first, b->first + b->count - 1);
+    return -1;
+  }
+
+  for (t = 0; t < b->count; t++) {
+    for (j = 0; j < IVLENGTH; j++) {
+      line[2 * j] = digits[b->info[t].iv[j] >> 4];
+      line[2 * j + 1] = digits[b->info[t].iv[j] & 0x0F];
+    }
+    line[2 * IVLENGTH] = '\n';
+    if (pwrite(x->ivs, line, sizeof(line), (off_t)((b->first + t) * sizeof(line))) != (ssize_t)sizeof(line)) return -1;
+  }
+
+  return 1;
+}
+
+
+static void store_release(void* ctx) {
+
+  store_t* x = ctx;
+
+  if (x->fd >= 0) close(x->fd);
+  if (x->ivs >= 0) close(x->ivs);
+  free(x);
+
+  return;
+}
+
+
+static int store_setup(pipeline_t* p, params_t* a, u64 threads, u64* samples) {
+
+  store_t* x = calloc(1, sizeof(store_t));
+  const char* path = param(a, "path");
+  char name[4096];
+
+  if (x == NULL) return -1;
+  x->fd = x->ivs = -1;
+  x->samples = *samples;
+
+  if (path == NULL) {
+    printf("[ERROR] store needs path=\n");
+    store_release(x);
+    return -1;
+  }
+
+  snprintf(name, sizeof(name), "%s.ivs", path);
+  x->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  x->ivs = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (x->fd < 0 || x->ivs < 0) {
+    printf("[ERROR] could not create %s\n", path);
+    store_release(x);
+    return -1;
+  }
+
+  if (pipeline_add(p, "store", threads, store_process, x, *samples) == NULL) {
+    store_release(x);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+typedef struct {
+  const char* kind;
+  setup_fn    setup;
+  void        (*release)(void* ctx);
+  int         source;
+} stage_kind_t;
+
+
+static const stage_kind_t kinds[] = {
+  { "archive", archive_setup, archive_release, 1 },
+  { "raw",     raw_setup,     raw_release,     1 },
+  { "align",   align_setup,   align_release,   0 },
+  { "filter",  filter_setup,  filter_release,  0 },
+  { "poi",     poi_setup,     poi_release,     0 },
+  { "cpa",     cpa_setup,     cpa_release,     0 },
+  { "store",   store_setup,   store_release,   0 },
+};
+
+#define KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+
+/***
+ * add_stage
+ *
+ * a stage line: its kind, then name=value pairs; every pair must be one
+ * the kind takes
+ *
+ */
+static int add_stage(pipeline_t* p, char* text, u64* samples, const stage_kind_t** added, u64 line) {
+
+  params_t a;
+  const stage_kind_t* k = NULL;
+  char* token, *save = NULL, *kind;
+  u64 threads = 1, i;
+
+  memset(&a, 0, sizeof(a));
+
+  kind = strtok_r(text, " \t\r\n", &save);
+  for (i = 0; kind != NULL && i < KINDS; i++) {
+    if (strcmp(kind, kinds[i].kind) == 0) k = &kinds[i];
+  }
+
+  if (k == NULL || k->source != (p->stages == 0)) {
+    printf("[ERROR] line %lu: %s\n", line, (k == NULL) ? "no such stage" : k->source ? "a source must come first" :
+           "the first stage must be a source");
+    return -1;
+  }
+
+  while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+    char* equal = strchr(token, '=');
+
+    if (equal == NULL || a.count == MAX_PARAMS) {
+      printf("[ERROR] line %lu: %s is not name=value\n", line, token);
+      return -1;
+    }
+    *equal = 0;
+    a.name[a.count] = token;
+    a.value[a.count++] = equal + 1;
+  }
+
+  if (param_u64(&a, "threads", &threads) < 0 || threads == 0 || threads > PIPELINE_MAX_THREADS) {
+    printf("[ERROR] line %lu: threads must be 1..%d\n", line, PIPELINE_MAX_THREADS);
+    return -1;
+  }
+
+  if (k->setup(p, &a, threads, samples) < 0) {
+    printf("[ERROR] line %lu: could not set up %s\n", line, k->kind);
+    return -1;
+  }
+  added[p->stages - 1] = k;
+
+  for (i = 0; i < a.count; i++) {
+    if (!a.used[i]) {
+      printf("[ERROR] line %lu: %s takes no %s\n", line, k->kind, a.name[i]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+static int run(const char* path) {
+
+  FILE* fp = fopen(path, "r");
+  pipeline_t p;
+  const stage_kind_t* added[PIPELINE_MAX_STAGES];
+  char buffer[LINE_MAX_LENGTH], word[LINE_MAX_LENGTH], *hash;
+  u64 batch = 256, depth = 4, samples = 0, line = 0, i, stages;
+  double progress = 1, value;
+  int result = 1;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return 1;
+  }
+
+  // the settings come before the stages use them
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if ((hash = strchr(buffer, '#')) != NULL) *hash = 0;
+    if (sscanf(buffer, "%s %lf", word, &value) != 2) continue;
+    if (strcmp(word, "batch") == 0) batch = (u64)value;
+    else if (strcmp(word, "depth") == 0) depth = (u64)value;
+    else if (strcmp(word, "progress") == 0) progress = value;
+  }
+
+  if (pipeline_init(&p, batch, depth, progress) < 0) {
+    printf("[ERROR] batch must be at least 1\n");
+    fclose(fp);
+    return 1;
+  }
+
+  rewind(fp);
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    line++;
+    if ((hash = strchr(buffer, '#')) != NULL) *hash = 0;
+    if (sscanf(buffer, "%s", word) != 1) continue;
+
+    if (strcmp(word, "stage") == 0) {
+      if (p.stages == PIPELINE_MAX_STAGES) {
+        printf("[ERROR] line %lu: at most %d stages\n", line, PIPELINE_MAX_STAGES);
+        goto done;
+      }
+      if (add_stage(&p, strstr(buffer, "stage") + 5, &samples, added, line) < 0) goto done;
+    } else if (strcmp(word, "batch") != 0 && strcmp(word, "depth") != 0 && strcmp(word, "progress") != 0) {
+      printf("[ERROR] line %lu: no such setting %s\n", line, word);
+      goto done;
+    }
+  }
+
+  printf("%lu stages, %lu traces per batch, %lu batches per queue\n", p.stages, p.batch, p.depth);
+  for (i = 0; i < p.stages; i++) printf("  %-8s %lu threads, %lu samples out\n", p.stage[i].name, p.stage[i].threads,
+                                        p.stage[i].samples);
+  printf("\n");
+
+  if (pipeline_run(&p) == 0) result = 0;
+
+done:
+  // a stage that failed its setup cleaned up after itself
+  stages = p.stages;
+  for (i = 0; i < stages; i++) added[i]->release(p.stage[i].ctx);
+  pipeline_free(&p);
+  fclose(fp);
+
+  return result;
+}
+
+
+int main(int argc, char** argv) {
+
+  if (argc != 2) {
+    printf("usage: %s description\n", argv[0]);
+    return 2;
+  }
+
+  return run(argv[1]);
+}
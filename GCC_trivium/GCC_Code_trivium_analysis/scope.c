@@ -0,0 +1,330 @@
+/*
+ * scope.c
+ *
+ * segmented acquisition over SCPI (see scope.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "scope.h"
+#include "util.h"
+
+#define BUFFER_BYTES (1 << 20)          // of the receiving stream, blocks are large
+
+
+int scope_open(scope_t* s, const char* address, double timeout) {
+
+  struct addrinfo hints, *list = NULL, *ai;
+  struct timeval tv;
+  char host[256];
+  const char* colon = strrchr(address, ':');
+  const char* port = SCOPE_PORT;
+  u64 length = colon ? (u64)(colon - address) : strlen(address);
+  int one = 1;
+
+  memset(s, 0, sizeof(scope_t));
+  s->fd = -1;
+  s->timeout = timeout;
+
+  if (length >= sizeof(host)) return -1;
+  memcpy(host, address, length);
+  host[length] = 0;
+  if (colon != NULL) port = colon + 1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(host, port, &hints, &list) != 0) {
+    printf("[ERROR] unknown scope address %s\n", address);
+    return -1;
+  }
+
+  for (ai = list; ai != NULL; ai = ai->ai_next) {
+    if ((s->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+    if (connect(s->fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(s->fd);
+    s->fd = -1;
+  }
+  freeaddrinfo(list);
+
+  if (s->fd < 0) {
+    printf("[ERROR] could not connect to the scope at %s\n", address);
+    return -1;
+  }
+
+  // commands are short lines that should not wait for more
+  setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  tv.tv_sec = (time_t)timeout;
+  tv.tv_usec = (suseconds_t)(1e6 * (timeout - (double)tv.tv_sec));
+  setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  s->in = fdopen(s->fd, "rb");
+  s->out = (s->in != NULL) ? fdopen(dup(s->fd), "wb") : NULL;
+
+  if (s->out == NULL) {
+    printf("[ERROR] out of memory\n");
+    scope_close(s);
+    return -1;
+  }
+
+  setvbuf(s->in, NULL, _IOFBF, BUFFER_BYTES);
+
+  if (scope_query(s, s->identity, sizeof(s->identity), "*IDN?") < 0) {
+    scope_close(s);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void scope_close(scope_t* s) {
+
+  if (s->in != NULL) fclose(s->in);
+  else if (s->fd >= 0) close(s->fd);
+  if (s->out != NULL) fclose(s->out);
+  free(s->block);
+  memset(s, 0, sizeof(scope_t));
+  s->fd = -1;
+
+  return;
+}
+
+
+static int send_line(scope_t* s, const char* format, va_list args) {
+
+  if (vfprintf(s->out, format, args) < 0 || fputc('\n', s->out) == EOF || fflush(s->out) != 0) {
+    printf("[ERROR] the scope closed the connection\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int scope_command(scope_t* s, const char* format, ...) {
+
+  va_list args;
+  int result;
+
+  va_start(args, format);
+  result = send_line(s, format, args);
+  va_end(args);
+
+  return result;
+}
+
+
+/***
+ * scope_query
+ *
+ * a command and its reply line, without the newline
+ *
+ */
+int scope_query(scope_t* s, char* reply, u64 size, const char* format, ...) {
+
+  va_list args;
+  u64 length;
+  int result;
+
+  va_start(args, format);
+  result = send_line(s, format, args);
+  va_end(args);
+
+  if (result < 0) return -1;
+
+  if (fgets(reply, (int)size, s->in) == NULL) {
+    printf("[ERROR] no reply from the scope within %.1f s\n", s->timeout);
+    return -1;
+  }
+
+  length = strlen(reply);
+  while (length > 0 && (reply[length - 1] == '\n' || reply[length - 1] == '\r')) reply[--length] = 0;
+
+  return 0;
+}
+
+
+/***
+ * scope_block
+ *
+ * the definite length block that a query returned
+ *
+ */
+int scope_block(scope_t* s, u8* data, u64 capacity, u64* length) {
+
+  char digits[10];
+  int c, n;
+
+  do {
+    c = fgetc(s->in);
+  } while (c == ' ' || c == '\r' || c == '\n');
+
+  if (c != '#' || (n = fgetc(s->in) - '0') < 1 || n > 9 || fread(digits, 1, (u64)n, s->in) != (u64)n) {
+    printf("[ERROR] the scope did not send a definite length block\n");
+    return -1;
+  }
+
+  digits[n] = 0;
+  *length = strtoul(digits, NULL, 10);
+
+  if (*length > capacity) {
+    printf("[ERROR] block of %lu bytes, room for %lu\n", *length, capacity);
+    return -1;
+  }
+
+  if (fread(data, 1, *length, s->in) != *length) {
+    printf("[ERROR] the block ended after less than %lu bytes\n", *length);
+    return -1;
+  }
+
+  // the newline that ends the reply
+  if ((c = fgetc(s->in)) != '\n' && c != EOF) ungetc(c, s->in);
+
+  return 0;
+}
+
+
+static int check_errors(scope_t* s) {
+
+  char reply[SCOPE_LINE];
+
+  if (scope_query(s, reply, sizeof(reply), ":SYSTem:ERRor?") < 0) return -1;
+
+  if (strtol(reply, NULL, 10) != 0) {
+    printf("[ERROR] the scope reports %s\n", reply);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * scope_setup
+ *
+ * trigger, segmented acquisition and byte waveforms of every segment;
+ * the rest of the setup (vertical range, timebase) is the user's
+ *
+ */
+int scope_setup(scope_t* s, const scope_config_t* c) {
+
+  if (c->points == 0 || c->segments == 0) return -1;
+
+  if (scope_command(s, ":STOP") < 0 ||
+      scope_command(s, ":TRIGger:EDGE:SOURce %s", c->trigger) < 0 ||
+      scope_command(s, ":TRIGger:EDGE:LEVel %g", c->level) < 0 ||
+      scope_command(s, ":TRIGger:EDGE:SLOPe %s", c->falling ? "NEGative" : "POSitive") < 0 ||
+      scope_command(s, ":ACQuire:MODE SEGMented") < 0 ||
+      scope_command(s, ":ACQuire:SEGMented:COUNt %lu", c->segments) < 0 ||
+      scope_command(s, ":WAVeform:SOURce CHANnel%u", c->channel) < 0 ||
+      scope_command(s, ":WAVeform:FORMat BYTE") < 0 ||
+      scope_command(s, ":WAVeform:POINts %lu", c->points) < 0 ||
+      scope_command(s, ":WAVeform:SEGMented:ALL ON") < 0 ||
+      check_errors(s) < 0) return -1;
+
+  free(s->block);
+  s->points = c->points;
+  s->segments = c->segments;
+  s->capacity = c->points * c->segments;
+  s->block = malloc(s->capacity);
+
+  if (s->block == NULL) {
+    printf("[ERROR] out of memory\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int scope_arm(scope_t* s) {
+
+  return scope_command(s, ":SINGle");
+}
+
+
+int scope_filled(scope_t* s, u64* segments) {
+
+  char reply[SCOPE_LINE];
+
+  if (scope_query(s, reply, sizeof(reply), ":WAVeform:SEGMented:COUNt?") < 0) return -1;
+  *segments = strtoul(reply, NULL, 10);
+
+  return 0;
+}
+
+
+/***
+ * scope_wait
+ *
+ * until at least this many segments are filled or the time is up
+ *
+ */
+int scope_wait(scope_t* s, u64 segments, double timeout, u64* filled) {
+
+  double start = now();
+
+  for (;;) {
+    if (scope_filled(s, filled) < 0) return -1;
+    if (*filled >= segments || now() - start > timeout) return 0;
+    usleep((useconds_t)(1e6 * SCOPE_POLL));
+  }
+}
+
+
+/***
+ * scope_download
+ *
+ * stop the batch and read its first segments, in volts
+ *
+ */
+int scope_download(scope_t* s, u64 segments, float* traces) {
+
+  char reply[SCOPE_LINE];
+  double field[10];
+  char* text = reply;
+  u64 i, length;
+
+  if (scope_command(s, ":STOP") < 0 || scope_query(s, reply, sizeof(reply), ":WAVeform:PREamble?") < 0) return -1;
+
+  // format, type, points, count, xincrement, xorigin, xreference, yincrement, yorigin, yreference
+  for (i = 0; i < 10; i++) {
+    field[i] = strtod(text, &text);
+    if (*text == ',') text++;
+  }
+
+  if ((u64)field[2] != s->points) {
+    printf("[ERROR] the scope sends %.0f points per segment, not %lu\n", field[2], s->points);
+    return -1;
+  }
+
+  s->y_increment = field[7];
+  s->y_origin = field[8];
+  s->y_reference = field[9];
+
+  if (scope_command(s, ":WAVeform:DATA?") < 0 || scope_block(s, s->block, s->capacity, &length) < 0) return -1;
+
+  if (length < segments * s->points) {
+    printf("[ERROR] %lu bytes of waveform for %lu segments of %lu points\n", length, segments, s->points);
+    return -1;
+  }
+
+  for (i = 0; i < segments * s->points; i++) {
+    traces[i] = (float)((s->block[i] - s->y_reference) * s->y_increment + s->y_origin);
+  }
+
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * scope.h
+ *
+ * SCPI over TCP to an oscilloscope in segmented acquisition
+ *
+ * the board raises PIN_B0 around every encryption; wired to the scope's
+ * trigger input, every encryption fills one segment of a segmented
+ * (sequence) acquisition, the scope rearming in hardware between them.
+ * The host only arms a batch of segments, watches the count of the ones
+ * filled and downloads all of them in one transfer, so the dead time per
+ * trace is the scope's rearm time instead of a network round trip.
+ *
+ * commands are those of the Keysight InfiniiVision family, most of
+ * which other vendors accept in their SCPI compatibility modes:
+ *
+ *   :TRIGger:EDGE:SOURce, :LEVel, :SLOPe     trigger on PIN_B0
+ *   :ACQuire:MODE SEGMented
+ *   :ACQuire:SEGMented:COUNt n               segments per batch
+ *   :WAVeform:SOURce, :FORMat BYTE, :POINts
+ *   :WAVeform:SEGMented:ALL ON               :DATA? returns every segment
+ *   :SINGle, :STOP                           arm, end the batch
+ *   :WAVeform:SEGMented:COUNt?               segments filled so far
+ *   :WAVeform:PREamble?, :WAVeform:DATA?
+ *   :SYSTem:ERRor?
+ *
+ * data comes as an IEEE 488.2 definite length block, "#" then the number
+ * of length digits, the length and the bytes, ended by a newline. Codes
+ * are unsigned bytes, volts = (code - yreference) yincrement + yorigin
+ * from the preamble.
+ *
+ */
+
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdio.h>
+
+#include "trivium.h"
+
+#define SCOPE_PORT        "5025"        // the usual SCPI raw socket
+#define SCOPE_LINE        4096
+#define SCOPE_POLL        0.002         // seconds between segment counts
+
+
+typedef struct {
+  u32    channel;                       // analog input of the power trace
+  char   trigger[32];                   // trigger source, e.g. EXTernal or CHANnel2
+  double level;                         // volts
+  int    falling;
+  u64    points;                        // per segment
+  u64    segments;                      // per batch
+} scope_config_t;
+
+
+typedef struct {
+  int    fd;
+  FILE*  in;
+  FILE*  out;
+  double timeout;                       // seconds for any one reply
+  char   identity[SCOPE_LINE];
+  u64    points, segments;
+  double y_increment, y_origin, y_reference;
+  u8*    block;                         // the last download
+  u64    capacity;
+} scope_t;
+
+
+int  scope_open(scope_t* s, const char* address, double timeout);
+void scope_close(scope_t* s);
+
+int  scope_command(scope_t* s, const char* format, ...);
+int  scope_query(scope_t* s, char* reply, u64 size, const char* format, ...);
+int  scope_block(scope_t* s, u8* data, u64 capacity, u64* length);
+
+int  scope_setup(scope_t* s, const scope_config_t* c);
+int  scope_arm(scope_t* s);
+int  scope_filled(scope_t* s, u64* segments);
+int  scope_wait(scope_t* s, u64 segments, double timeout, u64* filled);
+int  scope_download(scope_t* s, u64 segments, float* traces);
+
+#endif
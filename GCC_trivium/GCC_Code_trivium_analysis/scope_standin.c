@@ -0,0 +1,636 @@
+/*
+ * scope_standin.c
+ *
+ * a stand-in for the scope of scope.h and for the board, to try the
+ * acquisition without either
+ *
+ *  build : gcc -O3 -march=native -o scope_standin scope_standin.c targets.c trivium_word.c
+ *  run   : ./scope_standin -a address [-r rate] [-m bytes] [-n noise] [-A amplitude]
+ *                          [-d] [-k keys] [-i ivs]
+ *
+ *   -a address   listen here, e.g. 127.0.0.1:5025 where acquire looks
+ *   -r rate      triggers per second (default 2000)
+ *   -m bytes     segment memory of the scope (default 64M)
+ *   -n noise     standard deviation of the noise, in codes (default 6)
+ *   -A amplitude codes a set t1 bit adds (default 4)
+ *   -d           be the board as well, on a pseudo terminal whose name
+ *                is printed: key and iv arrive as 40 hex digits as
+ *                collect.m sends them, encryptions (and triggers) repeat
+ *                until a 'z', answered with 128 hex digits of keystream
+ *   -k keys      without -d, the key of every segment, keys.txt format,
+ *                from the first line on (and round again), as if the
+ *                host drove one encryption per segment
+ *   -i ivs       the same for the ivs
+ *
+ * one scope client at a time. Segments are filled as the triggers come,
+ * at the configured rate while armed, and hold unsigned byte codes: 128
+ * plus noise, plus the amplitude where the t1 bit of clock c is set, at
+ * sample LEAK_FIRST + LEAK_STRIDE c. The first four samples carry the
+ * number of the segment since the start, little endian, so a test can
+ * tell lost or reordered segments; the preamble scales codes to volts
+ * by 0.01. Triggers while the scope is not armed are lost, as they are
+ * on the real one.
+ *
+ */
+
+#define _GNU_SOURCE                     // posix_openpt
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "targets.h"
+#include "util.h"
+
+#define LINE_MAX_LENGTH 4096
+#define MAX_ERRORS      16
+#define MAX_LINES       4096             // of the key and iv files
+#define LEAK_FIRST      40
+#define LEAK_STRIDE     8
+#define Y_INCREMENT     0.01
+#define CIPHER_BYTES    64               // 128 hex digits, as collect.m reads
+#define POLL_MS         5
+
+
+typedef struct {
+  double rate;
+  u64    memory;
+  double noise;
+  double amplitude;
+
+  // scope
+  u64    segments, points;
+  int    armed, all;
+  u64    filled;
+  u8*    data;                          // [memory]
+  char   trigger[32];
+  double level;
+  int    errors;
+  char   error[MAX_ERRORS][64];
+
+  // board
+  int    device;                        // pty master, -1 without
+  int    running;
+  u8     key[KEYLENGTH], iv[IVLENGTH];
+  char   input[2 * (KEYLENGTH + IVLENGTH)];
+  u64    typed;
+  double since;
+  u64    emitted;                       // triggers of this encryption run
+  u64    captured;                      // segments filled in the whole session
+
+  // free running
+  u64    lines;
+  u8     (*keys)[KEYLENGTH];
+  u8     (*ivs)[IVLENGTH];
+
+  target_t target[TARGET_CLOCKS];
+  u64    targets;
+} standin_t;
+
+
+
+/************
+ * Triggers *
+ ************/
+
+
+
+static void push_error(standin_t* s, const char* text) {
+
+  if (s->errors < MAX_ERRORS) snprintf(s->error[s->errors++], sizeof(s->error[0]), "%s", text);
+
+  return;
+}
+
+
+/***
+ * render
+ *
+ * a segment: noise, the t1 bits and the number of the segment
+ *
+ */
+static void render(const standin_t* s, u64 segment, u8* out) {
+
+  u64 state = segment * 0x9E3779B97F4A7C15ULL, x = 0, j, c;
+  double scale = s->noise / 147.8, v;      // 147.8: deviation of a sum of four bytes
+  int code;
+
+  for (j = 0; j < s->points; j++) {
+    if ((j & 1) == 0) x = splitmix64(&state);
+    else x >>= 32;
+    v = 128 + scale * ((double)(x & 0xff) + ((x >> 8) & 0xff) + ((x >> 16) & 0xff) + ((x >> 24) & 0xff) - 510);
+
+    if (j >= LEAK_FIRST && (j - LEAK_FIRST) % LEAK_STRIDE == 0 && (c = (j - LEAK_FIRST) / LEAK_STRIDE) < s->targets) {
+      v += s->amplitude * target_predict(&s->target[c], s->iv, target_guess(&s->target[c], s->key));
+    }
+
+    code = (int)(v + 0.5);
+    out[j] = (u8)(code < 0 ? 0 : (code > 255 ? 255 : code));
+  }
+
+  for (j = 0; j < 4 && j < s->points; j++) out[j] = (u8)(segment >> (8 * j));
+
+  return;
+}
+
+
+/***
+ * advance
+ *
+ * the triggers due by now, into the segments while armed
+ *
+ */
+static void advance(standin_t* s) {
+
+  u64 due;
+
+  if (!s->running) return;
+
+  due = (u64)((now() - s->since) * s->rate);
+
+  for (; s->emitted < due; s->emitted++) {
+    if (!s->armed) continue;
+
+    if (s->lines > 0) {
+      memcpy(s->key, s->keys[s->captured % s->lines], KEYLENGTH);
+      memcpy(s->iv, s->ivs[s->captured % s->lines], IVLENGTH);
+    }
+
+    render(s, s->captured++, s->data + s->filled * s->points);
+    if (++s->filled == s->segments) s->armed = 0;
+  }
+
+  return;
+}
+
+
+
+/*********
+ * Board *
+ *********/
+
+
+
+static int open_device(standin_t* s) {
+
+  s->device = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (s->device < 0 || grantpt(s->device) != 0 || unlockpt(s->device) != 0) {
+    printf("[ERROR] no pseudo terminal for the board\n");
+    return -1;
+  }
+
+  printf("board on %s\n", ptsname(s->device));
+  fflush(stdout);
+
+  return 0;
+}
+
+
+/***
+ * board_input
+ *
+ * what the host typed: key and iv start the encryptions, z ends them
+ * with the keystream, y starts over
+ *
+ */
+static void board_input(standin_t* s) {
+
+  u8 buffer[256], stream[CIPHER_BYTES];
+  char hex[2 * CIPHER_BYTES + 1];
+  ssize_t n, i;
+  u64 j;
+
+  n = read(s->device, buffer, sizeof(buffer));
+
+  for (i = 0; i < n; i++) {
+    if (buffer[i] == 'z') {
+      advance(s);
+      s->running = 0;
+      trivium_word_keystream(s->key, s->iv, stream, CIPHER_BYTES);
+      for (j = 0; j < CIPHER_BYTES; j++) sprintf(hex + 2 * j, "%02X", stream[j]);
+      if (write(s->device, hex, 2 * CIPHER_BYTES) < 0) return;
+    } else if (buffer[i] == 'y') {
+      s->typed = 0;
+    } else if (hex_value((char)buffer[i]) >= 0 && s->typed < sizeof(s->input)) {
+      s->input[s->typed++] = (char)buffer[i];
+      if (s->typed == sizeof(s->input)) {
+        parse_bytes(s->input, s->key, KEYLENGTH);
+        parse_bytes(s->input + 2 * KEYLENGTH, s->iv, IVLENGTH);
+        s->typed = 0;
+        s->running = 1;
+        s->since = now();
+        s->emitted = 0;
+      }
+    }
+  }
+
+  return;
+}
+
+
+
+/********
+ * SCPI *
+ ********/
+
+
+
+/***
+ * node_match
+ *
+ * one node of a header against its pattern, whose upper case part is
+ * the short form: either form in any case
+ *
+ */
+static int node_match(const char* pattern, u64 plength, const char* word, u64 wlength) {
+
+  u64 shortened = 0;
+
+  while (shortened < plength && !islower((unsigned char)pattern[shortened])) shortened++;
+
+  return (wlength == shortened || wlength == plength) && strncasecmp(pattern, word, wlength) == 0;
+}
+
+
+static int header_match(const char* pattern, const char* header) {
+
+  const char* p, *w;
+  u64 plength, wlength;
+
+  if (*pattern == ':') pattern++;
+  if (*header == ':') header++;
+
+  for (;;) {
+    for (p = pattern; *p && *p != ':' && *p != '?'; p++);
+    for (w = header; *w && *w != ':' && *w != '?'; w++);
+    plength = (u64)(p - pattern);
+    wlength = (u64)(w - header);
+
+    if (!node_match(pattern, plength, header, wlength) || *p != *w) return 0;
+    if (*p == 0 || *p == '?') return 1;
+
+    pattern = p + 1;
+    header = w + 1;
+  }
+}
+
+
+static int send_all(int fd, const void* data, u64 length) {
+
+  const u8* p = data;
+  ssize_t n;
+
+  while (length > 0) {
+    if ((n = send(fd, p, length, MSG_NOSIGNAL)) <= 0) return -1;
+    p += n;
+    length -= (u64)n;
+  }
+
+  return 0;
+}
+
+
+static int reply(int fd, const char* format, ...) {
+
+  char line[LINE_MAX_LENGTH];
+  va_list args;
+  int n;
+
+  va_start(args, format);
+  n = vsnprintf(line, sizeof(line) - 1, format, args);
+  va_end(args);
+
+  line[n++] = '\n';
+
+  return send_all(fd, line, (u64)n);
+}
+
+
+static int send_block(int fd, const u8* data, u64 length) {
+
+  char header[32];
+  int digits = snprintf(header + 2, sizeof(header) - 2, "%lu", length);
+
+  header[0] = '#';
+  header[1] = (char)('0' + digits);
+
+  return (send_all(fd, header, (u64)digits + 2) == 0 && send_all(fd, data, length) == 0 &&
+          send_all(fd, "\n", 1) == 0) ? 0 : -1;
+}
+
+
+/***
+ * command
+ *
+ * one command of a line, -1 when the client is gone
+ *
+ */
+static int command(standin_t* s, int fd, char* text) {
+
+  char line[64], *argument;
+  u64 value, n;
+
+  while (*text == ' ') text++;
+  if (*text == 0) return 0;
+
+  argument = strchr(text, ' ');
+  if (argument != NULL) {
+    *argument++ = 0;
+    while (*argument == ' ') argument++;
+  } else {
+    argument = text + strlen(text);
+  }
+
+  advance(s);
+
+  if (header_match("*IDN?", text)) return reply(fd, "STAND-IN,TRIVIUM SCOPE,0,1.0");
+  if (header_match("*OPC?", text)) return reply(fd, "1");
+  if (header_match("*CLS", text)) {
+    s->errors = 0;
+    return 0;
+  }
+  if (header_match("*RST", text) || header_match(":STOP", text)) {
+    s->armed = 0;
+    return 0;
+  }
+  if (header_match(":SINGle", text) || header_match(":RUN", text)) {
+    s->armed = 1;
+    s->filled = 0;
+    return 0;
+  }
+
+  if (header_match(":SYSTem:ERRor?", text)) {
+    if (s->errors == 0) return reply(fd, "+0,\"No error\"");
+    snprintf(line, sizeof(line), "%s", s->error[0]);
+    memmove(s->error[0], s->error[1], --s->errors * sizeof(s->error[0]));
+    return reply(fd, "%s", line);
+  }
+
+  if (header_match(":TRIGger:EDGE:SOURce", text)) {
+    snprintf(s->trigger, sizeof(s->trigger), "%s", argument);
+    return 0;
+  }
+  if (header_match(":TRIGger:EDGE:LEVel", text)) {
+    s->level = atof(argument);
+    return 0;
+  }
+  if (header_match(":TRIGger:EDGE:SLOPe", text) || header_match(":ACQuire:MODE", text) ||
+      header_match(":WAVeform:SOURce", text)) return 0;
+
+  if (header_match(":WAVeform:FORMat", text)) {
+    if (strncasecmp(argument, "BYTE", 4) != 0) push_error(s, "-224,\"Illegal parameter value\"");
+    return 0;
+  }
+  if (header_match(":WAVeform:SEGMented:ALL", text)) {
+    s->all = (strcasecmp(argument, "ON") == 0 || strcmp(argument, "1") == 0);
+    return 0;
+  }
+
+  if (header_match(":ACQuire:SEGMented:COUNt", text) || header_match(":WAVeform:POINts", text)) {
+    value = strtoul(argument, NULL, 10);
+    n = (header_match(":WAVeform:POINts", text) ? s->segments : s->points) * value;
+    if (value == 0 || n > s->memory) {
+      push_error(s, "-222,\"Data out of range\"");
+      return 0;
+    }
+    if (header_match(":WAVeform:POINts", text)) s->points = value;
+    else s->segments = value;
+    s->armed = 0;
+    s->filled = 0;
+    return 0;
+  }
+
+  if (header_match(":ACQuire:SEGMented:COUNt?", text)) return reply(fd, "%lu", s->segments);
+  if (header_match(":WAVeform:POINts?", text)) return reply(fd, "%lu", s->points);
+  if (header_match(":WAVeform:SEGMented:COUNt?", text)) return reply(fd, "%lu", s->filled);
+
+  if (header_match(":WAVeform:PREamble?", text)) {
+    return reply(fd, "+0,+2,+%lu,+%lu,1.0E-9,0.0E+0,+0,%.6E,0.0E+0,+128", s->points, s->all ? s->filled : 1,
+                 Y_INCREMENT);
+  }
+
+  if (header_match(":WAVeform:DATA?", text)) {
+    if (s->filled == 0) return send_block(fd, s->data, 0);
+    if (s->all) return send_block(fd, s->data, s->filled * s->points);
+    return send_block(fd, s->data + (s->filled - 1) * s->points, s->points);
+  }
+
+  push_error(s, "-113,\"Undefined header\"");
+
+  return 0;
+}
+
+
+/***
+ * client_input
+ *
+ * whole lines of commands, separated by semicolons
+ *
+ */
+static int client_input(standin_t* s, int fd, char* buffer, u64* used) {
+
+  char* start = buffer, *line, *end, *next;
+  ssize_t n = recv(fd, buffer + *used, LINE_MAX_LENGTH - 1 - *used, 0);
+
+  if (n <= 0) return -1;
+  *used += (u64)n;
+  buffer[*used] = 0;
+
+  while ((end = strchr(start, '\n')) != NULL) {
+    *end = 0;
+    if (end > start && end[-1] == '\r') end[-1] = 0;
+
+    for (line = start; line != NULL; line = next) {
+      next = strchr(line, ';');
+      if (next != NULL) *next++ = 0;
+      if (command(s, fd, line) < 0) return -1;
+    }
+    start = end + 1;
+  }
+
+  *used -= (u64)(start - buffer);
+  memmove(buffer, start, *used);
+
+  if (*used == LINE_MAX_LENGTH - 1) return -1;     // no line in sight
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int listen_on(const char* address) {
+
+  struct addrinfo hints, *list = NULL, *ai;
+  char host[256];
+  const char* colon = strrchr(address, ':');
+  int fd = -1, one = 1;
+
+  if (colon == NULL || (u64)(colon - address) >= sizeof(host)) return -1;
+  memcpy(host, address, colon - address);
+  host[colon - address] = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &list) != 0) return -1;
+
+  for (ai = list; ai != NULL; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 4) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(list);
+
+  return fd;
+}
+
+
+static u64 read_lines(const char* path, u8* out, u64 length, u64 capacity) {
+
+  FILE* fp = fopen(path, "r");
+  char line[LINE_MAX_LENGTH];
+  u64 n = 0;
+
+  if (fp == NULL) return 0;
+
+  while (n < capacity && fgets(line, sizeof(line), fp) != NULL) {
+    if (parse_bytes(line, out + n * length, length) == 0) n++;
+  }
+
+  fclose(fp);
+
+  return n;
+}
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s -a address [-r rate] [-m bytes] [-n noise] [-A amplitude] [-d] [-k keys] [-i ivs]\n", name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  standin_t s;
+  struct pollfd p[3];
+  const char* address = NULL, *keys = NULL, *ivs = NULL;
+  char buffer[LINE_MAX_LENGTH];
+  u64 used = 0, c, lines;
+  int option, board = 0, listener, client = -1;
+
+  memset(&s, 0, sizeof(s));
+  s.rate = 2000;
+  s.memory = 64 << 20;
+  s.noise = 6;
+  s.amplitude = 4;
+  s.segments = 1;
+  s.points = 1000;
+  s.device = -1;
+
+  while ((option = getopt(argc, argv, "a:r:m:n:A:dk:i:")) != -1) {
+    switch (option) {
+    case 'a': address     = optarg;                     break;
+    case 'r': s.rate      = atof(optarg);               break;
+    case 'm': s.memory    = strtoul(optarg, NULL, 10);  break;
+    case 'n': s.noise     = atof(optarg);               break;
+    case 'A': s.amplitude = atof(optarg);               break;
+    case 'd': board       = 1;                          break;
+    case 'k': keys        = optarg;                     break;
+    case 'i': ivs         = optarg;                     break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc || address == NULL || !(s.rate > 0) || s.memory < s.points) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  for (c = 0; c < TARGET_CLOCKS; c++) target_init(&s.target[s.targets++], TARGET_T1, (u32)c);
+
+  s.data = malloc(s.memory);
+  s.keys = calloc(MAX_LINES, KEYLENGTH);
+  s.ivs = calloc(MAX_LINES, IVLENGTH);
+  if (s.data == NULL || s.keys == NULL || s.ivs == NULL) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  if (keys != NULL || ivs != NULL) {
+    lines = keys ? read_lines(keys, (u8*)s.keys, KEYLENGTH, MAX_LINES) : MAX_LINES;
+    c = ivs ? read_lines(ivs, (u8*)s.ivs, IVLENGTH, MAX_LINES) : MAX_LINES;
+    s.lines = (lines < c) ? lines : c;
+    if (s.lines == 0) {
+      printf("[ERROR] no keys or ivs in %s %s\n", keys ? keys : "", ivs ? ivs : "");
+      return 1;
+    }
+  }
+
+  if (board) {
+    if (open_device(&s) < 0) return 1;
+  } else {
+    // the triggers come whatever the host does
+    s.running = 1;
+    s.since = now();
+  }
+
+  if ((listener = listen_on(address)) < 0) {
+    printf("[ERROR] could not listen on %s\n", address);
+    return 1;
+  }
+
+  printf("scope on %s, %.0f triggers per second\n", address, s.rate);
+  fflush(stdout);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    p[0].fd = (client < 0) ? listener : -1;
+    p[0].events = POLLIN;
+    p[1].fd = client;
+    p[1].events = POLLIN;
+    p[2].fd = s.device;
+    p[2].events = POLLIN;
+
+    if (poll(p, 3, POLL_MS) < 0) continue;
+    advance(&s);
+
+    if (p[0].revents & POLLIN) {
+      client = accept(listener, NULL, NULL);
+      used = 0;
+    }
+
+    if (client >= 0 && (p[1].revents & (POLLIN | POLLHUP | POLLERR)) && client_input(&s, client, buffer, &used) < 0) {
+      close(client);
+      client = -1;
+    }
+
+    if (s.device >= 0 && (p[2].revents & POLLIN)) board_input(&s);
+  }
+
+  return 0;
+}
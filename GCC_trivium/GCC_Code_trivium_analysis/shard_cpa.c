@@ -0,0 +1,1019 @@
+/*
+ * shard_cpa.c
+ *
+ * the correlation attack on t1 of attack_monitor and a fixed against
+ * random t-test, split into shards of an archive that worker processes
+ * accumulate and a coordinator merges
+ *
+ *  build : gcc -O3 -march=native -pthread -o shard_cpa shard_cpa.c monitor.c fisher.c cpa.c ttest.c rank.c \
+ *                                   targets.c traces.c -lm
+ *  run   : ./shard_cpa [-c first:last] [-w first:count] [-r first:count] [-s traces] [-b traces]
+ *                      [-j workers] [-a address] [-C checkpoint] [-F iv] [-k key] [-m sigmas]
+ *                      [-t threads] archive
+ *          ./shard_cpa -W address [-b traces] [-t threads] archive
+ *          ./shard_cpa -M out [-k key] [-m sigmas] checkpoint...
+ *
+ *   -c clocks     clocks to attack (default 0:65)
+ *   -w window     samples to look at (default all)
+ *   -r traces     the traces of the archive to use (default all)
+ *   -s traces     traces per shard (default 16384)
+ *   -b traces     traces per pass of the engine (default 4096)
+ *   -j workers    worker processes to fork (default: online cpus)
+ *   -a address    listen here for workers as well, a unix socket path or
+ *                 host:port for workers on other machines
+ *   -C file       resume from this checkpoint if it exists, and keep the
+ *                 merged shards in it
+ *   -F iv         t-test of the traces with this iv against the others
+ *   -k key        the key, for its rank
+ *   -m sigmas     margin counted as success (default 5)
+ *   -t threads    threads per worker (default: online cpus / workers)
+ *   -W address    be a worker of the coordinator listening there
+ *   -M out        merge the checkpoints of separate runs into out
+ *
+ * the coordinator hands out the shards in order, one at a time per
+ * worker, and merges the results strictly in shard order however the
+ * workers finish, so the sums only depend on the shards; with shards a
+ * multiple of the batch the engine even sums the same batches as a
+ * single run. A worker that dies gives its shard back. After every
+ * merged shard the checkpoint is rewritten (through a temporary file),
+ * so an interrupted run goes on from the last one. Runs over adjoining
+ * ranges of the archive, on separate machines, merge with -M, given in
+ * any order; a gap or an overlap between them is an error.
+ *
+ * protocol, per shard: the coordinator sends "shard first count\n", the
+ * worker answers with the shard's checkpoint; "done\n" ends the worker.
+ * Checkpoints:
+ *
+ *   "TRVSHRD1" first_clock last_clock window samples first traces
+ *   has_fixed | fixed iv (16 bytes) | cpa.h sums | ttest.h moments
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "monitor.h"
+#include "ttest.h"
+#include "traces.h"
+#include "util.h"
+
+#define SHARD_MAGIC     "TRVSHRD1"
+#define SHARD_FIELDS    7
+#define MAX_WORKERS     256
+#define LINE_MAX_LENGTH 128
+
+enum {
+  SHARD_TODO = 0,
+  SHARD_RUNNING,
+  SHARD_DONE
+};
+
+
+typedef struct {
+  u32   first_clock, last_clock;
+  u64   window, samples;                // samples 0: the rest of the trace
+  u64   first, traces;                  // traces 0: to the end
+  u64   shard;
+  u64   batch;
+  u64   workers;
+  u64   threads;
+  int   has_fixed;
+  u8    fixed[IVLENGTH];
+  int   has_key;
+  u8    key[KEYLENGTH];
+  double margin;
+  const char* address;
+  const char* checkpoint;
+} options_t;
+
+
+typedef struct {
+  u64     first, traces;
+  cpa_t   cpa;
+  ttest_t ttest;
+} result_t;
+
+
+typedef struct {
+  u64   first, traces;
+  const char* path;
+} piece_t;                              // a checkpoint given to -M
+
+
+typedef struct {
+  int   fd;
+  FILE* in;
+  FILE* out;
+  u64   shard;
+  int   busy;
+} connection_t;
+
+
+
+/***************
+ * Checkpoints *
+ ***************/
+
+
+
+static void result_free(result_t* r) {
+
+  cpa_free(&r->cpa);
+  ttest_free(&r->ttest);
+  memset(r, 0, sizeof(result_t));
+
+  return;
+}
+
+
+static int result_write(const options_t* o, const result_t* r, FILE* fp) {
+
+  u64 header[SHARD_FIELDS] = { o->first_clock, o->last_clock, o->window, o->samples, r->first, r->traces,
+                               (u64)o->has_fixed };
+  u8 fixed[16] = { 0 };
+
+  memcpy(fixed, o->fixed, IVLENGTH);
+
+  if (fwrite(SHARD_MAGIC, 8, 1, fp) != 1 || fwrite(header, sizeof(header), 1, fp) != 1 ||
+      fwrite(fixed, sizeof(fixed), 1, fp) != 1 || cpa_write(&r->cpa, fp) < 0 ||
+      (o->has_fixed && ttest_write(&r->ttest, fp) < 0)) return -1;
+
+  return fflush(fp) == 0 ? 0 : -1;
+}
+
+
+/***
+ * result_read
+ *
+ * a checkpoint of the attack the options describe; with learn, whatever
+ * it was made with becomes the options
+ *
+ */
+static int result_read(options_t* o, result_t* r, FILE* fp, int learn) {
+
+  char magic[8];
+  u64 header[SHARD_FIELDS];
+  u8 fixed[16];
+
+  memset(r, 0, sizeof(result_t));
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, SHARD_MAGIC, 8) != 0 ||
+      fread(header, sizeof(header), 1, fp) != 1 || fread(fixed, sizeof(fixed), 1, fp) != 1) return -1;
+
+  if (learn) {
+    o->first_clock = (u32)header[0];
+    o->last_clock = (u32)header[1];
+    o->window = header[2];
+    o->samples = header[3];
+    o->has_fixed = (int)header[6];
+    memcpy(o->fixed, fixed, IVLENGTH);
+  } else if (header[0] != o->first_clock || header[1] != o->last_clock || header[2] != o->window ||
+             header[3] != o->samples || header[6] != (u64)o->has_fixed ||
+             (o->has_fixed && memcmp(fixed, o->fixed, IVLENGTH) != 0)) {
+    return -1;
+  }
+
+  r->first = header[4];
+  r->traces = header[5];
+
+  if (cpa_read(&r->cpa, fp, 1) < 0 || (o->has_fixed && ttest_read(&r->ttest, fp) < 0)) {
+    result_free(r);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * result_merge
+ *
+ * the sums of another result into r; the caller merges the traces that
+ * follow r, so r then covers both
+ *
+ */
+static int result_merge(const options_t* o, result_t* r, const result_t* other) {
+
+  if (cpa_merge(&r->cpa, &other->cpa) < 0 || (o->has_fixed && ttest_merge(&r->ttest, &other->ttest) < 0)) return -1;
+
+  r->traces += other->traces;
+
+  return 0;
+}
+
+
+static int result_save(const options_t* o, const result_t* r, const char* path) {
+
+  char temporary[4096];
+  FILE* fp;
+  int ok;
+
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+  if ((fp = fopen(temporary, "wb")) == NULL) {
+    printf("[ERROR] could not create %s\n", temporary);
+    return -1;
+  }
+
+  ok = result_write(o, r, fp) == 0;
+  if (fclose(fp) != 0) ok = 0;
+
+  // the old checkpoint stays until the new one is complete
+  if (!ok || rename(temporary, path) != 0) {
+    printf("[ERROR] could not write %s\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * result_range
+ *
+ * the traces a checkpoint covers, from its header
+ *
+ */
+static int result_range(piece_t* p) {
+
+  FILE* fp = fopen(p->path, "rb");
+  char magic[8];
+  u64 header[SHARD_FIELDS];
+  int status = -1;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", p->path);
+    return -1;
+  }
+
+  if (fread(magic, 8, 1, fp) == 1 && memcmp(magic, SHARD_MAGIC, 8) == 0 && fread(header, sizeof(header), 1, fp) == 1) {
+    p->first = header[4];
+    p->traces = header[5];
+    status = 0;
+  }
+  fclose(fp);
+
+  if (status < 0) printf("[ERROR] %s is not a checkpoint\n", p->path);
+
+  return status;
+}
+
+
+static int compare_pieces(const void* x, const void* y) {
+
+  const piece_t* a = x;
+  const piece_t* b = y;
+
+  if (a->first != b->first) return (a->first < b->first) ? -1 : 1;
+
+  return 0;
+}
+
+
+static int result_load(options_t* o, result_t* r, const char* path, int learn) {
+
+  FILE* fp = fopen(path, "rb");
+  int status;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  status = result_read(o, r, fp, learn);
+  fclose(fp);
+
+  if (status < 0) printf("[ERROR] %s is not a checkpoint of this attack\n", path);
+
+  return status;
+}
+
+
+
+/**********
+ * Report *
+ **********/
+
+
+
+static int report(const options_t* o, const result_t* r) {
+
+  monitor_t m;
+  monitor_report_t report;
+  double* t = NULL, worst = 0;
+  u64 j, column = 0, over = 0;
+  int result = -1;
+
+  if (monitor_init(&m, o->first_clock, o->last_clock, r->cpa.columns, 1, o->threads) < 0 || cpa_merge(&m.cpa, &r->cpa) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  m.margin = o->margin;
+  m.has_key = o->has_key;
+  memcpy(m.key, o->key, KEYLENGTH);
+
+  if (monitor_check(&m, &report) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  printf("\ntraces %lu from %lu: peak %.4f at clock %u, margin %.2f at clock %u", report.traces, r->first, report.peak,
+         report.peak_clock, report.margin, report.margin_clock);
+  if (isinf(report.needed)) printf(", needed -");
+  else printf(", needed %.0f", report.needed);
+  if (report.ranked) printf(", %lu/%lu first, log2 rank %.1f [%.1f, %.1f]", report.first, m.targets,
+                            report.rank.estimate, report.rank.lower, report.rank.upper);
+  printf("\n%s\n", report.success ? "success" : "no success");
+
+  if (o->has_fixed) {
+    t = malloc(r->ttest.columns * sizeof(double));
+    if (t == NULL) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+
+    ttest_welch(&r->ttest, t);
+    for (j = 0; j < r->ttest.columns; j++) {
+      if (fabs(t[j]) > fabs(worst)) {
+        worst = t[j];
+        column = j;
+      }
+      if (fabs(t[j]) > TTEST_THRESHOLD) over++;
+    }
+
+    printf("t-test: %lu fixed, %lu random, max |t| %.2f at sample %lu, %lu samples over %.1f\n", r->ttest.n[0],
+           r->ttest.n[1], fabs(worst), o->window + column, over, TTEST_THRESHOLD);
+  }
+
+  result = report.success ? 0 : 1;
+
+done:
+  monitor_free(&m);
+  free(t);
+
+  return result;
+}
+
+
+
+/***********
+ * Sockets *
+ ***********/
+
+
+
+/***
+ * open_socket
+ *
+ * host:port is tcp, anything else the path of a unix socket; listening
+ * or connected to it
+ *
+ */
+static int open_socket(const char* address, int listening) {
+
+  struct sockaddr_un local;
+  struct addrinfo hints, *list = NULL, *ai;
+  char host[256];
+  const char* colon = strrchr(address, ':');
+  int fd = -1, one = 1;
+
+  if (colon == NULL || strchr(address, '/') != NULL) {
+    if (strlen(address) >= sizeof(local.sun_path)) return -1;
+
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, address);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    if (listening) {
+      unlink(address);
+      if (bind(fd, (struct sockaddr*)&local, sizeof(local)) == 0 && listen(fd, MAX_WORKERS) == 0) return fd;
+    } else if (connect(fd, (struct sockaddr*)&local, sizeof(local)) == 0) {
+      return fd;
+    }
+    close(fd);
+    return -1;
+  }
+
+  if ((u64)(colon - address) >= sizeof(host)) return -1;
+  memcpy(host, address, colon - address);
+  host[colon - address] = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+  if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &list) != 0) return -1;
+
+  for (ai = list; ai != NULL; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) continue;
+    if (listening) {
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, MAX_WORKERS) == 0) break;
+    } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(list);
+
+  return fd;
+}
+
+
+static int connection_open(connection_t* c, int fd) {
+
+  memset(c, 0, sizeof(connection_t));
+  c->fd = fd;
+  c->in = fdopen(fd, "rb");
+  c->out = (c->in != NULL) ? fdopen(dup(fd), "wb") : NULL;
+
+  if (c->out == NULL) {
+    if (c->in != NULL) fclose(c->in);
+    else close(fd);
+    c->in = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void connection_close(connection_t* c) {
+
+  if (c->in != NULL) fclose(c->in);
+  if (c->out != NULL) fclose(c->out);
+  memset(c, 0, sizeof(connection_t));
+  c->fd = -1;
+
+  return;
+}
+
+
+
+/**********
+ * Worker *
+ **********/
+
+
+
+/***
+ * run_shard
+ *
+ * the sums of count traces from first
+ *
+ */
+static int run_shard(const options_t* o, const trace_archive_t* a, u64 first, u64 count, result_t* r) {
+
+  monitor_t m;
+  float* traces = NULL;
+  trace_info_t* info = NULL;
+  u8* ivs = NULL, *group = NULL;
+  u64 i, t, n, stride = a->format.samples;
+  int result = -1;
+
+  memset(&m, 0, sizeof(m));
+  memset(r, 0, sizeof(result_t));
+  r->first = first;
+  r->traces = count;
+
+  traces = malloc(o->batch * stride * sizeof(float));
+  info = malloc(o->batch * sizeof(trace_info_t));
+  ivs = malloc(o->batch * IVLENGTH);
+  group = malloc(o->batch);
+
+  if (traces == NULL || info == NULL || ivs == NULL || group == NULL ||
+      monitor_init(&m, o->first_clock, o->last_clock, o->samples, o->batch, o->threads) < 0 ||
+      (o->has_fixed && ttest_alloc(&r->ttest, o->samples) < 0)) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+    if (trace_archive_read(a, first + i, n, traces, info) < 0) goto done;
+
+    for (t = 0; t < n; t++) {
+      memcpy(ivs + t * IVLENGTH, info[t].iv, IVLENGTH);
+      group[t] = memcmp(info[t].iv, o->fixed, IVLENGTH) != 0;
+    }
+
+    if (monitor_add(&m, traces + o->window, stride, n, ivs) < 0 ||
+        (o->has_fixed && ttest_add(&r->ttest, traces + o->window, stride, n, group) < 0)) goto done;
+  }
+
+  // the sums move to the result
+  r->cpa = m.cpa;
+  memset(&m.cpa, 0, sizeof(cpa_t));
+  result = 0;
+
+done:
+  monitor_free(&m);
+  if (result < 0) result_free(r);
+  free(traces);
+  free(info);
+  free(ivs);
+  free(group);
+
+  return result;
+}
+
+
+/***
+ * worker
+ *
+ * serve shards until the coordinator is done
+ *
+ */
+static int worker(options_t* o, const char* address, const char* path) {
+
+  trace_archive_t a;
+  connection_t c;
+  result_t r;
+  char line[LINE_MAX_LENGTH];
+  u64 first, count;
+  int fd, result = 1;
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  if (o->samples == 0) o->samples = (a.format.samples > o->window) ? a.format.samples - o->window : 0;
+  if (o->samples == 0 || o->window + o->samples > a.format.samples) {
+    printf("[ERROR] the window must lie within the %lu samples of a trace\n", a.format.samples);
+    trace_archive_close(&a);
+    return 1;
+  }
+
+  if ((fd = open_socket(address, 0)) < 0 || connection_open(&c, fd) < 0) {
+    printf("[ERROR] could not connect to %s\n", address);
+    trace_archive_close(&a);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), c.in) != NULL) {
+    if (strcmp(line, "done\n") == 0) {
+      result = 0;
+      break;
+    }
+
+    if (sscanf(line, "shard %lu %lu", &first, &count) != 2 || first + count > a.format.traces) {
+      printf("[ERROR] no such shard: %s", line);
+      break;
+    }
+
+    if (run_shard(o, &a, first, count, &r) < 0) break;
+
+    if (result_write(o, &r, c.out) < 0) {
+      result_free(&r);
+      break;
+    }
+    result_free(&r);
+  }
+
+  connection_close(&c);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+
+/***************
+ * Coordinator *
+ ***************/
+
+
+
+typedef struct {
+  u64       start;                      // first trace of shard 0
+  u64       end;
+  u64       size;                       // traces per shard
+  u64       shards;
+  u8*       state;                      // [shards]
+  result_t* pending;                    // [shards], results ahead of the merge
+  u64       merged;                     // shards merged so far
+} schedule_t;
+
+
+/***
+ * next_shard
+ *
+ * the first shard nobody works on, unless it is too far ahead of the
+ * merge: the results waiting for the ones before stay few
+ *
+ */
+static u64 next_shard(const schedule_t* s, u64 ahead) {
+
+  u64 k, last = s->merged + ahead;
+
+  for (k = s->merged; k < s->shards && k < last; k++) {
+    if (s->state[k] == SHARD_TODO) return k;
+  }
+
+  return s->shards;
+}
+
+
+static int hand_out(const schedule_t* s, connection_t* c, u64 k) {
+
+  u64 first = s->start + k * s->size;
+  u64 count = (s->end - first < s->size) ? s->end - first : s->size;
+
+  if (fprintf(c->out, "shard %lu %lu\n", first, count) < 0 || fflush(c->out) != 0) return -1;
+
+  c->shard = k;
+  c->busy = 1;
+
+  return 0;
+}
+
+
+/***
+ * coordinate
+ *
+ * fork the local workers, serve the shards to whoever connects and merge
+ * the results in order into total
+ *
+ */
+static int coordinate(options_t* o, const char* path, result_t* total) {
+
+  connection_t c[MAX_WORKERS];
+  struct pollfd p[MAX_WORKERS + 1];
+  pid_t child[MAX_WORKERS];
+  schedule_t s;
+  result_t r;
+  char private[64];
+  const char* address = o->address;
+  u64 i, k, n, children = 0, connected, ahead;
+  double start = now();
+  int listener, fd, status, result = -1;
+
+  memset(&s, 0, sizeof(s));
+  s.start = total->first + total->traces;
+  s.end = o->first + o->traces;
+  s.size = o->shard;
+  s.shards = (s.end - s.start + s.size - 1) / s.size;
+
+  if (s.shards == 0) return 0;
+
+  s.state = calloc(s.shards, sizeof(u8));
+  s.pending = calloc(s.shards, sizeof(result_t));
+  if (s.state == NULL || s.pending == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  if (address == NULL) {
+    snprintf(private, sizeof(private), "/tmp/shard_cpa.%d.sock", (int)getpid());
+    address = private;
+  }
+
+  if ((listener = open_socket(address, 1)) < 0) {
+    printf("[ERROR] could not listen on %s\n", address);
+    goto done;
+  }
+
+  for (i = 0; i < MAX_WORKERS; i++) c[i].fd = -1;
+
+  signal(SIGPIPE, SIG_IGN);
+  fflush(stdout);
+
+  for (children = 0; children < o->workers; children++) {
+    if ((child[children] = fork()) < 0) break;
+    if (child[children] == 0) {
+      close(listener);
+      exit(worker(o, address, path));
+    }
+  }
+
+  printf("%lu shards of %lu traces from trace %lu, %lu local workers%s%s\n", s.shards, s.size, s.start, children,
+         o->address ? ", listening on " : "", o->address ? o->address : "");
+
+  while (s.merged < s.shards) {
+    for (connected = 0, i = 0; i < MAX_WORKERS; i++) connected += (c[i].fd >= 0);
+    ahead = (connected > 1) ? 2 * connected : 2;
+
+    for (i = 0; i < MAX_WORKERS; i++) {
+      if (c[i].fd < 0 || c[i].busy || (k = next_shard(&s, ahead)) == s.shards) continue;
+      if (hand_out(&s, &c[i], k) < 0) connection_close(&c[i]);
+      else s.state[k] = SHARD_RUNNING;
+    }
+
+    // local workers that are gone for good
+    for (i = 0; i < children; i++) {
+      if (child[i] > 0 && waitpid(child[i], &status, WNOHANG) == child[i]) child[i] = 0;
+    }
+    for (n = 0, i = 0; i < children; i++) n += (child[i] > 0);
+    if (n == 0 && connected == 0 && o->address == NULL) {
+      printf("[ERROR] no workers left\n");
+      goto stop;
+    }
+
+    p[0].fd = listener;
+    p[0].events = POLLIN;
+    for (i = 0; i < MAX_WORKERS; i++) {
+      p[i + 1].fd = c[i].fd;
+      p[i + 1].events = POLLIN;
+      p[i + 1].revents = 0;
+    }
+
+    if (poll(p, MAX_WORKERS + 1, 1000) <= 0) continue;
+
+    if (p[0].revents & POLLIN) {
+      fd = accept(listener, NULL, NULL);
+      for (i = 0; i < MAX_WORKERS && c[i].fd >= 0; i++);
+      if (fd >= 0 && (i == MAX_WORKERS || connection_open(&c[i], fd) < 0)) close(fd);
+    }
+
+    for (i = 0; i < MAX_WORKERS; i++) {
+      if (c[i].fd < 0 || !(p[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+      if (!c[i].busy || result_read(o, &r, c[i].in, 0) < 0) {
+        if (c[i].busy) {
+          printf("lost the worker of shard %lu, handed out again\n", c[i].shard);
+          s.state[c[i].shard] = SHARD_TODO;
+        }
+        connection_close(&c[i]);
+        continue;
+      }
+
+      s.pending[c[i].shard] = r;
+      s.state[c[i].shard] = SHARD_DONE;
+      c[i].busy = 0;
+    }
+
+    // strictly in shard order
+    while (s.merged < s.shards && s.state[s.merged] == SHARD_DONE) {
+      if (total->cpa.sum_h == NULL) {
+        *total = s.pending[s.merged];
+        memset(&s.pending[s.merged], 0, sizeof(result_t));
+      } else {
+        if (result_merge(o, total, &s.pending[s.merged]) < 0) {
+          printf("[ERROR] shard %lu does not match\n", s.merged);
+          goto stop;
+        }
+        result_free(&s.pending[s.merged]);
+      }
+      s.merged++;
+
+      printf("shard %6lu/%-6lu  traces %10lu  %8.1f s\n", s.merged, s.shards, total->traces, now() - start);
+      fflush(stdout);
+
+      if (o->checkpoint != NULL && result_save(o, total, o->checkpoint) < 0) goto stop;
+    }
+  }
+
+  result = 0;
+
+stop:
+  for (i = 0; i < MAX_WORKERS; i++) {
+    if (c[i].fd < 0) continue;
+    fprintf(c[i].out, "done\n");
+    connection_close(&c[i]);
+  }
+
+  close(listener);
+  if (address == private) unlink(private);
+
+  for (i = 0; i < children; i++) {
+    if (child[i] > 0) {
+      if (result < 0) kill(child[i], SIGTERM);
+      waitpid(child[i], &status, 0);
+    }
+  }
+
+done:
+  if (s.pending != NULL) {
+    for (k = 0; k < s.shards; k++) result_free(&s.pending[k]);
+  }
+  free(s.pending);
+  free(s.state);
+
+  return result;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static int run(options_t* o, const char* path) {
+
+  trace_archive_t a;
+  trace_format_t format;
+  result_t total;
+  int result = 2;
+
+  memset(&total, 0, sizeof(total));
+
+  if (trace_archive_open(&a, path, 1) < 0) return 2;
+  format = a.format;
+  trace_archive_close(&a);
+
+  if (o->samples == 0) o->samples = (format.samples > o->window) ? format.samples - o->window : 0;
+  if (o->traces == 0) o->traces = (format.traces > o->first) ? format.traces - o->first : 0;
+
+  if (o->samples == 0 || o->window + o->samples > format.samples) {
+    printf("[ERROR] the window must lie within the %lu samples of a trace\n", format.samples);
+    return 2;
+  }
+
+  if (o->traces == 0 || o->first + o->traces > format.traces) {
+    printf("[ERROR] the archive has %lu traces\n", format.traces);
+    return 2;
+  }
+
+  total.first = o->first;
+
+  if (o->checkpoint != NULL && access(o->checkpoint, F_OK) == 0) {
+    if (result_load(o, &total, o->checkpoint, 0) < 0) return 2;
+    if (total.first != o->first || total.traces > o->traces) {
+      printf("[ERROR] %s is of other traces\n", o->checkpoint);
+      goto done;
+    }
+    printf("resuming after %lu traces of %s\n", total.traces, o->checkpoint);
+  }
+
+  if (coordinate(o, path, &total) == 0) result = report(o, &total);
+
+done:
+  result_free(&total);
+
+  return result;
+}
+
+
+/***
+ * merge
+ *
+ * the checkpoints in the order of their traces, which must follow on
+ * from each other without a gap or an overlap
+ *
+ */
+static int merge(options_t* o, const char* out, char** paths, u64 count) {
+
+  result_t total, r;
+  piece_t* piece = malloc(count * sizeof(piece_t));
+  u64 i;
+  int result = 2;
+
+  memset(&total, 0, sizeof(total));
+
+  if (piece == NULL) {
+    printf("[ERROR] out of memory\n");
+    return 2;
+  }
+
+  for (i = 0; i < count; i++) {
+    piece[i].path = paths[i];
+    if (result_range(&piece[i]) < 0) goto done;
+  }
+
+  qsort(piece, count, sizeof(piece_t), compare_pieces);
+
+  for (i = 1; i < count; i++) {
+    if (piece[i].first != piece[i - 1].first + piece[i - 1].traces) {
+      printf("[ERROR] %s (traces %lu to %lu) does not follow on %s (traces %lu to %lu)\n", piece[i].path,
+             piece[i].first, piece[i].first + piece[i].traces, piece[i - 1].path, piece[i - 1].first,
+             piece[i - 1].first + piece[i - 1].traces);
+      goto done;
+    }
+  }
+
+  if (result_load(o, &total, piece[0].path, 1) < 0) goto done;
+
+  for (i = 1; i < count; i++) {
+    if (result_load(o, &r, piece[i].path, 0) < 0) goto done;
+    if (r.first != total.first + total.traces || result_merge(o, &total, &r) < 0) {
+      printf("[ERROR] %s does not match %s\n", piece[i].path, piece[0].path);
+      result_free(&r);
+      goto done;
+    }
+    result_free(&r);
+  }
+
+  if (result_save(o, &total, out) == 0) result = report(o, &total);
+
+done:
+  result_free(&total);
+  free(piece);
+
+  return result;
+}
+
+
+static void usage(const char* name) {
+
+  int w = (int)strlen(name);
+
+  printf("usage: %s [-c first:last] [-w first:count] [-r first:count] [-s traces] [-b traces]\n"
+         "       %*s [-j workers] [-a address] [-C checkpoint] [-F iv] [-k key] [-m sigmas]\n"
+         "       %*s [-t threads] archive\n"
+         "       %s -W address [-b traces] [-t threads] archive\n"
+         "       %s -M out [-k key] [-m sigmas] checkpoint...\n", name, w, "", w, "", name, name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  const char* serve = NULL, *out = NULL;
+  u64 a, b, cpus = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.last_clock = TARGET_CLOCKS - 1;
+  o.shard = 16384;
+  o.batch = 4096;
+  o.workers = cpus;
+  o.margin = 5;
+
+  while ((option = getopt(argc, argv, "c:w:r:s:b:j:a:C:F:k:m:t:W:M:")) != -1) {
+    switch (option) {
+    case 's': o.shard      = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch      = strtoul(optarg, NULL, 10);  break;
+    case 'j': o.workers    = strtoul(optarg, NULL, 10);  break;
+    case 'a': o.address    = optarg;                     break;
+    case 'C': o.checkpoint = optarg;                     break;
+    case 'm': o.margin     = atof(optarg);               break;
+    case 't': o.threads    = strtoul(optarg, NULL, 10);  break;
+    case 'W': serve        = optarg;                     break;
+    case 'M': out          = optarg;                     break;
+    case 'c':
+      if (parse_range(optarg, &a, &b) < 0 || a > b || b >= TARGET_CLOCKS) {
+        printf("[ERROR] clocks must be within 0:%d\n", TARGET_CLOCKS - 1);
+        return 2;
+      }
+      o.first_clock = (u32)a;
+      o.last_clock = (u32)b;
+      break;
+    case 'w':
+      if (parse_range(optarg, &o.window, &o.samples) < 0 || o.samples == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'r':
+      if (parse_range(optarg, &o.first, &o.traces) < 0 || o.traces == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'F':
+      if (strlen(optarg) != 2 * IVLENGTH || parse_bytes(optarg, o.fixed, IVLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_fixed = 1;
+      break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (o.threads == 0) o.threads = (serve != NULL || o.workers == 0) ? cpus : (cpus > o.workers ? cpus / o.workers : 1);
+
+  if (out != NULL) {
+    if (optind >= argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    return merge(&o, out, argv + optind, (u64)(argc - optind));
+  }
+
+  if (optind != argc - 1 || o.shard == 0 || o.batch == 0 || o.workers > MAX_WORKERS ||
+      (o.workers == 0 && o.address == NULL && serve == NULL)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (serve != NULL) return worker(&o, serve, argv[optind]);
+
+  return run(&o, argv[optind]);
+}
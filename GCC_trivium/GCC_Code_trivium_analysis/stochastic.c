@@ -0,0 +1,412 @@
+/*
+ * stochastic.c
+ *
+ * linear regression leakage model on the state bits (see stochastic.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "stochastic.h"
+
+#define STOCHASTIC_MAGIC "TRVSTOC1"
+
+// added to the diagonal of the bit covariance (a bit varies by at most 1/4)
+#define RIDGE 1e-6
+
+// samples per work item of the solver
+#define SOLVE_BLOCK 64
+
+
+typedef struct {
+  stochastic_t* s;
+  const double* chol;
+  const double* mean;                   // of the bits
+  u64           next;                   // next block of samples, shared
+} solve_job_t;
+
+
+
+/**************
+ * Regressors *
+ **************/
+
+
+
+/***
+ * stochastic_bits
+ *
+ * the regressors of one trace: the state bits before a clock, in the
+ * order of trivium_word_bits(), then t1, t2 and t3 of that clock
+ *
+ */
+void stochastic_bits(u32 clock, const u8* key, const u8* iv, u8* bits) {
+
+  trivium_word_t w;
+
+  trivium_word_load(&w, key, iv);
+  trivium_word_rounds(&w, clock);
+  trivium_word_bits(&w, bits);
+
+  bits[STOCHASTIC_T1] = bits[65]  ^ bits[92]  ^ (bits[90]  & bits[91])  ^ bits[170];
+  bits[STOCHASTIC_T2] = bits[161] ^ bits[176] ^ (bits[174] & bits[175]) ^ bits[263];
+  bits[STOCHASTIC_T3] = bits[242] ^ bits[287] ^ (bits[285] & bits[286]) ^ bits[68];
+
+  return;
+}
+
+
+/***
+ * stochastic_known
+ *
+ * the regressors that do not depend on the key, found by clocking which
+ * state bits any key bit has reached. Their values are those of
+ * stochastic_bits() with any key, e.g. all zero.
+ *
+ */
+void stochastic_known(u32 clock, u8* known) {
+
+  u8 dep[STATEBITS], t1, t2, t3;
+  u32 c;
+  int i;
+
+  memset(dep, 0, sizeof(dep));
+  memset(dep, 1, 8 * KEYLENGTH);
+
+  for (c = 0; c <= clock; c++) {
+    t1 = dep[65]  | dep[92]  | dep[90]  | dep[91]  | dep[170];
+    t2 = dep[161] | dep[176] | dep[174] | dep[175] | dep[263];
+    t3 = dep[242] | dep[287] | dep[285] | dep[286] | dep[68];
+
+    if (c == clock) break;
+
+    for (i = ALEN - 1; i > 0; i--) dep[i] = dep[i - 1];
+    for (i = ALEN + BLEN - 1; i > ALEN; i--) dep[i] = dep[i - 1];
+    for (i = STATEBITS - 1; i > ALEN + BLEN; i--) dep[i] = dep[i - 1];
+
+    dep[0] = t3;
+    dep[ALEN] = t1;
+    dep[ALEN + BLEN] = t2;
+  }
+
+  for (i = 0; i < STATEBITS; i++) known[i] = !dep[i];
+
+  known[STOCHASTIC_T1] = !t1;
+  known[STOCHASTIC_T2] = !t2;
+  known[STOCHASTIC_T3] = !t3;
+
+  return;
+}
+
+
+void stochastic_name(u64 regressor, char* name, u64 length) {
+
+  if (regressor < STATEBITS) {
+    snprintf(name, length, "s%lu", regressor + 1);
+  } else {
+    snprintf(name, length, "t%lu", regressor - STATEBITS + 1);
+  }
+
+  return;
+}
+
+
+
+/*************
+ * Profiling *
+ *************/
+
+
+
+int stochastic_alloc(stochastic_t* s, u32 clock, u64 samples, u64 threads) {
+
+  memset(s, 0, sizeof(stochastic_t));
+
+  s->clock   = clock;
+  s->samples = samples;
+  s->threads = (threads == 0) ? 1 : (threads > STOCHASTIC_MAX_THREADS ? STOCHASTIC_MAX_THREADS : threads);
+  s->gram    = calloc(STOCHASTIC_REGRESSORS * STOCHASTIC_REGRESSORS, sizeof(u64));
+  s->weight  = calloc(samples * (STOCHASTIC_REGRESSORS + 1), sizeof(double));
+  s->r2      = calloc(samples, sizeof(double));
+
+  if (s->gram == NULL || s->weight == NULL || s->r2 == NULL ||
+      cpa_alloc(&s->sums, STOCHASTIC_REGRESSORS, samples, s->threads) < 0) {
+    stochastic_free(s);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void stochastic_free(stochastic_t* s) {
+
+  cpa_free(&s->sums);
+  free(s->gram);
+  free(s->weight);
+  free(s->r2);
+  memset(s, 0, sizeof(stochastic_t));
+
+  return;
+}
+
+
+/***
+ * stochastic_add
+ *
+ * count traces, stride floats apart, with their regressors
+ * bits[t * STOCHASTIC_REGRESSORS + i]
+ *
+ */
+int stochastic_add(stochastic_t* s, const float* traces, u64 stride, u64 count, const u8* bits) {
+
+  const u64 P = STOCHASTIC_REGRESSORS;
+  u64 words = (count + 63) / 64, t, i, k, w, sum;
+  float* h = malloc(count * P * sizeof(float));
+  u64* packed = calloc(P * words, sizeof(u64));
+  int result = -1;
+
+  if (h == NULL || packed == NULL) goto done;
+
+  for (t = 0; t < count; t++) {
+    for (i = 0; i < P; i++) {
+      h[t * P + i] = (float)bits[t * P + i];
+      packed[i * words + t / 64] |= (u64)(bits[t * P + i] & 0x01) << (t % 64);
+    }
+  }
+
+  if (cpa_add(&s->sums, traces, stride, count, h, NULL, NULL) < 0) goto done;
+
+  for (i = 0; i < P; i++) {
+    for (k = i; k < P; k++) {
+      for (sum = 0, w = 0; w < words; w++) sum += (u64)__builtin_popcountll(packed[i * words + w] & packed[k * words + w]);
+      s->gram[i * P + k] += sum;
+    }
+  }
+
+  s->traces += count;
+  result = 0;
+
+done:
+  free(h);
+  free(packed);
+
+  return result;
+}
+
+
+/***
+ * solve_worker
+ *
+ * the weights of blocks of samples: the covariance of every bit with the
+ * sample, through the factor of the bit covariance
+ *
+ */
+static void* solve_worker(void* arg) {
+
+  solve_job_t* job = arg;
+  stochastic_t* s = job->s;
+  const u64 P = STOCHASTIC_REGRESSORS;
+  double n = (double)s->traces, c[STOCHASTIC_REGRESSORS], y[STOCHASTIC_REGRESSORS], mx, var, v, explained;
+  u64 block, j, jn, i, k;
+
+  while ((block = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) * SOLVE_BLOCK < s->samples) {
+    jn = (s->samples - block * SOLVE_BLOCK < SOLVE_BLOCK) ? s->samples : (block + 1) * SOLVE_BLOCK;
+
+    for (j = block * SOLVE_BLOCK; j < jn; j++) {
+      double* w = s->weight + j * (P + 1);
+
+      mx  = s->sums.sum_x[j] / n;
+      var = s->sums.sum_xx[j] / n - mx * mx;
+
+      for (i = 0; i < P; i++) c[i] = s->sums.sum_hx[i * s->samples + j] / n - job->mean[i] * mx;
+
+      // L y = c, then L^T w = y
+      for (i = 0; i < P; i++) {
+        v = c[i];
+        for (k = 0; k < i; k++) v -= job->chol[i * P + k] * y[k];
+        y[i] = v / job->chol[i * P + i];
+      }
+
+      for (i = P; i-- > 0;) {
+        v = y[i];
+        for (k = i + 1; k < P; k++) v -= job->chol[k * P + i] * w[k];
+        w[i] = v / job->chol[i * P + i];
+      }
+
+      // the sums of x are about the engine's reference
+      w[P] = mx + s->sums.ref_x[j];
+      explained = 0;
+      for (i = 0; i < P; i++) {
+        w[P] -= w[i] * job->mean[i];
+        explained += w[i] * c[i];
+      }
+
+      s->r2[j] = (var > 0) ? explained / var : 0.0;
+    }
+  }
+
+  return NULL;
+}
+
+
+/***
+ * stochastic_solve
+ *
+ * the weights and explained variance of every sample from the traces
+ * added so far
+ *
+ */
+int stochastic_solve(stochastic_t* s) {
+
+  const u64 P = STOCHASTIC_REGRESSORS;
+  pthread_t thread[STOCHASTIC_MAX_THREADS];
+  double n = (double)s->traces, *cov = malloc(P * P * sizeof(double));
+  double *chol = calloc(P * P, sizeof(double)), *mean = malloc(P * sizeof(double)), v;
+  solve_job_t job;
+  u64 i, j, k, threads;
+  int result = -1;
+
+  if (cov == NULL || chol == NULL || mean == NULL || s->traces < 2) goto done;
+
+  for (i = 0; i < P; i++) mean[i] = s->sums.sum_h[i] / n;
+
+  for (i = 0; i < P; i++) {
+    for (j = i; j < P; j++) cov[i * P + j] = cov[j * P + i] = (double)s->gram[i * P + j] / n - mean[i] * mean[j];
+    cov[i * P + i] += RIDGE;
+  }
+
+  // cov = L L^T
+  for (j = 0; j < P; j++) {
+    v = cov[j * P + j];
+    for (k = 0; k < j; k++) v -= chol[j * P + k] * chol[j * P + k];
+    if (!(v > 0)) goto done;
+    chol[j * P + j] = sqrt(v);
+
+    for (i = j + 1; i < P; i++) {
+      v = cov[i * P + j];
+      for (k = 0; k < j; k++) v -= chol[i * P + k] * chol[j * P + k];
+      chol[i * P + j] = v / chol[j * P + j];
+    }
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.s    = s;
+  job.chol = chol;
+  job.mean = mean;
+
+  threads = (s->samples + SOLVE_BLOCK - 1) / SOLVE_BLOCK;
+  if (threads > s->threads) threads = s->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, solve_worker, &job) != 0) break;
+  }
+
+  if (i == 0) solve_worker(&job);
+  threads = i;
+
+  for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+
+  result = 0;
+
+done:
+  free(cov);
+  free(chol);
+  free(mean);
+
+  return result;
+}
+
+
+
+/***********
+ * Storage *
+ ***********/
+
+
+
+/***
+ * stochastic_save
+ *
+ * the solved model: clock, window, weights and explained variance
+ *
+ */
+int stochastic_save(const stochastic_t* s, const char* path) {
+
+  FILE* fp = fopen(path, "wb");
+  u64 header[5] = { s->clock, STOCHASTIC_REGRESSORS, s->window, s->samples, s->traces };
+  u64 values = s->samples * (STOCHASTIC_REGRESSORS + 1);
+  int ok;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not create %s\n", path);
+    return -1;
+  }
+
+  ok = fwrite(STOCHASTIC_MAGIC, 8, 1, fp) == 1 &&
+       fwrite(header, sizeof(header), 1, fp) == 1 &&
+       fwrite(s->weight, sizeof(double), values, fp) == values &&
+       fwrite(s->r2, sizeof(double), s->samples, fp) == s->samples;
+
+  if (fclose(fp) != 0) ok = 0;
+  if (!ok) printf("[ERROR] could not write %s\n", path);
+
+  return ok ? 0 : -1;
+}
+
+
+/***
+ * stochastic_load
+ *
+ * a saved model, without the sums it was solved from
+ *
+ */
+int stochastic_load(stochastic_t* s, const char* path) {
+
+  FILE* fp = fopen(path, "rb");
+  char magic[8];
+  u64 header[5], values;
+  int ok;
+
+  memset(s, 0, sizeof(stochastic_t));
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, STOCHASTIC_MAGIC, 8) != 0 ||
+      fread(header, sizeof(header), 1, fp) != 1 || header[1] != STOCHASTIC_REGRESSORS || header[3] == 0) {
+    printf("[ERROR] %s is not a leakage model\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  s->clock   = (u32)header[0];
+  s->window  = header[2];
+  s->samples = header[3];
+  s->traces  = header[4];
+  s->threads = 1;
+  values     = s->samples * (STOCHASTIC_REGRESSORS + 1);
+  s->weight  = malloc(values * sizeof(double));
+  s->r2      = malloc(s->samples * sizeof(double));
+
+  ok = s->weight != NULL && s->r2 != NULL &&
+       fread(s->weight, sizeof(double), values, fp) == values &&
+       fread(s->r2, sizeof(double), s->samples, fp) == s->samples;
+
+  fclose(fp);
+
+  if (!ok) {
+    printf("[ERROR] %s is truncated\n", path);
+    stochastic_free(s);
+    return -1;
+  }
+
+  return 0;
+}
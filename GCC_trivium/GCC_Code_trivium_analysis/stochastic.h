@@ -0,0 +1,66 @@
+/*
+ * stochastic.h
+ *
+ * linear regression leakage model (stochastic model) on the state bits
+ *
+ * every sample is regressed on the 288 state bits before a profiled
+ * clock and that clock's t1, t2 and t3, with random keys and ivs:
+ *
+ *   x_j = w_j0 + sum_i w_ji b_i + noise
+ *
+ * the normal equations are accumulated online: the cross sums of bits
+ * and samples are the sums of the correlation engine (cpa.h, the bits
+ * as its hypotheses) and the gram matrix of the bits is counted with
+ * popcounts over bit packed batches. stochastic_solve() centers them,
+ * factors the bit covariance once (with a small ridge, so that bits
+ * that never change get no weight) and solves for every sample on the
+ * worker threads.
+ *
+ * the weights show which bits the device leaks where; an attack
+ * subtracts the part of every sample that it can predict without the
+ * key (stochastic_known()) before correlating, which removes that part
+ * of the algorithmic noise.
+ *
+ */
+
+#ifndef STOCHASTIC_H
+#define STOCHASTIC_H
+
+#include "trivium.h"
+#include "cpa.h"
+
+#define STOCHASTIC_T1          STATEBITS
+#define STOCHASTIC_T2          (STATEBITS + 1)
+#define STOCHASTIC_T3          (STATEBITS + 2)
+#define STOCHASTIC_REGRESSORS  (STATEBITS + 3)
+
+#define STOCHASTIC_MAX_THREADS 256
+
+
+typedef struct {
+  u32     clock;                        // profiled clock
+  u64     samples;
+  u64     window;                       // first sample, for the caller
+  u64     traces;
+  u64     threads;
+  cpa_t   sums;                         // bits and samples
+  u64*    gram;                         // [regressors][regressors]
+  double* weight;                       // [samples][regressors + 1], intercept last
+  double* r2;                           // [samples], explained variance
+} stochastic_t;
+
+
+void stochastic_bits(u32 clock, const u8* key, const u8* iv, u8* bits);
+void stochastic_known(u32 clock, u8* known);
+void stochastic_name(u64 regressor, char* name, u64 length);
+
+int  stochastic_alloc(stochastic_t* s, u32 clock, u64 samples, u64 threads);
+void stochastic_free(stochastic_t* s);
+
+int  stochastic_add(stochastic_t* s, const float* traces, u64 stride, u64 count, const u8* bits);
+int  stochastic_solve(stochastic_t* s);
+
+int  stochastic_save(const stochastic_t* s, const char* path);
+int  stochastic_load(stochastic_t* s, const char* path);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * targets.c
+ *
+ * intermediate values of the first clocks (see targets.h)
+ *
+ */
+
+#include <string.h>
+
+#include "targets.h"
+
+static const char* target_names[TARGET_KINDS] = { "t1", "t2", "t3", "and1", "and2", "and3" };
+
+// number of taps, the and term first, then the linear taps as in update()
+static const u32 target_taps[TARGET_KINDS][TARGET_TAPS + 1] = {
+  { 5, 90,  91,  65,  92,  170 },
+  { 5, 174, 175, 161, 176, 263 },
+  { 5, 285, 286, 242, 287, 68  },
+  { 2, 90,  91 },
+  { 2, 174, 175 },
+  { 2, 285, 286 }
+};
+
+
+const char* target_name(u32 kind) {
+  return kind < TARGET_KINDS ? target_names[kind] : "unknown";
+}
+
+
+int target_parse(const char* name, u32* kind) {
+
+  u32 i;
+
+  for (i = 0; i < TARGET_KINDS; i++) {
+    if (strcmp(name, target_names[i]) == 0) {
+      *kind = i;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+/***
+ * resolve
+ *
+ * what setup() loaded into the bit that sits in index i after c clocks
+ *
+ */
+static void resolve(target_t* t, u32 i, u32 c) {
+
+  u32 k = t->taps++, o = i - c, g;
+
+  if (o < 80) {
+    // the same key bit may be tapped twice
+    for (g = 0; g < t->guess_bits && t->key[g] != o; g++);
+    if (g == t->guess_bits) t->key[t->guess_bits++] = o;
+
+    t->tap[k] = TAP_KEY;
+    t->index[k] = g;
+  } else if (o >= 93 && o < 93 + 8 * IVLENGTH) {
+    t->tap[k] = TAP_IV;
+    t->index[k] = o - 93;
+  } else {
+    t->tap[k] = (o >= 285) ? TAP_ONE : TAP_ZERO;
+    t->index[k] = 0;
+  }
+
+  return;
+}
+
+
+/***
+ * target_init
+ *
+ * the target of the given kind before the given clock (< TARGET_CLOCKS)
+ *
+ */
+void target_init(target_t* t, u32 kind, u32 clock) {
+
+  u32 i;
+
+  memset(t, 0, sizeof(target_t));
+  t->kind = kind;
+  t->clock = clock;
+
+  for (i = 1; i <= target_taps[kind][0]; i++) resolve(t, target_taps[kind][i], clock);
+
+  return;
+}
+
+
+/***
+ * target_iv_bits
+ *
+ * the iv taps of a target for an iv (file order), bit k for tap k
+ *
+ */
+u32 target_iv_bits(const target_t* t, const u8* iv) {
+
+  u32 k, j, bits = 0;
+
+  for (k = 0; k < t->taps; k++) {
+    if (t->tap[k] != TAP_IV) continue;
+    j = t->index[k];
+    bits |= (u32)((iv[IVLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << k;
+  }
+
+  return bits;
+}
+
+
+static inline u8 tap_value(const target_t* t, u32 k, u32 iv_bits, u64 guess) {
+
+  switch (t->tap[k]) {
+  case TAP_ONE: return 1;
+  case TAP_KEY: return (u8)((guess >> t->index[k]) & 0x01);
+  case TAP_IV:  return (u8)((iv_bits >> k) & 0x01);
+  default:      return 0;
+  }
+}
+
+
+/***
+ * target_value
+ *
+ * the target's value for the iv taps of target_iv_bits() and a guess,
+ * guess bit g being key bit t->key[g]
+ *
+ */
+u8 target_value(const target_t* t, u32 iv_bits, u64 guess) {
+
+  u8 v = tap_value(t, 0, iv_bits, guess) & tap_value(t, 1, iv_bits, guess);
+  u32 k;
+
+  for (k = 2; k < t->taps; k++) v ^= tap_value(t, k, iv_bits, guess);
+
+  return v;
+}
+
+
+u8 target_predict(const target_t* t, const u8* iv, u64 guess) {
+  return target_value(t, target_iv_bits(t, iv), guess);
+}
+
+
+/***
+ * target_masks
+ *
+ * the value of every guess (bit g of the mask) for every value of the iv
+ * taps, so that predicting all guesses for a trace is one lookup
+ *
+ */
+void target_masks(const target_t* t, u16* mask) {
+
+  u32 p;
+  u64 g;
+
+  for (p = 0; p < (1u << TARGET_TAPS); p++) {
+    mask[p] = 0;
+    for (g = 0; g < ((u64)1 << t->guess_bits); g++) mask[p] |= (u16)(target_value(t, p, g) << g);
+  }
+
+  return;
+}
+
+
+/***
+ * target_depends_on_iv
+ *
+ * without an iv tap a target has the same value in every trace
+ *
+ */
+int target_depends_on_iv(const target_t* t) {
+
+  u32 k;
+
+  for (k = 0; k < t->taps; k++) {
+    if (t->tap[k] == TAP_IV) return 1;
+  }
+
+  return 0;
+}
+
+
+/***
+ * target_guess
+ *
+ * the guess a key (file order) corresponds to
+ *
+ */
+u64 target_guess(const target_t* t, const u8* key) {
+
+  u64 guess = 0;
+  u32 g, j;
+
+  for (g = 0; g < t->guess_bits; g++) {
+    j = t->key[g];
+    guess |= (u64)((key[KEYLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << g;
+  }
+
+  return guess;
+}
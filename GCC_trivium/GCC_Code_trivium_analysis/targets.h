@@ -0,0 +1,79 @@
+/*
+ * targets.h
+ *
+ * intermediate values of the first clocks that the attacks predict
+ *
+ * state indexes are from zero as in update(): key bit j sits in index j,
+ * iv bit j in index 93 + j. For the first TARGET_CLOCKS clocks every tap
+ * of update() still holds a bit that setup() loaded, shifted along its
+ * register, so each target is a fixed quadratic function of a handful of
+ * key bits (the guess) and of the known iv:
+ *
+ *   t1    s65 ^ s92 ^ s90 & s91 ^ s170     (the bit entering s93)
+ *   t2    s161 ^ s176 ^ s174 & s175 ^ s263
+ *   t3    s242 ^ s287 ^ s285 & s286 ^ s68
+ *   and1  s90 & s91                        (the and terms alone)
+ *   and2  s174 & s175
+ *   and3  s285 & s286
+ *
+ * all of them before clock c is executed (c = 0 is right after setup()).
+ *
+ */
+
+#ifndef TARGETS_H
+#define TARGETS_H
+
+#include "trivium.h"
+
+#define TARGET_CLOCKS  66
+#define TARGET_TAPS    5
+#define TARGET_GUESS   4               // key bits a target depends on at most
+
+enum {
+  TARGET_T1 = 0,
+  TARGET_T2,
+  TARGET_T3,
+  TARGET_AND1,
+  TARGET_AND2,
+  TARGET_AND3,
+  TARGET_KINDS
+};
+
+enum {
+  TAP_ZERO = 0,
+  TAP_ONE,
+  TAP_KEY,
+  TAP_IV
+};
+
+
+/***
+ * target_t
+ *
+ * taps[0] & taps[1] ^ taps[2] ^ ..., each tap resolved to what setup()
+ * put there
+ *
+ */
+typedef struct {
+  u32  kind;
+  u32  clock;
+  u32  taps;
+  u32  tap[TARGET_TAPS];                // TAP_*
+  u32  index[TARGET_TAPS];              // key bit, iv bit or guess bit
+  u32  guess_bits;
+  u32  key[TARGET_GUESS];               // key bit of every guess bit
+} target_t;
+
+
+const char* target_name(u32 kind);
+int  target_parse(const char* name, u32* kind);
+
+void target_init(target_t* t, u32 kind, u32 clock);
+u32  target_iv_bits(const target_t* t, const u8* iv);
+u8   target_value(const target_t* t, u32 iv_bits, u64 guess);
+u8   target_predict(const target_t* t, const u8* iv, u64 guess);
+void target_masks(const target_t* t, u16* mask);
+int  target_depends_on_iv(const target_t* t);
+u64  target_guess(const target_t* t, const u8* key);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * template.c
+ *
+ * gaussian templates with a pooled covariance (see template.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "template.h"
+
+#define TEMPLATE_MAGIC "TRVTMPL1"
+#define SCATTER_BLOCK  256
+
+
+typedef struct {
+  template_t*  t;
+  const float* x;
+  u64          stride;
+  u64          count;
+  u64          next;                    // next block of traces, shared
+  pthread_mutex_t lock;
+} scatter_job_t;
+
+
+int template_alloc(template_t* t, u64 classes, u64 pois, u64 threads) {
+
+  memset(t, 0, sizeof(template_t));
+
+  if (classes < 2 || classes > TEMPLATE_MAX_CLASSES || pois == 0 || pois > TEMPLATE_MAX_POIS) return -1;
+
+  t->classes   = classes;
+  t->pois      = pois;
+  t->threads   = (threads == 0) ? 1 : (threads > TEMPLATE_MAX_THREADS ? TEMPLATE_MAX_THREADS : threads);
+  t->reference = calloc(pois, sizeof(double));
+  t->count     = calloc(classes, sizeof(u64));
+  t->sum       = calloc(classes * pois, sizeof(double));
+  t->scatter   = calloc(pois * pois, sizeof(double));
+
+  if (t->reference == NULL || t->count == NULL || t->sum == NULL || t->scatter == NULL) {
+    template_free(t);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void template_free(template_t* t) {
+
+  free(t->reference);
+  free(t->count);
+  free(t->sum);
+  free(t->scatter);
+  free(t->chol);
+  free(t->white);
+  memset(t, 0, sizeof(template_t));
+
+  return;
+}
+
+
+
+/*************
+ * Profiling *
+ *************/
+
+
+
+/***
+ * scatter_worker
+ *
+ * upper triangle of the sum of d d^T, d = x - reference, over blocks of
+ * traces, in a private matrix merged at the end
+ *
+ */
+static void* scatter_worker(void* arg) {
+
+  scatter_job_t* job = arg;
+  template_t* t = job->t;
+  u64 P = t->pois, block, i, j, n;
+  double* s = calloc(P * P, sizeof(double));
+  double d[TEMPLATE_MAX_POIS];
+
+  if (s == NULL) return (void*)1;
+
+  while ((block = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) * SCATTER_BLOCK < job->count) {
+    for (n = block * SCATTER_BLOCK; n < job->count && n < (block + 1) * SCATTER_BLOCK; n++) {
+      const float* x = job->x + n * job->stride;
+
+      for (i = 0; i < P; i++) d[i] = x[i] - t->reference[i];
+
+      for (i = 0; i < P; i++) {
+        double* row = s + i * P;
+        for (j = i; j < P; j++) row[j] += d[i] * d[j];
+      }
+    }
+  }
+
+  pthread_mutex_lock(&job->lock);
+  for (i = 0; i < P; i++) {
+    for (j = i; j < P; j++) t->scatter[i * P + j] += s[i * P + j];
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  free(s);
+
+  return NULL;
+}
+
+
+/***
+ * template_add
+ *
+ * count profiling traces of pois values each, stride floats apart, and
+ * their classes
+ *
+ */
+int template_add(template_t* t, const float* x, u64 stride, const u32* classes, u64 count) {
+
+  pthread_t thread[TEMPLATE_MAX_THREADS];
+  scatter_job_t job;
+  u64 i, n, threads, blocks = (count + SCATTER_BLOCK - 1) / SCATTER_BLOCK;
+  void* failed;
+  int result = 0;
+
+  if (count == 0) return 0;
+
+  for (n = 0; n < count; n++) {
+    if (classes[n] >= t->classes) return -1;
+  }
+
+  if (!t->referenced) {
+    for (i = 0; i < t->pois; i++) t->reference[i] = x[i];
+    t->referenced = 1;
+  }
+
+  for (n = 0; n < count; n++) {
+    double* sum = t->sum + (u64)classes[n] * t->pois;
+    const float* v = x + n * stride;
+
+    for (i = 0; i < t->pois; i++) sum[i] += v[i] - t->reference[i];
+    t->count[classes[n]]++;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.t      = t;
+  job.x      = x;
+  job.stride = stride;
+  job.count  = count;
+  pthread_mutex_init(&job.lock, NULL);
+
+  threads = (blocks < t->threads) ? blocks : t->threads;
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&thread[i], NULL, scatter_worker, &job) != 0) break;
+  }
+
+  if (i == 0 && scatter_worker(&job) != NULL) result = -1;
+  threads = i;
+
+  for (i = 0; i < threads; i++) {
+    pthread_join(thread[i], &failed);
+    if (failed != NULL) result = -1;
+  }
+
+  pthread_mutex_destroy(&job.lock);
+  t->traces += count;
+
+  return result;
+}
+
+
+/***
+ * template_finish
+ *
+ * class means and the Cholesky factor of the pooled covariance; fails if
+ * a class has no trace or the covariance is not positive definite (too
+ * few traces, or two points of interest that always move together)
+ *
+ */
+int template_finish(template_t* t) {
+
+  u64 P = t->pois, K = t->classes, i, j, k;
+  double *cov = malloc(P * P * sizeof(double)), *m = malloc(P * sizeof(double)), v;
+  int result = -1;
+
+  free(t->chol);
+  free(t->white);
+  t->chol  = calloc(P * P, sizeof(double));
+  t->white = malloc(P * K * sizeof(float));
+
+  if (cov == NULL || m == NULL || t->chol == NULL || t->white == NULL || t->traces <= K) goto done;
+
+  for (k = 0; k < K; k++) {
+    if (t->count[k] == 0) goto done;
+  }
+
+  // within class scatter: the scatter about the reference less the class
+  // means' part of it
+  for (i = 0; i < P; i++) {
+    for (j = i; j < P; j++) {
+      v = t->scatter[i * P + j];
+      for (k = 0; k < K; k++) v -= t->sum[k * P + i] * t->sum[k * P + j] / (double)t->count[k];
+      cov[i * P + j] = cov[j * P + i] = v / (double)(t->traces - K);
+    }
+  }
+
+  // cov = L L^T
+  for (j = 0; j < P; j++) {
+    v = cov[j * P + j];
+    for (k = 0; k < j; k++) v -= t->chol[j * P + k] * t->chol[j * P + k];
+    if (!(v > 0)) goto done;
+    t->chol[j * P + j] = sqrt(v);
+
+    for (i = j + 1; i < P; i++) {
+      v = cov[i * P + j];
+      for (k = 0; k < j; k++) v -= t->chol[i * P + k] * t->chol[j * P + k];
+      t->chol[i * P + j] = v / t->chol[j * P + j];
+    }
+  }
+
+  // whitened class means about the reference, stored by point of interest
+  // so that matching runs along the classes
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < P; i++) {
+      v = t->sum[k * P + i] / (double)t->count[k];
+      for (j = 0; j < i; j++) v -= t->chol[i * P + j] * m[j];
+      m[i] = v / t->chol[i * P + i];
+      t->white[i * K + k] = (float)m[i];
+    }
+  }
+
+  result = 0;
+
+done:
+  free(cov);
+  free(m);
+
+  if (result < 0) {
+    free(t->chol);
+    free(t->white);
+    t->chol = NULL;
+    t->white = NULL;
+  }
+
+  return result;
+}
+
+
+void template_mean(const template_t* t, u64 k, double* mean) {
+
+  u64 i;
+
+  for (i = 0; i < t->pois; i++) {
+    mean[i] = t->reference[i] + (t->count[k] ? t->sum[k * t->pois + i] / (double)t->count[k] : 0.0);
+  }
+
+  return;
+}
+
+
+
+/************
+ * Matching *
+ ************/
+
+
+
+/***
+ * template_match
+ *
+ * log likelihood (up to a common constant) of every class for count
+ * attack traces of pois values, stride floats apart:
+ * loglik[n * classes + k]
+ *
+ */
+int template_match(const template_t* t, const float* x, u64 stride, u64 count, double* loglik) {
+
+  u64 P = t->pois, K = t->classes, n, i, j, k;
+  float* dist = malloc(K * sizeof(float));
+  double y[TEMPLATE_MAX_POIS], v;
+
+  if (dist == NULL) return -1;
+
+  for (n = 0; n < count; n++) {
+    const float* xn = x + n * stride;
+
+    for (i = 0; i < P; i++) {
+      v = xn[i] - t->reference[i];
+      for (j = 0; j < i; j++) v -= t->chol[i * P + j] * y[j];
+      y[i] = v / t->chol[i * P + i];
+    }
+
+    memset(dist, 0, K * sizeof(float));
+
+    for (i = 0; i < P; i++) {
+      const float* w = t->white + i * K;
+      float yi = (float)y[i];
+
+      for (k = 0; k < K; k++) dist[k] += (yi - w[k]) * (yi - w[k]);
+    }
+
+    for (k = 0; k < K; k++) loglik[n * K + k] = -0.5 * dist[k];
+  }
+
+  free(dist);
+
+  return 0;
+}
+
+
+
+/***********
+ * Storage *
+ ***********/
+
+
+
+/***
+ * template_save
+ *
+ * the profiling sums, so that a template can be extended later, with the
+ * sample index of every point of interest and extra_bytes of the
+ * caller's own description of the classes
+ *
+ */
+int template_save(const template_t* t, const char* path, const u64* poi, const void* extra, u64 extra_bytes) {
+
+  FILE* fp = fopen(path, "wb");
+  u64 header[4] = { t->classes, t->pois, t->traces, extra_bytes };
+  int ok;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not create %s\n", path);
+    return -1;
+  }
+
+  ok = fwrite(TEMPLATE_MAGIC, 8, 1, fp) == 1 &&
+       fwrite(header, sizeof(header), 1, fp) == 1 &&
+       fwrite(poi, sizeof(u64), t->pois, fp) == t->pois &&
+       (extra_bytes == 0 || fwrite(extra, extra_bytes, 1, fp) == 1) &&
+       fwrite(t->reference, sizeof(double), t->pois, fp) == t->pois &&
+       fwrite(t->count, sizeof(u64), t->classes, fp) == t->classes &&
+       fwrite(t->sum, sizeof(double), t->classes * t->pois, fp) == t->classes * t->pois &&
+       fwrite(t->scatter, sizeof(double), t->pois * t->pois, fp) == t->pois * t->pois;
+
+  if (fclose(fp) != 0) ok = 0;
+  if (!ok) printf("[ERROR] could not write %s\n", path);
+
+  return ok ? 0 : -1;
+}
+
+
+int template_load(template_t* t, const char* path, u64 threads, u64* poi, void* extra, u64 extra_bytes) {
+
+  FILE* fp = fopen(path, "rb");
+  char magic[8];
+  u64 header[4];
+  int ok;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, TEMPLATE_MAGIC, 8) != 0 ||
+      fread(header, sizeof(header), 1, fp) != 1 || header[3] != extra_bytes ||
+      template_alloc(t, header[0], header[1], threads) < 0) {
+    printf("[ERROR] %s is not a template of this kind\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  t->traces = header[2];
+  t->referenced = 1;
+
+  ok = fread(poi, sizeof(u64), t->pois, fp) == t->pois &&
+       (extra_bytes == 0 || fread(extra, extra_bytes, 1, fp) == 1) &&
+       fread(t->reference, sizeof(double), t->pois, fp) == t->pois &&
+       fread(t->count, sizeof(u64), t->classes, fp) == t->classes &&
+       fread(t->sum, sizeof(double), t->classes * t->pois, fp) == t->classes * t->pois &&
+       fread(t->scatter, sizeof(double), t->pois * t->pois, fp) == t->pois * t->pois;
+
+  fclose(fp);
+
+  if (!ok) {
+    printf("[ERROR] %s is truncated\n", path);
+    template_free(t);
+    return -1;
+  }
+
+  return 0;
+}
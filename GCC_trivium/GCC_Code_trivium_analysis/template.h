@@ -0,0 +1,58 @@
+/*
+ * template.h
+ *
+ * gaussian templates with a pooled covariance
+ *
+ * profiling keeps, per class, the number of traces and the sum of their
+ * points of interest, and one scatter matrix of all of them, all taken
+ * about a reference point (the first trace) so that the double sums do
+ * not cancel. Batches are summed per thread and merged, so profiling
+ * streams over any number of traces. template_finish() turns the sums
+ * into class means and the pooled covariance, and factors it.
+ *
+ * matching whitens a trace with the Cholesky factor L of the covariance
+ * (y = L^-1 (x - reference)) and compares it with the whitened class
+ * means, so the log likelihood of every class is one squared distance:
+ *
+ *   log p(x | k) = -|L^-1 (x - m_k)|^2 / 2 + constant
+ *
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include "trivium.h"
+
+#define TEMPLATE_MAX_POIS     128
+#define TEMPLATE_MAX_CLASSES  65536
+#define TEMPLATE_MAX_THREADS  256
+
+
+typedef struct {
+  u64     classes;
+  u64     pois;
+  u64     traces;
+  u64     threads;
+  int     referenced;                   // the reference point is set
+  double* reference;                    // [pois]
+  u64*    count;                        // [classes]
+  double* sum;                          // [classes][pois] of x - reference
+  double* scatter;                      // [pois][pois] of x - reference
+  double* chol;                         // [pois][pois] lower triangle, after template_finish()
+  float*  white;                        // [classes][pois] L^-1 m_k
+} template_t;
+
+
+int  template_alloc(template_t* t, u64 classes, u64 pois, u64 threads);
+void template_free(template_t* t);
+
+int  template_add(template_t* t, const float* x, u64 stride, const u32* classes, u64 count);
+int  template_finish(template_t* t);
+
+void template_mean(const template_t* t, u64 k, double* mean);
+int  template_match(const template_t* t, const float* x, u64 stride, u64 count, double* loglik);
+
+int  template_save(const template_t* t, const char* path, const u64* poi, const void* extra, u64 extra_bytes);
+int  template_load(template_t* t, const char* path, u64 threads, u64* poi, void* extra, u64 extra_bytes);
+
+#endif
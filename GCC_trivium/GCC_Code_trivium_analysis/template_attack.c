@@ -0,0 +1,545 @@
+/*
+ * template_attack.c
+ *
+ * template attack on t1 of the first clocks: profile on traces with known
+ * keys, then rank the key bits of an attack campaign
+ *
+ *  build : gcc -O3 -march=native -pthread -o template_attack template_attack.c template.c targets.c \
+ *                                         traces.c -lm
+ *  run   : ./template_attack [options] profile profiling templates
+ *          ./template_attack [options] attack templates archive
+ *
+ *   -c clock     first clock of the class (default 0)
+ *   -w width     clocks per class, 1..12 (default 8)
+ *   -p pois      points of interest (default 16)
+ *   -d spacing   least distance between two points of interest (default 1)
+ *   -n traces    use at most this many traces
+ *   -b traces    traces per read (default 4096)
+ *   -t threads   worker threads (default: online cpus)
+ *   -k key       the key of the attack campaign, to rank the right guess;
+ *                by default the archive's if every trace has the same one
+ *
+ * the class of a trace is the value of t1 (targets.h) before clocks
+ * clock..clock+width-1, bit i for clock + i; profiling reads it from
+ * the trace's key. The points of interest are the samples where the
+ * class means differ most against the noise (signal to noise ratio).
+ *
+ * the attack guesses every key bit the classes depend on at once; the
+ * score of a guess is the log likelihood of all attack traces under the
+ * classes it predicts for them. The rank of the right guess is printed
+ * as the traces come in.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "template.h"
+#include "targets.h"
+#include "traces.h"
+#include "util.h"
+
+#define MAX_WIDTH       12
+#define MAX_GUESS_BITS  20
+
+
+typedef struct {
+  u32   clock;
+  u32   width;
+  u64   pois;
+  u64   spacing;
+  u64   traces;
+  u64   batch;
+  u64   threads;
+  int   has_key;
+  u8    key[KEYLENGTH];
+} options_t;
+
+
+// saved with the templates
+typedef struct {
+  u32   clock;
+  u32   width;
+} classes_t;
+
+
+typedef struct {
+  u32      width;
+  target_t target[MAX_WIDTH];
+  u32      guess_bits;                  // union of the targets' key bits
+  u32      key[MAX_GUESS_BITS];
+  u64*     own;                         // [guess][width] the target's own guess
+  u16      mask[MAX_WIDTH][1 << TARGET_TAPS];
+} model_t;
+
+
+
+/*********
+ * Model *
+ *********/
+
+
+
+static int model_init(model_t* m, u32 clock, u32 width) {
+
+  u32 i, g, b;
+  u64 guess;
+
+  memset(m, 0, sizeof(model_t));
+  m->width = width;
+
+  for (i = 0; i < width; i++) {
+    target_init(&m->target[i], TARGET_T1, clock + i);
+
+    for (g = 0; g < m->target[i].guess_bits; g++) {
+      for (b = 0; b < m->guess_bits && m->key[b] != m->target[i].key[g]; b++);
+      if (b < m->guess_bits) continue;
+      if (m->guess_bits == MAX_GUESS_BITS) return -1;
+      m->key[m->guess_bits++] = m->target[i].key[g];
+    }
+
+    target_masks(&m->target[i], m->mask[i]);
+  }
+
+  m->own = malloc(((u64)1 << m->guess_bits) * width * sizeof(u64));
+  if (m->own == NULL) return -1;
+
+  // the union guess spread over every target's own guess bits
+  for (guess = 0; guess < ((u64)1 << m->guess_bits); guess++) {
+    for (i = 0; i < width; i++) {
+      u64 own = 0;
+
+      for (g = 0; g < m->target[i].guess_bits; g++) {
+        for (b = 0; m->key[b] != m->target[i].key[g]; b++);
+        own |= ((guess >> b) & 0x01) << g;
+      }
+
+      m->own[guess * width + i] = own;
+    }
+  }
+
+  return 0;
+}
+
+
+/***
+ * model_class
+ *
+ * the class of a trace for a guess of the union key bits
+ *
+ */
+static inline u32 model_class(const model_t* m, const u32* iv_bits, u64 guess) {
+
+  const u64* own = m->own + guess * m->width;
+  u32 i, k = 0;
+
+  for (i = 0; i < m->width; i++) k |= (u32)((m->mask[i][iv_bits[i]] >> own[i]) & 0x01) << i;
+
+  return k;
+}
+
+
+static u64 model_guess(const model_t* m, const u8* key) {
+
+  u64 guess = 0;
+  u32 b, j;
+
+  for (b = 0; b < m->guess_bits; b++) {
+    j = m->key[b];
+    guess |= (u64)((key[KEYLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << b;
+  }
+
+  return guess;
+}
+
+
+static u32 model_class_of(const model_t* m, const trace_info_t* info) {
+
+  u32 iv_bits[MAX_WIDTH], i;
+
+  for (i = 0; i < m->width; i++) iv_bits[i] = target_iv_bits(&m->target[i], info->iv);
+
+  return model_class(m, iv_bits, model_guess(m, info->key));
+}
+
+
+
+/*************
+ * Profiling *
+ *************/
+
+
+
+/***
+ * choose_pois
+ *
+ * first pass: per class mean and variance of every sample, then the
+ * samples of highest signal to noise ratio at least spacing apart
+ *
+ */
+static int choose_pois(const options_t* o, const model_t* m, trace_archive_t* a, u64 count,
+                       float* traces, trace_info_t* info, u64* poi) {
+
+  u64 S = a->format.samples, K = (u64)1 << m->width, i, n, t, j, k, p;
+  double *sum = calloc(K * S, sizeof(double)), *square = calloc(K * S, sizeof(double));
+  double *snr = malloc(S * sizeof(double));
+  u64* number = calloc(K, sizeof(u64));
+  int result = -1;
+
+  if (sum == NULL || square == NULL || snr == NULL || number == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+    if (trace_archive_read(a, i, n, traces, info) < 0) goto done;
+
+    for (t = 0; t < n; t++) {
+      const float* x = traces + t * S;
+      k = model_class_of(m, &info[t]);
+      number[k]++;
+
+      for (j = 0; j < S; j++) {
+        sum[k * S + j] += x[j];
+        square[k * S + j] += (double)x[j] * x[j];
+      }
+    }
+  }
+
+  for (j = 0; j < S; j++) {
+    double mean = 0, signal = 0, noise = 0, classes = 0;
+
+    for (k = 0; k < K; k++) {
+      if (number[k] < 2) continue;
+      mean += sum[k * S + j] / number[k];
+      classes++;
+    }
+    mean /= classes;
+
+    for (k = 0; k < K; k++) {
+      double mk;
+      if (number[k] < 2) continue;
+      mk = sum[k * S + j] / number[k];
+      signal += (mk - mean) * (mk - mean);
+      noise  += (square[k * S + j] - number[k] * mk * mk) / (number[k] - 1);
+    }
+
+    snr[j] = (noise > 0) ? signal / noise : 0;
+  }
+
+  for (p = 0; p < o->pois; p++) {
+    double best = -1;
+
+    for (j = 0; j < S; j++) {
+      if (snr[j] <= best) continue;
+
+      for (k = 0; k < p; k++) {
+        if ((poi[k] > j ? poi[k] - j : j - poi[k]) < o->spacing) break;
+      }
+      if (k == p) {
+        best = snr[j];
+        poi[p] = j;
+      }
+    }
+
+    if (best < 0) {
+      printf("[ERROR] only %lu samples are %lu apart\n", p, o->spacing);
+      goto done;
+    }
+
+    printf("  poi %2lu: sample %6lu, snr %.4g\n", p, poi[p], best);
+  }
+
+  result = 0;
+
+done:
+  free(sum);
+  free(square);
+  free(snr);
+  free(number);
+
+  return result;
+}
+
+
+static int profile(const options_t* o, const char* path, const char* output) {
+
+  trace_archive_t a;
+  template_t tp;
+  model_t m;
+  classes_t def = { o->clock, o->width };
+  u64 poi[TEMPLATE_MAX_POIS], count, i, n, t, p;
+  float *traces = NULL, *x = NULL;
+  trace_info_t* info = NULL;
+  u32* classes = NULL;
+  double start = now();
+  int result = 1;
+
+  memset(&tp, 0, sizeof(tp));
+
+  if (model_init(&m, o->clock, o->width) < 0) {
+    printf("[ERROR] the classes depend on too many key bits\n");
+    return 1;
+  }
+
+  if (trace_archive_open(&a, path, o->threads) < 0) {
+    free(m.own);
+    return 1;
+  }
+
+  count = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+
+  traces  = malloc(o->batch * a.format.samples * sizeof(float));
+  info    = malloc(o->batch * sizeof(trace_info_t));
+  x       = malloc(o->batch * o->pois * sizeof(float));
+  classes = malloc(o->batch * sizeof(u32));
+
+  if (traces == NULL || info == NULL || x == NULL || classes == NULL ||
+      template_alloc(&tp, (u64)1 << o->width, o->pois, o->threads) < 0) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  printf("%lu profiling traces, %lu classes: t1 before clocks %u..%u\n",
+         count, tp.classes, o->clock, o->clock + o->width - 1);
+
+  if (choose_pois(o, &m, &a, count, traces, info, poi) < 0) goto done;
+
+  // second pass: the templates at the points of interest
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+
+    for (t = 0; t < n; t++) {
+      for (p = 0; p < o->pois; p++) x[t * o->pois + p] = traces[t * a.format.samples + poi[p]];
+      classes[t] = model_class_of(&m, &info[t]);
+    }
+
+    if (template_add(&tp, x, o->pois, classes, n) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+  }
+
+  if (template_finish(&tp) < 0) {
+    printf("[ERROR] no template: every class needs traces and the covariance must be positive definite\n");
+    goto done;
+  }
+
+  if (template_save(&tp, output, poi, &def, sizeof(def)) < 0) goto done;
+
+  printf("templates written to %s (%.3f s)\n", output, now() - start);
+  result = 0;
+
+done:
+  free(traces);
+  free(info);
+  free(x);
+  free(classes);
+  free(m.own);
+  template_free(&tp);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+
+/**********
+ * Attack *
+ **********/
+
+
+
+static int attack(options_t* o, const char* templates, const char* path) {
+
+  trace_archive_t a;
+  template_t tp;
+  model_t m;
+  classes_t def;
+  u64 poi[TEMPLATE_MAX_POIS], count, guesses, i, n, t, p, g, next = 1, correct = 0;
+  float *traces = NULL, *x = NULL;
+  double *loglik = NULL, *score = NULL, start = now();
+  trace_info_t* info = NULL;
+  u32 iv_bits[MAX_WIDTH], j;
+  int result = 1, same_key = 1;
+
+  if (template_load(&tp, templates, o->threads, poi, &def, sizeof(def)) < 0) return 1;
+
+  if (template_finish(&tp) < 0 || model_init(&m, def.clock, def.width) < 0) {
+    printf("[ERROR] %s: damaged templates\n", templates);
+    template_free(&tp);
+    return 1;
+  }
+
+  if (trace_archive_open(&a, path, o->threads) < 0) {
+    free(m.own);
+    template_free(&tp);
+    return 1;
+  }
+
+  for (p = 0; p < tp.pois; p++) {
+    if (poi[p] >= a.format.samples) {
+      printf("[ERROR] the templates need %lu samples per trace\n", poi[p] + 1);
+      goto done;
+    }
+  }
+
+  count   = (o->traces && o->traces < a.format.traces) ? o->traces : a.format.traces;
+  guesses = (u64)1 << m.guess_bits;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info   = malloc(o->batch * sizeof(trace_info_t));
+  x      = malloc(o->batch * tp.pois * sizeof(float));
+  loglik = malloc(o->batch * tp.classes * sizeof(double));
+  score  = calloc(guesses, sizeof(double));
+
+  if (traces == NULL || info == NULL || x == NULL || loglik == NULL || score == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  printf("templates of %lu traces, %lu classes, %lu pois: t1 before clocks %u..%u, %u key bits\n",
+         tp.traces, tp.classes, tp.pois, def.clock, def.clock + def.width - 1, m.guess_bits);
+
+  for (i = 0; i < count; i += n) {
+    n = (count - i < o->batch) ? count - i : o->batch;
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+
+    if (!o->has_key) {
+      if (i == 0) memcpy(o->key, info[0].key, KEYLENGTH);
+      for (t = 0; t < n && same_key; t++) same_key = (memcmp(info[t].key, o->key, KEYLENGTH) == 0);
+    }
+
+    for (t = 0; t < n; t++) {
+      for (p = 0; p < tp.pois; p++) x[t * tp.pois + p] = traces[t * a.format.samples + poi[p]];
+    }
+
+    if (template_match(&tp, x, tp.pois, n, loglik) < 0) {
+      printf("[ERROR] out of memory\n");
+      goto done;
+    }
+
+    for (t = 0; t < n; t++) {
+      const double* l = loglik + t * tp.classes;
+
+      for (j = 0; j < m.width; j++) iv_bits[j] = target_iv_bits(&m.target[j], info[t].iv);
+      for (g = 0; g < guesses; g++) score[g] += l[model_class(&m, iv_bits, g)];
+
+      // report at 1, 2, 5, 10, 20, 50, ... traces and at the end
+      if (i + t + 1 == next || i + t + 1 == count) {
+        u64 best = 0, rank = 1;
+        int known = o->has_key || same_key;
+
+        if (i + t == 0) printf("  traces  best guess  log likelihood  %s\n", known ? "right guess  rank" : "");
+
+        for (g = 1; g < guesses; g++) {
+          if (score[g] > score[best]) best = g;
+        }
+
+        printf("  %6lu  %10lu  %14.2f", i + t + 1, best, score[best]);
+
+        if (known) {
+          correct = model_guess(&m, o->key);
+          for (g = 0; g < guesses; g++) rank += (score[g] > score[correct]);
+          printf("  %11lu  %4lu", correct, rank);
+        }
+
+        printf("\n");
+
+        if (i + t + 1 == next) {
+          u64 lead;
+          for (lead = next; lead >= 10; lead /= 10);
+          next = (lead == 2) ? next / 2 * 5 : 2 * next;
+        }
+      }
+    }
+  }
+
+  printf("%.3f s\n", now() - start);
+  result = 0;
+
+done:
+  free(traces);
+  free(info);
+  free(x);
+  free(loglik);
+  free(score);
+  free(m.own);
+  template_free(&tp);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c clock] [-w width] [-p pois] [-d spacing] [-n traces] [-b traces] [-t threads]\n"
+         "       %*s profile profiling templates\n"
+         "       %s [-n traces] [-b traces] [-t threads] [-k key] attack templates archive\n",
+         name, (int)strlen(name), "", name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o;
+  int option;
+
+  memset(&o, 0, sizeof(o));
+  o.width   = 8;
+  o.pois    = 16;
+  o.spacing = 1;
+  o.batch   = 4096;
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "c:w:p:d:n:b:t:k:")) != -1) {
+    switch (option) {
+    case 'c': o.clock   = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'w': o.width   = (u32)strtoul(optarg, NULL, 10);  break;
+    case 'p': o.pois    = strtoul(optarg, NULL, 10);       break;
+    case 'd': o.spacing = strtoul(optarg, NULL, 10);       break;
+    case 'n': o.traces  = strtoul(optarg, NULL, 10);       break;
+    case 'b': o.batch   = strtoul(optarg, NULL, 10);       break;
+    case 't': o.threads = strtoul(optarg, NULL, 10);       break;
+    case 'k':
+      if (strlen(optarg) != 2 * KEYLENGTH || parse_bytes(optarg, o.key, KEYLENGTH) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      o.has_key = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (argc - optind != 3 || o.width == 0 || o.width > MAX_WIDTH || o.clock + o.width > TARGET_CLOCKS ||
+      o.pois == 0 || o.pois > TEMPLATE_MAX_POIS || o.spacing == 0 || o.batch == 0 || o.threads == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (strcmp(argv[optind], "profile") == 0) return profile(&o, argv[optind + 1], argv[optind + 2]);
+  if (strcmp(argv[optind], "attack") == 0) return attack(&o, argv[optind + 1], argv[optind + 2]);
+
+  usage(argv[0]);
+
+  return 2;
+}
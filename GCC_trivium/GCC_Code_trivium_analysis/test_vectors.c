@@ -0,0 +1,1022 @@
+/*
+ * test_vectors.c
+ *
+ * conformance runner: parses eSTREAM test vectors and checks every
+ * trivium implementation in this folder against them. Replaces
+ * format_text_vectors.py + check_similarity.py.
+ *
+ *  build : gcc -O2 -march=native -o test_vectors test_vectors.c trivium_ref.c trivium_word.c \
+ *                                  trivium_slice.c trivium_masked.c trivium_byte.c targets.c \
+ *                                  stochastic.c cpa.c anf.c -pthread -lm
+ *  run   : ./test_vectors [vectors] [keys] [ivs] [plain] [cipher]
+ *
+ * [vectors] defaults to the pasted eSTREAM set all_test_vectors.txt.
+ * The parser understands the eSTREAM layout
+ *
+ *    Set 1, vector#  0:
+ *                               key = 80000000000000000000
+ *                                IV = 00000000000000000000
+ *                     stream[0..63] = 38EB86FF730D7A9CAF8DF13A4420540D
+ *                                     BB7B651464C87501552041C249F29A64
+ *                                     ...
+ *                        xor-digest = 7AE3A4B53355061766122E04391EA1E6
+ *                                     699B51C21A1F8058D3CF74A209D7E4CB
+ *                                     ...
+ *
+ * where a line without '=' continues the last field, the stream block or
+ * the digest (which is not checked), as well as the copy-pasted form
+ * where only the first 'stream[..] = ' prefix survived: a bare hex line
+ * following a complete block starts a new vector with the same block
+ * layout as the previous one. Vectors without 'key =' / 'IV =' lines
+ * take the next line of [keys] / [ivs].
+ *
+ * reduced round variants have no published vectors, for those the word
+ * core is cross checked against the reference with the same number
+ * of initialization rounds on every key and iv of the set
+ *
+ * backward clocking is checked by running every key and iv forward
+ * through the initialization and back to the loaded state
+ *
+ * the attack targets of targets.h are checked against the state the word
+ * core reaches in the first clocks, and the regressors a leakage model
+ * takes as known must come out the same under any key
+ *
+ * the normal form of anf.h is checked against the word core: the
+ * feedbacks of every clock, key restricted and not, and the whole state
+ * every ANF_STRIDE clocks
+ *
+ * the integer path of the correlation engine must give the correlations
+ * of the float path to the bit on traces of 8 bit codes
+ *
+ * the masked core encrypts [plain] under every line of [keys] / [ivs]
+ * at every order and must reproduce [cipher], the unmasked encryptor's
+ * output; its shares must recombine to the state of the word core
+ *
+ * the parser is also run on estream_test_vectors.txt, a few vectors in
+ * the full layout above, checked with the reference
+ *
+ * exit status is 0 only if every variant matches every vector
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "trivium.h"
+#include "targets.h"
+#include "stochastic.h"
+#include "anf.h"
+#include "util.h"
+
+#define DATA_DIR "../GCC_Code_trivium_128_bytes/"
+#define LAYOUT   DATA_DIR "Format_test_vector_128_python/estream_test_vectors.txt"
+
+#define LINE_MAX_LENGTH 256
+#define MAX_BLOCKS      8
+#define MAX_BLOCK_BYTES 512
+#define MAX_CIPHER      256
+#define ANF_STRIDE      32
+#define DIGEST_BYTES    64
+#define INT8_TRACES     1001            // not whole quads, in two batches
+#define INT8_COLUMNS    40              // not whole tiles
+#define INT8_HYPOTHESES 70
+
+
+/***
+ * variants
+ *
+ * every implementation that must reproduce the eSTREAM keystream
+ *
+ */
+typedef void (*keystream_fn)(const u8* key, const u8* iv, u8* out, u64 length);
+
+static const struct {
+  const char*  name;
+  keystream_fn keystream;
+} variants[] = {
+  { "ref",      trivium_ref_keystream      },
+  { "word",     trivium_word_keystream     },
+  { "slice64",  trivium_slice64_keystream  },
+  { "slice256", trivium_slice256_keystream },
+  { "masked1",  trivium_masked1_keystream  },
+  { "masked2",  trivium_masked2_keystream  },
+  { "byte",     trivium_byte_keystream     },
+};
+
+#define VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+
+// reduced round variants studied in cube and side channel experiments
+static const u64 reduced_rounds[] = { 576, 672, 767, 799, 100 };
+
+#define REDUCED_ROUNDS (sizeof(reduced_rounds) / sizeof(reduced_rounds[0]))
+#define REDUCED_BYTES  64
+
+
+typedef struct {
+  u64 offset;
+  u64 length;    // declared length
+  u64 filled;    // bytes parsed so far
+  u8  data[MAX_BLOCK_BYTES];
+} block_t;
+
+typedef struct {
+  u8      key[KEYLENGTH];
+  u8      iv[IVLENGTH];
+  int     has_key;
+  int     has_iv;
+  u64     line;  // line number of the first block, for reports
+  u64     blocks;
+  block_t block[MAX_BLOCKS];
+} vector_t;
+
+typedef struct {
+  vector_t* v;
+  u64       count;
+  u64       capacity;
+} vectors_t;
+
+
+
+/***********
+ * Parsing *
+ ***********/
+
+
+
+/***
+ * parse_hex
+ *
+ * convert up to max bytes of hex text to bytes, skipping white space and
+ * the '.' separators of pasted vectors. Returns the number of bytes, or
+ * -1 on a character that is not hex
+ *
+ */
+static long parse_hex(const char* text, u8* out, u64 max) {
+
+  u64 count = 0;
+  int high = -1, v;
+
+  for (; *text; text++) {
+    if (isspace((unsigned char)*text) || *text == '.') continue;
+
+    v = hex_value(*text);
+    if (v < 0 || count == max) return -1;
+
+    if (high < 0) {
+      high = v;
+    } else {
+      out[count++] = (u8)(16 * high + v);
+      high = -1;
+    }
+  }
+
+  return (high < 0) ? (long)count : -1;
+}
+
+
+/***
+ * trim
+ *
+ * strip leading and trailing white space in place
+ *
+ */
+static char* trim(char* text) {
+
+  char* end;
+
+  while (isspace((unsigned char)*text)) text++;
+
+  end = text + strlen(text);
+  while (end > text && isspace((unsigned char)end[-1])) end--;
+  *end = 0;
+
+  return text;
+}
+
+
+/***
+ * new_vector
+ *
+ * append an empty vector
+ *
+ */
+static vector_t* new_vector(vectors_t* set, u64 line) {
+
+  vector_t* v;
+
+  if (set->count == set->capacity) {
+    set->capacity = set->capacity ? 2 * set->capacity : 64;
+    set->v = realloc(set->v, set->capacity * sizeof(vector_t));
+    if (set->v == NULL) {
+      printf("[ERROR] out of memory\n");
+      exit(1);
+    }
+  }
+
+  v = &set->v[set->count++];
+  memset(v, 0, sizeof(vector_t));
+  v->line = line;
+
+  return v;
+}
+
+
+/***
+ * block_complete
+ *
+ * true if the last block of the vector has all of its declared bytes
+ *
+ */
+static int block_complete(const vector_t* v) {
+  return v->blocks > 0 && v->block[v->blocks - 1].filled == v->block[v->blocks - 1].length;
+}
+
+
+/***
+ * append_hex
+ *
+ * add a line of hex to the last block of a vector
+ *
+ */
+static int append_hex(vector_t* v, const char* text) {
+
+  block_t* b = &v->block[v->blocks - 1];
+  long n = parse_hex(text, b->data + b->filled, b->length - b->filled);
+
+  if (n < 0) return -1;
+  b->filled += (u64)n;
+
+  return 0;
+}
+
+
+/***
+ * parse_vectors
+ *
+ * parse an eSTREAM vector file, see the top of the file for the format
+ *
+ */
+static int parse_vectors(const char* path, vectors_t* set) {
+
+  FILE* fp = fopen(path, "r");
+  char buffer[LINE_MAX_LENGTH];
+  char *line, *eq, *name, *value;
+  vector_t* v = NULL;
+  u8 digest[DIGEST_BYTES];
+  u64 number = 0, a, b, digested = 0;
+  long n;
+  int in_digest = 0;                    // the last field was the xor-digest
+
+  if (fp == NULL) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    number++;
+    line = trim(buffer);
+    if (*line == 0) continue;
+
+    // "Set 1, vector#  0:" starts a new vector
+    if (strncmp(line, "Set ", 4) == 0 && strstr(line, "vector#") != NULL) {
+      v = new_vector(set, number);
+      in_digest = 0;
+      continue;
+    }
+
+    eq = strchr(line, '=');
+
+    if (eq == NULL && in_digest) {
+      if ((n = parse_hex(line, digest + digested, DIGEST_BYTES - digested)) < 0) goto malformed;
+      digested += (u64)n;
+      continue;
+    }
+
+    if (eq == NULL) {
+      // continuation line, or a vector whose prefix was lost in the paste
+      if (v == NULL || v->blocks == 0) goto malformed;
+
+      if (block_complete(v)) {
+        block_t layout = v->block[0];
+        v = new_vector(set, number);
+        v->blocks = 1;
+        v->block[0].offset = layout.offset;
+        v->block[0].length = layout.length;
+      }
+
+      if (append_hex(v, line) < 0) goto malformed;
+      continue;
+    }
+
+    *eq = 0;
+    name = trim(line);
+    value = trim(eq + 1);
+    in_digest = 0;
+
+    if (strcmp(name, "key") == 0) {
+      if (v == NULL || v->has_key || v->blocks > 0) v = new_vector(set, number);
+      if (parse_hex(value, v->key, KEYLENGTH) != KEYLENGTH) goto malformed;
+      v->has_key = 1;
+
+    } else if (strcmp(name, "IV") == 0) {
+      if (v == NULL || v->has_iv || v->blocks > 0) v = new_vector(set, number);
+      if (parse_hex(value, v->iv, IVLENGTH) != IVLENGTH) goto malformed;
+      v->has_iv = 1;
+
+    } else if (sscanf(name, "stream[%lu..%lu]", &a, &b) == 2) {
+      if (b < a || b - a + 1 > MAX_BLOCK_BYTES) goto malformed;
+
+      // a block starting again at offset 0 belongs to the next vector
+      if (v == NULL || v->blocks == MAX_BLOCKS || (v->blocks > 0 && a <= v->block[v->blocks - 1].offset)) {
+        v = new_vector(set, number);
+      }
+
+      v->block[v->blocks].offset = a;
+      v->block[v->blocks].length = b - a + 1;
+      v->block[v->blocks].filled = 0;
+      v->blocks++;
+
+      if (append_hex(v, value) < 0) goto malformed;
+
+    } else if (strcmp(name, "xor-digest") == 0) {
+      if ((n = parse_hex(value, digest, DIGEST_BYTES)) < 0) goto malformed;
+      digested = (u64)n;
+      in_digest = 1;
+
+    } else {
+      goto malformed;
+    }
+  }
+
+  fclose(fp);
+  return 0;
+
+malformed:
+  printf("[ERROR] %s:%lu: malformed line\n", path, number);
+  fclose(fp);
+  return -1;
+}
+
+
+/***
+ * fill_from_file
+ *
+ * give vectors without a key (or iv) the next line of a keys.txt style file
+ *
+ */
+static int fill_from_file(const char* path, vectors_t* set, int want_iv) {
+
+  FILE* fp = NULL;
+  char buffer[LINE_MAX_LENGTH];
+  vector_t* v;
+  u64 i;
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+    if (want_iv ? v->has_iv : v->has_key) continue;
+
+    if (fp == NULL && (fp = fopen(path, "r")) == NULL) {
+      printf("[ERROR] vectors need %s from %s, could not open it\n", want_iv ? "ivs" : "keys", path);
+      return -1;
+    }
+
+    if (fgets(buffer, sizeof(buffer), fp) == NULL ||
+        parse_hex(trim(buffer), want_iv ? v->iv : v->key, KEYLENGTH) != KEYLENGTH) {
+      printf("[ERROR] %s has no entry for the vector at line %lu\n", path, v->line);
+      fclose(fp);
+      return -1;
+    }
+
+    if (want_iv) v->has_iv = 1; else v->has_key = 1;
+  }
+
+  if (fp != NULL) fclose(fp);
+
+  return 0;
+}
+
+
+
+/***********
+ * Running *
+ ***********/
+
+
+
+static void print_hex(const u8* data, u64 length) {
+
+  u64 i;
+
+  for (i = 0; i < length; i++) printf("%02X", data[i]);
+
+  return;
+}
+
+
+/***
+ * stream_length
+ *
+ * the keystream length that reaches the furthest block, 0 if a block is
+ * truncated
+ *
+ */
+static u64 stream_length(const vectors_t* set) {
+
+  const block_t* b;
+  u64 i, j, length = 0;
+
+  for (i = 0; i < set->count; i++) {
+    for (j = 0; j < set->v[i].blocks; j++) {
+      b = &set->v[i].block[j];
+
+      if (b->filled != b->length) {
+        printf("[ERROR] vector at line %lu: stream[%lu..%lu] is truncated\n",
+               set->v[i].line, b->offset, b->offset + b->length - 1);
+        return 0;
+      }
+      if (b->offset + b->length > length) length = b->offset + b->length;
+    }
+  }
+
+  return length;
+}
+
+
+/***
+ * check_variant
+ *
+ * run one variant over every vector and report each mismatching block
+ * with key, iv and the byte offset of the first differing byte
+ *
+ */
+static u64 check_variant(u64 index, const vectors_t* set, u8* keystream, u64 length) {
+
+  const vector_t* v;
+  const block_t* b;
+  u64 i, j, k, failures = 0, bytes = 0;
+  double start = now();
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+    variants[index].keystream(v->key, v->iv, keystream, length);
+
+    for (j = 0; j < v->blocks; j++) {
+      b = &v->block[j];
+      bytes += b->length;
+
+      for (k = 0; k < b->length; k++) {
+        if (keystream[b->offset + k] == b->data[k]) continue;
+
+        printf("[ERROR] %s: vector %lu (line %lu) key ", variants[index].name, i, v->line);
+        print_hex(v->key, KEYLENGTH);
+        printf(" iv ");
+        print_hex(v->iv, IVLENGTH);
+        printf(" byte %lu: expected %02X, got %02X\n",
+               b->offset + k, b->data[k], keystream[b->offset + k]);
+
+        failures++;
+        break;
+      }
+    }
+  }
+
+  printf("[%s] %-8s %lu vectors, %lu bytes, %lu mismatches, %.3f ms\n",
+         failures ? "ERROR" : "SUCCESS", variants[index].name, set->count, bytes, failures,
+         1e3 * (now() - start));
+
+  return failures;
+}
+
+
+/***
+ * check_rounds
+ *
+ * cross check the word core against the reference for a reduced
+ * number of initialization rounds
+ *
+ */
+static u64 check_rounds(u64 rounds, const vectors_t* set) {
+
+  u8 expected[REDUCED_BYTES], got[REDUCED_BYTES];
+  const vector_t* v;
+  u64 i, k, failures = 0;
+
+  init_rounds = rounds;
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+    trivium_ref_keystream(v->key, v->iv, expected, REDUCED_BYTES);
+    trivium_word_keystream_rounds(v->key, v->iv, rounds, got, REDUCED_BYTES);
+
+    for (k = 0; k < REDUCED_BYTES; k++) {
+      if (expected[k] == got[k]) continue;
+
+      printf("[ERROR] word/%lu: key ", rounds);
+      print_hex(v->key, KEYLENGTH);
+      printf(" iv ");
+      print_hex(v->iv, IVLENGTH);
+      printf(" byte %lu: ref %02X, got %02X\n", k, expected[k], got[k]);
+
+      failures++;
+      break;
+    }
+  }
+
+  init_rounds = INIT_ROUNDS;
+
+  printf("[%s] word/%-4lu %lu key/iv pairs against ref\n", failures ? "ERROR" : "SUCCESS", rounds, set->count);
+
+  return failures;
+}
+
+
+/***
+ * check_inverse
+ *
+ * clock every initialized state back to its key and iv, with the word
+ * and the bitsliced core
+ *
+ */
+static u64 check_inverse(const vectors_t* set) {
+
+  trivium_word_t w;
+  trivium_slice64_t s;
+  lane64_t bits[STATEBITS];
+  u8 word_bits[STATEBITS], key[KEYLENGTH], iv[IVLENGTH];
+  const vector_t* v;
+  u64 i, j, failures = 0;
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+
+    trivium_word_init(&w, v->key, v->iv);
+    trivium_word_back(&w, INIT_ROUNDS);
+
+    trivium_slice64_broadcast(&s, v->key, v->iv);
+    trivium_slice64_run(&s, INIT_ROUNDS, NULL);
+    trivium_slice64_back(&s, INIT_ROUNDS);
+    trivium_slice64_bits(&s, bits);
+
+    trivium_word_bits(&w, word_bits);
+    for (j = 0; j < STATEBITS; j++) {
+      if (bits[j][0] != (word_bits[j] ? ~(u64)0 : 0)) break;
+    }
+
+    if (!trivium_word_loaded(&w, key, iv) || memcmp(key, v->key, KEYLENGTH) || memcmp(iv, v->iv, IVLENGTH) ||
+        j < STATEBITS) {
+      printf("[ERROR] back: key ");
+      print_hex(v->key, KEYLENGTH);
+      printf(" iv ");
+      print_hex(v->iv, IVLENGTH);
+      printf(" does not clock back to its loaded state\n");
+      failures++;
+    }
+  }
+
+  printf("[%s] back     %lu states clocked back to their key and iv\n", failures ? "ERROR" : "SUCCESS", set->count);
+
+  return failures;
+}
+
+
+/***
+ * check_targets
+ *
+ * every target of the first clocks, predicted from the iv and the right
+ * guess, against the state itself
+ *
+ */
+static u64 check_targets(const vectors_t* set) {
+
+  trivium_word_t w;
+  target_t t;
+  u8 bits[STATEBITS], expected;
+  const vector_t* v;
+  u64 i, failures = 0;
+  u32 c, kind;
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+    trivium_word_load(&w, v->key, v->iv);
+
+    for (c = 0; c < TARGET_CLOCKS; c++) {
+      trivium_word_bits(&w, bits);
+
+      for (kind = 0; kind < TARGET_KINDS; kind++) {
+        target_init(&t, kind, c);
+
+        switch (kind) {
+        case TARGET_T1:   expected = bits[65]  ^ bits[92]  ^ (bits[90]  & bits[91])  ^ bits[170]; break;
+        case TARGET_T2:   expected = bits[161] ^ bits[176] ^ (bits[174] & bits[175]) ^ bits[263]; break;
+        case TARGET_T3:   expected = bits[242] ^ bits[287] ^ (bits[285] & bits[286]) ^ bits[68];  break;
+        case TARGET_AND1: expected = bits[90]  & bits[91];  break;
+        case TARGET_AND2: expected = bits[174] & bits[175]; break;
+        default:          expected = bits[285] & bits[286]; break;
+        }
+
+        if (target_predict(&t, v->iv, target_guess(&t, v->key)) != expected) {
+          printf("[ERROR] targets: %s before clock %u of key ", target_name(kind), c);
+          print_hex(v->key, KEYLENGTH);
+          printf(" iv ");
+          print_hex(v->iv, IVLENGTH);
+          printf("\n");
+          failures++;
+        }
+      }
+
+      trivium_word_step(&w, 1);
+    }
+  }
+
+  printf("[%s] targets  %lu key/iv pairs, %d clocks\n", failures ? "ERROR" : "SUCCESS", set->count, TARGET_CLOCKS);
+
+  return failures;
+}
+
+
+/***
+ * check_known
+ *
+ * the regressors stochastic_known() reports for a clock against the
+ * regressors of the same iv under the zero key
+ *
+ */
+static u64 check_known(const vectors_t* set) {
+
+  static const u8 zero[KEYLENGTH] = { 0 };
+  u8 known[STOCHASTIC_REGRESSORS], bits[STOCHASTIC_REGRESSORS], expected[STOCHASTIC_REGRESSORS];
+  const vector_t* v;
+  u64 i, r, failures = 0;
+  u32 c;
+
+  for (c = 0; c < TARGET_CLOCKS; c++) {
+    stochastic_known(c, known);
+
+    for (i = 0; i < set->count; i++) {
+      v = &set->v[i];
+      stochastic_bits(c, v->key, v->iv, bits);
+      stochastic_bits(c, zero, v->iv, expected);
+
+      for (r = 0; r < STOCHASTIC_REGRESSORS && (!known[r] || bits[r] == expected[r]); r++);
+      if (r == STOCHASTIC_REGRESSORS) continue;
+
+      printf("[ERROR] known: regressor %lu before clock %u depends on key ", r, c);
+      print_hex(v->key, KEYLENGTH);
+      printf("\n");
+      failures++;
+    }
+  }
+
+  printf("[%s] known    %lu key/iv pairs, %d clocks\n", failures ? "ERROR" : "SUCCESS", set->count, TARGET_CLOCKS);
+
+  return failures;
+}
+
+
+/***
+ * check_int8
+ *
+ * the correlations of cpa_add_int8() against those of cpa_add() on the
+ * same codes and byte hypotheses, the float traces the unsigned codes
+ * as cpa_attack -8 1:0 reads them
+ *
+ */
+static u64 check_int8(void) {
+
+  const u64 T = INT8_TRACES, C = INT8_COLUMNS, H = INT8_HYPOTHESES;
+  float *x = malloc(T * C * sizeof(float)), *h = malloc(T * H * sizeof(float));
+  float *rf = malloc(C * sizeof(float)), *ri = malloc(C * sizeof(float));
+  int8_t* x8 = malloc(T * C);
+  u8* h8 = malloc(T * H);
+  u64 state = 0x5EED, t, j, k, half = T / 2, failures = 0;
+  u32 code;
+  cpa_t f, q;
+
+  memset(&f, 0, sizeof(f));
+  memset(&q, 0, sizeof(q));
+
+  if (x == NULL || h == NULL || rf == NULL || ri == NULL || x8 == NULL || h8 == NULL ||
+      cpa_alloc(&f, H, C, 2) < 0 || cpa_alloc(&q, H, C, 2) < 0) {
+    printf("[ERROR] int8: out of memory\n");
+    failures = 1;
+    goto done;
+  }
+
+  // codes around 200 (a DC offset), the first hypothesis leaking into every column
+  for (t = 0; t < T; t++) {
+    for (k = 0; k < H; k++) h8[t * H + k] = (u8)splitmix64(&state);
+    for (j = 0; j < C; j++) {
+      code = 200 + (u32)(splitmix64(&state) % 32) + (u32)(h8[t * H] >> (j % 8));
+      x8[t * C + j] = (int8_t)((int)(code > 255 ? 255 : code) - 128);
+    }
+  }
+
+  for (t = 0; t < T * C; t++) x[t] = (float)(x8[t] + 128);
+  for (t = 0; t < T * H; t++) h[t] = (float)h8[t];
+
+  if (cpa_add(&f, x, C, half, h, NULL, NULL) < 0 || cpa_add(&f, x + half * C, C, T - half, h + half * H, NULL, NULL) < 0 ||
+      cpa_add_int8(&q, x8, C, half, h8) < 0 || cpa_add_int8(&q, x8 + half * C, C, T - half, h8 + half * H) < 0) {
+    printf("[ERROR] int8: out of memory\n");
+    failures = 1;
+    goto done;
+  }
+
+  for (k = 0; k < H; k++) {
+    cpa_correlation(&f, k, rf);
+    cpa_correlation(&q, k, ri);
+    for (j = 0; j < C && memcmp(&rf[j], &ri[j], sizeof(float)) == 0; j++);
+    if (j == C) continue;
+
+    printf("[ERROR] int8: hypothesis %lu column %lu: float %.9g, int8 %.9g\n", k, j, rf[j], ri[j]);
+    failures++;
+  }
+
+  printf("[%s] int8     %lu traces, %lu hypotheses x %lu columns\n", failures ? "ERROR" : "SUCCESS", T, H, C);
+
+done:
+  cpa_free(&f);
+  cpa_free(&q);
+  free(x);
+  free(h);
+  free(rf);
+  free(ri);
+  free(x8);
+  free(h8);
+
+  return failures;
+}
+
+
+/***
+ * check_anf
+ *
+ * the normal form of the first ANF_MAX_CLOCKS clocks against the state
+ * the word core reaches
+ *
+ */
+static u64 check_anf(const vectors_t* set) {
+
+  static anf_t a;
+  trivium_word_t w;
+  anf_fn_t f;
+  u8 bits[STATEBITS], expected[3];
+  const vector_t* v;
+  u64 key[2], iv[2], i, c, failures = 0;
+  u32 j, kind;
+
+  if (anf_build(&a, ANF_MAX_CLOCKS, 0) < 0) {
+    printf("[ERROR] anf      the normal form of %d clocks takes more than %d terms\n", ANF_MAX_CLOCKS, ANF_LIMIT);
+    return 1;
+  }
+
+  for (i = 0; i < set->count; i++) {
+    v = &set->v[i];
+    anf_pack(v->key, key);
+    anf_pack(v->iv, iv);
+    trivium_word_load(&w, v->key, v->iv);
+
+    for (c = 0; c <= ANF_MAX_CLOCKS; c++) {
+      trivium_word_bits(&w, bits);
+
+      if (c % ANF_STRIDE == 0 || c == ANF_MAX_CLOCKS) {
+        for (j = 0; j < STATEBITS && anf_value(&a, anf_state(&a, c, j), key, iv) == bits[j]; j++);
+        if (j < STATEBITS) {
+          printf("[ERROR] anf      state bit %u after %lu clocks of key ", j, c);
+          print_hex(v->key, KEYLENGTH);
+          printf("\n");
+          failures++;
+        }
+      }
+
+      if (c == ANF_MAX_CLOCKS) break;
+
+      expected[0] = bits[65]  ^ bits[92]  ^ (bits[90]  & bits[91])  ^ bits[170];
+      expected[1] = bits[161] ^ bits[176] ^ (bits[174] & bits[175]) ^ bits[263];
+      expected[2] = bits[242] ^ bits[287] ^ (bits[285] & bits[286]) ^ bits[68];
+
+      for (kind = 0; kind < 3; kind++) {
+        if (anf_restrict(&a, anf_feedback(&a, c, kind), key, &f) < 0) {
+          printf("[ERROR] out of memory\n");
+          anf_free(&a);
+          return failures + 1;
+        }
+
+        if (anf_value(&a, anf_feedback(&a, c, kind), key, iv) != expected[kind] || anf_eval(&f, iv) != expected[kind]) {
+          printf("[ERROR] anf      %s of clock %lu of key ", target_name(kind), c);
+          print_hex(v->key, KEYLENGTH);
+          printf(" iv ");
+          print_hex(v->iv, IVLENGTH);
+          printf("\n");
+          failures++;
+        }
+
+        anf_fn_free(&f);
+      }
+
+      trivium_word_step(&w, 1);
+    }
+  }
+
+  printf("[%s] anf      %lu key/iv pairs, %d clocks, %lu terms\n", failures ? "ERROR" : "SUCCESS", set->count, ANF_MAX_CLOCKS, a.used);
+  anf_free(&a);
+
+  return failures;
+}
+
+
+/***
+ * read_line
+ *
+ * the next non empty line of a hex file, -1 at its end or on a line that
+ * is not hex
+ *
+ */
+static long read_line(FILE* fp, u8* out, u64 max) {
+
+  char buffer[LINE_MAX_LENGTH], *text;
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    text = trim(buffer);
+    if (*text) return parse_hex(text, out, max);
+  }
+
+  return -1;
+}
+
+
+/***
+ * check_masked
+ *
+ * encrypt the plain text under every key and iv with the masked core of
+ * every order against the cipher texts of the unmasked encryptor, and
+ * recombine the shares after the initialization against the word core
+ *
+ */
+static u64 check_masked(const char* keys_path, const char* ivs_path, const char* plain_path, const char* cipher_path) {
+
+  FILE *keys = fopen(keys_path, "r"), *ivs = fopen(ivs_path, "r");
+  FILE *plain = fopen(plain_path, "r"), *cipher = fopen(cipher_path, "r");
+  u8 key[KEYLENGTH], iv[IVLENGTH], text[MAX_CIPHER], expected[MAX_CIPHER], got[MAX_CIPHER];
+  trivium_masked_t s;
+  trivium_word_t w, u;
+  long length = -1;
+  u64 k, order, lines = 0, failures = 0;
+
+  if (keys == NULL || ivs == NULL || plain == NULL || cipher == NULL) {
+    printf("[ERROR] masked: could not open %s, %s, %s and %s\n", keys_path, ivs_path, plain_path, cipher_path);
+    failures++;
+    goto done;
+  }
+
+  length = read_line(plain, text, MAX_CIPHER);
+  if (length <= 0) {
+    printf("[ERROR] masked: no plain text in %s\n", plain_path);
+    failures++;
+    goto done;
+  }
+
+  while (read_line(cipher, expected, MAX_CIPHER) == length) {
+    if (read_line(keys, key, KEYLENGTH) != KEYLENGTH || read_line(ivs, iv, IVLENGTH) != IVLENGTH) {
+      printf("[ERROR] masked: %s line %lu has no key and iv\n", cipher_path, lines + 1);
+      failures++;
+      break;
+    }
+
+    trivium_word_init(&w, key, iv);
+
+    for (order = 1; order <= MASKED_MAX_ORDER; order++) {
+      trivium_masked_init(&s, key, iv, order, 1000 * lines + order);
+      trivium_masked_unmask(&s, &u);
+      trivium_masked_stream(&s, got, (u64)length);
+
+      for (k = 0; k < (u64)length && (got[k] ^ text[k]) == expected[k]; k++);
+
+      if (k < (u64)length || u.a != w.a || u.b != w.b || u.c != w.c || s.share[0].a == w.a) {
+        printf("[ERROR] masked%lu: %s line %lu key ", order, cipher_path, lines + 1);
+        print_hex(key, KEYLENGTH);
+        printf(" iv ");
+        print_hex(iv, IVLENGTH);
+        if (k < (u64)length) {
+          printf(" byte %lu: expected %02X, got %02X\n", k, expected[k], got[k] ^ text[k]);
+        } else {
+          printf(" shares do not recombine to the state\n");
+        }
+        failures++;
+      }
+    }
+
+    lines++;
+  }
+
+  if (lines == 0) {
+    printf("[ERROR] masked: no %ld byte cipher texts in %s\n", length, cipher_path);
+    failures++;
+  }
+
+  printf("[%s] masked   %lu cipher texts, orders 1 to %d\n", failures ? "ERROR" : "SUCCESS", lines, MASKED_MAX_ORDER);
+
+done:
+  if (keys != NULL) fclose(keys);
+  if (ivs != NULL) fclose(ivs);
+  if (plain != NULL) fclose(plain);
+  if (cipher != NULL) fclose(cipher);
+
+  return failures;
+}
+
+
+/***
+ * check_layout
+ *
+ * parse a vector file in the full eSTREAM layout, with key and iv lines
+ * and xor-digests over several lines, and run the reference over it
+ *
+ */
+static u64 check_layout(const char* path) {
+
+  vectors_t set = { NULL, 0, 0 };
+  u64 i, length, failures = 1;
+  u8* keystream = NULL;
+
+  if (parse_vectors(path, &set) < 0) goto done;
+
+  for (i = 0; i < set.count; i++) {
+    if (!set.v[i].has_key || !set.v[i].has_iv || set.v[i].blocks == 0) {
+      printf("[ERROR] %s: the vector at line %lu is incomplete\n", path, set.v[i].line);
+      goto done;
+    }
+  }
+
+  if (set.count == 0 || (length = stream_length(&set)) == 0) goto done;
+
+  keystream = malloc(length);
+  if (keystream == NULL) {
+    printf("[ERROR] out of memory\n");
+    goto done;
+  }
+
+  failures = check_variant(0, &set, keystream, length);
+
+done:
+  printf("[%s] layout   %lu vectors in %s\n", failures ? "ERROR" : "SUCCESS", set.count, path);
+
+  free(keystream);
+  free(set.v);
+
+  return failures;
+}
+
+
+int main(int argc, char** argv) {
+
+  const char* vectors_path = (argc > 1) ? argv[1] : DATA_DIR "Format_test_vector_128_python/all_test_vectors.txt";
+  const char* keys_path    = (argc > 2) ? argv[2] : DATA_DIR "keys.txt";
+  const char* ivs_path     = (argc > 3) ? argv[3] : DATA_DIR "ivs.txt";
+  const char* plain_path   = (argc > 4) ? argv[4] : DATA_DIR "plain.txt";
+  const char* cipher_path  = (argc > 5) ? argv[5] : DATA_DIR "cipher.txt";
+
+  vectors_t set = { NULL, 0, 0 };
+  u64 i, length, failures = 0;
+  u8* keystream;
+
+  if (argc > 6) {
+    printf("usage: %s [vectors] [keys] [ivs] [plain] [cipher]\n", argv[0]);
+    return 2;
+  }
+
+  if (parse_vectors(vectors_path, &set) < 0) return 1;
+  if (fill_from_file(keys_path, &set, 0) < 0) return 1;
+  if (fill_from_file(ivs_path, &set, 1) < 0) return 1;
+
+  if (set.count == 0) {
+    printf("[ERROR] no vectors in %s\n", vectors_path);
+    return 1;
+  }
+
+  if ((length = stream_length(&set)) == 0) return 1;
+
+  keystream = malloc(length);
+  if (keystream == NULL) {
+    printf("[ERROR] out of memory\n");
+    return 1;
+  }
+
+  for (i = 0; i < VARIANTS; i++) failures += check_variant(i, &set, keystream, length);
+  for (i = 0; i < REDUCED_ROUNDS; i++) failures += check_rounds(reduced_rounds[i], &set);
+  failures += check_inverse(&set);
+  failures += check_targets(&set);
+  failures += check_known(&set);
+  failures += check_anf(&set);
+  failures += check_int8();
+  failures += check_masked(keys_path, ivs_path, plain_path, cipher_path);
+  failures += check_layout(LAYOUT);
+
+  free(keystream);
+  free(set.v);
+
+  return failures ? 1 : 0;
+}
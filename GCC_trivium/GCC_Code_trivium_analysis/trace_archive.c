@@ -0,0 +1,391 @@
+/*
+ * trace_archive.c
+ *
+ * pack raw float32 traces into a chunked archive (see traces.h), and
+ * get them back out
+ *
+ *  build : gcc -O3 -march=native -pthread -o trace_archive trace_archive.c traces.c -lm
+ *  run   : ./trace_archive [options] pack samples raw archive
+ *          ./trace_archive [options] unpack archive raw [first [count]]
+ *          ./trace_archive [options] compare archive raw
+ *          ./trace_archive [options] bench archive
+ *          ./trace_archive info archive
+ *
+ *   -c codec     float, quant or rice (default rice)
+ *   -q bits      quantization bits, 1..16 (default 12)
+ *   -n traces    traces per chunk (default 256)
+ *   -k keys      keys of the traces, keys.txt format (pack)
+ *   -i ivs       ivs of the traces, ivs.txt format (pack)
+ *   -t threads   decoding threads (default: online cpus)
+ *   -b traces    traces per read (default 16 chunks)
+ *
+ * raw is a file of float32 traces of the given number of samples back to
+ * back, as the scope is dumped. compare prints the largest difference
+ * between archive and raw, bench the decoding rate.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "traces.h"
+#include "util.h"
+
+
+typedef struct {
+  u32   codec;
+  u32   qbits;
+  u64   chunk_traces;
+  u64   threads;
+  u64   batch;
+  FILE* keys;
+  FILE* ivs;
+} options_t;
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+static void print_format(const trace_archive_t* a) {
+
+  const trace_format_t* f = &a->format;
+  double raw = (double)f->traces * f->samples * sizeof(float);
+
+  printf("%lu traces of %lu samples, %lu chunks of %lu\n", f->traces, f->samples, f->chunks, f->chunk_traces);
+  printf("codec %s", trace_codec_name(f->codec));
+  if (f->codec != TRACE_FLOAT) printf(", %u bits", f->qbits);
+  printf(", %lu bytes, %.2f bits per sample, ratio %.2f to float32\n", trace_archive_stored(a),
+         raw > 0 ? 8.0 * trace_archive_stored(a) / (raw / sizeof(float)) : 0.0,
+         raw > 0 ? raw / trace_archive_stored(a) : 0.0);
+
+  return;
+}
+
+
+
+/************
+ * Commands *
+ ************/
+
+
+
+static int pack(const options_t* o, u64 samples, const char* raw, const char* path) {
+
+  trace_writer_t w;
+  trace_info_t info;
+  trace_archive_t a;
+  FILE* fp = fopen(raw, "rb");
+  float* trace = malloc(samples * sizeof(float));
+  u64 traces = 0;
+  double start = now();
+  int result = 1;
+
+  if (fp == NULL || trace == NULL) {
+    printf("[ERROR] could not read %s\n", raw);
+    goto done;
+  }
+
+  if (trace_writer_open(&w, path, samples, o->chunk_traces, o->codec, o->qbits) < 0) goto done;
+
+  while (fread(trace, sizeof(float), samples, fp) == samples) {
+    memset(&info, 0, sizeof(info));
+
+    if ((o->keys != NULL && next_hex(o->keys, info.key, KEYLENGTH) < 0) ||
+        (o->ivs != NULL && next_hex(o->ivs, info.iv, IVLENGTH) < 0)) {
+      printf("[ERROR] no key or iv for trace %lu\n", traces);
+      trace_writer_close(&w);
+      goto done;
+    }
+
+    if (trace_writer_add(&w, trace, &info) < 0) {
+      trace_writer_close(&w);
+      goto done;
+    }
+
+    traces++;
+  }
+
+  if (trace_writer_close(&w) < 0 || trace_archive_open(&a, path, 1) < 0) goto done;
+
+  print_format(&a);
+  printf("packed in %.3f s\n", now() - start);
+  trace_archive_close(&a);
+
+  result = 0;
+
+done:
+  if (fp != NULL) fclose(fp);
+  free(trace);
+
+  return result;
+}
+
+
+/***
+ * unpack
+ *
+ * write traces first..first+count-1 back as raw float32; keys and ivs
+ * go to path.keys and path.ivs
+ *
+ */
+static int unpack(const options_t* o, const char* path, const char* raw, u64 first, u64 count) {
+
+  trace_archive_t a;
+  trace_info_t* info = NULL;
+  float* traces = NULL;
+  FILE *fp = NULL, *keys = NULL, *ivs = NULL;
+  char name[4096];
+  u64 i, j, n;
+  int result = 1;
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  if (first > a.format.traces) first = a.format.traces;
+  if (count > a.format.traces - first) count = a.format.traces - first;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  info = malloc(o->batch * sizeof(trace_info_t));
+  fp = fopen(raw, "wb");
+  snprintf(name, sizeof(name), "%s.keys", raw);
+  keys = fopen(name, "w");
+  snprintf(name, sizeof(name), "%s.ivs", raw);
+  ivs = fopen(name, "w");
+
+  if (traces == NULL || info == NULL || fp == NULL || keys == NULL || ivs == NULL) {
+    printf("[ERROR] could not write %s\n", raw);
+    goto done;
+  }
+
+  for (i = first; i < first + count; i += n) {
+    n = (first + count - i < o->batch) ? first + count - i : o->batch;
+
+    if (trace_archive_read(&a, i, n, traces, info) < 0) goto done;
+
+    if (fwrite(traces, sizeof(float) * a.format.samples, n, fp) != n) {
+      printf("[ERROR] could not write %s\n", raw);
+      goto done;
+    }
+
+    for (j = 0; j < n; j++) {
+      u64 b;
+      for (b = 0; b < KEYLENGTH; b++) fprintf(keys, "%02X", info[j].key[b]);
+      fprintf(keys, "\n");
+      for (b = 0; b < IVLENGTH; b++) fprintf(ivs, "%02X", info[j].iv[b]);
+      fprintf(ivs, "\n");
+    }
+  }
+
+  result = 0;
+
+done:
+  if (fp != NULL) fclose(fp);
+  if (keys != NULL) fclose(keys);
+  if (ivs != NULL) fclose(ivs);
+  free(traces);
+  free(info);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+static int compare(const options_t* o, const char* path, const char* raw) {
+
+  trace_archive_t a;
+  FILE* fp = fopen(raw, "rb");
+  float *traces = NULL, *expected = NULL;
+  double largest = 0, range = 0;
+  u64 i, j, n, values;
+  int result = 1;
+
+  if (fp == NULL) {
+    printf("[ERROR] could not read %s\n", raw);
+    return 1;
+  }
+
+  if (trace_archive_open(&a, path, o->threads) < 0) {
+    fclose(fp);
+    return 1;
+  }
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  expected = malloc(o->batch * a.format.samples * sizeof(float));
+  if (traces == NULL || expected == NULL) goto done;
+
+  for (i = 0; i < a.format.traces; i += n) {
+    n = (a.format.traces - i < o->batch) ? a.format.traces - i : o->batch;
+    values = n * a.format.samples;
+
+    if (trace_archive_read(&a, i, n, traces, NULL) < 0) goto done;
+
+    if (fread(expected, sizeof(float), values, fp) != values) {
+      printf("[ERROR] %s holds fewer traces than the archive\n", raw);
+      goto done;
+    }
+
+    for (j = 0; j < values; j++) {
+      double d = fabs((double)traces[j] - expected[j]);
+      if (d > largest) largest = d;
+      if (fabs(expected[j]) > range) range = fabs(expected[j]);
+    }
+  }
+
+  print_format(&a);
+  printf("largest difference %g (%g of the largest sample)\n", largest, range > 0 ? largest / range : 0.0);
+  result = 0;
+
+done:
+  fclose(fp);
+  free(traces);
+  free(expected);
+  trace_archive_close(&a);
+
+  return result;
+}
+
+
+/***
+ * bench
+ *
+ * decode the whole archive in batches, once in order and once in a
+ * random batch order
+ *
+ */
+static int bench(const options_t* o, const char* path) {
+
+  trace_archive_t a;
+  float* traces;
+  u64 i, n, batches, state = 1, pass;
+  double start, seconds, checksum = 0;
+
+  if (trace_archive_open(&a, path, o->threads) < 0) return 1;
+
+  traces = malloc(o->batch * a.format.samples * sizeof(float));
+  if (traces == NULL) {
+    trace_archive_close(&a);
+    return 1;
+  }
+
+  print_format(&a);
+  batches = (a.format.traces + o->batch - 1) / o->batch;
+
+  for (pass = 0; pass < 2; pass++) {
+    start = now();
+
+    for (i = 0; i < batches; i++) {
+      u64 b = pass ? splitmix64(&state) % batches : i;
+      n = (a.format.traces - b * o->batch < o->batch) ? a.format.traces - b * o->batch : o->batch;
+
+      if (trace_archive_read(&a, b * o->batch, n, traces, NULL) < 0) break;
+      checksum += traces[0];
+    }
+
+    seconds = now() - start;
+    printf("%-10s %lu threads: %10.0f traces/s, %8.1f MB/s of float32, %8.1f MB/s read (%g)\n",
+           pass ? "random" : "sequential", a.threads,
+           a.format.traces / seconds, 1e-6 * a.format.traces * a.format.samples * sizeof(float) / seconds,
+           1e-6 * trace_archive_stored(&a) / seconds, checksum);
+  }
+
+  free(traces);
+  trace_archive_close(&a);
+
+  return 0;
+}
+
+
+
+/********
+ * Main *
+ ********/
+
+
+
+static void usage(const char* name) {
+
+  printf("usage: %s [-c codec] [-q bits] [-n traces] [-k keys] [-i ivs] pack samples raw archive\n"
+         "       %s [-t threads] [-b traces] unpack archive raw [first [count]]\n"
+         "       %s [-t threads] [-b traces] compare archive raw\n"
+         "       %s [-t threads] [-b traces] bench archive\n"
+         "       %s info archive\n", name, name, name, name, name);
+
+  return;
+}
+
+
+int main(int argc, char** argv) {
+
+  options_t o = { TRACE_RICE, 12, TRACE_CHUNK, 0, 0, NULL, NULL };
+  trace_archive_t a;
+  const char* command;
+  int option, result;
+
+  o.threads = (u64)sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((option = getopt(argc, argv, "c:q:n:k:i:t:b:")) != -1) {
+    switch (option) {
+    case 'q': o.qbits        = strtoul(optarg, NULL, 10);  break;
+    case 'n': o.chunk_traces = strtoul(optarg, NULL, 10);  break;
+    case 't': o.threads      = strtoul(optarg, NULL, 10);  break;
+    case 'b': o.batch        = strtoul(optarg, NULL, 10);  break;
+    case 'c':
+      if (trace_codec_parse(optarg, &o.codec) < 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'k':
+    case 'i':
+      if ((*(option == 'k' ? &o.keys : &o.ivs) = fopen(optarg, "r")) == NULL) {
+        printf("[ERROR] could not open %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind >= argc || o.threads == 0 || o.chunk_traces == 0 || o.qbits == 0 || o.qbits > 16) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  command = argv[optind++];
+  if (o.batch == 0) o.batch = 16 * TRACE_CHUNK;
+
+  if (strcmp(command, "pack") == 0 && argc - optind == 3) {
+    result = pack(&o, strtoul(argv[optind], NULL, 10), argv[optind + 1], argv[optind + 2]);
+  } else if (strcmp(command, "unpack") == 0 && argc - optind >= 2 && argc - optind <= 4) {
+    result = unpack(&o, argv[optind], argv[optind + 1],
+                    argc - optind > 2 ? strtoul(argv[optind + 2], NULL, 10) : 0,
+                    argc - optind > 3 ? strtoul(argv[optind + 3], NULL, 10) : UINT64_MAX);
+  } else if (strcmp(command, "compare") == 0 && argc - optind == 2) {
+    result = compare(&o, argv[optind], argv[optind + 1]);
+  } else if (strcmp(command, "bench") == 0 && argc - optind == 1) {
+    result = bench(&o, argv[optind]);
+  } else if (strcmp(command, "info") == 0 && argc - optind == 1) {
+    result = trace_archive_open(&a, argv[optind], 1) < 0;
+    if (result == 0) {
+      print_format(&a);
+      trace_archive_close(&a);
+    }
+  } else {
+    usage(argv[0]);
+    result = 2;
+  }
+
+  if (o.keys != NULL) fclose(o.keys);
+  if (o.ivs != NULL) fclose(o.ivs);
+
+  return result;
+}
@@ -0,0 +1,771 @@
+/*
+ * traces.c
+ *
+ * chunked trace archive (see traces.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "traces.h"
+
+#define RICE_K_BITS  5
+#define RICE_ESCAPE  24                 // unary quotients from here on are escaped
+#define PADDING      8                  // zero bytes after a rice payload
+
+static const char* codec_name[] = { "float", "quant", "rice" };
+
+
+
+/***********
+ * Helpers *
+ ***********/
+
+
+
+const char* trace_codec_name(u32 codec) {
+  return codec <= TRACE_RICE ? codec_name[codec] : "unknown";
+}
+
+
+int trace_codec_parse(const char* name, u32* codec) {
+
+  u32 i;
+
+  for (i = 0; i <= TRACE_RICE; i++) {
+    if (strcmp(name, codec_name[i]) == 0) {
+      *codec = i;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+/***
+ * sample_bytes
+ *
+ * bytes per sample of the float and quant payloads
+ *
+ */
+static u64 sample_bytes(const trace_format_t* f) {
+
+  if (f->codec == TRACE_FLOAT) return sizeof(float);
+
+  return f->qbits <= 8 ? 1 : 2;
+}
+
+
+/***
+ * chunk_bound
+ *
+ * largest encoded size of a chunk of n traces
+ *
+ */
+static u64 chunk_bound(const trace_format_t* f, u64 n) {
+
+  u64 bytes = 2 * sizeof(float) + n * sizeof(trace_info_t);
+  u64 blocks = (f->samples + TRACE_BLOCK - 1) / TRACE_BLOCK;
+
+  if (f->codec != TRACE_RICE) return bytes + n * f->samples * sample_bytes(f);
+
+  return bytes + 2 * f->samples + (n * (blocks * RICE_K_BITS + f->samples * (RICE_ESCAPE + 1 + f->qbits + 1)) + 7) / 8 + PADDING;
+}
+
+
+static void put_u32(u8* p, u32 v) { memcpy(p, &v, sizeof(v)); }
+static void put_u64(u8* p, u64 v) { memcpy(p, &v, sizeof(v)); }
+static u32  get_u32(const u8* p) { u32 v; memcpy(&v, p, sizeof(v)); return v; }
+static u64  get_u64(const u8* p) { u64 v; memcpy(&v, p, sizeof(v)); return v; }
+
+
+
+/**************
+ * Rice codes *
+ **************/
+
+
+
+typedef struct {
+  u8*  p;
+  u64  acc;
+  u32  n;                               // pending bits in acc, < 8 between calls
+} bit_writer_t;
+
+
+typedef struct {
+  const u8* p;
+  const u8* end;                        // of the input, never read past
+  u64  buf;                             // left aligned
+  u32  n;                               // valid bits in buf
+} bit_reader_t;
+
+
+/***
+ * bits_put
+ *
+ * append the low bits of v, most significant first (bits <= 32)
+ *
+ */
+static inline void bits_put(bit_writer_t* w, u64 v, u32 bits) {
+
+  w->acc = (w->acc << bits) | v;
+  w->n += bits;
+
+  while (w->n >= 8) {
+    w->n -= 8;
+    *w->p++ = (u8)(w->acc >> w->n);
+  }
+
+  return;
+}
+
+
+static inline void bits_flush(bit_writer_t* w) {
+
+  if (w->n > 0) *w->p++ = (u8)(w->acc << (8 - w->n));
+  w->n = 0;
+
+  return;
+}
+
+
+/***
+ * bits_refill
+ *
+ * at least 57 valid bits afterwards. Near the end of the input the load
+ * is cut short and zeros come in instead, p still advancing: p past
+ * end means the stream ran out
+ *
+ */
+static inline void bits_refill(bit_reader_t* r) {
+
+  u64 next = 0;
+
+  // whole bytes, as many as fit, with one big endian load
+  if (r->p + sizeof(next) <= r->end) {
+    memcpy(&next, r->p, sizeof(next));
+  } else if (r->p < r->end) {
+    memcpy(&next, r->p, (size_t)(r->end - r->p));
+  }
+  r->buf |= __builtin_bswap64(next) >> r->n;
+  r->p += (63 - r->n) >> 3;
+  r->n |= 56;
+
+  return;
+}
+
+
+static inline u32 bits_get(bit_reader_t* r, u32 bits) {
+
+  u32 v;
+
+  if (bits == 0) return 0;
+
+  v = (u32)(r->buf >> (64 - bits));
+  r->buf <<= bits;
+  r->n -= bits;
+
+  return v;
+}
+
+
+/***
+ * rice_put
+ *
+ * zigzagged value z with parameter k: the quotient in unary (zeros
+ * closed by a one), then the k low bits; large quotients escape to the
+ * whole value in zbits bits
+ *
+ */
+static inline void rice_put(bit_writer_t* w, u32 z, u32 k, u32 zbits) {
+
+  u32 q = z >> k;
+
+  if (q < RICE_ESCAPE) {
+    bits_put(w, 1, q + 1);
+    if (k > 0) bits_put(w, z & ((1u << k) - 1), k);
+  } else {
+    bits_put(w, 1, RICE_ESCAPE + 1);
+    bits_put(w, z, zbits);
+  }
+
+  return;
+}
+
+
+static inline u32 rice_get(bit_reader_t* r, u32 k, u32 zbits) {
+
+  u32 q;
+
+  bits_refill(r);
+
+  // a sound stream holds a one within RICE_ESCAPE + 1 bits, a damaged
+  // one is caught by the caller when it runs past the input
+  q = r->buf ? (u32)__builtin_clzll(r->buf) : 64;
+  if (q > RICE_ESCAPE) q = RICE_ESCAPE;
+  r->buf <<= q + 1;
+  r->n -= q + 1;
+
+  if (q < RICE_ESCAPE) return (q << k) | bits_get(r, k);
+
+  return bits_get(r, zbits);
+}
+
+
+static inline u32 zigzag(int32_t v)   { return ((u32)v << 1) ^ (u32)(v >> 31); }
+static inline int32_t unzigzag(u32 z) { return (int32_t)(z >> 1) ^ -(int32_t)(z & 0x01); }
+
+
+/***
+ * rice_parameter
+ *
+ * k for a block of zigzagged values: 2^k close to their mean
+ *
+ */
+static inline u32 rice_parameter(const u32* z, u64 n, u32 zbits) {
+
+  u64 sum = 0, i;
+  u32 k = 0;
+
+  for (i = 0; i < n; i++) sum += z[i];
+
+  while (k < zbits && (n << (k + 1)) <= sum) k++;
+
+  return k;
+}
+
+
+
+/**********
+ * Writer *
+ **********/
+
+
+
+/***
+ * encode_chunk
+ *
+ * encode the buffered traces of the writer, returns the encoded size
+ *
+ */
+static u64 encode_chunk(trace_writer_t* w) {
+
+  const trace_format_t* f = &w->format;
+  u64 n = w->filled, values = n * f->samples, i, t, j;
+  u32 levels = (f->codec == TRACE_FLOAT) ? 0 : (1u << f->qbits) - 1, zbits = f->qbits + 1;
+  float lo = 0, hi = 0, step = 1;
+  u8* p = w->out;
+
+  if (f->codec != TRACE_FLOAT && values > 0) {
+    lo = hi = w->chunk[0];
+
+    for (i = 1; i < values; i++) {
+      if (w->chunk[i] < lo) lo = w->chunk[i];
+      if (w->chunk[i] > hi) hi = w->chunk[i];
+    }
+
+    if (hi > lo) step = (hi - lo) / (float)levels;
+  }
+
+  memcpy(p, &lo, sizeof(float));
+  memcpy(p + sizeof(float), &step, sizeof(float));
+  p += 2 * sizeof(float);
+
+  memcpy(p, w->info, n * sizeof(trace_info_t));
+  p += n * sizeof(trace_info_t);
+
+  if (f->codec == TRACE_FLOAT) {
+    memcpy(p, w->chunk, values * sizeof(float));
+    return (u64)(p - w->out) + values * sizeof(float);
+  }
+
+  // quantize in place, the values stay exact in a float
+  for (i = 0; i < values; i++) {
+    float q = rintf((w->chunk[i] - lo) / step);
+    w->chunk[i] = q < 0 ? 0 : (q > (float)levels ? (float)levels : q);
+  }
+
+  if (f->codec == TRACE_QUANT) {
+    if (f->qbits <= 8) {
+      for (i = 0; i < values; i++) p[i] = (u8)w->chunk[i];
+    } else {
+      for (i = 0; i < values; i++) {
+        u16 v = (u16)w->chunk[i];
+        memcpy(p + 2 * i, &v, sizeof(v));
+      }
+    }
+    return (u64)(p - w->out) + values * sample_bytes(f);
+  }
+
+  // rice: mean trace of the chunk as the predictor
+  {
+    bit_writer_t b = { NULL, 0, 0 };
+    u32 z[TRACE_BLOCK], k;
+    u16* mean = malloc(f->samples * sizeof(u16));
+
+    if (mean == NULL) return 0;
+
+    for (j = 0; j < f->samples; j++) {
+      double sum = 0;
+      for (t = 0; t < n; t++) sum += w->chunk[t * f->samples + j];
+      mean[j] = (u16)lrint(sum / (double)n);
+    }
+
+    memcpy(p, mean, f->samples * sizeof(u16));
+    b.p = p + f->samples * sizeof(u16);
+
+    for (t = 0; t < n; t++) {
+      const float* q = w->chunk + t * f->samples;
+
+      for (j = 0; j < f->samples; j += TRACE_BLOCK) {
+        u64 m = (f->samples - j < TRACE_BLOCK) ? f->samples - j : TRACE_BLOCK;
+
+        for (i = 0; i < m; i++) z[i] = zigzag((int32_t)q[j + i] - (int32_t)mean[j + i]);
+
+        k = rice_parameter(z, m, zbits);
+        bits_put(&b, k, RICE_K_BITS);
+
+        for (i = 0; i < m; i++) rice_put(&b, z[i], k, zbits);
+      }
+    }
+
+    bits_flush(&b);
+    memset(b.p, 0, PADDING);
+    free(mean);
+
+    return (u64)(b.p - w->out) + PADDING;
+  }
+}
+
+
+static int write_header(FILE* fp, const trace_format_t* f, u64 index_offset) {
+
+  u8 header[TRACE_HEADER] = { 0 };
+
+  memcpy(header, TRACE_MAGIC, 8);
+  put_u32(header + 8,  TRACE_VERSION);
+  put_u32(header + 12, f->codec);
+  put_u32(header + 16, f->qbits);
+  put_u64(header + 24, f->samples);
+  put_u64(header + 32, f->traces);
+  put_u64(header + 40, f->chunk_traces);
+  put_u64(header + 48, f->chunks);
+  put_u64(header + 56, index_offset);
+
+  return fwrite(header, TRACE_HEADER, 1, fp) == 1 ? 0 : -1;
+}
+
+
+/***
+ * trace_writer_flush
+ *
+ * encode and append the buffered traces as one chunk
+ *
+ */
+static int trace_writer_flush(trace_writer_t* w) {
+
+  trace_format_t* f = &w->format;
+  u64 size, capacity, *index;
+
+  if (w->filled == 0) return 0;
+
+  if (f->chunks == w->capacity) {
+    capacity = w->capacity ? 2 * w->capacity : 1024;
+    index = realloc(w->index, 2 * capacity * sizeof(u64));
+    if (index == NULL) return -1;
+    w->index = index;
+    w->capacity = capacity;
+  }
+
+  size = encode_chunk(w);
+  if (size == 0 || fwrite(w->out, size, 1, w->fp) != 1) return -1;
+
+  w->index[2 * f->chunks]     = w->offset;
+  w->index[2 * f->chunks + 1] = size;
+  w->offset += size;
+
+  f->chunks++;
+  f->traces += w->filled;
+  w->filled = 0;
+
+  return 0;
+}
+
+
+int trace_writer_open(trace_writer_t* w, const char* path, u64 samples, u64 chunk_traces, u32 codec, u32 qbits) {
+
+  trace_format_t* f = &w->format;
+
+  memset(w, 0, sizeof(trace_writer_t));
+
+  if (samples == 0 || chunk_traces == 0 || codec > TRACE_RICE ||
+      (codec != TRACE_FLOAT && (qbits == 0 || qbits > 16))) {
+    printf("[ERROR] %s: bad archive format\n", path);
+    return -1;
+  }
+
+  f->codec        = codec;
+  f->qbits        = (codec == TRACE_FLOAT) ? 32 : qbits;
+  f->samples      = samples;
+  f->chunk_traces = chunk_traces;
+
+  w->chunk = malloc(chunk_traces * samples * sizeof(float));
+  w->info  = malloc(chunk_traces * sizeof(trace_info_t));
+  w->out   = malloc(chunk_bound(f, chunk_traces));
+  w->fp    = fopen(path, "wb");
+
+  if (w->chunk == NULL || w->info == NULL || w->out == NULL || w->fp == NULL ||
+      write_header(w->fp, f, 0) < 0) {
+    printf("[ERROR] could not create %s\n", path);
+    if (w->fp != NULL) fclose(w->fp);
+    free(w->chunk);
+    free(w->info);
+    free(w->out);
+    return -1;
+  }
+
+  w->offset = TRACE_HEADER;
+
+  return 0;
+}
+
+
+int trace_writer_add(trace_writer_t* w, const float* trace, const trace_info_t* info) {
+
+  memcpy(w->chunk + w->filled * w->format.samples, trace, w->format.samples * sizeof(float));
+
+  if (info != NULL) w->info[w->filled] = *info;
+  else memset(&w->info[w->filled], 0, sizeof(trace_info_t));
+
+  if (++w->filled == w->format.chunk_traces) return trace_writer_flush(w);
+
+  return 0;
+}
+
+
+/***
+ * trace_writer_close
+ *
+ * flush the last chunk, append the index and complete the header
+ *
+ */
+int trace_writer_close(trace_writer_t* w) {
+
+  int result = trace_writer_flush(w);
+
+  if (result == 0 && w->format.chunks > 0 &&
+      fwrite(w->index, 2 * w->format.chunks * sizeof(u64), 1, w->fp) != 1) result = -1;
+
+  if (result == 0 && (fseek(w->fp, 0, SEEK_SET) != 0 || write_header(w->fp, &w->format, w->offset) < 0)) result = -1;
+
+  if (fclose(w->fp) != 0) result = -1;
+  if (result < 0) printf("[ERROR] could not write the trace archive\n");
+
+  free(w->chunk);
+  free(w->info);
+  free(w->out);
+  free(w->index);
+
+  return result;
+}
+
+
+
+/**********
+ * Reader *
+ **********/
+
+
+
+int trace_archive_open(trace_archive_t* a, const char* path, u64 threads) {
+
+  trace_format_t* f = &a->format;
+  u8 header[TRACE_HEADER];
+  u64 index_offset, i, expected = TRACE_HEADER;
+
+  memset(a, 0, sizeof(trace_archive_t));
+  a->threads = (threads == 0) ? 1 : (threads > TRACE_MAX_THREADS ? TRACE_MAX_THREADS : threads);
+
+  a->fd = open(path, O_RDONLY);
+  if (a->fd < 0) {
+    printf("[ERROR] could not open %s\n", path);
+    return -1;
+  }
+
+  if (pread(a->fd, header, TRACE_HEADER, 0) != TRACE_HEADER || memcmp(header, TRACE_MAGIC, 8) != 0 ||
+      get_u32(header + 8) != TRACE_VERSION) {
+    printf("[ERROR] %s is not a trace archive\n", path);
+    goto fail;
+  }
+
+  f->codec        = get_u32(header + 12);
+  f->qbits        = get_u32(header + 16);
+  f->samples      = get_u64(header + 24);
+  f->traces       = get_u64(header + 32);
+  f->chunk_traces = get_u64(header + 40);
+  f->chunks       = get_u64(header + 48);
+  index_offset    = get_u64(header + 56);
+
+  if (f->codec > TRACE_RICE || f->samples == 0 || f->chunk_traces == 0 || index_offset == 0 ||
+      (f->codec != TRACE_FLOAT && (f->qbits == 0 || f->qbits > 16)) ||
+      f->chunks != (f->traces + f->chunk_traces - 1) / f->chunk_traces) {
+    printf("[ERROR] %s: damaged or unfinished archive\n", path);
+    goto fail;
+  }
+
+  a->index = malloc((2 * f->chunks + 1) * sizeof(u64));
+
+  if (a->index == NULL ||
+      pread(a->fd, a->index, 2 * f->chunks * sizeof(u64), (off_t)index_offset) != (ssize_t)(2 * f->chunks * sizeof(u64))) {
+    printf("[ERROR] %s: could not read the chunk index\n", path);
+    goto fail;
+  }
+
+  // chunks follow each other, and none may be larger than its bound
+  for (i = 0; i < f->chunks; i++) {
+    u64 n = (i + 1 < f->chunks) ? f->chunk_traces : f->traces - i * f->chunk_traces;
+
+    if (a->index[2 * i] != expected || a->index[2 * i + 1] > chunk_bound(f, n) ||
+        a->index[2 * i + 1] < 2 * sizeof(float) + n * sizeof(trace_info_t)) {
+      printf("[ERROR] %s: damaged chunk index\n", path);
+      goto fail;
+    }
+
+    expected += a->index[2 * i + 1];
+    if (a->index[2 * i + 1] > a->largest) a->largest = a->index[2 * i + 1];
+  }
+
+  return 0;
+
+fail:
+  close(a->fd);
+  free(a->index);
+  a->index = NULL;
+
+  return -1;
+}
+
+
+void trace_archive_close(trace_archive_t* a) {
+
+  close(a->fd);
+  free(a->index);
+  memset(a, 0, sizeof(trace_archive_t));
+
+  return;
+}
+
+
+/***
+ * trace_archive_stored
+ *
+ * size of the archive in bytes
+ *
+ */
+u64 trace_archive_stored(const trace_archive_t* a) {
+
+  u64 last = a->format.chunks - 1;
+
+  if (a->format.chunks == 0) return TRACE_HEADER;
+
+  return a->index[2 * last] + a->index[2 * last + 1] + 2 * a->format.chunks * sizeof(u64);
+}
+
+
+/***
+ * decode_chunk
+ *
+ * traces lo..hi-1 of an encoded chunk of n traces into out; the rice
+ * codec has to run through the traces before lo, into scratch
+ *
+ */
+static int decode_chunk(const trace_format_t* f, const u8* in, u64 size, u64 n, u64 lo, u64 hi,
+                        float* out, trace_info_t* info, float* scratch) {
+
+  u64 values = f->samples, t, j, i;
+  float offset, step;
+  const u8* p = in;
+
+  memcpy(&offset, p, sizeof(float));
+  memcpy(&step, p + sizeof(float), sizeof(float));
+  p += 2 * sizeof(float);
+
+  if (info != NULL) memcpy(info, p + lo * sizeof(trace_info_t), (hi - lo) * sizeof(trace_info_t));
+  p += n * sizeof(trace_info_t);
+
+  if (f->codec == TRACE_FLOAT) {
+    if ((u64)(p - in) + n * values * sizeof(float) != size) return -1;
+    memcpy(out, p + lo * values * sizeof(float), (hi - lo) * values * sizeof(float));
+    return 0;
+  }
+
+  if (f->codec == TRACE_QUANT) {
+    if ((u64)(p - in) + n * values * sample_bytes(f) != size) return -1;
+
+    if (f->qbits <= 8) {
+      const u8* q = p + lo * values;
+      for (i = 0; i < (hi - lo) * values; i++) out[i] = offset + step * (float)q[i];
+    } else {
+      const u8* q = p + 2 * lo * values;
+      for (i = 0; i < (hi - lo) * values; i++) {
+        u16 v;
+        memcpy(&v, q + 2 * i, sizeof(v));
+        out[i] = offset + step * (float)v;
+      }
+    }
+    return 0;
+  }
+
+  // rice
+  {
+    const u8* mean = p;
+    bit_reader_t r = { p + values * sizeof(u16), in + size, 0, 0 };
+    u32 zbits = f->qbits + 1, k;
+    float base[TRACE_BLOCK];
+
+    if ((u64)(r.p - in) + PADDING > size) return -1;
+
+    for (t = 0; t < hi; t++) {
+      float* o = (t < lo) ? scratch : out + (t - lo) * values;
+
+      for (j = 0; j < values; j += TRACE_BLOCK) {
+        u64 m = (values - j < TRACE_BLOCK) ? values - j : TRACE_BLOCK;
+
+        // a damaged stream runs past its chunk
+        if (r.p > r.end) return -1;
+
+        bits_refill(&r);
+        k = bits_get(&r, RICE_K_BITS);
+
+        for (i = 0; i < m; i++) {
+          u16 v;
+          memcpy(&v, mean + 2 * (j + i), sizeof(v));
+          base[i] = (float)v;
+        }
+
+        for (i = 0; i < m; i++) {
+          int32_t d = unzigzag(rice_get(&r, k, zbits));
+          o[j + i] = offset + step * (base[i] + (float)d);
+        }
+      }
+    }
+
+    if (r.p > r.end) return -1;
+  }
+
+  return 0;
+}
+
+
+typedef struct {
+  const trace_archive_t* a;
+  u64     first;
+  u64     count;
+  u64     c0, c1;                       // chunks to decode
+  u64     next;                         // next chunk, shared by the workers
+  float*  traces;
+  trace_info_t* info;
+  int     error;
+} read_job_t;
+
+
+static void* read_worker(void* arg) {
+
+  read_job_t* job = arg;
+  const trace_format_t* f = &job->a->format;
+  u8* in = malloc(job->a->largest);
+  float* scratch = malloc(f->samples * sizeof(float));
+  u64 c, lo, hi, n, start;
+
+  if (in == NULL || scratch == NULL) {
+    job->error = 1;
+    goto done;
+  }
+
+  while ((c = job->c0 + __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->c1) {
+    start = c * f->chunk_traces;
+    n = (c + 1 < f->chunks) ? f->chunk_traces : f->traces - start;
+
+    lo = (job->first > start) ? job->first - start : 0;
+    hi = (job->first + job->count < start + n) ? job->first + job->count - start : n;
+
+    if (pread(job->a->fd, in, job->a->index[2 * c + 1], (off_t)job->a->index[2 * c]) != (ssize_t)job->a->index[2 * c + 1] ||
+        decode_chunk(f, in, job->a->index[2 * c + 1], n, lo, hi,
+                     job->traces + (start + lo - job->first) * f->samples,
+                     job->info ? job->info + (start + lo - job->first) : NULL, scratch) < 0) {
+      job->error = 1;
+      break;
+    }
+  }
+
+done:
+  free(in);
+  free(scratch);
+
+  return NULL;
+}
+
+
+/***
+ * trace_archive_read
+ *
+ * traces first..first+count-1 and, if info is not NULL, what they were
+ * recorded with. The chunks are decoded in parallel, so reading many
+ * chunks at a time is cheaper than reading them one by one.
+ *
+ */
+int trace_archive_read(const trace_archive_t* a, u64 first, u64 count, float* traces, trace_info_t* info) {
+
+  const trace_format_t* f = &a->format;
+  pthread_t thread[TRACE_MAX_THREADS];
+  read_job_t job;
+  u64 i, threads;
+
+  if (count == 0) return 0;
+
+  if (first + count > f->traces || first + count < first) {
+    printf("[ERROR] traces %lu..%lu are not in the archive\n", first, first + count - 1);
+    return -1;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.a      = a;
+  job.first  = first;
+  job.count  = count;
+  job.c0     = first / f->chunk_traces;
+  job.c1     = (first + count - 1) / f->chunk_traces + 1;
+  job.traces = traces;
+  job.info   = info;
+
+  threads = (job.c1 - job.c0 < a->threads) ? job.c1 - job.c0 : a->threads;
+
+  if (threads == 1) {
+    read_worker(&job);
+  } else {
+    for (i = 0; i < threads; i++) {
+      if (pthread_create(&thread[i], NULL, read_worker, &job) != 0) break;
+    }
+
+    // whatever could not get a thread is done by the ones that did
+    if (i == 0) read_worker(&job);
+    threads = i;
+
+    for (i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+  }
+
+  if (job.error) {
+    printf("[ERROR] damaged chunk in traces %lu..%lu\n", first, first + count - 1);
+    return -1;
+  }
+
+  return 0;
+}
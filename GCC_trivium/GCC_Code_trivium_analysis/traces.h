@@ -0,0 +1,111 @@
+/*
+ * traces.h
+ *
+ * chunked trace archive
+ *
+ * a campaign of power traces is stored as a header, a sequence of
+ * chunks of a fixed number of traces (the last one may be short) and an
+ * index of the chunks at the end of the file, so any trace is found
+ * without reading the ones before it. Every trace carries the key and
+ * iv it was recorded with.
+ *
+ * codecs:
+ *
+ *   float   the float32 samples as recorded
+ *   quant   samples quantized to qbits <= 16 bits with a per chunk
+ *           offset and step, stored in one or two bytes
+ *   rice    the same quantization, predicted by the chunk's mean trace
+ *           and the residuals rice coded in blocks of TRACE_BLOCK
+ *           samples with their own parameter
+ *
+ * the quantized codecs are lossy by at most half a step. The step spans
+ * the chunk's own range, so it does not fall on the scope's ADC grid
+ * even with qbits set to its resolution: the codes come back rounded,
+ * and only float keeps them exactly. All numbers are little endian.
+ *
+ *   header  "TRVTRACE" version codec qbits samples traces chunk_traces
+ *           chunks index_offset                              (64 bytes)
+ *   chunk   offset step (float) | info[n] | payload
+ *   index   chunks x { offset, size }                        (u64 each)
+ *
+ */
+
+#ifndef TRACES_H
+#define TRACES_H
+
+#include <stdio.h>
+
+#include "trivium.h"
+
+#define TRACE_MAGIC        "TRVTRACE"
+#define TRACE_VERSION      1
+#define TRACE_HEADER       64
+#define TRACE_CHUNK        256          // default traces per chunk
+#define TRACE_BLOCK        32           // samples per rice parameter
+#define TRACE_MAX_THREADS  256
+
+enum {
+  TRACE_FLOAT = 0,
+  TRACE_QUANT = 1,
+  TRACE_RICE  = 2
+};
+
+
+/***
+ * trace_info_t
+ *
+ * what a trace was recorded with, file order as in keys.txt / ivs.txt
+ *
+ */
+typedef struct {
+  u8 key[KEYLENGTH];
+  u8 iv[IVLENGTH];
+} trace_info_t;
+
+
+typedef struct {
+  u32    codec;
+  u32    qbits;
+  u64    samples;                   // per trace
+  u64    traces;
+  u64    chunk_traces;
+  u64    chunks;
+} trace_format_t;
+
+
+typedef struct {
+  trace_format_t format;
+  FILE*   fp;
+  u64     filled;                   // traces in the current chunk
+  float*  chunk;                    // [chunk_traces][samples]
+  trace_info_t* info;
+  u8*     out;                      // encoded chunk
+  u64*    index;                    // [2 * chunks]
+  u64     capacity;                 // of the index, in chunks
+  u64     offset;                   // file offset of the next chunk
+} trace_writer_t;
+
+
+typedef struct {
+  trace_format_t format;
+  int     fd;
+  u64*    index;                    // [2 * chunks]
+  u64     largest;                  // largest encoded chunk
+  u64     threads;                  // used to decode
+} trace_archive_t;
+
+
+const char* trace_codec_name(u32 codec);
+int  trace_codec_parse(const char* name, u32* codec);
+
+int  trace_writer_open(trace_writer_t* w, const char* path, u64 samples, u64 chunk_traces, u32 codec, u32 qbits);
+int  trace_writer_add(trace_writer_t* w, const float* trace, const trace_info_t* info);
+int  trace_writer_close(trace_writer_t* w);
+
+int  trace_archive_open(trace_archive_t* a, const char* path, u64 threads);
+void trace_archive_close(trace_archive_t* a);
+int  trace_archive_read(const trace_archive_t* a, u64 first, u64 count, float* traces, trace_info_t* info);
+
+u64  trace_archive_stored(const trace_archive_t* a);
+
+#endif
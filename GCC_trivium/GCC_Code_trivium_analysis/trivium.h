@@ -0,0 +1,269 @@
+/*
+ * trivium.h
+ *
+ * shared definitions for the trivium analysis tools
+ *
+ *  trivium_ref.c    - byte oriented reference (the code running on the PIC)
+ *  trivium_word.c   - word oriented core, 64 clocks per step
+ *  trivium_slice.c  - bitsliced core, 64 or 256 independent instances
+ *  trivium_masked.c - boolean masked word core of order 1 or more
+ *  trivium_byte.c   - byte aligned core, 8 clocks per step, the portable
+ *                     model of the firmware kernel pic_kernel generates
+ *
+ * keys and ivs are always passed in file order, i.e. the order in which
+ * they appear in keys.txt / ivs.txt
+ *
+ */
+
+#ifndef TRIVIUM_H
+#define TRIVIUM_H
+
+#include <stdint.h>
+
+#define STATELENGTH 36
+#define KEYLENGTH   10
+#define IVLENGTH    10
+
+// full warm up; reduced round variants pass their own count
+#define INIT_ROUNDS (4 * 288)
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef unsigned __int128 u128;
+
+
+/*************
+ * Reference *
+ *************/
+
+extern u8  trivum_state[STATELENGTH];
+extern u64 init_rounds;
+
+u8* setup(u8* key, u8* iv);
+u8  update(u8* state);
+u8  stream(u8* state);
+
+void ip_encrypt(u8* key, u8* iv, u8* input, u64 length);
+u8*  encrypt(u8* key, u8* iv, u8* input, u64 length);
+
+void trivium_ref_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+
+
+/*****************
+ * Word oriented *
+ *****************/
+
+/***
+ * trivium_word_t
+ *
+ * the three shift registers, oldest bit in the lowest position:
+ * bit (len - 1 - i) of a register holds its (i + 1)th state bit, so
+ * a = s1..s93, b = s94..s177, c = s178..s288
+ *
+ */
+typedef struct {
+  u128 a;
+  u128 b;
+  u128 c;
+} trivium_word_t;
+
+#define ALEN 93
+#define BLEN 84
+#define CLEN 111
+
+#define STATEBITS (ALEN + BLEN + CLEN)
+
+
+/***
+ * tap
+ *
+ * the next 64 values of state bit (i + 1) of a register of length len,
+ * bit k of the result is the value seen at clock k
+ *
+ */
+static inline u64 tap(u128 r, unsigned len, unsigned i) {
+  return (u64)(r >> (len - 1 - i));
+}
+
+
+/***
+ * trivium_word_step
+ *
+ * clock the state n times (1 <= n <= 64) and return the n keystream
+ * bits, first bit in the least significant position. Every state bit is
+ * at least 66 clocks away from the feedback that overwrites it, so the
+ * n clocks are computed at once. Inline so that trivium_word_rounds()
+ * and the tools that clock a state themselves pay no call per step.
+ *
+ */
+static inline u64 trivium_word_step(trivium_word_t* s, unsigned n) {
+
+  u64 mask = (n == 64) ? ~(u64)0 : (((u64)1 << n) - 1);
+  u64 t1, t2, t3, z;
+
+  t1 = tap(s->a, ALEN, 65)  ^ tap(s->a, ALEN, 92);
+  t2 = tap(s->b, BLEN, 68)  ^ tap(s->b, BLEN, 83);
+  t3 = tap(s->c, CLEN, 65)  ^ tap(s->c, CLEN, 110);
+
+  z = t1 ^ t2 ^ t3;
+
+  t1 = t1 ^ (tap(s->a, ALEN, 90)  & tap(s->a, ALEN, 91))  ^ tap(s->b, BLEN, 77);
+  t2 = t2 ^ (tap(s->b, BLEN, 81)  & tap(s->b, BLEN, 82))  ^ tap(s->c, CLEN, 86);
+  t3 = t3 ^ (tap(s->c, CLEN, 108) & tap(s->c, CLEN, 109)) ^ tap(s->a, ALEN, 68);
+
+  s->a = (s->a >> n) | ((u128)(t3 & mask) << (ALEN - n));
+  s->b = (s->b >> n) | ((u128)(t1 & mask) << (BLEN - n));
+  s->c = (s->c >> n) | ((u128)(t2 & mask) << (CLEN - n));
+
+  return z & mask;
+}
+
+
+void trivium_word_load(trivium_word_t* s, const u8* key, const u8* iv);
+void trivium_word_bits(const trivium_word_t* s, u8* bits);
+void trivium_word_from_bits(trivium_word_t* s, const u8* bits);
+int  trivium_word_loaded(const trivium_word_t* s, u8* key, u8* iv);
+void trivium_word_rounds(trivium_word_t* s, u64 rounds);
+void trivium_word_init(trivium_word_t* s, const u8* key, const u8* iv);
+void trivium_word_back(trivium_word_t* s, u64 clocks);
+void trivium_word_init_rounds(trivium_word_t* s, const u8* key, const u8* iv, u64 rounds);
+void trivium_word_stream(trivium_word_t* s, u8* out, u64 length);
+
+void trivium_word_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+void trivium_word_keystream_rounds(const u8* key, const u8* iv, u64 rounds, u8* out, u64 length);
+
+
+/*************
+ * Bitsliced *
+ *************/
+
+/***
+ * lane64_t / lane256_t
+ *
+ * one word per state bit, bit l of the word belongs to instance l. Both
+ * are gcc vectors so the same code serves either width (lane256_t maps
+ * to AVX2 registers with -march=native)
+ *
+ */
+typedef u64 lane64_t  __attribute__((vector_size(8)));
+typedef u64 lane256_t __attribute__((vector_size(32)));
+
+#define LANE_WORDS(lane_t) (sizeof(lane_t) / sizeof(u64))
+
+// clocks between two rewinds of the register windows
+#define SLICE_WINDOW 128
+
+/***
+ * trivium_slice64_t / trivium_slice256_t
+ *
+ * the registers slide down a buffer one word per clock instead of
+ * shifting 288 words (up when clocking backwards), and are copied back
+ * to their home position every SLICE_WINDOW clocks so the whole state
+ * stays in L1
+ *
+ *  _load      - load 288 state words, s1..s288
+ *  _bits      - the 288 state words, s1..s288
+ *  _broadcast - load the same key and iv into every instance
+ *  _run       - clock n times, writing the keystream words to z unless
+ *               z is NULL
+ *  _back      - clock n times backwards
+ *  _keystream - keystream of instance 0 (all instances must agree),
+ *               for the conformance runner
+ *
+ */
+#define SLICE_DECLARE(name, lane_t)                                    \
+  typedef struct {                                                     \
+    lane_t  buf[4 * SLICE_WINDOW + STATEBITS];                         \
+    lane_t* a;                                                         \
+    lane_t* b;                                                         \
+    lane_t* c;                                                         \
+  } name##_t;                                                          \
+                                                                       \
+  void name##_load(name##_t* s, const lane_t* bits);                   \
+  void name##_broadcast(name##_t* s, const u8* key, const u8* iv);     \
+  void name##_bits(const name##_t* s, lane_t* bits);                   \
+  void name##_run(name##_t* s, u64 clocks, lane_t* z);                 \
+  void name##_back(name##_t* s, u64 clocks);                           \
+  void name##_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+
+SLICE_DECLARE(trivium_slice64,  lane64_t)
+SLICE_DECLARE(trivium_slice256, lane256_t)
+
+
+
+/**********
+ * Masked *
+ **********/
+
+#define MASKED_MAX_ORDER 3
+
+/***
+ * trivium_masked_t
+ *
+ * order + 1 word oriented states whose xor is the trivium state. The
+ * linear terms are computed share by share, the three and terms with the
+ * ISW gadget on fresh randomness from a splitmix64 counter, so any order
+ * shares of a clock are independent of the unmasked state. Only the
+ * keystream, which is public, is recombined.
+ *
+ *  _load      - split the loaded key and iv state into fresh shares
+ *  _unmask    - recombine the shares (for checks, never on the device)
+ *  _keystream - conformance runner entries, order 1 and 2
+ *
+ */
+typedef struct {
+  u64            order;
+  u64            random;                // splitmix64 counter
+  trivium_word_t share[MASKED_MAX_ORDER + 1];
+} trivium_masked_t;
+
+void trivium_masked_load(trivium_masked_t* s, const u8* key, const u8* iv, u64 order, u64 seed);
+void trivium_masked_unmask(const trivium_masked_t* s, trivium_word_t* w);
+u64  trivium_masked_step(trivium_masked_t* s, unsigned n);
+void trivium_masked_rounds(trivium_masked_t* s, u64 rounds);
+void trivium_masked_init(trivium_masked_t* s, const u8* key, const u8* iv, u64 order, u64 seed);
+void trivium_masked_stream(trivium_masked_t* s, u8* out, u64 length);
+
+void trivium_masked1_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+void trivium_masked2_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+
+
+
+/****************
+ * Byte aligned *
+ ****************/
+
+/***
+ * trivium_byte_t
+ *
+ * every register is a little endian integer of whole bytes with its
+ * newest bit at the top: bit (8 * bytes - 1 - i) holds its (i + 1)th
+ * state bit and the bits below the register are spent. Eight clocks
+ * shift every register down one byte, so the feedback bytes go straight
+ * into the top ones and the taps are the unaligned bytes at bit
+ * (8 * bytes - 1 - i). Only u8 arithmetic with constant shifts, as the
+ * PIC18 runs it.
+ *
+ *  a[2..11] = key, b[1..10] = iv (file order), c[0] = 0x0E after loading
+ *
+ */
+#define ABYTES 12
+#define BBYTES 11
+#define CBYTES 14
+
+typedef struct {
+  u8 a[ABYTES];
+  u8 b[BBYTES];
+  u8 c[CBYTES];
+} trivium_byte_t;
+
+void trivium_byte_load(trivium_byte_t* s, const u8* key, const u8* iv);
+u8   trivium_byte_step(trivium_byte_t* s);
+void trivium_byte_init(trivium_byte_t* s, const u8* key, const u8* iv);
+void trivium_byte_stream(trivium_byte_t* s, u8* out, u64 length);
+
+void trivium_byte_keystream(const u8* key, const u8* iv, u8* out, u64 length);
+
+#endif
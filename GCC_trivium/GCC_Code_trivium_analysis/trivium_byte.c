@@ -0,0 +1,151 @@
+/*
+ * trivium_byte.c
+ *
+ * byte aligned trivium (see trivium.h), eight clocks per step. This is
+ * the portable form of the firmware kernel: pic_kernel.c emits the same
+ * taps in the same order as PIC18 code and checks both against each
+ * other on the emulator
+ *
+ */
+
+#include <string.h>
+
+#include "trivium.h"
+
+
+// bit position of the (i + 1)th state bit of a register of n bytes
+#define AT(n, i) (8 * (n) - 1 - (i))
+
+
+/***
+ * grab
+ *
+ * the eight bits from position q up: the values tap q sees in the next
+ * eight clocks, first clock in the least significant bit
+ *
+ */
+static inline u8 grab(const u8* r, unsigned q) {
+
+  unsigned j = q >> 3, k = q & 7;
+
+  if (k == 0) return r[j];
+
+  return (u8)((r[j] >> k) | (r[j + 1] << (8 - k)));
+}
+
+
+/***
+ * shift
+ *
+ * eight clocks of a register: every byte moves down one, the feedback
+ * byte enters at the top
+ *
+ */
+static inline void shift(u8* r, unsigned n, u8 feedback) {
+
+  memmove(r, r + 1, n - 1);
+  r[n - 1] = feedback;
+
+  return;
+}
+
+
+/***
+ * trivium_byte_load
+ *
+ * load key and iv as trivium_word_load() does: in this layout the key
+ * and iv bytes land whole, in file order
+ *
+ */
+void trivium_byte_load(trivium_byte_t* s, const u8* key, const u8* iv) {
+
+  memset(s, 0, sizeof(*s));
+
+  memcpy(s->a + 2, key, KEYLENGTH);
+  memcpy(s->b + 1, iv, IVLENGTH);
+
+  // s286..s288
+  s->c[0] = 0x0E;
+
+  return;
+}
+
+
+/***
+ * trivium_byte_step
+ *
+ * clock the state eight times and return the keystream byte. The order
+ * of the terms is the order of the generated code
+ *
+ */
+u8 trivium_byte_step(trivium_byte_t* s) {
+
+  u8 t1, t2, t3, z;
+
+  t1 = grab(s->a, AT(ABYTES, 65)) ^ grab(s->a, AT(ABYTES, 92));
+  t2 = grab(s->b, AT(BBYTES, 68)) ^ grab(s->b, AT(BBYTES, 83));
+  t3 = grab(s->c, AT(CBYTES, 65)) ^ grab(s->c, AT(CBYTES, 110));
+
+  z = t1 ^ t2 ^ t3;
+
+  t1 ^= (grab(s->a, AT(ABYTES, 90))  & grab(s->a, AT(ABYTES, 91)))  ^ grab(s->b, AT(BBYTES, 77));
+  t2 ^= (grab(s->b, AT(BBYTES, 81))  & grab(s->b, AT(BBYTES, 82)))  ^ grab(s->c, AT(CBYTES, 86));
+  t3 ^= (grab(s->c, AT(CBYTES, 108)) & grab(s->c, AT(CBYTES, 109))) ^ grab(s->a, AT(ABYTES, 68));
+
+  shift(s->a, ABYTES, t3);
+  shift(s->b, BBYTES, t1);
+  shift(s->c, CBYTES, t2);
+
+  return z;
+}
+
+
+/***
+ * trivium_byte_init
+ *
+ * load key and iv and run the full initialization, 144 steps
+ *
+ */
+void trivium_byte_init(trivium_byte_t* s, const u8* key, const u8* iv) {
+
+  u64 i;
+
+  trivium_byte_load(s, key, iv);
+  for (i = 0; i < INIT_ROUNDS / 8; i++) trivium_byte_step(s);
+
+  return;
+}
+
+
+/***
+ * trivium_byte_stream
+ *
+ * generate length keystream bytes, first keystream bit in the least
+ * significant bit of the first byte as stream() does
+ *
+ */
+void trivium_byte_stream(trivium_byte_t* s, u8* out, u64 length) {
+
+  u64 i;
+
+  for (i = 0; i < length; i++) out[i] = trivium_byte_step(s);
+
+  return;
+}
+
+
+/***
+ * trivium_byte_keystream
+ *
+ * keystream for a key and iv given in file order
+ *
+ */
+void trivium_byte_keystream(const u8* key, const u8* iv, u8* out, u64 length) {
+
+  trivium_byte_t s;
+
+  trivium_byte_init(&s, key, iv);
+  trivium_byte_stream(&s, out, length);
+
+  return;
+}
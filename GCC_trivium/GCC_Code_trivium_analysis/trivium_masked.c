@@ -0,0 +1,299 @@
+/*
+ * trivium_masked.c
+ *
+ * boolean masked trivium on the word oriented core (see trivium.h), 64
+ * clocks per step on every share
+ *
+ */
+
+#include <string.h>
+
+#include "trivium.h"
+#include "util.h"
+
+
+/***
+ * register_mask
+ *
+ * the bits a register of length len occupies
+ *
+ */
+static inline u128 register_mask(unsigned len) {
+  return ((u128)1 << len) - 1;
+}
+
+
+/***
+ * random_register
+ *
+ * a fresh random value for a register of length len
+ *
+ */
+static inline u128 random_register(u64* random, unsigned len) {
+
+  u128 r = ((u128)splitmix64(random) << 64) | splitmix64(random);
+
+  return r & register_mask(len);
+}
+
+
+/***
+ * trivium_masked_load
+ *
+ * load key and iv as trivium_word_load() does and split the state into
+ * order + 1 shares, all but the first uniformly random
+ *
+ */
+void trivium_masked_load(trivium_masked_t* s, const u8* key, const u8* iv, u64 order, u64 seed) {
+
+  trivium_word_t* share = s->share;
+  u64 i;
+
+  s->order  = (order > MASKED_MAX_ORDER) ? MASKED_MAX_ORDER : order;
+  s->random = seed;
+
+  trivium_word_load(&share[0], key, iv);
+
+  for (i = 1; i <= s->order; i++) {
+    share[i].a = random_register(&s->random, ALEN);
+    share[i].b = random_register(&s->random, BLEN);
+    share[i].c = random_register(&s->random, CLEN);
+
+    share[0].a ^= share[i].a;
+    share[0].b ^= share[i].b;
+    share[0].c ^= share[i].c;
+  }
+
+  return;
+}
+
+
+/***
+ * trivium_masked_unmask
+ *
+ * the state the shares stand for
+ *
+ */
+void trivium_masked_unmask(const trivium_masked_t* s, trivium_word_t* w) {
+
+  u64 i;
+
+  *w = s->share[0];
+
+  for (i = 1; i <= s->order; i++) {
+    w->a ^= s->share[i].a;
+    w->b ^= s->share[i].b;
+    w->c ^= s->share[i].c;
+  }
+
+  return;
+}
+
+
+/***
+ * secure_and
+ *
+ * ISW multiplication of two shared words: share i of the result is
+ * x_i y_i plus a fresh word r_ij for every j > i, share j gets
+ * (r_ij ^ x_i y_j) ^ x_j y_i. The bracketing is the gadget's, each partial
+ * sum is masked by r_ij
+ *
+ */
+static inline __attribute__((always_inline)) void secure_and(const u64* x, const u64* y, u64* z,
+                                                             const unsigned shares, u64* random) {
+
+  unsigned i, j;
+  u64 r;
+
+  for (i = 0; i < shares; i++) z[i] = x[i] & y[i];
+
+  for (i = 0; i < shares; i++) {
+    for (j = i + 1; j < shares; j++) {
+      r = splitmix64(random);
+      z[i] ^= r;
+      z[j] ^= (r ^ (x[i] & y[j])) ^ (x[j] & y[i]);
+    }
+  }
+
+  return;
+}
+
+
+/***
+ * step_fixed
+ *
+ * trivium_word_step() on every share, with the and terms through the
+ * gadget; inlined per share count so that the share loops unroll
+ *
+ */
+static inline __attribute__((always_inline)) u64 step_fixed(trivium_masked_t* s, unsigned n, const unsigned shares) {
+
+  u64 mask = (n == 64) ? ~(u64)0 : (((u64)1 << n) - 1);
+  u64 t1[MASKED_MAX_ORDER + 1], t2[MASKED_MAX_ORDER + 1], t3[MASKED_MAX_ORDER + 1];
+  u64 x[MASKED_MAX_ORDER + 1], y[MASKED_MAX_ORDER + 1], and[MASKED_MAX_ORDER + 1];
+  u64 z = 0;
+  trivium_word_t* w;
+  unsigned i;
+
+  for (i = 0; i < shares; i++) {
+    w = &s->share[i];
+
+    t1[i] = tap(w->a, ALEN, 65) ^ tap(w->a, ALEN, 92);
+    t2[i] = tap(w->b, BLEN, 68) ^ tap(w->b, BLEN, 83);
+    t3[i] = tap(w->c, CLEN, 65) ^ tap(w->c, CLEN, 110);
+
+    // the keystream is public, its shares are recombined
+    z ^= t1[i] ^ t2[i] ^ t3[i];
+  }
+
+  for (i = 0; i < shares; i++) {
+    x[i] = tap(s->share[i].a, ALEN, 90);
+    y[i] = tap(s->share[i].a, ALEN, 91);
+  }
+  secure_and(x, y, and, shares, &s->random);
+  for (i = 0; i < shares; i++) t1[i] ^= and[i] ^ tap(s->share[i].b, BLEN, 77);
+
+  for (i = 0; i < shares; i++) {
+    x[i] = tap(s->share[i].b, BLEN, 81);
+    y[i] = tap(s->share[i].b, BLEN, 82);
+  }
+  secure_and(x, y, and, shares, &s->random);
+  for (i = 0; i < shares; i++) t2[i] ^= and[i] ^ tap(s->share[i].c, CLEN, 86);
+
+  for (i = 0; i < shares; i++) {
+    x[i] = tap(s->share[i].c, CLEN, 108);
+    y[i] = tap(s->share[i].c, CLEN, 109);
+  }
+  secure_and(x, y, and, shares, &s->random);
+  for (i = 0; i < shares; i++) t3[i] ^= and[i] ^ tap(s->share[i].a, ALEN, 68);
+
+  for (i = 0; i < shares; i++) {
+    w = &s->share[i];
+
+    w->a = (w->a >> n) | ((u128)(t3[i] & mask) << (ALEN - n));
+    w->b = (w->b >> n) | ((u128)(t1[i] & mask) << (BLEN - n));
+    w->c = (w->c >> n) | ((u128)(t2[i] & mask) << (CLEN - n));
+  }
+
+  return z & mask;
+}
+
+
+/***
+ * trivium_masked_step
+ *
+ * clock the shares n times (1 <= n <= 64) and return the n keystream
+ * bits, as trivium_word_step()
+ *
+ */
+u64 trivium_masked_step(trivium_masked_t* s, unsigned n) {
+
+  switch (s->order) {
+  case 0:  return step_fixed(s, n, 1);
+  case 1:  return step_fixed(s, n, 2);
+  case 2:  return step_fixed(s, n, 3);
+  default: return step_fixed(s, n, MASKED_MAX_ORDER + 1);
+  }
+}
+
+
+#define ROUNDS_ORDER(shares)                                    \
+  for (; rounds >= 64; rounds -= 64) step_fixed(s, 64, shares); \
+  if (rounds > 0) step_fixed(s, (unsigned)rounds, shares);      \
+  break;
+
+/***
+ * trivium_masked_rounds
+ *
+ * clock the shares a number of times, discarding the keystream
+ *
+ */
+void trivium_masked_rounds(trivium_masked_t* s, u64 rounds) {
+
+  switch (s->order) {
+  case 0:  ROUNDS_ORDER(1)
+  case 1:  ROUNDS_ORDER(2)
+  case 2:  ROUNDS_ORDER(3)
+  default: ROUNDS_ORDER(MASKED_MAX_ORDER + 1)
+  }
+
+  return;
+}
+
+
+/***
+ * trivium_masked_init
+ *
+ * share key and iv and run the full initialization
+ *
+ */
+void trivium_masked_init(trivium_masked_t* s, const u8* key, const u8* iv, u64 order, u64 seed) {
+
+  trivium_masked_load(s, key, iv, order, seed);
+  trivium_masked_rounds(s, INIT_ROUNDS);
+
+  return;
+}
+
+
+/***
+ * trivium_masked_stream
+ *
+ * length keystream bytes, in the byte order of trivium_word_stream()
+ *
+ */
+void trivium_masked_stream(trivium_masked_t* s, u8* out, u64 length) {
+
+  u64 z;
+  unsigned b;
+
+  for (; length >= 8; length -= 8, out += 8) {
+    z = trivium_masked_step(s, 64);
+    for (b = 0; b < 8; b++) out[b] = (u8)(z >> (8 * b));
+  }
+
+  if (length > 0) {
+    z = trivium_masked_step(s, (unsigned)(8 * length));
+    for (b = 0; b < length; b++) out[b] = (u8)(z >> (8 * b));
+  }
+
+  return;
+}
+
+
+/***
+ * masked_keystream
+ *
+ * keystream of a given order, the randomness seeded from key and iv so
+ * that every vector runs on different shares
+ *
+ */
+static void masked_keystream(u64 order, const u8* key, const u8* iv, u8* out, u64 length) {
+
+  trivium_masked_t s;
+  u64 seed = order, i;
+
+  for (i = 0; i < KEYLENGTH; i++) seed = 31 * seed + key[i];
+  for (i = 0; i < IVLENGTH; i++) seed = 31 * seed + iv[i];
+
+  trivium_masked_init(&s, key, iv, order, seed);
+  trivium_masked_stream(&s, out, length);
+
+  return;
+}
+
+
+void trivium_masked1_keystream(const u8* key, const u8* iv, u8* out, u64 length) {
+
+  masked_keystream(1, key, iv, out, length);
+
+  return;
+}
+
+
+void trivium_masked2_keystream(const u8* key, const u8* iv, u8* out, u64 length) {
+
+  masked_keystream(2, key, iv, out, length);
+
+  return;
+}
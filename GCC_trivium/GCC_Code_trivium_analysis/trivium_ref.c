@@ -0,0 +1,427 @@
+/*
+ * trivium_ref.c
+ *
+ * byte oriented reference implementation, copied from
+ * GCC_Code_trivium_128_bytes/encript_128_bytes.c so that the analysis
+ * tools can link against exactly the code that runs on the device
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "trivium.h"
+
+u8 trivum_state[STATELENGTH];
+u8 trivium_output[64];
+u64 init_rounds = INIT_ROUNDS;
+
+
+/***
+ * scw (subsequent crosswrite)
+ *
+ * write the last n bits of a byte into the first n bits of the next
+ *
+ */
+void scw(u8* split, u64 offset) {
+
+  u8* post = split;
+  u8* pre  = split - 1;
+
+  // e.g., for 3 -> 11111111 shifted to 11100000
+  u8 mask = 0xFF << (8 - offset);
+
+  // e.g., for 3 -> 00000101 shifted to 10100000
+  u8 shifted = (*pre) << (8 - offset);
+
+  (*post) = (*post & ~mask) | (shifted & mask);
+  (*pre) >>= offset;
+
+  return;
+}
+
+
+/***
+ * acw (antecedent crosswrite)
+ *
+ * write the first n bits of a byte into the last n bits of the previous
+ *
+ */
+void acw(u8* split, u64 offset) {
+
+  u8* post = split;
+  u8* pre  = split - 1;
+
+  // e.g., for 3 -> 00000001 shifted to 00001000 becomes 00000111
+  u8 mask = (0x01 << offset) - 1;
+
+  // e.g., for 3 -> 10100000 shifted to 00000101
+  u8 shifted = (*post) >> (8 - offset);
+
+  (*pre) = (*pre & ~mask) | (shifted & mask);
+  (*post) <<= offset;
+
+  return;
+}
+
+
+
+/*****************
+ * Initialization *
+ *****************/
+
+/***
+ * insert_byte
+ *
+ * insert a byte a repeat number of times
+ *
+ */
+void insert_byte(u8** p_mark, u8* b8, u64 repeat) {
+
+  u8* mark = (*p_mark);
+  u64 iter;
+
+  for (iter = 0; iter < repeat; iter++) {
+    mark = memmove(mark, b8, 1);
+    mark += 1;
+  }
+
+  (*p_mark) = mark;
+
+  return;
+}
+
+
+/***
+ * insert_key
+ *
+ * insert the key into the state
+ *
+ */
+void insert_key(u8** p_mark, u8* key) {
+
+  u8* mark = (*p_mark);
+
+  memmove(mark, key, KEYLENGTH);
+  mark += KEYLENGTH;
+
+  (*p_mark) = mark;
+
+  return;
+}
+
+
+/***
+ * insert_iv
+ *
+ * insert the iv - this requires cross writing
+ * across bytes, since the iv is not positioned
+ * on a clean byte boundary in the state
+ *
+ */
+void insert_iv(u8** p_mark, u8* iv) {
+
+ // u8* temp;
+  u64 iter;
+  u8* mark = (*p_mark);
+
+  // zero out the current byte - we'll acw
+  // the first three bits of the iv into it.
+  (*mark) = 0x00;
+  mark += 1;
+
+  for (iter = 0; iter < IVLENGTH; iter++) {
+    memmove(mark, iv + iter, 1);
+    acw(mark, 3);
+
+    mark += 1;
+  }
+
+  (*p_mark) = mark;
+
+  return;
+}
+
+
+/***
+ * setup
+ *
+ * setup the state per the key and iv
+ *
+ */
+u8* setup(u8* key, u8* iv) {
+  u8* mark = trivum_state;
+
+  u8 zero = 0x00; // 00000000
+  u8 end  = 0x07; // 00000111
+
+  // the insert_* functions increment mark accordingly
+  insert_key(&mark, key);
+  insert_byte(&mark, &zero, 1);
+  insert_iv(&mark, iv);
+  insert_byte(&mark, &zero, 13);
+  insert_byte(&mark, &end, 1);
+
+  return trivum_state;
+}
+
+
+
+/************************
+ * Keystream Generation *
+ ************************/
+
+
+
+/***
+ * gb
+ *
+ * get the bit at a given index in a byte
+ *
+ */
+u8 gb(u8* from, u64 index) {
+
+  u8 b8 = (*from);
+
+  u8 shifted = b8 >> (7 - index);
+
+  return shifted & 0x01;
+}
+
+
+/***
+ * pb
+ *
+ * put the bit at a given index in a byte
+ *
+ */
+void pb(u8* to, u8* from, u64 index) {
+
+  u8 mask = (0x01 << (7 - index));
+
+  u8 put = (*from);
+  put <<= (7 - index);
+
+  (*to) = (*to & ~mask) | (put & mask);
+
+  return;
+}
+
+
+/***
+ * gsb
+ *
+ * get the bit at a given index in the state
+ *
+ */
+u8 gsb(u8* state, u64 index) {
+
+  u64 b8 = index / 8;
+  u64 bit  = index % 8;
+
+  return gb(state + b8, bit);
+}
+
+
+/***
+ * psb
+ *
+ * put the bit at a given index in the state
+ *
+ */
+void psb(u8* state, u8* from, u64 index) {
+
+  u64 b8 = index / 8;
+  u64 bit  = index % 8;
+
+  pb(state + b8, from, bit);
+
+  return;
+}
+
+
+/***
+ * update
+ *
+ * generate a keystream bit and update the state accordingly
+ *
+ */
+u8 update(u8* state) {
+  u8 t1, t2, t3, z;
+  u8 _ = 0x00;
+  u64 iter;
+
+  // indexes are from zero
+  t1 = gsb(state, 65)  ^ gsb(state, 92);
+  t2 = gsb(state, 161) ^ gsb(state, 176);
+  t3 = gsb(state, 242) ^ gsb(state, 287);
+
+  z = t1 ^ t2 ^ t3;
+
+  t1 = t1 ^ (gsb(state, 90)  & gsb(state, 91))  ^ gsb(state, 170);
+  t2 = t2 ^ (gsb(state, 174) & gsb(state, 175)) ^ gsb(state, 263);
+  t3 = t3 ^ (gsb(state, 285) & gsb(state, 286)) ^ gsb(state, 68);
+
+  // zero out the last bit so that state material is not
+  // written into out of bounds memory when we shift up
+  psb(state, &_, 287);
+
+  // rotate
+  for (iter = STATELENGTH; iter > 0; iter--) scw(state + iter, 1);
+
+  // update
+  psb(state, &t3, 0);
+  psb(state, &t1, 93);
+  psb(state, &t2, 177);
+
+  return z;
+}
+
+
+/***
+ * stream
+ *
+ * generate a keystream byte
+ *
+ */
+u8 stream(u8* state) {
+
+  u8 keystream = 0, z;
+  u64 bit;
+
+  for (bit = 8; bit > 0; bit--) {
+    z = update(state);
+    pb(&keystream, &z, (bit - 1));
+  }
+
+  return keystream;
+}
+
+
+
+/**************
+ * Cipherment *
+ **************/
+
+
+
+/***
+ * reverse
+ *
+ * reverse input
+ *
+ */
+void reverse(u8* str, u64 length) {
+
+  u64 l = 0, r = length - 1;
+  u8 t1, t2;
+
+  for (; l < r; l++, r--) {
+    t1 = str[l];
+    t2 = str[r];
+
+    str[l] = t2;
+    str[r] = t1;
+  }
+
+  return;
+}
+
+
+/***
+ * ip_cipher
+ *
+ * generate and apply keystream on input in place
+ *
+ */
+void ip_cipher(u8* key, u8* iv, u8* input, u64 length) {
+
+  u64 mark = length;
+  u64 iter;
+
+  reverse(key, KEYLENGTH);
+  reverse(iv, IVLENGTH);
+
+  u8* state;
+  state = setup(key, iv);
+  for (iter = 0; iter < init_rounds; iter++) update(state);
+
+  u8 keystream;
+ 
+  for (; mark > 0; mark--) {
+    keystream = stream(state);
+    //printf("|%02x|",keystream);
+    input[(length - mark)] ^= keystream;
+  }
+  return;
+}
+
+
+/***
+ * cipher
+ *
+ * generate and apply keystream
+ *
+ */
+u8* cipher(u8* key, u8* iv, u8* input, u64 length) {
+
+  memmove(trivium_output, input, length);
+  ip_cipher(key, iv, trivium_output, length);
+ 
+  return trivium_output;
+}
+
+
+
+/********
+ * APIs *
+ ********/
+
+
+
+/***
+ * ip_encrypt
+ *
+ * encrypt in place (syntactic sugar for in place cipher function)
+ *
+ */
+void ip_encrypt(u8* key, u8* iv, u8* input, u64 length) {
+  ip_cipher(key, iv, input, length);
+
+  return;
+}
+
+
+/***
+ * encrypt
+ *
+ * encrypt (syntactic sugar for cipher function)
+ *
+ */
+u8* encrypt(u8* key, u8* iv, u8* input, u64 length) {
+  return cipher(key, iv, input, length);
+}
+
+
+/***
+ * trivium_ref_keystream
+ *
+ * keystream of the reference implementation for a key and iv given in
+ * file order (the in place functions above reverse their arguments, so
+ * work on copies)
+ *
+ */
+void trivium_ref_keystream(const u8* key, const u8* iv, u8* out, u64 length) {
+
+  u8 k[KEYLENGTH], v[IVLENGTH];
+
+  memcpy(k, key, KEYLENGTH);
+  memcpy(v, iv, IVLENGTH);
+  memset(out, 0, length);
+
+  ip_encrypt(k, v, out, length);
+
+  return;
+}
@@ -0,0 +1,189 @@
+/*
+ * trivium_slice.c
+ *
+ * bitsliced trivium, 64 or 256 instances per clock (see trivium.h)
+ *
+ */
+
+#include <string.h>
+
+#include "trivium.h"
+
+
+/***
+ * SLICE_DEFINE
+ *
+ * the register windows are laid out as
+ *
+ *   [ SLICE_WINDOW | a (93) | SLICE_WINDOW | b (84) | SLICE_WINDOW | c (111) | SLICE_WINDOW ]
+ *
+ * every clock moves a, b and c one word down and writes the feedback into
+ * the new first word (a backward clock moves them up and writes the
+ * recovered oldest bit), after SLICE_WINDOW clocks they are copied back.
+ * The three move together so their distance never changes.
+ *
+ */
+#define SLICE_DEFINE(name, lane_t)                                                 \
+                                                                                   \
+  static void name##_rewind(name##_t* s) {                                         \
+                                                                                   \
+    lane_t* a = s->buf + SLICE_WINDOW;                                             \
+    lane_t* b = a + ALEN + SLICE_WINDOW;                                           \
+    lane_t* c = b + BLEN + SLICE_WINDOW;                                           \
+                                                                                   \
+    if (s->a != a) memmove(a, s->a, ALEN * sizeof(lane_t));                        \
+    if (s->b != b) memmove(b, s->b, BLEN * sizeof(lane_t));                        \
+    if (s->c != c) memmove(c, s->c, CLEN * sizeof(lane_t));                        \
+                                                                                   \
+    s->a = a;                                                                      \
+    s->b = b;                                                                      \
+    s->c = c;                                                                      \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_load(name##_t* s, const lane_t* bits) {                              \
+                                                                                   \
+    s->a = s->buf + SLICE_WINDOW;                                                  \
+    s->b = s->a + ALEN + SLICE_WINDOW;                                             \
+    s->c = s->b + BLEN + SLICE_WINDOW;                                             \
+                                                                                   \
+    memcpy(s->a, bits, ALEN * sizeof(lane_t));                                     \
+    memcpy(s->b, bits + ALEN, BLEN * sizeof(lane_t));                              \
+    memcpy(s->c, bits + ALEN + BLEN, CLEN * sizeof(lane_t));                       \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_bits(const name##_t* s, lane_t* bits) {                              \
+                                                                                   \
+    memcpy(bits, s->a, ALEN * sizeof(lane_t));                                     \
+    memcpy(bits + ALEN, s->b, BLEN * sizeof(lane_t));                              \
+    memcpy(bits + ALEN + BLEN, s->c, CLEN * sizeof(lane_t));                       \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_broadcast(name##_t* s, const u8* key, const u8* iv) {                \
+                                                                                   \
+    trivium_word_t w;                                                              \
+    u8 bits[STATEBITS];                                                            \
+    lane_t words[STATEBITS];                                                       \
+    lane_t zero = { 0 };                                                           \
+    u64 i;                                                                         \
+                                                                                   \
+    trivium_word_load(&w, key, iv);                                                \
+    trivium_word_bits(&w, bits);                                                   \
+                                                                                   \
+    for (i = 0; i < STATEBITS; i++) words[i] = bits[i] ? ~zero : zero;             \
+                                                                                   \
+    name##_load(s, words);                                                         \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_run(name##_t* s, u64 clocks, lane_t* z) {                            \
+                                                                                   \
+    lane_t *a, *b, *c;                                                             \
+    lane_t t1, t2, t3;                                                             \
+    u64 n, k;                                                                      \
+                                                                                   \
+    while (clocks > 0) {                                                           \
+      if (s->a == s->buf) name##_rewind(s);                                        \
+                                                                                   \
+      a = s->a;                                                                    \
+      b = s->b;                                                                    \
+      c = s->c;                                                                    \
+                                                                                   \
+      /* clocks left before a reaches the start of the buffer */                   \
+      n = (u64)(a - s->buf);                                                       \
+      if (n > clocks) n = clocks;                                                  \
+                                                                                   \
+      for (k = 0; k < n; k++) {                                                    \
+        t1 = a[65] ^ a[92];                                                        \
+        t2 = b[68] ^ b[83];                                                        \
+        t3 = c[65] ^ c[110];                                                       \
+                                                                                   \
+        if (z != NULL) *z++ = t1 ^ t2 ^ t3;                                        \
+                                                                                   \
+        t1 = t1 ^ (a[90]  & a[91])  ^ b[77];                                       \
+        t2 = t2 ^ (b[81]  & b[82])  ^ c[86];                                       \
+        t3 = t3 ^ (c[108] & c[109]) ^ a[68];                                       \
+                                                                                   \
+        *--a = t3;                                                                 \
+        *--b = t1;                                                                 \
+        *--c = t2;                                                                 \
+      }                                                                            \
+                                                                                   \
+      s->a = a;                                                                    \
+      s->b = b;                                                                    \
+      s->c = c;                                                                    \
+      clocks -= n;                                                                 \
+    }                                                                              \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_back(name##_t* s, u64 clocks) {                                      \
+                                                                                   \
+    lane_t *a, *b, *c;                                                             \
+    lane_t a93, b84, c111;                                                         \
+    u64 n, k;                                                                      \
+                                                                                   \
+    while (clocks > 0) {                                                           \
+      if (s->a == s->buf + 2 * SLICE_WINDOW) name##_rewind(s);                     \
+                                                                                   \
+      a = s->a;                                                                    \
+      b = s->b;                                                                    \
+      c = s->c;                                                                    \
+                                                                                   \
+      /* clocks left before c reaches the end of the buffer */                     \
+      n = (u64)(s->buf + 2 * SLICE_WINDOW - a);                                    \
+      if (n > clocks) n = clocks;                                                  \
+                                                                                   \
+      for (k = 0; k < n; k++) {                                                    \
+        a93  = b[0] ^ a[66] ^ (a[91]  & a[92])  ^ b[78];                           \
+        b84  = c[0] ^ b[69] ^ (b[82]  & b[83])  ^ c[87];                           \
+        c111 = a[0] ^ c[66] ^ (c[109] & c[110]) ^ a[69];                           \
+                                                                                   \
+        (++a)[ALEN - 1] = a93;                                                     \
+        (++b)[BLEN - 1] = b84;                                                     \
+        (++c)[CLEN - 1] = c111;                                                    \
+      }                                                                            \
+                                                                                   \
+      s->a = a;                                                                    \
+      s->b = b;                                                                    \
+      s->c = c;                                                                    \
+      clocks -= n;                                                                 \
+    }                                                                              \
+                                                                                   \
+    return;                                                                        \
+  }                                                                                \
+                                                                                   \
+  void name##_keystream(const u8* key, const u8* iv, u8* out, u64 length) {        \
+                                                                                   \
+    name##_t s;                                                                    \
+    lane_t z[8];                                                                   \
+    u64 i, w, bit, bad;                                                            \
+                                                                                   \
+    name##_broadcast(&s, key, iv);                                                 \
+    name##_run(&s, INIT_ROUNDS, NULL);                                             \
+                                                                                   \
+    for (i = 0; i < length; i++) {                                                 \
+      name##_run(&s, 8, z);                                                        \
+      out[i] = 0;                                                                  \
+                                                                                   \
+      for (bit = 0; bit < 8; bit++) {                                              \
+        /* an instance that disagrees with the others flips the bit */             \
+        bad = (z[bit][0] != 0 && z[bit][0] != ~(u64)0);                            \
+        for (w = 1; w < LANE_WORDS(lane_t); w++) bad |= (z[bit][w] != z[bit][0]);  \
+                                                                                   \
+        out[i] |= (u8)(((z[bit][0] & 0x01) ^ bad) << bit);                         \
+      }                                                                            \
+    }                                                                              \
+                                                                                   \
+    return;                                                                        \
+  }
+
+SLICE_DEFINE(trivium_slice64,  lane64_t)
+SLICE_DEFINE(trivium_slice256, lane256_t)
@@ -0,0 +1,258 @@
+/*
+ * trivium_word.c
+ *
+ * word oriented trivium, 64 clocks per trivium_word_step() (see trivium.h),
+ * initialization for full and reduced round counts and backward
+ * clocking for recovering the key from an internal state
+ *
+ */
+
+#include <string.h>
+
+#include "trivium.h"
+
+
+/***
+ * trivium_word_load
+ *
+ * load key and iv the same way setup() does: key bits into s1..s80,
+ * iv bits into s94..s173 and ones into s286..s288
+ *
+ */
+void trivium_word_load(trivium_word_t* s, const u8* key, const u8* iv) {
+
+  u64 j;
+
+  s->a = 0;
+  s->b = 0;
+  s->c = 0;
+
+  // setup() works on reversed byte order, most significant bit first
+  for (j = 0; j < 8 * KEYLENGTH; j++) {
+    s->a |= (u128)((key[KEYLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << (ALEN - 1 - j);
+  }
+
+  for (j = 0; j < 8 * IVLENGTH; j++) {
+    s->b |= (u128)((iv[IVLENGTH - 1 - j / 8] >> (7 - j % 8)) & 0x01) << (BLEN - 1 - j);
+  }
+
+  s->c = 0x07;
+
+  return;
+}
+
+
+/***
+ * trivium_word_bits
+ *
+ * unpack the state into one byte per state bit, bits[i] = s(i + 1)
+ *
+ */
+void trivium_word_bits(const trivium_word_t* s, u8* bits) {
+
+  u64 i;
+
+  for (i = 0; i < ALEN; i++) bits[i]               = (u8)(s->a >> (ALEN - 1 - i)) & 0x01;
+  for (i = 0; i < BLEN; i++) bits[ALEN + i]        = (u8)(s->b >> (BLEN - 1 - i)) & 0x01;
+  for (i = 0; i < CLEN; i++) bits[ALEN + BLEN + i] = (u8)(s->c >> (CLEN - 1 - i)) & 0x01;
+
+  return;
+}
+
+
+/***
+ * trivium_word_from_bits
+ *
+ * pack one byte per state bit into the registers
+ *
+ */
+void trivium_word_from_bits(trivium_word_t* s, const u8* bits) {
+
+  u64 i;
+
+  s->a = 0;
+  s->b = 0;
+  s->c = 0;
+
+  for (i = 0; i < ALEN; i++) s->a |= (u128)(bits[i] & 0x01)               << (ALEN - 1 - i);
+  for (i = 0; i < BLEN; i++) s->b |= (u128)(bits[ALEN + i] & 0x01)        << (BLEN - 1 - i);
+  for (i = 0; i < CLEN; i++) s->c |= (u128)(bits[ALEN + BLEN + i] & 0x01) << (CLEN - 1 - i);
+
+  return;
+}
+
+
+/***
+ * trivium_word_loaded
+ *
+ * true if the state has the layout setup() leaves (zeros in s81..s93,
+ * s174..s285 and ones in s286..s288); key and iv are then extracted in
+ * file order
+ *
+ */
+int trivium_word_loaded(const trivium_word_t* s, u8* key, u8* iv) {
+
+  u64 j;
+
+  if ((s->a & 0x1FFF) != 0 || (s->b & 0x0F) != 0 || s->c != 0x07) return 0;
+
+  memset(key, 0, KEYLENGTH);
+  memset(iv, 0, IVLENGTH);
+
+  for (j = 0; j < 8 * KEYLENGTH; j++) {
+    key[KEYLENGTH - 1 - j / 8] |= (u8)(((s->a >> (ALEN - 1 - j)) & 0x01) << (7 - j % 8));
+  }
+
+  for (j = 0; j < 8 * IVLENGTH; j++) {
+    iv[IVLENGTH - 1 - j / 8] |= (u8)(((s->b >> (BLEN - 1 - j)) & 0x01) << (7 - j % 8));
+  }
+
+  return 1;
+}
+
+
+/***
+ * trivium_word_rounds
+ *
+ * clock the state a number of times, discarding the keystream
+ *
+ */
+void trivium_word_rounds(trivium_word_t* s, u64 rounds) {
+
+  for (; rounds >= 64; rounds -= 64) trivium_word_step(s, 64);
+  if (rounds > 0) trivium_word_step(s, (unsigned)rounds);
+
+  return;
+}
+
+
+/***
+ * bit
+ *
+ * state bit (i + 1) of a register of length len
+ *
+ */
+static inline u64 bit(u128 r, unsigned len, unsigned i) {
+  return (u64)(r >> (len - 1 - i)) & 0x01;
+}
+
+
+/***
+ * trivium_word_back
+ *
+ * clock the state backwards. The bit dropped from each register is
+ * recovered from its feedback equation; the and term involves the two
+ * next oldest bits, which the previous backward clock recovered, so this
+ * goes one clock at a time
+ *
+ */
+void trivium_word_back(trivium_word_t* s, u64 clocks) {
+
+  const u128 amask = ((u128)1 << ALEN) - 1;
+  const u128 bmask = ((u128)1 << BLEN) - 1;
+  const u128 cmask = ((u128)1 << CLEN) - 1;
+  u64 a93, b84, c111;
+
+  for (; clocks > 0; clocks--) {
+    // s93, s177 and s288 of the previous clock
+    a93  = bit(s->b, BLEN, 0) ^ bit(s->a, ALEN, 66) ^ (bit(s->a, ALEN, 91)  & bit(s->a, ALEN, 92))  ^ bit(s->b, BLEN, 78);
+    b84  = bit(s->c, CLEN, 0) ^ bit(s->b, BLEN, 69) ^ (bit(s->b, BLEN, 82)  & bit(s->b, BLEN, 83))  ^ bit(s->c, CLEN, 87);
+    c111 = bit(s->a, ALEN, 0) ^ bit(s->c, CLEN, 66) ^ (bit(s->c, CLEN, 109) & bit(s->c, CLEN, 110)) ^ bit(s->a, ALEN, 69);
+
+    s->a = ((s->a << 1) & amask) | a93;
+    s->b = ((s->b << 1) & bmask) | b84;
+    s->c = ((s->c << 1) & cmask) | c111;
+  }
+
+  return;
+}
+
+
+/***
+ * trivium_word_init_rounds
+ *
+ * load key and iv and run a given number of initialization rounds
+ *
+ */
+void trivium_word_init_rounds(trivium_word_t* s, const u8* key, const u8* iv, u64 rounds) {
+
+  trivium_word_load(s, key, iv);
+  trivium_word_rounds(s, rounds);
+
+  return;
+}
+
+
+/***
+ * trivium_word_init
+ *
+ * load key and iv and run the full initialization
+ *
+ */
+void trivium_word_init(trivium_word_t* s, const u8* key, const u8* iv) {
+
+  trivium_word_load(s, key, iv);
+  trivium_word_rounds(s, INIT_ROUNDS);
+
+  return;
+}
+
+
+/***
+ * trivium_word_stream
+ *
+ * generate length keystream bytes, first keystream bit in the least
+ * significant bit of the first byte as stream() does
+ *
+ */
+void trivium_word_stream(trivium_word_t* s, u8* out, u64 length) {
+
+  u64 z;
+  unsigned b;
+
+  for (; length >= 8; length -= 8, out += 8) {
+    z = trivium_word_step(s, 64);
+    for (b = 0; b < 8; b++) out[b] = (u8)(z >> (8 * b));
+  }
+
+  if (length > 0) {
+    z = trivium_word_step(s, (unsigned)(8 * length));
+    for (b = 0; b < length; b++) out[b] = (u8)(z >> (8 * b));
+  }
+
+  return;
+}
+
+
+/***
+ * trivium_word_keystream
+ *
+ * keystream for a key and iv given in file order
+ *
+ */
+void trivium_word_keystream(const u8* key, const u8* iv, u8* out, u64 length) {
+
+  trivium_word_t s;
+
+  trivium_word_init(&s, key, iv);
+  trivium_word_stream(&s, out, length);
+
+  return;
+}
+
+
+/***
+ * trivium_word_keystream_rounds
+ *
+ * keystream of a reduced (or extended) round variant
+ *
+ */
+void trivium_word_keystream_rounds(const u8* key, const u8* iv, u64 rounds, u8* out, u64 length) {
+
+  trivium_word_t s;
+
+  trivium_word_init_rounds(&s, key, iv, rounds);
+  trivium_word_stream(&s, out, length);
+
+  return;
+}
@@ -0,0 +1,217 @@
+/*
+ * ttest.c
+ *
+ * fixed against random t-test moments (see ttest.h)
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "ttest.h"
+
+
+int ttest_alloc(ttest_t* t, u64 columns) {
+
+  u64 g;
+
+  memset(t, 0, sizeof(ttest_t));
+
+  if (columns == 0) return -1;
+
+  t->columns = columns;
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    t->mean[g] = calloc(columns, sizeof(double));
+    t->m2[g] = calloc(columns, sizeof(double));
+    if (t->mean[g] == NULL || t->m2[g] == NULL) break;
+  }
+  t->batch = malloc(2 * columns * sizeof(double));
+
+  if (g < TTEST_GROUPS || t->batch == NULL) {
+    ttest_free(t);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void ttest_free(ttest_t* t) {
+
+  u64 g;
+
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    free(t->mean[g]);
+    free(t->m2[g]);
+  }
+  free(t->batch);
+  memset(t, 0, sizeof(ttest_t));
+
+  return;
+}
+
+
+/***
+ * combine
+ *
+ * Chan's update of the moments of na observations with those of nb more
+ *
+ */
+static void combine(u64 columns, u64 na, double* mean_a, double* m2_a, u64 nb, const double* mean_b,
+                    const double* m2_b) {
+
+  double n = (double)na + (double)nb, d;
+  u64 j;
+
+  if (nb == 0) return;
+
+  if (na == 0) {
+    memcpy(mean_a, mean_b, columns * sizeof(double));
+    memcpy(m2_a, m2_b, columns * sizeof(double));
+    return;
+  }
+
+  for (j = 0; j < columns; j++) {
+    d = mean_b[j] - mean_a[j];
+    mean_a[j] += d * nb / n;
+    m2_a[j] += m2_b[j] + d * d * ((double)na * nb / n);
+  }
+
+  return;
+}
+
+
+/***
+ * ttest_add
+ *
+ * count traces, stride floats apart, of the groups group[t] (0 or 1)
+ *
+ */
+int ttest_add(ttest_t* t, const float* traces, u64 stride, u64 count, const u8* group) {
+
+  double* mean = t->batch;
+  double* m2 = t->batch + t->columns;
+  const float* x;
+  double d;
+  u64 g, i, j, n;
+
+  for (i = 0; i < count; i++) {
+    if (group[i] >= TTEST_GROUPS) return -1;
+  }
+
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    memset(t->batch, 0, 2 * t->columns * sizeof(double));
+
+    for (n = 0, i = 0; i < count; i++) {
+      if (group[i] != g) continue;
+      x = traces + i * stride;
+      for (j = 0; j < t->columns; j++) mean[j] += x[j];
+      n++;
+    }
+    if (n == 0) continue;
+
+    for (j = 0; j < t->columns; j++) mean[j] /= n;
+
+    for (i = 0; i < count; i++) {
+      if (group[i] != g) continue;
+      x = traces + i * stride;
+      for (j = 0; j < t->columns; j++) {
+        d = x[j] - mean[j];
+        m2[j] += d * d;
+      }
+    }
+
+    combine(t->columns, t->n[g], t->mean[g], t->m2[g], n, mean, m2);
+    t->n[g] += n;
+  }
+
+  return 0;
+}
+
+
+/***
+ * ttest_merge
+ *
+ * add the moments of another run over other traces of the same columns
+ *
+ */
+int ttest_merge(ttest_t* t, const ttest_t* other) {
+
+  u64 g;
+
+  if (other->columns != t->columns) return -1;
+
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    combine(t->columns, t->n[g], t->mean[g], t->m2[g], other->n[g], other->mean[g], other->m2[g]);
+    t->n[g] += other->n[g];
+  }
+
+  return 0;
+}
+
+
+/***
+ * ttest_welch
+ *
+ * t per column, zero while a group has fewer than two traces or neither
+ * varies
+ *
+ */
+void ttest_welch(const ttest_t* t, double* out) {
+
+  double n0 = (double)t->n[0], n1 = (double)t->n[1], v;
+  u64 j;
+
+  for (j = 0; j < t->columns; j++) {
+    out[j] = 0;
+    if (t->n[0] < 2 || t->n[1] < 2) continue;
+
+    v = t->m2[0][j] / ((n0 - 1) * n0) + t->m2[1][j] / ((n1 - 1) * n1);
+    if (v > 0) out[j] = (t->mean[0][j] - t->mean[1][j]) / sqrt(v);
+  }
+
+  return;
+}
+
+
+int ttest_write(const ttest_t* t, FILE* fp) {
+
+  u64 header[3] = { t->columns, t->n[0], t->n[1] };
+  u64 g, C = t->columns;
+
+  if (fwrite(TTEST_MAGIC, 8, 1, fp) != 1 || fwrite(header, sizeof(header), 1, fp) != 1) return -1;
+
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    if (fwrite(t->mean[g], sizeof(double), C, fp) != C || fwrite(t->m2[g], sizeof(double), C, fp) != C) return -1;
+  }
+
+  return 0;
+}
+
+
+int ttest_read(ttest_t* t, FILE* fp) {
+
+  char magic[8];
+  u64 header[3], g, C;
+
+  memset(t, 0, sizeof(ttest_t));
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, TTEST_MAGIC, 8) != 0 ||
+      fread(header, sizeof(header), 1, fp) != 1 || ttest_alloc(t, header[0]) < 0) return -1;
+
+  C = t->columns;
+  t->n[0] = header[1];
+  t->n[1] = header[2];
+
+  for (g = 0; g < TTEST_GROUPS; g++) {
+    if (fread(t->mean[g], sizeof(double), C, fp) != C || fread(t->m2[g], sizeof(double), C, fp) != C) {
+      ttest_free(t);
+      return -1;
+    }
+  }
+
+  return 0;
+}
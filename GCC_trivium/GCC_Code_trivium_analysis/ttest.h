@@ -0,0 +1,54 @@
+/*
+ * ttest.h
+ *
+ * Welch's t-test of two groups of traces, fixed against random inputs,
+ * per sample
+ *
+ * every group keeps its count and, per sample, the mean and the sum of
+ * squared deviations from it (M2). A batch is summed on its own in two
+ * passes and merged in with Chan's update
+ *
+ *   n = na + nb,  d = mean_b - mean_a,
+ *   mean = mean_a + d nb / n,  M2 = M2a + M2b + d^2 na nb / n
+ *
+ * which is also how the moments of separate runs over parts of a trace
+ * set merge. Unlike raw power sums they do not lose the variance to
+ * cancellation when the mean is large against the noise. Checkpoints:
+ *
+ *   "TRVTTST1" columns n0 n1 | mean0 | m2_0 | mean1 | m2_1
+ *
+ */
+
+#ifndef TTEST_H
+#define TTEST_H
+
+#include <stdio.h>
+
+#include "trivium.h"
+
+#define TTEST_MAGIC     "TRVTTST1"
+#define TTEST_GROUPS    2
+#define TTEST_THRESHOLD 4.5             // the usual leakage threshold on |t|
+
+
+typedef struct {
+  u64     columns;
+  u64     n[TTEST_GROUPS];
+  double* mean[TTEST_GROUPS];           // [columns]
+  double* m2[TTEST_GROUPS];             // [columns]
+  double* batch;                        // [2][columns], moments of a batch
+} ttest_t;
+
+
+int  ttest_alloc(ttest_t* t, u64 columns);
+void ttest_free(ttest_t* t);
+
+int  ttest_add(ttest_t* t, const float* traces, u64 stride, u64 count, const u8* group);
+int  ttest_merge(ttest_t* t, const ttest_t* other);
+
+void ttest_welch(const ttest_t* t, double* out);
+
+int  ttest_write(const ttest_t* t, FILE* fp);
+int  ttest_read(ttest_t* t, FILE* fp);
+
+#endif
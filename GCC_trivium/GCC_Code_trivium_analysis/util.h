@@ -0,0 +1,129 @@
+/*
+ * util.h
+ *
+ * small helpers shared by the analysis tools
+ *
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trivium.h"
+
+#define HEX_LINE_LENGTH 256             // of a keys.txt / ivs.txt line
+
+
+/***
+ * now
+ *
+ * monotonic time in seconds
+ *
+ */
+static inline double now(void) {
+
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+
+/***
+ * splitmix64
+ *
+ * counter based generator for reproducible random keys and ivs
+ *
+ */
+static inline u64 splitmix64(u64* state) {
+
+  u64 z = (*state += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+  return z ^ (z >> 31);
+}
+
+
+/***
+ * hex_value
+ *
+ * value of a hexadecimal digit, -1 if it is not one
+ *
+ */
+static inline int hex_value(char digit) {
+
+  if (digit >= '0' && digit <= '9') return digit - '0';
+  if (digit >= 'A' && digit <= 'F') return digit - 'A' + 10;
+  if (digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+
+  return -1;
+}
+
+
+/***
+ * parse_bytes
+ *
+ * exactly length bytes of hex, as in keys.txt
+ *
+ */
+static inline int parse_bytes(const char* text, u8* out, u64 length) {
+
+  u64 i;
+  int high, low;
+
+  for (i = 0; i < length; i++) {
+    high = hex_value(text[2 * i]);
+    if (high < 0) return -1;
+    low = hex_value(text[2 * i + 1]);
+    if (low < 0) return -1;
+    out[i] = (u8)(16 * high + low);
+  }
+
+  return 0;
+}
+
+
+/***
+ * parse_range
+ *
+ * "a:b" into two numbers, as the -c and -w options take them
+ *
+ */
+static inline int parse_range(const char* text, u64* a, u64* b) {
+
+  char* end;
+
+  *a = strtoul(text, &end, 10);
+  if (end == text || *end != ':') return -1;
+  text = end + 1;
+  *b = strtoul(text, &end, 10);
+
+  return (end == text || *end != 0) ? -1 : 0;
+}
+
+
+/***
+ * next_hex
+ *
+ * the next line of a keys.txt / ivs.txt style file, skipping blank lines
+ *
+ */
+static inline int next_hex(FILE* fp, u8* out, u64 length) {
+
+  char buffer[HEX_LINE_LENGTH];
+
+  while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    if (buffer[0] == '\n' || buffer[0] == '\r') continue;
+    return parse_bytes(buffer, out, length);
+  }
+
+  return -1;
+}
+
+#endif
@@ -42,6 +42,13 @@ NOMCLR - No master clear reset
 //settings for the UART
 #use rs232(UART1,baud=9600,parity=N,bits=8)
 
+//TRIVIUM8 builds ip_cipher() on the byte aligned kernel of trivium8.h (generated by
+//GCC_Code_trivium_analysis/pic_kernel.c): 8 clocks in 225 cycles instead of one clock of update()
+//#define TRIVIUM8
+#ifdef TRIVIUM8
+#include "trivium8.h"
+#endif
+
 
 /*************
  * Utilities *
@@ -378,6 +385,26 @@ void reverse(u8* str, u64 length) {
  * generate and apply keystream on input in place
  *
  */
+#ifdef TRIVIUM8
+void ip_cipher(u8* key, u8* iv, u8* input, u64 length) {
+
+  u64 mark;
+  u8 input_backup [16];
+  memcpy(input_backup,input,16);
+
+  trivium8_load(key, iv);
+  trivium8_init();
+
+  output_high (PIN_B0);
+  for (mark = 0; mark < length; mark++) {
+    trivium8_step();
+    input_backup[mark] ^= trivium8_z;
+  }
+  output_low (PIN_B0);
+  memcpy(input,input_backup,16);
+  return;
+}
+#else
 void ip_cipher(u8* key, u8* iv, u8* input, u64 length) {
 
   u64 mark = length;
@@ -403,6 +430,7 @@ void ip_cipher(u8* key, u8* iv, u8* input, u64 length) {
   memcpy(input,input_backup,16);
   return;
 }
+#endif
 
 u8 outputtt[16];
 
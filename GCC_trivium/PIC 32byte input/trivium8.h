@@ -0,0 +1,286 @@
+/*
+ * trivium8.h
+ *
+ * generated by GCC_Code_trivium_analysis/pic_kernel.c, do not edit: the
+ * byte aligned trivium kernel (trivium_byte.c) as PIC18 code, verified
+ * on the emulator at 225 cycles per step and 32118 for the initialization
+ *
+ *   trivium8_load(key, iv)  key and iv as setup() takes them
+ *   trivium8_init()         144 steps, 1152 clocks
+ *   trivium8_step()         8 clocks, the keystream byte in trivium8_z
+ *
+ */
+
+#org 0x4000, 0x41C5 {}
+#rom 0x4000 = {
+  0x5103,    // 4000:  MOVF   x03,W
+  0x0D04,    // 4002:  MULLW  04
+  0x50F4,    // 4004:  MOVF   FF4,W
+  0x6F29,    // 4006:  MOVWF  x29
+  0x5104,    // 4008:  MOVF   x04,W
+  0x0D04,    // 400A:  MULLW  04
+  0x50F3,    // 400C:  MOVF   FF3,W
+  0x1129,    // 400E:  IORWF  x29,W
+  0x6F25,    // 4010:  MOVWF  x25
+  0x5100,    // 4012:  MOVF   x00,W
+  0x0D20,    // 4014:  MULLW  20
+  0x50F4,    // 4016:  MOVF   FF4,W
+  0x6F29,    // 4018:  MOVWF  x29
+  0x5101,    // 401A:  MOVF   x01,W
+  0x0D20,    // 401C:  MULLW  20
+  0x50F3,    // 401E:  MOVF   FF3,W
+  0x1129,    // 4020:  IORWF  x29,W
+  0x1B25,    // 4022:  XORWF  x25,F
+  0x510E,    // 4024:  MOVF   x0E,W
+  0x0D20,    // 4026:  MULLW  20
+  0x50F4,    // 4028:  MOVF   FF4,W
+  0x6F29,    // 402A:  MOVWF  x29
+  0x510F,    // 402C:  MOVF   x0F,W
+  0x0D20,    // 402E:  MULLW  20
+  0x50F3,    // 4030:  MOVF   FF3,W
+  0x1129,    // 4032:  IORWF  x29,W
+  0x6F26,    // 4034:  MOVWF  x26
+  0x510C,    // 4036:  MOVF   x0C,W
+  0x0D10,    // 4038:  MULLW  10
+  0x50F4,    // 403A:  MOVF   FF4,W
+  0x6F29,    // 403C:  MOVWF  x29
+  0x510D,    // 403E:  MOVF   x0D,W
+  0x0D10,    // 4040:  MULLW  10
+  0x50F3,    // 4042:  MOVF   FF3,W
+  0x1129,    // 4044:  IORWF  x29,W
+  0x1B26,    // 4046:  XORWF  x26,F
+  0x511C,    // 4048:  MOVF   x1C,W
+  0x0D04,    // 404A:  MULLW  04
+  0x50F4,    // 404C:  MOVF   FF4,W
+  0x6F29,    // 404E:  MOVWF  x29
+  0x511D,    // 4050:  MOVF   x1D,W
+  0x0D04,    // 4052:  MULLW  04
+  0x50F3,    // 4054:  MOVF   FF3,W
+  0x1129,    // 4056:  IORWF  x29,W
+  0x6F27,    // 4058:  MOVWF  x27
+  0x5117,    // 405A:  MOVF   x17,W
+  0x0D80,    // 405C:  MULLW  80
+  0x50F4,    // 405E:  MOVF   FF4,W
+  0x6F29,    // 4060:  MOVWF  x29
+  0x5118,    // 4062:  MOVF   x18,W
+  0x0D80,    // 4064:  MULLW  80
+  0x50F3,    // 4066:  MOVF   FF3,W
+  0x1129,    // 4068:  IORWF  x29,W
+  0x1B27,    // 406A:  XORWF  x27,F
+  0x5125,    // 406C:  MOVF   x25,W
+  0x1926,    // 406E:  XORWF  x26,W
+  0x1927,    // 4070:  XORWF  x27,W
+  0x6F2A,    // 4072:  MOVWF  x2A
+  0x5100,    // 4074:  MOVF   x00,W
+  0x0D08,    // 4076:  MULLW  08
+  0x50F4,    // 4078:  MOVF   FF4,W
+  0x6F29,    // 407A:  MOVWF  x29
+  0x5101,    // 407C:  MOVF   x01,W
+  0x0D08,    // 407E:  MULLW  08
+  0x50F3,    // 4080:  MOVF   FF3,W
+  0x1129,    // 4082:  IORWF  x29,W
+  0x6F28,    // 4084:  MOVWF  x28
+  0x5100,    // 4086:  MOVF   x00,W
+  0x0D10,    // 4088:  MULLW  10
+  0x50F4,    // 408A:  MOVF   FF4,W
+  0x6F29,    // 408C:  MOVWF  x29
+  0x5101,    // 408E:  MOVF   x01,W
+  0x0D10,    // 4090:  MULLW  10
+  0x50F3,    // 4092:  MOVF   FF3,W
+  0x1129,    // 4094:  IORWF  x29,W
+  0x1528,    // 4096:  ANDWF  x28,W
+  0x1B25,    // 4098:  XORWF  x25,F
+  0x510D,    // 409A:  MOVF   x0D,W
+  0x0D40,    // 409C:  MULLW  40
+  0x50F4,    // 409E:  MOVF   FF4,W
+  0x6F29,    // 40A0:  MOVWF  x29
+  0x510E,    // 40A2:  MOVF   x0E,W
+  0x0D40,    // 40A4:  MULLW  40
+  0x50F3,    // 40A6:  MOVF   FF3,W
+  0x1129,    // 40A8:  IORWF  x29,W
+  0x1B25,    // 40AA:  XORWF  x25,F
+  0x510C,    // 40AC:  MOVF   x0C,W
+  0x0D04,    // 40AE:  MULLW  04
+  0x50F4,    // 40B0:  MOVF   FF4,W
+  0x6F29,    // 40B2:  MOVWF  x29
+  0x510D,    // 40B4:  MOVF   x0D,W
+  0x0D04,    // 40B6:  MULLW  04
+  0x50F3,    // 40B8:  MOVF   FF3,W
+  0x1129,    // 40BA:  IORWF  x29,W
+  0x6F28,    // 40BC:  MOVWF  x28
+  0x510C,    // 40BE:  MOVF   x0C,W
+  0x0D08,    // 40C0:  MULLW  08
+  0x50F4,    // 40C2:  MOVF   FF4,W
+  0x6F29,    // 40C4:  MOVWF  x29
+  0x510D,    // 40C6:  MOVF   x0D,W
+  0x0D08,    // 40C8:  MULLW  08
+  0x50F3,    // 40CA:  MOVF   FF3,W
+  0x1129,    // 40CC:  IORWF  x29,W
+  0x1528,    // 40CE:  ANDWF  x28,W
+  0x1B26,    // 40D0:  XORWF  x26,F
+  0x511A,    // 40D2:  MOVF   x1A,W
+  0x0D80,    // 40D4:  MULLW  80
+  0x50F4,    // 40D6:  MOVF   FF4,W
+  0x6F29,    // 40D8:  MOVWF  x29
+  0x511B,    // 40DA:  MOVF   x1B,W
+  0x0D80,    // 40DC:  MULLW  80
+  0x50F3,    // 40DE:  MOVF   FF3,W
+  0x1129,    // 40E0:  IORWF  x29,W
+  0x1B26,    // 40E2:  XORWF  x26,F
+  0x5117,    // 40E4:  MOVF   x17,W
+  0x0D20,    // 40E6:  MULLW  20
+  0x50F4,    // 40E8:  MOVF   FF4,W
+  0x6F29,    // 40EA:  MOVWF  x29
+  0x5118,    // 40EC:  MOVF   x18,W
+  0x0D20,    // 40EE:  MULLW  20
+  0x50F3,    // 40F0:  MOVF   FF3,W
+  0x1129,    // 40F2:  IORWF  x29,W
+  0x6F28,    // 40F4:  MOVWF  x28
+  0x5117,    // 40F6:  MOVF   x17,W
+  0x0D40,    // 40F8:  MULLW  40
+  0x50F4,    // 40FA:  MOVF   FF4,W
+  0x6F29,    // 40FC:  MOVWF  x29
+  0x5118,    // 40FE:  MOVF   x18,W
+  0x0D40,    // 4100:  MULLW  40
+  0x50F3,    // 4102:  MOVF   FF3,W
+  0x1129,    // 4104:  IORWF  x29,W
+  0x1528,    // 4106:  ANDWF  x28,W
+  0x1B27,    // 4108:  XORWF  x27,F
+  0x5103,    // 410A:  MOVF   x03,W
+  0x0D20,    // 410C:  MULLW  20
+  0x50F4,    // 410E:  MOVF   FF4,W
+  0x6F29,    // 4110:  MOVWF  x29
+  0x5104,    // 4112:  MOVF   x04,W
+  0x0D20,    // 4114:  MULLW  20
+  0x50F3,    // 4116:  MOVF   FF3,W
+  0x1129,    // 4118:  IORWF  x29,W
+  0x1B27,    // 411A:  XORWF  x27,F
+  0x5101,    // 411C:  MOVF   x01,W
+  0x6F00,    // 411E:  MOVWF  x00
+  0x5102,    // 4120:  MOVF   x02,W
+  0x6F01,    // 4122:  MOVWF  x01
+  0x5103,    // 4124:  MOVF   x03,W
+  0x6F02,    // 4126:  MOVWF  x02
+  0x5104,    // 4128:  MOVF   x04,W
+  0x6F03,    // 412A:  MOVWF  x03
+  0x5105,    // 412C:  MOVF   x05,W
+  0x6F04,    // 412E:  MOVWF  x04
+  0x5106,    // 4130:  MOVF   x06,W
+  0x6F05,    // 4132:  MOVWF  x05
+  0x5107,    // 4134:  MOVF   x07,W
+  0x6F06,    // 4136:  MOVWF  x06
+  0x5108,    // 4138:  MOVF   x08,W
+  0x6F07,    // 413A:  MOVWF  x07
+  0x5109,    // 413C:  MOVF   x09,W
+  0x6F08,    // 413E:  MOVWF  x08
+  0x510A,    // 4140:  MOVF   x0A,W
+  0x6F09,    // 4142:  MOVWF  x09
+  0x510B,    // 4144:  MOVF   x0B,W
+  0x6F0A,    // 4146:  MOVWF  x0A
+  0x5127,    // 4148:  MOVF   x27,W
+  0x6F0B,    // 414A:  MOVWF  x0B
+  0x510D,    // 414C:  MOVF   x0D,W
+  0x6F0C,    // 414E:  MOVWF  x0C
+  0x510E,    // 4150:  MOVF   x0E,W
+  0x6F0D,    // 4152:  MOVWF  x0D
+  0x510F,    // 4154:  MOVF   x0F,W
+  0x6F0E,    // 4156:  MOVWF  x0E
+  0x5110,    // 4158:  MOVF   x10,W
+  0x6F0F,    // 415A:  MOVWF  x0F
+  0x5111,    // 415C:  MOVF   x11,W
+  0x6F10,    // 415E:  MOVWF  x10
+  0x5112,    // 4160:  MOVF   x12,W
+  0x6F11,    // 4162:  MOVWF  x11
+  0x5113,    // 4164:  MOVF   x13,W
+  0x6F12,    // 4166:  MOVWF  x12
+  0x5114,    // 4168:  MOVF   x14,W
+  0x6F13,    // 416A:  MOVWF  x13
+  0x5115,    // 416C:  MOVF   x15,W
+  0x6F14,    // 416E:  MOVWF  x14
+  0x5116,    // 4170:  MOVF   x16,W
+  0x6F15,    // 4172:  MOVWF  x15
+  0x5125,    // 4174:  MOVF   x25,W
+  0x6F16,    // 4176:  MOVWF  x16
+  0x5118,    // 4178:  MOVF   x18,W
+  0x6F17,    // 417A:  MOVWF  x17
+  0x5119,    // 417C:  MOVF   x19,W
+  0x6F18,    // 417E:  MOVWF  x18
+  0x511A,    // 4180:  MOVF   x1A,W
+  0x6F19,    // 4182:  MOVWF  x19
+  0x511B,    // 4184:  MOVF   x1B,W
+  0x6F1A,    // 4186:  MOVWF  x1A
+  0x511C,    // 4188:  MOVF   x1C,W
+  0x6F1B,    // 418A:  MOVWF  x1B
+  0x511D,    // 418C:  MOVF   x1D,W
+  0x6F1C,    // 418E:  MOVWF  x1C
+  0x511E,    // 4190:  MOVF   x1E,W
+  0x6F1D,    // 4192:  MOVWF  x1D
+  0x511F,    // 4194:  MOVF   x1F,W
+  0x6F1E,    // 4196:  MOVWF  x1E
+  0x5120,    // 4198:  MOVF   x20,W
+  0x6F1F,    // 419A:  MOVWF  x1F
+  0x5121,    // 419C:  MOVF   x21,W
+  0x6F20,    // 419E:  MOVWF  x20
+  0x5122,    // 41A0:  MOVF   x22,W
+  0x6F21,    // 41A2:  MOVWF  x21
+  0x5123,    // 41A4:  MOVF   x23,W
+  0x6F22,    // 41A6:  MOVWF  x22
+  0x5124,    // 41A8:  MOVF   x24,W
+  0x6F23,    // 41AA:  MOVWF  x23
+  0x5126,    // 41AC:  MOVF   x26,W
+  0x6F24,    // 41AE:  MOVWF  x24
+  0x0012,    // 41B0:  RETURN 0
+  0x0102,    // 41B2:  MOVLB  2
+  0xDF25,    // 41B4:  RCALL  4000
+  0x0013,    // 41B6:  RETURN 1
+  0x0102,    // 41B8:  MOVLB  2
+  0x0E90,    // 41BA:  MOVLW  90
+  0x6F2B,    // 41BC:  MOVWF  x2B
+  0xDF20,    // 41BE:  RCALL  4000
+  0x2F2B,    // 41C0:  DECFSZ x2B,F
+  0xD7FD,    // 41C2:  BRA    41BE
+  0x0013     // 41C4:  RETURN 1
+}
+
+u8 trivium8_a[12];
+#locate trivium8_a = 0x200
+u8 trivium8_b[11];
+#locate trivium8_b = 0x20C
+u8 trivium8_c[14];
+#locate trivium8_c = 0x217
+u8 trivium8_scratch[5];
+#locate trivium8_scratch = 0x225
+u8 trivium8_z;
+#locate trivium8_z = 0x22A
+u8 trivium8_n;
+#locate trivium8_n = 0x22B
+
+
+void trivium8_load(u8* key, u8* iv) {
+
+  int i;
+
+  memset(trivium8_a, 0, 12);
+  memset(trivium8_b, 0, 11);
+  memset(trivium8_c, 0, 14);
+
+  for (i = 0; i < 10; i++) trivium8_a[11 - i] = key[i];
+  for (i = 0; i < 10; i++) trivium8_b[10 - i] = iv[i];
+  trivium8_c[0] = 0x0E;
+
+  return;
+}
+
+
+void trivium8_init(void) {
+#asm
+  CALL 0x41B8, 1
+#endasm
+}
+
+
+void trivium8_step(void) {
+#asm
+  CALL 0x41B2, 1
+#endasm
+}
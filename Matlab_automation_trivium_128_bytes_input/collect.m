@@ -19,6 +19,9 @@ verifyen=1;
 %if verify set to 1 the file name for test vectors
 verifyfile='ciphertest.txt';
 
+%stop file written by attack_monitor once the attack has succeeded. Acquisition stops when it appears.
+stopfile='stop.txt';
+
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%% Cryptosystem interface setup%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
 %open files
@@ -39,8 +42,19 @@ fopen(s);
 
 fprintf('TRIVIUM encription initialised\n\n');
 
+%a stop file left from an earlier run would end this one at once
+if exist(stopfile,'file')
+    delete(stopfile);
+end
+
 count=1;
 while (feof(keys) == 0) || (feof(ivs)==0) 
+    %the attack monitor has seen enough traces
+    if exist(stopfile,'file')
+        fprintf('Stopped by %s\n\n',stopfile);
+        break;
+    end
+
     pin_key=strtrim(fgets(keys));
     pin_iv=strtrim(fgets(ivs));
     pin=strcat(pin_key,pin_iv);